@@ -28,6 +28,10 @@ namespace SphereSim
         /** \brief Client object to communicate with server. */
         ActionSender* sender;
 
+        /** \brief Benchmark result (0: all stiff systems stayed stable, 1: the
+         * semi-implicit integrator gained energy). */
+        unsigned short benchmarkResult;
+
         /** \copydoc runBenchmark
          * \param detectCollisions Flag for collision detection.
          * \param calculateGravity Flag for gravity calculation.
@@ -38,16 +42,31 @@ namespace SphereSim
         /** \brief Run a benchmark test with gravitation of many spheres. */
         Scalar runBenchmark_internal2();
 
-        /** \brief Run a benchmark test with Lennard-Jones potential. */
-        Scalar runBenchmark_internal3();
+        /** \brief Run a benchmark test with Lennard-Jones potential.
+         * \param integratorMethod Used integrator method; the multiple time
+         * step method runs with respaStepRatio times the step length. */
+        Scalar runBenchmark_internal3(unsigned int integratorMethod);
+
+        /** \brief Run a benchmark test with stiff collisions.
+         * \param integratorMethod Used integrator method.
+         * \param timeStep Length of one step; explicit methods need much
+         * shorter steps than the semi-implicit one. */
+        Scalar runBenchmark_internal4(unsigned int integratorMethod,
+            Scalar timeStep);
+
+        /** \brief Output the share of each step phase in the total step time.
+         * \see CalculationPhases */
+        void printPhaseCalculationTimes();
 
     public:
         /** \brief Start a ServerBenchmark with the specified address and port.
          * \param addr The address that the socket will be connecting to.
          * \param sendPort The port that the client will be sending to.
-         * \param recvPort The port that the client will be listening to. */
+         * \param recvPort The port that the client will be listening to.
+         * \param frameRecvPort The port that the client will be receiving
+         * frames from. */
         ServerBenchmark(const char* addr, unsigned short sendPort,
-            unsigned short recvPort);
+            unsigned short recvPort, unsigned short frameRecvPort);
 
         ~ServerBenchmark();
 
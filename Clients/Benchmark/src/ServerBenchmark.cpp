@@ -19,8 +19,9 @@
 using namespace SphereSim;
 
 ServerBenchmark::ServerBenchmark(const char* addr, unsigned short sendPort,
-    unsigned short recvPort)
-    :sender(new ActionSender(addr, sendPort, recvPort, this))
+    unsigned short recvPort, unsigned short frameRecvPort)
+    :sender(new ActionSender(addr, sendPort, recvPort, frameRecvPort,
+        this)), benchmarkResult(0)
 {
     sender->failureExitWhenDisconnected = true;
 }
@@ -38,6 +39,8 @@ void ServerBenchmark::run()
     sender->simulatedSystem->set(SimulationVariables::wallPoissonRatio, 0.5);
     sender->simulatedSystem->set(SimulationVariables::earthGravity,
         Vector3(0, -9.81, 0));
+    // the simulated time is counted as steps times the fixed step length
+    sender->simulatedSystem->set(SimulationVariables::adaptiveTimeStep, false);
 
     Scalar totalScore = 0;
     totalScore += runBenchmark_internal(false, false, true);
@@ -45,10 +48,19 @@ void ServerBenchmark::run()
     totalScore += runBenchmark_internal(true, false, false);
     totalScore += runBenchmark_internal(false, false, false);
     totalScore += runBenchmark_internal2();
-    totalScore += runBenchmark_internal3();
+    totalScore += runBenchmark_internal3(IntegratorMethods::CashKarp54);
+    totalScore += runBenchmark_internal3(IntegratorMethods::RespaVerlet);
     Console()<<"\ntotal score: "<<std::setprecision(3)<<totalScore<<".\n";
 
-    qApp->exit(0);
+    // not part of the total score: the semi-implicit integrator against an
+    // explicit one with a step short enough for the stiff contacts
+    Scalar imexScore = runBenchmark_internal4(IntegratorMethods::ImexEuler, 1.0e-5);
+    Scalar explicitScore = runBenchmark_internal4(IntegratorMethods::CashKarp54,
+        1.0e-7);
+    Console()<<"\nstiff system score: "<<std::setprecision(3)<<imexScore
+        <<" (explicit: "<<explicitScore<<").\n";
+
+    qApp->exit(benchmarkResult);
 }
 
 Scalar ServerBenchmark::runBenchmark_internal(bool detectCollisions,
@@ -156,6 +168,7 @@ Scalar ServerBenchmark::runBenchmark_internal2()
     Scalar beginEnergy, endEnergy;
     beginEnergy = sender->getTotalEnergy();
 
+    sender->popPhaseCalculationTimes();
     QElapsedTimer timer = QElapsedTimer();
     sender->startSimulation();
     timer.start();
@@ -178,6 +191,7 @@ Scalar ServerBenchmark::runBenchmark_internal2()
     Scalar calculationsPerSecond = calculationCounter/(elapsedTime*0.001);
     Console()<<"\rcalculations per second: "
         <<calculationsPerSecond<<"\n";
+    printPhaseCalculationTimes();
 
     Scalar simulatedSeconds = stepCounter*timeStep;
     Scalar simulatedSecondsPerSecond = simulatedSeconds/(elapsedTime*0.001);
@@ -196,22 +210,34 @@ Scalar ServerBenchmark::runBenchmark_internal2()
     return score;
 }
 
-Scalar ServerBenchmark::runBenchmark_internal3()
+Scalar ServerBenchmark::runBenchmark_internal3(unsigned int integratorMethod)
 {
     // use square numbers
     unsigned short sphCount = 64;
     Console()<<"\nsimulating microscopic Lennard-Jones potential system with "
-        <<sphCount<<" spheres.\n";
+        <<sphCount<<" spheres";
     SystemCreator systemCreator(sender);
     systemCreator.createArgonGasSystem(sphCount, 473.15);
+    sender->simulatedSystem->set(SimulationVariables::integratorMethod,
+        integratorMethod);
 
     Scalar timeStep = 2.0e-14;
+    if (integratorMethod == IntegratorMethods::RespaVerlet)
+    {
+        // the inner steps resolve the close encounters with the same length
+        unsigned int respaStepRatio = sender->simulatedSystem->get<unsigned int>(
+            SimulationVariables::respaStepRatio);
+        Console()<<" (multiple time steps, "<<respaStepRatio<<" inner steps)";
+        timeStep *= respaStepRatio;
+    }
+    Console()<<".\n";
     Console()<<"simulated seconds per step: "<<timeStep<<'\n';
     sender->simulatedSystem->set(SimulationVariables::timeStep, timeStep);
 
     Scalar beginEnergy, endEnergy;
     beginEnergy = sender->getTotalEnergy();
 
+    sender->popPhaseCalculationTimes();
     QElapsedTimer timer = QElapsedTimer();
     sender->startSimulation();
     timer.start();
@@ -234,6 +260,7 @@ Scalar ServerBenchmark::runBenchmark_internal3()
     Scalar calculationsPerSecond = calculationCounter/(elapsedTime*0.001);
     Console()<<"\rcalculations per second: "
         <<calculationsPerSecond<<"\n";
+    printPhaseCalculationTimes();
 
     Scalar simulatedSeconds = stepCounter*timeStep;
     Scalar simulatedSecondsPerSecond = simulatedSeconds/(elapsedTime*0.001);
@@ -245,9 +272,112 @@ Scalar ServerBenchmark::runBenchmark_internal3()
     Console()<<"rel. error: "<<relError<<'\n';
 
     sender->removeSomeLastSpheres(sphCount);
+    sender->simulatedSystem->set(SimulationVariables::integratorMethod,
+        (unsigned int)IntegratorMethods::CashKarp54);
 
     Scalar simulatedMSecondsPerSecond = 1000*simulatedSecondsPerSecond;
     Scalar score = std::log(simulatedMSecondsPerSecond);
     Console()<<"\npartial score: "<<std::setprecision(3)<<score<<".\n";
     return score;
 }
+
+Scalar ServerBenchmark::runBenchmark_internal4(unsigned int integratorMethod,
+    Scalar timeStep)
+{
+    unsigned short sphCount = 100;
+    Console()<<"\nsimulating stiff collision system with "
+        <<sphCount<<" spheres and "
+        <<(integratorMethod == IntegratorMethods::ImexEuler
+            ? "semi-implicit" : "explicit")<<" integrator.\n";
+    SystemCreator systemCreator(sender);
+    systemCreator.createMacroscopic2DCollisionSystem(sphCount);
+    // realistic elastic moduli; explicit integrators need steps around 1e-7 s
+    sender->simulatedSystem->set(SimulationVariables::sphereE, 1.0e9);
+    sender->simulatedSystem->set(SimulationVariables::wallE, 1.0e9);
+    sender->simulatedSystem->set(SimulationVariables::integratorMethod,
+        integratorMethod);
+
+    Console()<<"simulated seconds per step: "<<timeStep<<'\n';
+    sender->simulatedSystem->set(SimulationVariables::timeStep, timeStep);
+
+    Scalar beginEnergy, endEnergy;
+    beginEnergy = sender->getTotalEnergy();
+
+    sender->popPhaseCalculationTimes();
+    QElapsedTimer timer = QElapsedTimer();
+    sender->startSimulation();
+    timer.start();
+    for (unsigned short i = 0; i<100; i++)
+    {
+        QTest::qWait(2*1000/100);
+        Console()<<"\rprogress: "<<(i+1)<<" % ";
+    }
+    sender->stopSimulation();
+    while (sender->simulatedSystem->get<bool>(SimulationVariables::simulating))
+    {
+        QCoreApplication::processEvents();
+    }
+    unsigned int elapsedTime = timer.elapsed();
+    unsigned int stepCounter = sender->popStepCounter();
+    Scalar stepsPerSecond = stepCounter/(elapsedTime*0.001);
+    Console()<<"\rsimulated steps per second: "
+        <<stepsPerSecond<<"\n";
+    printPhaseCalculationTimes();
+
+    Scalar simulatedSeconds = stepCounter*timeStep;
+    Scalar simulatedSecondsPerSecond = simulatedSeconds/(elapsedTime*0.001);
+    Console()<<"simulated seconds per second: "
+        <<simulatedSecondsPerSecond<<'\n';
+    // a stable integration of the contacts may dissipate energy, but never gains
+    // more than the error of linearizing the contacts
+    endEnergy = sender->getTotalEnergy();
+    Scalar relError = 1.0-(beginEnergy/endEnergy);
+    Console()<<"rel. error: "<<relError<<'\n';
+    bool stable = (endEnergy <= beginEnergy+0.001*fabs(beginEnergy));
+    if (stable)
+    {
+        Console()<<"stable: yes\n";
+    }
+    else
+    {
+        Console()<<Console::red<<Console::bold<<"stable: no\n";
+        if (integratorMethod == IntegratorMethods::ImexEuler)
+        {
+            benchmarkResult = 1;
+        }
+    }
+
+    sender->removeSomeLastSpheres(sphCount);
+    sender->simulatedSystem->set(SimulationVariables::sphereE, 5000.0);
+    sender->simulatedSystem->set(SimulationVariables::wallE, 5000.0);
+    sender->simulatedSystem->set(SimulationVariables::integratorMethod,
+        (unsigned int)IntegratorMethods::CashKarp54);
+
+    Scalar simulatedMSecondsPerSecond = 1000*simulatedSecondsPerSecond;
+    Scalar score = std::log(simulatedMSecondsPerSecond);
+    Console()<<"\nscore: "<<std::setprecision(3)<<score<<".\n";
+    return score;
+}
+
+void ServerBenchmark::printPhaseCalculationTimes()
+{
+    const char* phaseNames[CalculationPhases::numberOfPhases] = {"sphere box",
+        "cell lists", "gravity cell lists", "gravity cell data", "integration",
+        "spatial sorting"};
+    std::vector<unsigned int> times = sender->popPhaseCalculationTimes();
+    unsigned long long totalTime = 0;
+    for (unsigned int i = 0; i<times.size(); i++)
+    {
+        totalTime += times[i];
+    }
+    if (totalTime == 0 || times.size() != CalculationPhases::numberOfPhases)
+    {
+        return;
+    }
+    Console()<<"step phases:\n";
+    for (unsigned int i = 0; i<times.size(); i++)
+    {
+        Console()<<"  "<<phaseNames[i]<<": "<<std::setprecision(3)
+            <<(100.0*times[i]/totalTime)<<" %\n";
+    }
+}
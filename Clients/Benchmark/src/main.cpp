@@ -27,7 +27,7 @@ int main(int argc, char** argv)
     try
     {
         ServerBenchmark svrBenchmark(Connection::address, Connection::serverRecvPort,
-            Connection::serverSendPort);
+            Connection::serverSendPort, Connection::serverFramePort);
         return app.exec();
     }
     catch (std::exception ex)
@@ -12,6 +12,8 @@
 #include "Actions.hpp"
 #include "Sphere.hpp"
 #include "FrameBuffer.hpp"
+#include "FrameCodec.hpp"
+#include "SharedFrameRing.hpp"
 #include "SimulatedSystem.hpp"
 
 #include <QObject>
@@ -45,6 +47,9 @@ namespace SphereSim
         /** \brief Buffer for the spheres received from server. */
         FrameBuffer<Sphere> frameBuffer;
 
+        /** \brief Decoder keeping the sphere data of the received frames. */
+        FrameDecoder frameDecoder;
+
         /** \brief Last received server status. */
         unsigned short lastServerStatus;
 
@@ -66,6 +71,9 @@ namespace SphereSim
         /** \brief Measured rate of received frames per second. */
         Scalar receivedFramesPerSecond;
 
+        /** \brief Number of frames received since the last heartbeat. */
+        unsigned int heartbeatFrameCount;
+
         /** \brief Encapsulate and encode messages sent over network. */
         MessageTransmitter* messageTransmitter;
 
@@ -75,6 +83,23 @@ namespace SphereSim
         /** \brief Heartbeat sending timer. */
         QTimer heartbeatTimer;
 
+        /** \brief Ring of frames shared with a server on the same host. */
+        SharedFrameRing sharedFrameRing;
+
+        /** \brief Decode a received frame and push it to the frame buffer. */
+        void processFrame(const char* data, size_t size);
+
+        /** \brief Apply the frame parsed by the frame decoder and push it to the
+         * frame buffer, unless it is older than the last frame. */
+        void applyFrame();
+
+        /** \brief Open the shared memory ring offered by the server and tell the
+         * server whether frames can be sent over it. */
+        void openSharedFrames(const std::string& offer);
+
+        /** \brief Decode the new frames of the shared memory ring in place. */
+        void readSharedFrames();
+
         /** \brief Send an action request to the server.
          * \param actionGroup Group of the requested action.
          * \param action Requested action. */
@@ -106,9 +131,14 @@ namespace SphereSim
         /** \brief Start an ActionSender with the specified address and port.
          * \param addr The address that the socket will be connecting to.
          * \param sendPort The port that the client will be sending to.
-         * \param recvPort The port that the client will be listening to. */
+         * \param recvPort The port that the client will be listening to.
+         * \param frameRecvPort The port that the client will be receiving
+         * frames from.
+         * \param client Object whose run() slot is called when the server is
+         * ready; may be nullptr. */
         ActionSender(const char* addr, unsigned short sendPort,
-            unsigned short recvPort, QObject* client);
+            unsigned short recvPort, unsigned short frameRecvPort,
+            QObject* client);
 
         ~ActionSender();
 
@@ -124,6 +154,10 @@ namespace SphereSim
          * \see connectedFlag */
         bool isConnected();
 
+        /** \brief Flag whether frames are received over the shared memory
+         * ring of a server on the same host. */
+        bool isReceivingSharedFrames();
+
         FrameBuffer<Sphere>* getFrameBuffer();
 
         /** \copydoc BasicActions::terminateServer */
@@ -180,6 +214,10 @@ namespace SphereSim
         /** \copydoc CalculationActions::getLastStepCalculationTime */
         unsigned int getLastStepCalculationTime();
 
+        /** \copydoc CalculationActions::popPhaseCalculationTimes
+         * \return Time (in us) per phase, indexed by CalculationPhases. */
+        std::vector<unsigned int> popPhaseCalculationTimes();
+
         /** \copydoc InformationActions::getTotalEnergy
          * \return Total energy (in joules). */
         Scalar getTotalEnergy();
@@ -190,7 +228,7 @@ namespace SphereSim
 
     public slots:
         /** \brief Process and answer to received reply. */
-        void processReply(std::string data);
+        void processReply(const char* data, size_t size);
 
         /** \brief Executed when some measured event (e.g. received frame) happened.
          * \see newFrameReceived */
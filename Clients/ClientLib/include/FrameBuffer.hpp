@@ -107,6 +107,10 @@ namespace SphereSim
 
         /** \brief Get number of frames in the buffer. */
         unsigned short getFrameCount();
+
+        /** \brief Get the percentage level of the buffer.
+         * \see percentageLevel */
+        unsigned char getPercentageLevel();
     };
 }
 
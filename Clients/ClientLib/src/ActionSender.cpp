@@ -7,6 +7,7 @@
  * Full license text is under the file "LICENSE" provided with this code. */
 
 #include "ActionSender.hpp"
+#include "ByteBuffer.hpp"
 #include "Connection.hpp"
 #include "Console.hpp"
 #include "DataTransmit.hpp"
@@ -14,6 +15,7 @@
 
 #include <QCoreApplication>
 #include <QTimer>
+#include <cstring>
 #include <nanomsg/pubsub.h>
 #include <random>
 #include <string>
@@ -23,26 +25,31 @@ Q_DECLARE_METATYPE(std::string);
 using namespace SphereSim;
 
 ActionSender::ActionSender(const char* addr, unsigned short sendPort,
-    unsigned short recvPort, QObject* client)
+    unsigned short recvPort, unsigned short frameRecvPort, QObject* client)
     :sendSocket(AF_SP, NN_PUB), recvSocket(AF_SP, NN_SUB),
     connectedFlag(false), clientID(0), frameBuffer(30),
+    frameDecoder(),
     lastServerStatus(ServerStatusReplies::acknowledge),
     receivedServerReply(false), lastServerReplyData(), framerateTimer(),
     frameCounter(0), oldFrameCounter(0), receivedFramesPerSecond(0),
+    heartbeatFrameCount(0),
     messageTransmitter(new MessageTransmitter(&sendSocket, &recvSocket)),
-    readyToRun(false), heartbeatTimer(),
+    readyToRun(false), heartbeatTimer(), sharedFrameRing(),
     failureExitWhenDisconnected(false),  simulatedSystem(nullptr)
 {
     qRegisterMetaType<std::string>();
     //~ connect(socket, SIGNAL(connected()), SLOT(connected()));
     //~ connect(socket, SIGNAL(disconnected()), SLOT(disconnected()));
-    connect(messageTransmitter, SIGNAL(processData(std::string)),
-        SLOT(processReply(std::string)));
+    connect(messageTransmitter, SIGNAL(processData(const char*, size_t)),
+        SLOT(processReply(const char*, size_t)), Qt::DirectConnection);
     framerateTimer.start();
     frameBuffer.setActionSender(this);
     connect(this, SIGNAL(newFrameReceived()), SLOT(framerateEvent()));
-    connect(this, SIGNAL(serverReady()), client, SLOT(run()),
-        Qt::QueuedConnection);
+    if (client != nullptr)
+    {
+        connect(this, SIGNAL(serverReady()), client, SLOT(run()),
+            Qt::QueuedConnection);
+    }
     connect(&heartbeatTimer, SIGNAL(timeout()), SLOT(heartbeat()));
 
     std::ostringstream sendAddress;
@@ -51,6 +58,10 @@ ActionSender::ActionSender(const char* addr, unsigned short sendPort,
     std::ostringstream recvAddress;
     recvAddress<<"tcp://"<<addr<<':'<<recvPort;
     recvSocket.connect(recvAddress.str().c_str());
+    // frames come over their own connection, apart from the control replies
+    std::ostringstream frameRecvAddress;
+    frameRecvAddress<<"tcp://"<<addr<<':'<<frameRecvPort;
+    recvSocket.connect(frameRecvAddress.str().c_str());
     recvSocket.setsockopt(NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
 
     simulatedSystem = new SimulatedSystem();
@@ -79,13 +90,20 @@ ActionSender::~ActionSender()
 void ActionSender::sendAction(unsigned char actionGroup, unsigned char action,
     const std::string& arr)
 {
-    std::ostringstream data;
-    writeInt(data, clientID); // simulation ID is same as client ID
-    writeInt(data, clientID);
-    writeChar(data, actionGroup);
-    writeChar(data, action);
-    data<<arr;
-    messageTransmitter->send(data.str());
+    // the request is encoded directly into the message handed to nanomsg
+    const size_t headerSize = 2*sizeof(unsigned int)+2*sizeof(unsigned char);
+    char* message = messageTransmitter->allocateMessage(headerSize+arr.size());
+    if (message == nullptr)
+    {
+        return;
+    }
+    // simulation ID is same as client ID
+    ByteOrder::store<unsigned int>(&message[0], clientID);
+    ByteOrder::store<unsigned int>(&message[4], clientID);
+    ByteOrder::store<unsigned char>(&message[8], actionGroup);
+    ByteOrder::store<unsigned char>(&message[9], action);
+    memcpy(&message[headerSize], arr.data(), arr.size());
+    messageTransmitter->sendMessage(message);
 }
 void ActionSender::sendAction(unsigned char actionGroup, unsigned char action)
 {
@@ -110,40 +128,31 @@ std::string ActionSender::sendReplyAction(unsigned char actionGroup,
     return sendReplyAction(actionGroup, action, std::string());
 }
 
-void ActionSender::processReply(std::string data)
+void ActionSender::processReply(const char* data, size_t size)
 {
-    std::istringstream stream(data);
-    const unsigned int simulationID = readInt(stream);
+    ByteReader reader(data, size);
+    const unsigned int simulationID = reader.readInt();
     if (simulationID != clientID)
     {
         return;
     }
-    const unsigned int serverID = readInt(stream);
-    lastServerStatus = readShort(stream);
+    const unsigned int serverID = reader.readInt();
+    lastServerStatus = reader.readShort();
 
     if (lastServerStatus == ServerStatusReplies::sendFrame)
     {
-        if (readyToRun == false)
-        {
-            return;
-        }
-        unsigned int serverFrameCounter = readInt(stream);
-        if (serverFrameCounter > frameCounter)
-        {
-            frameBuffer.pushFrame();
-            frameCounter = serverFrameCounter;
-            emit newFrameReceived();
-        }
-        unsigned short sphereIndex = readShort(stream);
-        Sphere sphere;
-        readBasicSphereData(stream, sphere);
-        frameBuffer.pushElement(sphere);
+        // the frame is decoded in place from the received message
+        processFrame(reader.getCurrent(), reader.getRemainingSize());
+    }
+    else if (lastServerStatus == ServerStatusReplies::sharedFrameWritten)
+    {
+        readSharedFrames();
     }
     else if (lastServerStatus == ServerStatusReplies::sendVariable)
     {
-        unsigned short _var = readShort(stream);
+        unsigned short _var = reader.readShort();
         SimulationVariables::Variable var = (SimulationVariables::Variable)_var;
-        std::string varData = data.substr(12);
+        std::string varData(reader.getCurrent(), reader.getRemainingSize());
         simulatedSystem->receiveVariable(var, varData);
     }
     else if (lastServerStatus == ServerStatusReplies::clientAccepted)
@@ -154,24 +163,91 @@ void ActionSender::processReply(std::string data)
         }
         Console()<<"ActionSender: connected to host.\n";
         connectedFlag = true;
-        std::ostringstream stream;
-        writeInt(stream, clientID);
-        std::string idString = stream.str();
+        // replies start with the simulation ID, little-endian like all values
+        std::string idString;
+        ByteWriter writer(idString);
+        writer.writeInt(clientID);
         recvSocket.setsockopt(NN_SUB, NN_SUB_SUBSCRIBE,
             idString.c_str(), idString.size());
         recvSocket.setsockopt(NN_SUB, NN_SUB_UNSUBSCRIBE, "", 0);
         simulatedSystem->sendAllVariables();
         readyToRun = true;
+        // frames go over shared memory if the server runs on this host
+        sendAction(ActionGroups::basic, BasicActions::requestSharedFrames);
         emit serverReady();
     }
+    else if (lastServerStatus == ServerStatusReplies::sharedFramesOffered)
+    {
+        openSharedFrames(std::string(reader.getCurrent(),
+            reader.getRemainingSize()));
+    }
     else
     {
-        std::string replyData = data.substr(10);
-        lastServerReplyData = replyData;
+        lastServerReplyData.assign(reader.getCurrent(), reader.getRemainingSize());
         receivedServerReply = true;
     }
 }
 
+void ActionSender::processFrame(const char* data, size_t size)
+{
+    if (readyToRun && frameDecoder.parse(data, size))
+    {
+        applyFrame();
+    }
+}
+
+void ActionSender::applyFrame()
+{
+    unsigned int serverFrameCounter = frameDecoder.getParsedFrameCounter();
+    if (serverFrameCounter <= frameCounter)
+    {
+        return;
+    }
+    frameDecoder.apply();
+    // the server may send only part of the spheres
+    frameBuffer.updateElementsPerFrame(frameDecoder.getSphereCount());
+    frameBuffer.pushFrame();
+    frameCounter = serverFrameCounter;
+    heartbeatFrameCount++;
+    emit newFrameReceived();
+    Sphere sphere;
+    for (unsigned int i = 0; i<frameDecoder.getSphereCount(); i++)
+    {
+        sphere.radius = frameDecoder.getRadius(i);
+        sphere.pos = frameDecoder.getPosition(i);
+        frameBuffer.pushElement(sphere);
+    }
+}
+
+void ActionSender::openSharedFrames(const std::string& offer)
+{
+    ByteReader reader(offer);
+    unsigned long long token = reader.read<unsigned long long>();
+    std::string name(reader.getCurrent(), reader.getRemainingSize());
+    bool opened = (reader.isGood() && sharedFrameRing.open(name, token));
+    if (opened)
+    {
+        Console()<<"ActionSender: receiving frames over shared memory.\n";
+    }
+    std::string answer(1, (char)(opened ? 1 : 0));
+    sendAction(ActionGroups::basic, BasicActions::useSharedFrames, answer);
+}
+
+void ActionSender::readSharedFrames()
+{
+    size_t size;
+    const char* data;
+    while ((data = sharedFrameRing.peek(size)) != nullptr)
+    {
+        // frames overwritten while being parsed are discarded
+        bool parsed = (readyToRun && frameDecoder.parse(data, size));
+        if (parsed && sharedFrameRing.check())
+        {
+            applyFrame();
+        }
+    }
+}
+
 void ActionSender::updateSphereCount(unsigned short sphereCount)
 {
     frameBuffer.updateElementsPerFrame(sphereCount);
@@ -187,6 +263,11 @@ bool ActionSender::isConnected()
     return connectedFlag;
 }
 
+bool ActionSender::isReceivingSharedFrames()
+{
+    return sharedFrameRing.isOpen();
+}
+
 FrameBuffer<Sphere>* ActionSender::getFrameBuffer()
 {
     return &frameBuffer;
@@ -201,8 +282,8 @@ unsigned short ActionSender::addSphere()
 {
     std::string retData = sendReplyAction(ActionGroups::spheresUpdating,
         SpheresUpdatingActions::addSphere);
-    std::istringstream retStream(retData);
-    unsigned short sphereCount = readShort(retStream);
+    ByteReader reader(retData);
+    unsigned short sphereCount = reader.readShort();
     updateSphereCount(sphereCount);
     return sphereCount;
 }
@@ -211,61 +292,66 @@ unsigned short ActionSender::removeLastSphere()
 {
     std::string retData = sendReplyAction(ActionGroups::spheresUpdating,
         SpheresUpdatingActions::removeLastSphere);
-    std::istringstream retStream(retData);
-    unsigned short sphereCount = readShort(retStream);
+    ByteReader reader(retData);
+    unsigned short sphereCount = reader.readShort();
     updateSphereCount(sphereCount);
     return sphereCount;
 }
 
 void ActionSender::updateSphere(unsigned short i, Sphere s)
 {
-    std::ostringstream stream;
-    writeShort(stream, i);
-    writeAllSphereData(stream, s);
+    std::string data;
+    ByteWriter writer(data);
+    writer.writeShort(i);
+    writeAllSphereData(writer, s);
     sendAction(ActionGroups::spheresUpdating,
-        SpheresUpdatingActions::updateSphere, stream.str());
+        SpheresUpdatingActions::updateSphere, data);
 }
 
 void ActionSender::getBasicSphereData(unsigned short i, Sphere& s)
 {
-    std::ostringstream stream;
-    writeShort(stream, i);
+    std::string data;
+    ByteWriter writer(data);
+    writer.writeShort(i);
     std::string retData = sendReplyAction(ActionGroups::spheresUpdating,
-        SpheresUpdatingActions::getBasicSphereData, stream.str());
-    std::istringstream retStream(retData);
-    readBasicSphereData(retStream, s);
+        SpheresUpdatingActions::getBasicSphereData, data);
+    ByteReader reader(retData);
+    readBasicSphereData(reader, s);
 }
 
 void ActionSender::getAllSphereData(unsigned short i, Sphere& s)
 {
-    std::ostringstream stream;
-    writeShort(stream, i);
+    std::string data;
+    ByteWriter writer(data);
+    writer.writeShort(i);
     std::string retData = sendReplyAction(ActionGroups::spheresUpdating,
-        SpheresUpdatingActions::getAllSphereData, stream.str());
-    std::istringstream retStream(retData);
-    readAllSphereData(retStream, s);
+        SpheresUpdatingActions::getAllSphereData, data);
+    ByteReader reader(retData);
+    readAllSphereData(reader, s);
 }
 
 unsigned short ActionSender::addSomeSpheres(unsigned short sphCount)
 {
-    std::ostringstream stream;
-    writeShort(stream, sphCount);
+    std::string data;
+    ByteWriter writer(data);
+    writer.writeShort(sphCount);
     std::string retData = sendReplyAction(ActionGroups::spheresUpdating,
-        SpheresUpdatingActions::addSomeSpheres, stream.str());
-    std::istringstream retStream(retData);
-    unsigned short sphereCount = readShort(retStream);
+        SpheresUpdatingActions::addSomeSpheres, data);
+    ByteReader reader(retData);
+    unsigned short sphereCount = reader.readShort();
     updateSphereCount(sphereCount);
     return sphereCount;
 }
 
 unsigned short ActionSender::removeSomeLastSpheres(unsigned short sphCount)
 {
-    std::ostringstream stream;
-    writeShort(stream, sphCount);
+    std::string data;
+    ByteWriter writer(data);
+    writer.writeShort(sphCount);
     std::string retData = sendReplyAction(ActionGroups::spheresUpdating,
-        SpheresUpdatingActions::removeSomeLastSpheres, stream.str());
-    std::istringstream retStream(retData);
-    unsigned short sphereCount = readShort(retStream);
+        SpheresUpdatingActions::removeSomeLastSpheres, data);
+    ByteReader reader(retData);
+    unsigned short sphereCount = reader.readShort();
     updateSphereCount(sphereCount);
     return sphereCount;
 }
@@ -273,27 +359,30 @@ unsigned short ActionSender::removeSomeLastSpheres(unsigned short sphCount)
 void ActionSender::updateSpherePositionsInBox(Scalar randomDisplacement,
     Scalar randomSpeed)
 {
-    std::ostringstream stream;
-    writeDouble(stream, randomDisplacement);
-    writeDouble(stream, randomSpeed);
+    std::string data;
+    ByteWriter writer(data);
+    writer.writeDouble(randomDisplacement);
+    writer.writeDouble(randomSpeed);
     sendAction(ActionGroups::spheresUpdating,
-        SpheresUpdatingActions::updateSpherePositionsInBox, stream.str());
+        SpheresUpdatingActions::updateSpherePositionsInBox, data);
 }
 
 void ActionSender::updateAllSpheres(Sphere s)
 {
-    std::ostringstream stream;
-    writeAllSphereData(stream, s);
+    std::string data;
+    ByteWriter writer(data);
+    writeAllSphereData(writer, s);
     sendAction(ActionGroups::spheresUpdating,
-        SpheresUpdatingActions::updateAllSpheres, stream.str());
+        SpheresUpdatingActions::updateAllSpheres, data);
 }
 
 void ActionSender::updateKineticEnergy(Scalar factor)
 {
-    std::ostringstream stream;
-    writeDouble(stream, factor);
+    std::string data;
+    ByteWriter writer(data);
+    writer.writeDouble(factor);
     sendAction(ActionGroups::spheresUpdating,
-        SpheresUpdatingActions::updateKineticEnergy, stream.str());
+        SpheresUpdatingActions::updateKineticEnergy, data);
 }
 
 void ActionSender::calculateStep()
@@ -306,8 +395,8 @@ unsigned int ActionSender::popCalculationCounter()
 {
     std::string retData = sendReplyAction(ActionGroups::calculation,
         CalculationActions::popCalculationCounter);
-    std::istringstream retStream(retData);
-    unsigned int calculationCounter = readInt(retStream);
+    ByteReader reader(retData);
+    unsigned int calculationCounter = reader.readInt();
     return calculationCounter;
 }
 
@@ -317,10 +406,11 @@ void ActionSender::calculateSomeSteps(unsigned int steps)
     {
         return;
     }
-    std::ostringstream stream;
-    writeInt(stream, steps);
+    std::string data;
+    ByteWriter writer(data);
+    writer.writeInt(steps);
     sendAction(ActionGroups::calculation,
-        CalculationActions::calculateSomeSteps, stream.str());
+        CalculationActions::calculateSomeSteps, data);
     willBeSimulating();
 }
 
@@ -339,8 +429,8 @@ unsigned int ActionSender::popStepCounter()
 {
     std::string retData = sendReplyAction(ActionGroups::calculation,
         CalculationActions::popStepCounter);
-    std::istringstream retStream(retData);
-    unsigned int stepCounter = readInt(retStream);
+    ByteReader reader(retData);
+    unsigned int stepCounter = reader.readInt();
     return stepCounter;
 }
 
@@ -348,17 +438,31 @@ unsigned int ActionSender::getLastStepCalculationTime()
 {
     std::string retData = sendReplyAction(ActionGroups::calculation,
         CalculationActions::getLastStepCalculationTime);
-    std::istringstream retStream(retData);
-    unsigned int lastStepCalculationTime = readInt(retStream);
+    ByteReader reader(retData);
+    unsigned int lastStepCalculationTime = reader.readInt();
     return lastStepCalculationTime;
 }
 
+std::vector<unsigned int> ActionSender::popPhaseCalculationTimes()
+{
+    std::string retData = sendReplyAction(ActionGroups::calculation,
+        CalculationActions::popPhaseCalculationTimes);
+    ByteReader reader(retData);
+    unsigned int count = reader.readInt();
+    std::vector<unsigned int> times(count);
+    for (unsigned int i = 0; i<count; i++)
+    {
+        times[i] = reader.readInt();
+    }
+    return times;
+}
+
 Scalar ActionSender::getTotalEnergy()
 {
     std::string retData = sendReplyAction(ActionGroups::information,
         InformationActions::getTotalEnergy);
-    std::istringstream retStream(retData);
-    Scalar totalEnergy = readDouble(retStream);
+    ByteReader reader(retData);
+    Scalar totalEnergy = reader.readDouble();
     return totalEnergy;
 }
 
@@ -366,8 +470,8 @@ Scalar ActionSender::getKineticEnergy()
 {
     std::string retData = sendReplyAction(ActionGroups::information,
         InformationActions::getKineticEnergy);
-    std::istringstream retStream(retData);
-    Scalar kineticEnergy = readDouble(retStream);
+    ByteReader reader(retData);
+    Scalar kineticEnergy = reader.readDouble();
     return kineticEnergy;
 }
 
@@ -402,5 +506,11 @@ void ActionSender::variableUpdated(int var)
 
 void ActionSender::heartbeat()
 {
-    sendAction(ActionGroups::basic, BasicActions::heartbeat);
+    // the server paces its frames by the buffer level and received frames
+    std::string data;
+    ByteWriter writer(data);
+    writer.writeChar(frameBuffer.getPercentageLevel());
+    writer.writeInt(heartbeatFrameCount);
+    heartbeatFrameCount = 0;
+    sendAction(ActionGroups::basic, BasicActions::heartbeat, data);
 }
@@ -137,6 +137,17 @@ unsigned short FrameBuffer<T>::getFrameCount()
     return (unsigned short) frameCount;
 }
 
+template <typename T>
+unsigned char FrameBuffer<T>::getPercentageLevel()
+{
+    unsigned short frameCount = getFrameCount();
+    if (bufferSize <= 2 || frameCount == 0)
+    {
+        return 0;
+    }
+    return (unsigned char)((frameCount-1)*100/(bufferSize-2));
+}
+
 template <typename T>
 void FrameBuffer<T>::updatePercentageLevel(bool greaterThanHysteresis)
 {
@@ -145,14 +156,7 @@ void FrameBuffer<T>::updatePercentageLevel(bool greaterThanHysteresis)
         return;
     }
 
-    if (bufferSize == 0)
-    {
-        percentageLevel = 0;
-    }
-    else
-    {
-        percentageLevel = (unsigned char)((getFrameCount()-1)*100/(bufferSize-2));
-    }
+    percentageLevel = getPercentageLevel();
     if (greaterThanHysteresis)
     {
         emit actionSender->greatFrameBufferPercentageLevelUpdate(percentageLevel);
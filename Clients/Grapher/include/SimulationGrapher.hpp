@@ -60,9 +60,11 @@ namespace SphereSim
         /** \brief Start a SimulationGrapher with the specified address and port.
          * \param addr The address that the socket will be connecting to.
          * \param sendPort The port that the client will be sending to.
-         * \param recvPort The port that the client will be listening to. */
+         * \param recvPort The port that the client will be listening to.
+         * \param frameRecvPort The port that the client will be receiving
+         * frames from. */
         SimulationGrapher(const char* addr, unsigned short sendPort,
-            unsigned short recvPort);
+            unsigned short recvPort, unsigned short frameRecvPort);
 
         ~SimulationGrapher();
 
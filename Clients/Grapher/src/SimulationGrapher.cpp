@@ -22,8 +22,9 @@
 using namespace SphereSim;
 
 SimulationGrapher::SimulationGrapher(const char* addr, unsigned short sendPort,
-    unsigned short recvPort)
-    :actionSender(new ActionSender(addr, sendPort, recvPort, this)),
+    unsigned short recvPort, unsigned short frameRecvPort)
+    :actionSender(new ActionSender(addr, sendPort, recvPort, frameRecvPort,
+        this)),
     dataUpdateTimer(new QTimer(this)), counter(0), timeStep(1.0), time(1.0),
     sphereCountSqrt(1), sphereCount(1), dataPoints(2048), data(), temperatures(),
     stepsToEquilibrium(400), stepsBeforeMeasuring(30), graphNumber(1),
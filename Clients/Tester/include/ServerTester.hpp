@@ -11,9 +11,11 @@
 
 #include "Actions.hpp"
 #include "Console.hpp"
+#include "Sphere.hpp"
 #include "Version.hpp"
 
 #include <QObject>
+#include <vector>
 
 class ActionSender;
 
@@ -30,6 +32,12 @@ namespace SphereSim
         /** \brief Client object to communicate with server. */
         ActionSender* sender;
 
+        /** \brief Server address and ports, used for further clients. */
+        const char* address;
+        unsigned short sendPort;
+        unsigned short recvPort;
+        unsigned short frameRecvPort;
+
         /** \brief Number of already done tests. */
         unsigned short testCounter;
 
@@ -45,6 +53,28 @@ namespace SphereSim
         /** \brief Dummy variable to name the framebuffer test. */
         static const int framebuffer;
 
+        /** \brief Dummy variable to name the task scheduler test. */
+        static const int taskScheduler;
+
+        /** \brief Dummy variable to name the distributed run test. */
+        static const int distributedRun;
+
+        /** \brief Dummy variable to name the frame tests. */
+        static const int frames;
+
+        /** \brief Number of frames received by the client. */
+        unsigned int receivedFrameCount;
+
+        /** \brief Flag whether only the distributed run test is run. */
+        bool distributedRunOnly;
+
+        /** \brief Sphere count, total energy and spheres (positions and
+         * speeds) of the distributed run test on another server; 0 spheres if
+         * there is no reference. */
+        unsigned int referenceSphereCount;
+        Scalar referenceTotalEnergy;
+        std::vector<Sphere> referenceSpheres;
+
         /** \brief Test result (0: all tests passed, 1 = at least one failed). */
         unsigned short testResult;
 
@@ -56,9 +86,11 @@ namespace SphereSim
         /** \brief Start a ServerTester with the specified address and port.
          * \param addr The address that the socket will be connecting to.
          * \param sendPort The port that the client will be sending to.
-         * \param recvPort The port that the client will be listening to. */
+         * \param recvPort The port that the client will be listening to.
+         * \param frameRecvPort The port that the client will be receiving
+         * frames from. */
         ServerTester(const char* addr, unsigned short sendPort,
-            unsigned short recvPort);
+            unsigned short recvPort, unsigned short frameRecvPort);
 
         ~ServerTester();
 
@@ -86,9 +118,89 @@ namespace SphereSim
         void runCalculationActionTests_internal(unsigned char order,
             const char* integratorMethod);
 
+        /** \brief Simulation of a bouncing sphere with a symplectic integrator.
+         * \param evaluations Force evaluations per step of the integrator.
+         * \param integratorMethod Name of the used integrator method. */
+        void runSymplecticIntegratorTests_internal(unsigned char evaluations,
+            const char* integratorMethod);
+
+        /** \brief Simulation of a Lennard-Jones gas with fixed initial spheres.
+         * \param integratorMethod Used integrator method.
+         * \param timeStep Length of one step.
+         * \param steps Number of simulated steps.
+         * \param initialSpheres Spheres at the beginning of the simulation.
+         * \param realSteps Number of force evaluations of the simulation.
+         * \return Relative energy error at the end of the simulation. */
+        Scalar runEnergyDriftTests_internal(unsigned int integratorMethod,
+            Scalar timeStep, unsigned int steps,
+            const std::vector<Sphere>& initialSpheres, unsigned int& realSteps);
+
         /** \brief Verification of the FrameBuffer. */
         void runFrameBufferTests();
 
+        /** \brief Verification of the frame encoding and of the frames sent by
+         * the server. */
+        void runFrameTests();
+
+        /** \brief Verification of the shared memory ring for frames. */
+        void runSharedFrameRingTests_internal();
+
+        /** \brief Verification of the spheres chosen for the frames.
+         * \param frame Buffer for the received frames. */
+        void runFrameSelectionTests_internal(std::vector<Sphere>& frame);
+
+        /** \brief Verification of the frame rate paced by the frame buffer
+         * level of the client. */
+        void runFramePacingTests_internal();
+
+        /** \brief Count the frames received in the last second of a wait.
+         * \param frameSender Client receiving the frames.
+         * \param waitTime Time (in ms) to wait, at least 1000.
+         * \param reading Flag whether the frames are read from the frame buffer
+         * meanwhile.
+         * \return Number of frames. */
+        unsigned int countFrames_internal(ActionSender* frameSender,
+            unsigned int waitTime, bool reading);
+
+        /** \brief Read the newest frame of the frame buffer of a client.
+         * \param frame Spheres of the frame; empty if there is none. */
+        void readNewestFrame_internal(ActionSender* frameSender,
+            std::vector<Sphere>& frame);
+
+        /** \brief Wait for a frame of count spheres whose first sphere has the
+         * specified radius; a radius of 0 accepts any first sphere.
+         * \return Flag whether such a frame was received. */
+        bool waitForFrame_internal(unsigned int count, Scalar firstRadius,
+            std::vector<Sphere>& frame);
+
+        /** \brief Check that a frame sphere matches a sphere of the server up
+         * to the quantization of the positions. */
+        void verifyFrameSphere_internal(const Sphere& frameSphere,
+            const Sphere& sphere);
+
+        /** \brief Verification of the shares of the server threads that two
+         * simulations with different weights and priorities get. */
+        void runTaskSchedulerTests();
+
+        /** \brief Run two equal simulations at the same time.
+         * \param senders Clients of the simulations.
+         * \return Steps of the first simulation per step of the second one. */
+        Scalar runTaskSchedulerTests_internal(ActionSender** senders);
+
+        /** \brief Simulation of colliding spheres crossing the middle of the
+         * box, where the domains of a distributed server meet. */
+        void runDistributedRunTests();
+
+        /** \brief Run only the distributed run test, e.g. on a server split
+         * over several processes, and compare it with a reference run.
+         * \param sphereCount Sphere count of the reference run; 0 prints the
+         * result as reference instead.
+         * \param totalEnergy Total energy of the reference run.
+         * \param spheres Positions and speeds of the spheres at the end of
+         * the reference run, in client order. */
+        void selectDistributedRunTest(unsigned int sphereCount, Scalar totalEnergy,
+            const std::vector<Sphere>& spheres);
+
         /** \brief Verification of a comparison and result printing on console. */
         #define verify(t1, op, t2)                          \
             verify##op(t1, t2, __LINE__, TOSTR(t1), TOSTR(t2));
@@ -153,6 +265,9 @@ namespace SphereSim
         /** \brief Verification of all actions. */
         void run();
 
+        /** \brief Count a frame received by the client. */
+        void frameReceived();
+
     };
 
 }
@@ -8,6 +8,8 @@
 
 #include "ActionSender.hpp"
 #include "ServerTester.hpp"
+#include "FrameCodec.hpp"
+#include "SharedFrameRing.hpp"
 #include "Integrators.hpp"
 #include "SystemCreator.hpp"
 #include "Object.hpp"
@@ -32,17 +34,34 @@
     endTest();                                                              \
 }
 
+#define runSymplecticIntegratorTests_internal_(evaluations, integrMethod)   \
+{                                                                           \
+    startTest_(integratorMethod);                                           \
+        sender->simulatedSystem->set(SimulationVariables::integratorMethod, \
+            (unsigned int)integrMethod);                                    \
+        runSymplecticIntegratorTests_internal(evaluations,                  \
+            TOSTR(integrMethod));                                           \
+    endTest();                                                              \
+}
+
 using namespace SphereSim;
 
 const int ServerTester::framebuffer = 255;
+const int ServerTester::taskScheduler = 254;
+const int ServerTester::distributedRun = 253;
+const int ServerTester::frames = 252;
 
 ServerTester::ServerTester(const char* addr, unsigned short sendPort,
-    unsigned short recvPort)
-    :sender(new ActionSender(addr, sendPort, recvPort, this)), testCounter(0),
-    successCounter(0), testSuccess(true), testActionName(), testResult(0),
-    systemCreator(new SystemCreator(sender)), currentTestConsole()
+    unsigned short recvPort, unsigned short frameRecvPort)
+    :sender(new ActionSender(addr, sendPort, recvPort, frameRecvPort, this)),
+    address(addr), sendPort(sendPort), recvPort(recvPort),
+    frameRecvPort(frameRecvPort), testCounter(0), successCounter(0),
+    testSuccess(true), testActionName(), receivedFrameCount(0),
+    distributedRunOnly(false), referenceSphereCount(0), referenceTotalEnergy(0),
+    referenceSpheres(), testResult(0), systemCreator(new SystemCreator(sender)), currentTestConsole()
 {
     sender->failureExitWhenDisconnected = true;
+    connect(sender, SIGNAL(newFrameReceived()), SLOT(frameReceived()));
 }
 
 ServerTester::~ServerTester()
@@ -51,13 +70,31 @@ ServerTester::~ServerTester()
     delete sender;
 }
 
+void ServerTester::selectDistributedRunTest(unsigned int sphereCount,
+    Scalar totalEnergy, const std::vector<Sphere>& spheres)
+{
+    distributedRunOnly = true;
+    referenceSphereCount = sphereCount;
+    referenceTotalEnergy = totalEnergy;
+    referenceSpheres = spheres;
+}
+
 void ServerTester::run()
 {
     Console()<<'\n';
+    if (distributedRunOnly)
+    {
+        runTests_(ServerTester::distributedRun);
+        qApp->exit(result());
+        return;
+    }
     runTests_(ActionGroups::basic);
     runTests_(ActionGroups::spheresUpdating);
     runTests_(ActionGroups::calculation);
     runTests_(ServerTester::framebuffer);
+    runTests_(ServerTester::frames);
+    runTests_(ServerTester::taskScheduler);
+    runTests_(ServerTester::distributedRun);
     //~ sender->terminateServer();
     qApp->exit(result());
 }
@@ -82,6 +119,15 @@ void ServerTester::runTests(unsigned char actionGroup, const char* groupName)
     case ServerTester::framebuffer:
         runFrameBufferTests();
         break;
+    case ServerTester::frames:
+        runFrameTests();
+        break;
+    case ServerTester::taskScheduler:
+        runTaskSchedulerTests();
+        break;
+    case ServerTester::distributedRun:
+        runDistributedRunTests();
+        break;
     default:
         Console()<<"ServerTester: "
             <<Console::bold<<"Unknown action group requested. \n";
@@ -249,6 +295,116 @@ void ServerTester::runCalculationActionTests()
     runCalculationActionTests_internal_(6, IntegratorMethods::RungeKuttaFehlberg54);
     runCalculationActionTests_internal_(7, IntegratorMethods::DormandPrince54);
     runCalculationActionTests_internal_(4, IntegratorMethods::BogackiShampine32);
+    runSymplecticIntegratorTests_internal_(1, IntegratorMethods::VelocityVerlet);
+    runSymplecticIntegratorTests_internal_(3, IntegratorMethods::Yoshida4);
+    // respaStepRatio short range passes and one long range pass per step
+    runSymplecticIntegratorTests_internal_(5, IntegratorMethods::RespaVerlet);
+
+    systemCreator->createSimpleWallCollisionSystem();
+    sender->simulatedSystem->set(SimulationVariables::integratorMethod,
+        (unsigned int)IntegratorMethods::CashKarp54);
+    startTest_(SimulationVariables::adaptiveTimeStep);
+        Scalar adaptedTimeStep = 0.02;
+        sender->simulatedSystem->set(SimulationVariables::timeStep, adaptedTimeStep);
+        sender->simulatedSystem->set(SimulationVariables::adaptiveTimeStep, true);
+        Scalar beginEnergy = sender->getTotalEnergy();
+        sender->calculateSomeSteps(50);
+        do
+        {
+            QTest::qWait(10);
+        }
+        while (sender->simulatedSystem->get<bool>(SimulationVariables::simulating));
+        Scalar relError = 1.0-(beginEnergy/sender->getTotalEnergy());
+        currentTestConsole<<"rel. error: "<<std::setw(14)<<relError<<". ";
+        adaptedTimeStep = sender->simulatedSystem->get<Scalar>(
+            SimulationVariables::timeStep);
+        currentTestConsole<<"time step: "<<std::setw(14)<<adaptedTimeStep<<". ";
+        verify(fabs(relError), Smaller, 0.01);
+        verify(adaptedTimeStep, Greater, 0);
+        // the initial step is too long for the wall contacts
+        verify(adaptedTimeStep, Smaller, 0.02);
+    startNewTest_(SimulationVariables::rejectedStepCount);
+        unsigned int rejectedSteps = sender->simulatedSystem->get<unsigned int>(
+            SimulationVariables::rejectedStepCount);
+        // a step longer than the whole bounce can only be rejected
+        sender->simulatedSystem->set(SimulationVariables::timeStep, 1.0);
+        sender->calculateSomeSteps(5);
+        do
+        {
+            QTest::qWait(10);
+        }
+        while (sender->simulatedSystem->get<bool>(SimulationVariables::simulating));
+        unsigned int newRejectedSteps = sender->simulatedSystem->get<unsigned int>(
+            SimulationVariables::rejectedStepCount);
+        currentTestConsole<<"rejected steps: "<<std::setw(6)
+            <<(newRejectedSteps-rejectedSteps)<<". ";
+        verify(newRejectedSteps, Greater, rejectedSteps);
+        verify(sender->simulatedSystem->get<Scalar>(SimulationVariables::timeStep),
+            Smaller, 1.0);
+        sender->simulatedSystem->set(SimulationVariables::adaptiveTimeStep, false);
+        sender->simulatedSystem->set(SimulationVariables::timeStep, timeStep);
+    endTest();
+    sender->removeLastSphere();
+
+    systemCreator->createSimpleWallCollisionSystem();
+    sender->simulatedSystem->set(SimulationVariables::integratorMethod,
+        (unsigned int)IntegratorMethods::DormandPrince54);
+    startTest_(firstSameAsLast);
+        sender->simulatedSystem->set(SimulationVariables::maximumStepDivision, 0u);
+        unsigned int stepCount = 50;
+        sender->popCalculationCounter();
+        sender->calculateSomeSteps(stepCount);
+        do
+        {
+            QTest::qWait(10);
+        }
+        while (sender->simulatedSystem->get<bool>(SimulationVariables::simulating));
+        unsigned int realSteps = sender->popCalculationCounter();
+        currentTestConsole<<"real steps: "<<std::setw(6)<<realSteps<<". ";
+        // the last stage of a step is the first one of the next step
+        verify(realSteps, Equal, 6*stepCount+1);
+    endTest();
+    sender->removeLastSphere();
+
+    unsigned short sphereCount = 64;
+    systemCreator->createMacroscopicGravitationSystem(sphereCount);
+    startTest_(SimulationVariables::spatialSorting);
+        // the masses tell the spheres apart after they were sorted; the
+        // spheres start in reverse order along the x axis, so they are sorted
+        Sphere sphere;
+        for (unsigned short i = 0; i<sphereCount; i++)
+        {
+            sender->getAllSphereData(i, sphere);
+            sphere.mass = i+1;
+            sphere.pos(0) = 0.05+0.9*(sphereCount-1-i)/(sphereCount-1);
+            sender->updateSphere(i, sphere);
+        }
+        sender->simulatedSystem->set(SimulationVariables::spatialSorting, true);
+        sender->popPhaseCalculationTimes();
+        sender->calculateSomeSteps(10);
+        do
+        {
+            QTest::qWait(10);
+        }
+        while (sender->simulatedSystem->get<bool>(SimulationVariables::simulating));
+        std::vector<unsigned int> phaseTimes = sender->popPhaseCalculationTimes();
+        unsigned int sortingTime = (phaseTimes.size() > CalculationPhases::spatialSorting
+            ? phaseTimes[CalculationPhases::spatialSorting] : 0);
+        currentTestConsole<<"sorting: "<<std::setw(6)<<sortingTime<<" us. ";
+        verify(sortingTime, Greater, 0u);
+        unsigned short movedSpheres = 0;
+        for (unsigned short i = 0; i<sphereCount; i++)
+        {
+            sender->getAllSphereData(i, sphere);
+            movedSpheres += (sphere.mass == i+1 ? 0 : 1);
+        }
+        verify(movedSpheres, Equal, 0);
+        verify(sender->removeLastSphere(), Equal, sphereCount-1);
+        sender->getAllSphereData(sphereCount-2, sphere);
+        verify(sphere.mass, ApproxEqual, sphereCount-1);
+        sender->simulatedSystem->set(SimulationVariables::spatialSorting, false);
+    endTest();
+    sender->removeSomeLastSpheres(sphereCount-1);
 
     systemCreator->createSimpleWallCollisionSystem();
     sender->simulatedSystem->set(SimulationVariables::integratorMethod,
@@ -272,6 +428,87 @@ void ServerTester::runCalculationActionTests()
         currentTestConsole<<"real steps: "<<std::setw(6)<<steps<<". ";
         verify(steps, Greater, 0);
     endTest();
+    sender->removeLastSphere();
+
+    // two columns of touching spheres resting on the floor, stiff like glass;
+    // each sphere has up to four contacts
+    sphereCount = 16;
+    systemCreator->createMacroscopic2DCollisionSystem(sphereCount);
+    sender->simulatedSystem->set(SimulationVariables::sphereE, 1.0e9);
+    sender->simulatedSystem->set(SimulationVariables::wallE, 1.0e9);
+    sender->simulatedSystem->set(SimulationVariables::integratorMethod,
+        (unsigned int)IntegratorMethods::ImexEuler);
+    for (unsigned short i = 0; i<sphereCount; i++)
+    {
+        sphere = Sphere();
+        sphere.radius = 0.05;
+        sphere.mass = 1;
+        sphere.pos = Vector3(0.45+0.1*(i%2), 0.05+0.1*(i/2), 0.5);
+        sphere.speed = Vector3(0, (i%4 < 2 ? 0.05 : -0.05), 0);
+        sender->updateSphere(i, sphere);
+    }
+    startTest_(IntegratorMethods::ImexEuler);
+        // the step is about as long as a contact oscillation; explicit
+        // integrators need steps a hundred times shorter
+        sender->simulatedSystem->set(SimulationVariables::timeStep, 1.0e-3);
+        Scalar stiffBeginEnergy = sender->getTotalEnergy();
+        sender->calculateSomeSteps(200);
+        do
+        {
+            QTest::qWait(10);
+        }
+        while (sender->simulatedSystem->get<bool>(SimulationVariables::simulating));
+        Scalar stiffEndEnergy = sender->getTotalEnergy();
+        currentTestConsole<<"rel. error: "<<std::setw(14)
+            <<(1.0-(stiffBeginEnergy/stiffEndEnergy))<<". ";
+        // the implicit contacts may dissipate energy, but gain no more than the
+        // error of linearizing them
+        verify(stiffEndEnergy, SmallerOrEqual,
+            stiffBeginEnergy+0.001*fabs(stiffBeginEnergy));
+        sender->getAllSphereData(sphereCount-1, sphere);
+        verify(sphere.pos(1), Smaller, 0.05+0.1*(sphereCount/2));
+    endTest();
+    sender->simulatedSystem->set(SimulationVariables::sphereE, 5000.0);
+    sender->simulatedSystem->set(SimulationVariables::wallE, 5000.0);
+    sender->simulatedSystem->set(SimulationVariables::integratorMethod,
+        (unsigned int)IntegratorMethods::CashKarp54);
+    sender->simulatedSystem->set(SimulationVariables::timeStep, timeStep);
+    sender->removeSomeLastSpheres(sphereCount);
+
+    // the gas positions are random, both integrators start from the same ones
+    sphereCount = 16;
+    systemCreator->createArgonGasSystem(sphereCount, 273.15);
+    std::vector<Sphere> gasSpheres(sphereCount);
+    for (unsigned short i = 0; i<sphereCount; i++)
+    {
+        sender->getAllSphereData(i, gasSpheres[i]);
+    }
+    startTest_(IntegratorMethods::RespaVerlet);
+        Scalar gasTimeStep = 2.0e-14;
+        unsigned int gasSteps = 500;
+        unsigned int explicitSteps, respaSteps;
+        Scalar explicitError = runEnergyDriftTests_internal(
+            IntegratorMethods::CashKarp54, gasTimeStep, gasSteps, gasSpheres,
+            explicitSteps);
+        // one outer step covers respaStepRatio inner steps of the same length
+        unsigned int respaStepRatio = sender->simulatedSystem->get<unsigned int>(
+            SimulationVariables::respaStepRatio);
+        Scalar respaError = runEnergyDriftTests_internal(
+            IntegratorMethods::RespaVerlet, respaStepRatio*gasTimeStep,
+            gasSteps/respaStepRatio, gasSpheres, respaSteps);
+        currentTestConsole<<"rel. error: "<<std::setw(14)<<respaError
+            <<" (CashKarp54: "<<explicitError<<"). ";
+        currentTestConsole<<"real steps: "<<std::setw(6)<<respaSteps
+            <<" (CashKarp54: "<<explicitSteps<<"). ";
+        verify(fabs(explicitError), Smaller, 0.01);
+        verify(fabs(respaError), Smaller, 0.01);
+        verify(respaSteps, Smaller, explicitSteps);
+    endTest();
+    sender->simulatedSystem->set(SimulationVariables::periodicBoundaryConditions,
+        false);
+    sender->simulatedSystem->set(SimulationVariables::integratorMethod,
+        (unsigned int)IntegratorMethods::CashKarp54);
+    sender->removeSomeLastSpheres(sphereCount);
 }
 
 void ServerTester::runCalculationActionTests_internal(unsigned char order,
@@ -331,6 +568,61 @@ void ServerTester::runCalculationActionTests_internal(unsigned char order,
     sender->removeLastSphere();
 }
 
+void ServerTester::runSymplecticIntegratorTests_internal(unsigned char evaluations,
+    const char* integratorMethod)
+{
+    systemCreator->createSimpleWallCollisionSystem();
+
+    Scalar timeStep = 0.002;
+    sender->simulatedSystem->set(SimulationVariables::timeStep, timeStep);
+    Scalar simulationTime = 1;
+    unsigned int steps = (unsigned int)(simulationTime/timeStep);
+    Scalar beginEnergy, endEnergy;
+    beginEnergy = sender->getTotalEnergy();
+    sender->popCalculationCounter();
+    sender->calculateSomeSteps(steps);
+    do
+    {
+        QTest::qWait(10);
+    }
+    while (sender->simulatedSystem->get<bool>(SimulationVariables::simulating));
+    endEnergy = sender->getTotalEnergy();
+    Scalar relError = 1.0-(beginEnergy/endEnergy);
+    currentTestConsole<<"rel. error: "<<std::setw(14)<<relError<<". ";
+    unsigned int realSteps = sender->popCalculationCounter();
+    currentTestConsole<<"real steps: "<<std::setw(6)<<realSteps
+        <<" ("<<integratorMethod<<"). ";
+    verify(fabs(relError), Smaller, 0.01);
+    // one additional evaluation for the initial accelerations
+    verify(realSteps, Equal, evaluations*steps+1);
+    sender->removeLastSphere();
+}
+
+Scalar ServerTester::runEnergyDriftTests_internal(unsigned int integratorMethod,
+    Scalar timeStep, unsigned int steps, const std::vector<Sphere>& initialSpheres,
+    unsigned int& realSteps)
+{
+    sender->simulatedSystem->set(SimulationVariables::integratorMethod,
+        integratorMethod);
+    sender->simulatedSystem->set(SimulationVariables::timeStep, timeStep);
+    for (unsigned int i = 0; i<initialSpheres.size(); i++)
+    {
+        sender->updateSphere(i, initialSpheres[i]);
+    }
+    Scalar beginEnergy, endEnergy;
+    beginEnergy = sender->getTotalEnergy();
+    sender->popCalculationCounter();
+    sender->calculateSomeSteps(steps);
+    do
+    {
+        QTest::qWait(10);
+    }
+    while (sender->simulatedSystem->get<bool>(SimulationVariables::simulating));
+    endEnergy = sender->getTotalEnergy();
+    realSteps = sender->popCalculationCounter();
+    return 1.0-(beginEnergy/endEnergy);
+}
+
 void ServerTester::runFrameBufferTests()
 {
     unsigned short bufferSize = 4;
@@ -379,6 +671,470 @@ void ServerTester::runFrameBufferTests()
     endTest();
 }
 
+void ServerTester::runFrameTests()
+{
+    const unsigned int codecSphereCount = 10;
+    Vector3 codecBoxSize(2, 1, 1);
+    std::vector<Scalar> radii(codecSphereCount, 0.05);
+    std::vector<Vector3> positions(codecSphereCount);
+    for (unsigned int i = 0; i<codecSphereCount; i++)
+    {
+        positions[i] = Vector3(0.1+0.15*i, 0.5, 0.25+0.05*i);
+    }
+    FrameEncoder encoder;
+    FrameDecoder decoder;
+    std::string keyframe, deltaFrame;
+    startTest_(FrameCodec::keyframe);
+        encoder.encode(1, codecBoxSize, codecSphereCount, radii.data(),
+            positions.data(), keyframe);
+        verify(decoder.decode(keyframe.data(), keyframe.size()), Equal, true);
+        verify(decoder.getSphereCount(), Equal, codecSphereCount);
+        for (unsigned int i = 0; i<codecSphereCount; i++)
+        {
+            for (unsigned char axis = 0; axis<3; axis++)
+            {
+                verify(fabs(decoder.getPosition(i)(axis)-positions[i](axis)),
+                    SmallerOrEqual, codecBoxSize(axis)/65536);
+            }
+        }
+    startNewTest_(FrameCodec::deltaFrame);
+        // one sphere moves and another one changes its radius
+        positions[3] += Vector3(0.1, -0.2, 0.05);
+        radii[7] = 0.08;
+        encoder.encode(2, codecBoxSize, codecSphereCount, radii.data(),
+            positions.data(), deltaFrame);
+        verify(deltaFrame.size(), Smaller, keyframe.size());
+        verify(decoder.decode(deltaFrame.data(), deltaFrame.size()), Equal, true);
+        verify(decoder.getFrameCounter(), Equal, 2u);
+        for (unsigned int i = 0; i<codecSphereCount; i++)
+        {
+            verify(decoder.getRadius(i), ApproxEqual, radii[i]);
+            for (unsigned char axis = 0; axis<3; axis++)
+            {
+                verify(fabs(decoder.getPosition(i)(axis)-positions[i](axis)),
+                    SmallerOrEqual, codecBoxSize(axis)/65536);
+            }
+        }
+        // a delta frame referring to a lost frame waits for the next keyframe
+        encoder.encode(3, codecBoxSize, codecSphereCount, radii.data(),
+            positions.data(), deltaFrame);
+        encoder.encode(4, codecBoxSize, codecSphereCount, radii.data(),
+            positions.data(), deltaFrame);
+        verify(decoder.decode(deltaFrame.data(), deltaFrame.size()), Equal, false);
+        verify(decoder.getFrameCounter(), Equal, 2u);
+    endTest();
+    runSharedFrameRingTests_internal();
+
+    unsigned short sphereCount = 8;
+    systemCreator->createMacroscopic2DCollisionSystem(sphereCount);
+    sender->simulatedSystem->set(SimulationVariables::earthGravity,
+        Vector3(0, 0, 0));
+    sender->simulatedSystem->set(SimulationVariables::frameSending, true);
+    Sphere sphere;
+    sphere.radius = 0.05;
+    for (unsigned short i = 0; i<sphereCount; i++)
+    {
+        sphere.pos = Vector3(0.2+0.2*(i%4), 0.3+0.4*(i/4), 0.5);
+        sphere.speed = Vector3((i%2 == 0 ? 0.5 : -0.5), 0.1*(i%3), 0);
+        sender->updateSphere(i, sphere);
+    }
+    std::vector<Sphere> frame;
+    startTest_(SimulationVariables::frameSending);
+        receivedFrameCount = 0;
+        sender->calculateSomeSteps(200);
+        do
+        {
+            QTest::qWait(10);
+        }
+        while (sender->simulatedSystem->get<bool>(SimulationVariables::simulating));
+        // updating a sphere sends a frame of the final positions
+        sender->getAllSphereData(0, sphere);
+        sphere.radius = 0.07;
+        sender->updateSphere(0, sphere);
+        verify(waitForFrame_internal(sphereCount, sphere.radius, frame), Equal,
+            true);
+        verify(receivedFrameCount, Greater, 0u);
+        currentTestConsole<<"frames: "<<receivedFrameCount<<". ";
+        for (unsigned short i = 0; i<sphereCount && testSuccess; i++)
+        {
+            sender->getAllSphereData(i, sphere);
+            verifyFrameSphere_internal(frame[i], sphere);
+        }
+    endTest();
+    sender->removeSomeLastSpheres(sphereCount);
+    runFrameSelectionTests_internal(frame);
+    runFramePacingTests_internal();
+    sender->simulatedSystem->set(SimulationVariables::frameSending, false);
+}
+
+void ServerTester::runSharedFrameRingTests_internal()
+{
+    // simulation IDs are odd, so this name is not used by the server
+    std::string name = SharedFrameRing::getName(2);
+    const unsigned int slotCount = 4;
+    SharedFrameRing writer, reader;
+    size_t size = 0;
+    const char* data;
+    auto frameText = [](const char* data)
+    {
+        return std::string(data != nullptr ? data : "");
+    };
+    startTest_(SharedFrameRing);
+        verify(writer.create(name, 42, slotCount, 64), Equal, true);
+        verify(reader.open(name, 43), Equal, false);
+        verify(reader.open(name, 42), Equal, true);
+        verify(reader.peek(size) == nullptr, Equal, true);
+        verify(writer.push("frame 1", 8), Equal, true);
+        verify(writer.push(std::string(65, 'x').data(), 65), Equal, false);
+        data = reader.peek(size);
+        verify(data != nullptr, Equal, true);
+        verify(size, Equal, (size_t)8);
+        verify(frameText(data), Equal, std::string("frame 1"));
+        verify(reader.check(), Equal, true);
+        verify(reader.peek(size) == nullptr, Equal, true);
+        // a frame overwritten while being read is detected
+        writer.push("frame 2", 8);
+        data = reader.peek(size);
+        verify(data != nullptr, Equal, true);
+        for (unsigned int i = 0; i<slotCount; i++)
+        {
+            writer.push("frame x", 8);
+        }
+        verify(reader.check(), Equal, false);
+        // a reader lapped by the writer continues with the newest frame
+        writer.push("frame 9", 8);
+        data = reader.peek(size);
+        verify(data != nullptr, Equal, true);
+        verify(frameText(data), Equal, std::string("frame 9"));
+        verify(reader.check(), Equal, true);
+        verify(reader.peek(size) == nullptr, Equal, true);
+    startNewTest_(BasicActions::useSharedFrames);
+        // frames of a server on the same host come over the ring
+        std::string serverAddress = address;
+        if (serverAddress == "127.0.0.1" || serverAddress == "localhost")
+        {
+            verify(sender->isReceivingSharedFrames(), Equal, true);
+        }
+    endTest();
+}
+
+void ServerTester::runFrameSelectionTests_internal(std::vector<Sphere>& frame)
+{
+    // resting spheres on an 8x8 grid, every second one small
+    unsigned short sphereCount = 64;
+    sender->addSomeSpheres(sphereCount);
+    Sphere sphere;
+    for (unsigned short i = 0; i<sphereCount; i++)
+    {
+        sphere.radius = (i%2 == 0 ? 0.02 : 0.04);
+        sphere.pos = Vector3(0.1+0.1*(i%8), 0.1+0.1*(i/8), 0.5);
+        sender->updateSphere(i, sphere);
+    }
+    startTest_(SimulationVariables::minimumFrameSphereRadius);
+        sender->simulatedSystem->set(SimulationVariables::minimumFrameSphereRadius,
+            0.03);
+        // the first large sphere grows, which sends a frame
+        sender->getAllSphereData(1, sphere);
+        sphere.radius = 0.045;
+        sender->updateSphere(1, sphere);
+        verify(waitForFrame_internal(sphereCount/2, sphere.radius, frame), Equal,
+            true);
+        for (unsigned short i = 0; i<frame.size() && testSuccess; i++)
+        {
+            sender->getAllSphereData(2*i+1, sphere);
+            verifyFrameSphere_internal(frame[i], sphere);
+        }
+    startNewTest_(SimulationVariables::maximumFrameSphereCount);
+        unsigned int maximumCount = 8;
+        sender->simulatedSystem->set(SimulationVariables::maximumFrameSphereCount,
+            maximumCount);
+        sender->getAllSphereData(0, sphere);
+        sender->updateSphere(0, sphere);
+        verify(waitForFrame_internal(maximumCount, 0, frame), Equal, true);
+        // the frame spheres are large spheres of the server, spread evenly
+        // over the quarters of the grid
+        unsigned short quarterCounts[4] = {0, 0, 0, 0};
+        for (unsigned short i = 0; i<frame.size() && testSuccess; i++)
+        {
+            verify(frame[i].radius, Greater, 0.03);
+            unsigned short column = (unsigned short)(frame[i].pos(0)*10-0.5);
+            unsigned short row = (unsigned short)(frame[i].pos(1)*10-0.5);
+            sender->getAllSphereData(row*8+column, sphere);
+            verifyFrameSphere_internal(frame[i], sphere);
+            quarterCounts[(column/4)+2*(row/4)]++;
+        }
+        for (unsigned short i = 0; i<4; i++)
+        {
+            verify(quarterCounts[i], Equal, maximumCount/4);
+        }
+    endTest();
+    sender->simulatedSystem->set(SimulationVariables::maximumFrameSphereCount, 0u);
+    sender->simulatedSystem->set(SimulationVariables::minimumFrameSphereRadius,
+        0.0);
+    sender->removeSomeLastSpheres(sphereCount);
+}
+
+void ServerTester::runFramePacingTests_internal()
+{
+    // a new client, so the frame rate does not depend on the frames of the
+    // tests before
+    ActionSender otherSender(address, sendPort, recvPort, frameRecvPort, nullptr);
+    otherSender.failureExitWhenDisconnected = true;
+    connect(&otherSender, SIGNAL(newFrameReceived()), SLOT(frameReceived()));
+    for (unsigned short i = 0; i<500 && otherSender.isConnected() == false; i++)
+    {
+        QTest::qWait(10);
+    }
+    unsigned int frameRate = 100;
+    SystemCreator(&otherSender).createMacroscopic2DCollisionSystem(8);
+    otherSender.simulatedSystem->set(SimulationVariables::frameRate, frameRate);
+    otherSender.simulatedSystem->set(SimulationVariables::frameSending, true);
+    startTest_(SimulationVariables::frameRate);
+        verify(otherSender.isConnected(), Equal, true);
+        otherSender.startSimulation();
+        // frames not read by the client fill its buffer, so the server halves
+        // the frame rate with every heartbeat
+        unsigned int fullBufferFrameRate = countFrames_internal(&otherSender,
+            5000, false);
+        // a client reading its frames gets more of them again
+        unsigned int readingFrameRate = countFrames_internal(&otherSender,
+            4000, true);
+        otherSender.stopSimulation();
+        do
+        {
+            QTest::qWait(10);
+        }
+        while (otherSender.simulatedSystem->get<bool>(
+            SimulationVariables::simulating));
+        currentTestConsole<<"frames per second: "<<fullBufferFrameRate<<" | "
+            <<readingFrameRate<<". ";
+        verify(fullBufferFrameRate, SmallerOrEqual, frameRate/10);
+        verify(readingFrameRate, Greater, fullBufferFrameRate);
+    endTest();
+}
+
+unsigned int ServerTester::countFrames_internal(ActionSender* frameSender,
+    unsigned int waitTime, bool reading)
+{
+    std::vector<Sphere> frame;
+    unsigned int firstFrameCount = receivedFrameCount;
+    for (unsigned int time = 0; time<waitTime; time += 10)
+    {
+        if (time+1000 == waitTime)
+        {
+            firstFrameCount = receivedFrameCount;
+        }
+        if (reading)
+        {
+            readNewestFrame_internal(frameSender, frame);
+        }
+        QTest::qWait(10);
+    }
+    return receivedFrameCount-firstFrameCount;
+}
+
+void ServerTester::readNewestFrame_internal(ActionSender* frameSender,
+    std::vector<Sphere>& frame)
+{
+    FrameBuffer<Sphere>* frameBuffer = frameSender->getFrameBuffer();
+    frame.clear();
+    if (frameBuffer->getFrameCount() == 0)
+    {
+        return;
+    }
+    // the frame at the read position is complete, the one behind is written
+    do
+    {
+        frameBuffer->popFrame();
+    }
+    while (frameBuffer->getFrameCount() > 1);
+    while (frameBuffer->hasElements())
+    {
+        frame.push_back(frameBuffer->popElement());
+    }
+}
+
+bool ServerTester::waitForFrame_internal(unsigned int count, Scalar firstRadius,
+    std::vector<Sphere>& frame)
+{
+    for (unsigned short i = 0; i<500; i++)
+    {
+        readNewestFrame_internal(sender, frame);
+        if (frame.size() == count && count > 0
+            && (firstRadius == 0 || fabs(frame[0].radius-firstRadius) < 1.0e-6))
+        {
+            return true;
+        }
+        QTest::qWait(10);
+    }
+    return false;
+}
+
+void ServerTester::verifyFrameSphere_internal(const Sphere& frameSphere,
+    const Sphere& sphere)
+{
+    Vector3 boxSize = sender->simulatedSystem->get<Vector3>(
+        SimulationVariables::boxSize);
+    verify(frameSphere.radius, ApproxEqual, sphere.radius);
+    for (unsigned char axis = 0; axis<3; axis++)
+    {
+        verify(fabs(frameSphere.pos(axis)-sphere.pos(axis)), SmallerOrEqual,
+            boxSize(axis)/65536);
+    }
+}
+
+void ServerTester::frameReceived()
+{
+    receivedFrameCount++;
+}
+
+void ServerTester::runTaskSchedulerTests()
+{
+    // a second client runs an equal simulation on the same server, so the
+    // step rates show the shares of the server threads
+    ActionSender otherSender(address, sendPort, recvPort, frameRecvPort, nullptr);
+    otherSender.failureExitWhenDisconnected = true;
+    for (unsigned short i = 0; i<500 && otherSender.isConnected() == false; i++)
+    {
+        QTest::qWait(10);
+    }
+    ActionSender* senders[2] = {sender, &otherSender};
+    unsigned short sphereCount = 4000;
+    for (unsigned int s = 0; s<2; s++)
+    {
+        SystemCreator(senders[s]).createMacroscopic2DCollisionSystem(sphereCount);
+        senders[s]->simulatedSystem->set(SimulationVariables::frameSending, false);
+    }
+    startTest_(SimulationVariables::simulationWeight);
+        verify(otherSender.isConnected(), Equal, true);
+        sender->simulatedSystem->set(SimulationVariables::simulationWeight, 3u);
+        Scalar stepRatio = runTaskSchedulerTests_internal(senders);
+        currentTestConsole<<"step ratio: "<<std::setw(8)<<stepRatio<<". ";
+        // three times the share, less the parts of the steps outside the pool
+        verify(stepRatio, Greater, 1.5);
+        sender->simulatedSystem->set(SimulationVariables::simulationWeight, 1u);
+    startNewTest_(SimulationVariables::simulationPriority);
+        verify(otherSender.isConnected(), Equal, true);
+        sender->simulatedSystem->set(SimulationVariables::simulationPriority, 1u);
+        stepRatio = runTaskSchedulerTests_internal(senders);
+        currentTestConsole<<"step ratio: "<<std::setw(8)<<stepRatio<<". ";
+        // the other simulation only gets threads its loops leave idle
+        verify(stepRatio, Greater, 1.5);
+        sender->simulatedSystem->set(SimulationVariables::simulationPriority, 0u);
+    endTest();
+    for (unsigned int s = 0; s<2; s++)
+    {
+        senders[s]->removeSomeLastSpheres(sphereCount);
+    }
+}
+
+Scalar ServerTester::runTaskSchedulerTests_internal(ActionSender** senders)
+{
+    unsigned int steps[2];
+    for (unsigned int s = 0; s<2; s++)
+    {
+        senders[s]->popStepCounter();
+        senders[s]->startSimulation();
+    }
+    QTest::qWait(2000);
+    for (unsigned int s = 0; s<2; s++)
+    {
+        senders[s]->stopSimulation();
+    }
+    for (unsigned int s = 0; s<2; s++)
+    {
+        do
+        {
+            QTest::qWait(10);
+        }
+        while (senders[s]->simulatedSystem->get<bool>(
+            SimulationVariables::simulating));
+        steps[s] = senders[s]->popStepCounter();
+    }
+    currentTestConsole<<"steps: "<<std::setw(6)<<steps[0]<<" | "<<std::setw(6)
+        <<steps[1]<<". ";
+    return (Scalar)steps[0]/(steps[1] > 0 ? steps[1] : 1);
+}
+
+void ServerTester::runDistributedRunTests()
+{
+    unsigned short sphereCount = 16;
+    systemCreator->createMacroscopic2DCollisionSystem(sphereCount);
+    sender->simulatedSystem->set(SimulationVariables::earthGravity,
+        Vector3(0, 0, 0));
+    sender->simulatedSystem->set(SimulationVariables::integratorMethod,
+        (unsigned int)IntegratorMethods::CashKarp54);
+    // the domains have to agree on every adapted step
+    sender->simulatedSystem->set(SimulationVariables::adaptiveTimeStep, true);
+    // fixed spheres, so runs on different servers can be compared; the
+    // masses tell them apart after they were distributed
+    Sphere sphere;
+    sphere.radius = 0.05;
+    for (unsigned short i = 0; i<sphereCount; i++)
+    {
+        sphere.mass = i+1;
+        sphere.pos = Vector3(0.2+0.2*(i%4), 0.2+0.2*(i/4), 0.5);
+        sphere.speed = Vector3((i%2 == 0 ? 0.5 : -0.5), 0.1*(i%3), 0);
+        sphere.acc = Vector3(0, 0, 0);
+        sender->updateSphere(i, sphere);
+    }
+    startTest_(distributedRun);
+        sender->calculateSomeSteps(500);
+        do
+        {
+            QTest::qWait(10);
+        }
+        while (sender->simulatedSystem->get<bool>(SimulationVariables::simulating));
+        unsigned short movedSpheres = 0;
+        std::vector<Sphere> spheres(sphereCount);
+        for (unsigned short i = 0; i<sphereCount; i++)
+        {
+            sender->getAllSphereData(i, spheres[i]);
+            movedSpheres += (spheres[i].mass == i+1 ? 0 : 1);
+        }
+        Scalar totalEnergy = sender->getTotalEnergy();
+        unsigned int finalSphereCount = sender->simulatedSystem->get<unsigned int>(
+            SimulationVariables::sphereCount);
+        currentTestConsole<<"spheres: "<<finalSphereCount<<", total energy: "
+            <<std::setprecision(10)<<totalEnergy<<". ";
+        verify(movedSpheres, Equal, 0);
+        verify(finalSphereCount, Equal, sphereCount);
+        if (referenceSphereCount > 0)
+        {
+            verify(finalSphereCount, Equal, referenceSphereCount);
+            verify(totalEnergy, ApproxEqual, referenceTotalEnergy);
+            verify(referenceSpheres.size(), Equal, referenceSphereCount);
+        }
+        // only the order of the force sums differs from the reference, far
+        // below the float precision of the transferred spheres
+        const Scalar positionTolerance = 1.0e-5;
+        const Scalar speedTolerance = 1.0e-4;
+        for (unsigned short i = 0; i<referenceSpheres.size() && i<sphereCount; i++)
+        {
+            verify(spheres[i].pos.distance(referenceSpheres[i].pos), SmallerOrEqual,
+                positionTolerance);
+            verify(spheres[i].speed.distance(referenceSpheres[i].speed),
+                SmallerOrEqual, speedTolerance);
+        }
+    endTest();
+    if (distributedRunOnly && referenceSphereCount == 0)
+    {
+        // read by scripts/domain_test.sh, all on one line
+        Console reference;
+        reference<<"ServerTester: reference: "<<finalSphereCount<<' '
+            <<std::setprecision(17)<<totalEnergy;
+        for (unsigned short i = 0; i<sphereCount; i++)
+        {
+            const Sphere& s = spheres[i];
+            reference<<' '<<s.pos(0)<<' '<<s.pos(1)<<' '<<s.pos(2)<<' '
+                <<s.speed(0)<<' '<<s.speed(1)<<' '<<s.speed(2);
+        }
+        reference<<'\n';
+    }
+    sender->simulatedSystem->set(SimulationVariables::adaptiveTimeStep, false);
+    sender->removeSomeLastSpheres(sphereCount);
+}
+
 void ServerTester::startTest(const char* actionName)
 {
     testSuccess = true;
@@ -12,6 +12,8 @@
 
 #include <QCoreApplication>
 #include <QTimer>
+#include <cstdlib>
+#include <string>
 
 using namespace SphereSim;
 
@@ -19,6 +21,11 @@ using namespace SphereSim;
  * method main:
  * Creates instance of ServerTester to test server actions.
  * Starts QCoreApplication.
+ *
+ * With "--distributed-run [<sphere count> <total energy> <spheres>]", only
+ * the distributed run test is run and compared with the given reference run,
+ * or its result is printed as reference (see scripts/domain_test.sh). The
+ * spheres are given by their positions and speeds, six values each.
  */
 
 int main(int argc, char** argv)
@@ -27,7 +34,24 @@ int main(int argc, char** argv)
     try
     {
         ServerTester svrTester(Connection::address, Connection::serverRecvPort,
-            Connection::serverSendPort);
+            Connection::serverSendPort, Connection::serverFramePort);
+        if (argc > 1 && std::string(argv[1]) == "--distributed-run")
+        {
+            // six values (position and speed) per sphere
+            std::vector<Sphere> spheres;
+            Sphere sphere;
+            for (int i = 4; i+6<=argc; i += 6)
+            {
+                sphere.pos = Vector3(strtod(argv[i], nullptr),
+                    strtod(argv[i+1], nullptr), strtod(argv[i+2], nullptr));
+                sphere.speed = Vector3(strtod(argv[i+3], nullptr),
+                    strtod(argv[i+4], nullptr), strtod(argv[i+5], nullptr));
+                spheres.push_back(sphere);
+            }
+            svrTester.selectDistributedRunTest(
+                (argc > 3 ? strtoul(argv[2], nullptr, 10) : 0),
+                (argc > 3 ? strtod(argv[3], nullptr) : 0), spheres);
+        }
         return app.exec();
     }
     catch (std::exception ex)
@@ -61,7 +61,8 @@ namespace SphereSim
     public:
         /** \brief Initialize member variables. */
         MainWindow(const char* addr, unsigned short sendPort,
-            unsigned short recvPort, unsigned short sphCount,
+            unsigned short recvPort, unsigned short frameRecvPort,
+            unsigned short sphCount,
             QWidget* parent = nullptr);
 
         /** \brief Clean up member variables. */
@@ -19,9 +19,11 @@
 using namespace SphereSim;
 
 MainWindow::MainWindow(const char* addr, unsigned short sendPort,
-    unsigned short recvPort, unsigned short sphCount, QWidget* parent)
+    unsigned short recvPort, unsigned short frameRecvPort, unsigned short sphCount,
+    QWidget* parent)
     :QMainWindow(parent), ui(new Ui::MainWindow()),
-    actionSender(new ActionSender(addr, sendPort, recvPort, this)),
+    actionSender(new ActionSender(addr, sendPort, recvPort, frameRecvPort,
+        this)),
     sphCount(sphCount), timer(), boxLength(0), systemToPrepare(2),
     systemCreator(new SystemCreator(actionSender))
 {
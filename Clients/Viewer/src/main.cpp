@@ -34,7 +34,8 @@ int main(int argc, char** argv)
         try
         {
             MainWindow mainWindow(Connection::address, Connection::serverRecvPort,
-                Connection::serverSendPort, sphereCount);
+                Connection::serverSendPort, Connection::serverFramePort,
+                sphereCount);
             mainWindow.show();
 
             return app.exec();
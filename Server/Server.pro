@@ -14,7 +14,13 @@ HEADERS     +=  ActionServer.hpp        \
                 ButcherTableau.hpp      \
                 SimulationWorker.hpp    \
                 WorkQueue.hpp           \
-                TwoDimArray.hpp
+                TwoDimArray.hpp         \
+                TaskScheduler.hpp       \
+                FrameSerializer.hpp     \
+                ServerShard.hpp         \
+                DomainGroup.hpp         \
+                DomainSimulation.hpp    \
+                SphereSorting.hpp
 
 SOURCES     +=  main.cpp                \
                 ActionServer.cpp        \
@@ -22,16 +28,15 @@ SOURCES     +=  main.cpp                \
                 SphereCalculator.cpp    \
                 ButcherTableau.cpp      \
                 SimulationWorker.cpp    \
-                WorkQueue.cpp
-
-LIBS        +=  -lnanomsg
-
-equals(NO_OPENMP, "true") {
-    DEFINES         +=  NO_OPENMP=1
-} else {
-    LIBS            +=  -lgomp
-    QMAKE_CXXFLAGS  +=  -fopenmp
-}
+                WorkQueue.cpp           \
+                TaskScheduler.cpp       \
+                FrameSerializer.cpp     \
+                ServerShard.cpp         \
+                DomainGroup.cpp         \
+                DomainSimulation.cpp    \
+                SphereSorting.cpp
+
+LIBS        +=  -lnanomsg -lrt
 
 QMAKE_CXXFLAGS      +=  -Ofast -fno-fast-math
 QMAKE_LFLAGS        +=  -Ofast -fno-fast-math
@@ -18,7 +18,9 @@
 
 namespace SphereSim
 {
+    class DomainGroup;
     class MessageTransmitter;
+    class SharedFrameRing;
 
     /** \brief Receiver of client requests. */
     class ActionReceiver:public QObject
@@ -39,9 +41,34 @@ namespace SphereSim
 
         bool receivedRequests;
 
+        /** \brief Shared memory ring offered to the client; nullptr if not
+         * requested or declined. */
+        SharedFrameRing* sharedFrameRing;
+
+        /** \brief Flag showing that the client reads the frames from the
+         * shared memory ring. */
+        bool sharedFramesUsed;
+
+        /** \brief Group the simulation is distributed over; nullptr if it is
+         * not distributed. */
+        DomainGroup* domainGroup;
+
+        /** \brief Handle the shared memory negotiation.
+         * \return Flag whether the action was a negotiation action. */
+        bool negotiateSharedFrames(unsigned char action, const char* data,
+            size_t size);
+
+        /** \brief Forward variable updates of the client to the other domains
+         * of a distributed simulation. */
+        void forwardToDomains(const char* data, size_t size);
+
     public:
-        /** \brief Start a new server handling requests from the client. */
-        ActionReceiver(const unsigned int clientID);
+        /** \brief Start a new server handling requests from the client.
+         * \param taskScheduler Scheduler shared by all simulations.
+         * \param domainGroup Group the simulation is distributed over;
+         * nullptr if it is not distributed. */
+        ActionReceiver(const unsigned int clientID, TaskScheduler* taskScheduler,
+            DomainGroup* domainGroup);
 
         /** \brief Clean up member variables. */
         ~ActionReceiver();
@@ -52,23 +79,36 @@ namespace SphereSim
 
         bool hasReceivedRequests();
 
+        /** \brief Copy reply data into a message behind the space of the reply
+         * header. */
+        static MessageBuffer createReply(const std::string& data);
+
     public slots:
-        /** \brief Process and reply to received request. */
-        void processRequest(std::string data);
+        /** \brief Process and reply to received request.
+         * \param data Request without the message header; read in place. */
+        void processRequest(const char* data, size_t size);
 
-        void sendFrame(std::string frameToSend);
+        /** \brief Send a frame over the shared memory ring or the network.
+         * \param message Message with the space of the reply header. */
+        void sendFrame(MessageBuffer message);
 
-        void sendVariable(std::string variableToSend);
+        void sendVariable(const std::string& variableToSend);
 
         void simulating(bool isSimulating);
 
         /** \brief Send encoded data to client.
          * \param serverStatus Server status to be sent.
-         * \param data Data to be sent to client. */
-        void sendReply(unsigned short serverStatus, std::string dataToSend);
+         * \param data Data to be sent to client, copied into a message. */
+        void sendReply(unsigned short serverStatus, const std::string& dataToSend);
+
+        /** \brief Send a message from createReply to client. */
+        void sendReply(unsigned short serverStatus, MessageBuffer message);
 
     signals:
-        void send(unsigned int clientID, std::string reply);
+        /** \brief Message to be sent to the client without copying; the server
+         * fills in the reply header in front of the data. */
+        void sendMessage(unsigned int clientID, unsigned short serverStatus,
+            MessageBuffer message);
 
         void terminateServer();
 
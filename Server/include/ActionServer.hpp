@@ -11,40 +11,83 @@
 
 #include <QObject>
 #include <QTimer>
-#include <map>
 #include <nanomsg/nn.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+class QThread;
 
 namespace SphereSim
 {
-    class ActionReceiver;
-    class MessageTransmitter;
-
-    /** \brief Start server and wait for incoming connections from clients. */
+    class DomainGroup;
+    class ServerShard;
+    class TaskScheduler;
+
+    /** \brief Start server and wait for incoming connections from clients.
+     *
+     * The network layer is split into ServerShards, each running in its own
+     * thread with its own sockets, and every simulation is pinned to one
+     * shard. Three nanomsg devices connect the shards to the listening
+     * sockets: one forwards all requests to the shards, which subscribe to
+     * the requests of their simulations, one forwards the control replies of
+     * all shards to the clients, and one forwards their frames to a port of
+     * their own. Frames thus neither delay control replies nor make them get
+     * dropped in full queues. */
     class ActionServer:private QObject
     {
         Q_OBJECT
 
     private:
-        nn::socket sendSocket;
-        nn::socket recvSocket;
+        /** \brief Raw sockets of the request device: listening socket and
+         * socket the shards connect to. */
+        int requestFrontend;
+        int requestBackend;
+
+        /** \brief Raw sockets of the reply device: socket the shards connect
+         * to and listening socket. */
+        int replyFrontend;
+        int replyBackend;
+
+        /** \brief Raw sockets of the frame device: socket the shards connect
+         * to and listening socket. */
+        int frameFrontend;
+        int frameBackend;
+
+        /** \brief Threads running the devices. */
+        std::thread requestDevice;
+        std::thread replyDevice;
+        std::thread frameDevice;
+
+        /** \brief Socket sending the server heartbeat. */
+        nn::socket heartbeatSocket;
 
         unsigned int serverID;
 
-        MessageTransmitter* messageTransmitter;
+        /** \brief Thread pool shared by the simulations of all clients. */
+        TaskScheduler* taskScheduler;
 
-        typedef std::map<unsigned int, ActionReceiver*> ActionReceiverMap;
-        ActionReceiverMap actionReceivers;
+        std::vector<ServerShard*> shards;
+        std::vector<QThread*> shardThreads;
 
         QTimer heartbeatTimer;
-        QTimer disconnectionTimer;
+
+        /** \brief Buffer for encoding heartbeats. */
+        std::string sendBuffer;
 
     public:
         /** \brief Start a server and listen to the specified port.
          * \param addr The address that the server will be listening to.
          * \param sendPort The port that the server will be sending to.
-         * \param recvPort The port that the server will be listening to. */
-        ActionServer(const char* addr,
-            unsigned short sendPort, unsigned short recvPort);
+         * \param recvPort The port that the server will be listening to.
+         * \param framePort The port that the server will be sending frames to.
+         * \param shardCount Number of network threads; 0 chooses it from the
+         * number of hardware threads.
+         * \param domainGroup Group the simulations are distributed over, with
+         * this server as coordinator; nullptr if they are not distributed. */
+        ActionServer(const char* addr, unsigned short sendPort,
+            unsigned short recvPort, unsigned short framePort,
+            unsigned int shardCount = 0, DomainGroup* domainGroup = nullptr);
 
         ~ActionServer();
 
@@ -53,16 +96,10 @@ namespace SphereSim
         ActionServer& operator=(const ActionServer&) = delete;
 
     public slots:
-        void send(unsigned int clientID, std::string reply);
-
-        void receiveRequest(std::string request);
-
         void tearDown();
 
         void sendHeartbeat();
 
-        void disconnectionCheck();
-
     };
 
 }
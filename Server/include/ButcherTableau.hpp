@@ -14,41 +14,270 @@
 namespace SphereSim
 {
 
-    /** \brief Butcher tableau values for an adaptive stepsize Runge-Kutta method. */
-    class ButcherTableau
+    /** \brief Butcher tableaux of the adaptive stepsize Runge-Kutta methods.
+     *
+     * Every tableau is a type providing its values as compile-time constants:
+     * the number of stages, the order of the embedded solution used for the
+     * error estimate, the central matrix a, the first and second bottom
+     * vectors b and b_ and the left vector c. The integrator is templated on
+     * these types, so stage loops have constant bounds and zero coefficients
+     * are removed by the compiler. */
+    namespace ButcherTableau
     {
-    public:
-        /** \brief Runge-Kutta method order and array size. */
-        unsigned char order;
-        /** \brief Central matrix. */
-        Scalar a[10][10];
-        /** \brief First bottom vector. */
-        Scalar b[10];
-        /** \brief Second bottom vector. */
-        Scalar b_[10];
-        /** \brief Left vector. */
-        Scalar c[10];
-
-        /** \brief Initialize empty ButcherTableau. */
-        ButcherTableau();
-
-        /** \copydoc ButcherTableau
-         * \param order Runge-Kutta method order. */
-        ButcherTableau(unsigned char order);
-
-        /** \brief Initialization of the Butcher tableau.
-         * \param order Runge-Kutta method order and array size.
-         * \param a Central matrix.
-         * \param b First bottom vector.
-         * \param b_ Second bottom vector.
-         * \param c Left vector. */
-        ButcherTableau(unsigned char order, const Scalar* a, const Scalar* b,
-            const Scalar* b_, const Scalar* c);
-
-        ButcherTableau(const ButcherTableau&) = default;
-        ButcherTableau& operator=(const ButcherTableau&) = default;
-
-    };
+        /** \copydoc IntegratorMethods::HeunEuler21 */
+        struct HeunEuler21
+        {
+            static constexpr unsigned char stages = 2;
+            static constexpr unsigned char embeddedOrder = 1;
+            static constexpr Scalar a[stages][stages] =
+                {
+                    {0.0,   0.0},
+                    {1.0,   0.0}
+                };
+            static constexpr Scalar b[stages] =     {1/2.0, 1/2.0};
+            static constexpr Scalar b_[stages] =    {1.0,   0.0};
+            static constexpr Scalar c[stages] =     {0.0,   1.0};
+        };
+
+        /** \copydoc IntegratorMethods::BogackiShampine32 */
+        struct BogackiShampine32
+        {
+            static constexpr unsigned char stages = 4;
+            static constexpr unsigned char embeddedOrder = 2;
+            static constexpr Scalar a[stages][stages] =
+                {
+                    {0.0,   0.0,    0.0,    0.0},
+                    {1/2.0, 0.0,    0.0,    0.0},
+                    {0.0,   3/4.0,  0.0,    0.0},
+                    {2/9.0, 1/3.0,  4/9.0,  0.0}
+                };
+            static constexpr Scalar b[stages] =     {2/9.0,     1/3.0,  4/9.0,  0.0};
+            static constexpr Scalar b_[stages] =    {7/24.0,    1/4.0,  1/3.0,  1/8.0};
+            static constexpr Scalar c[stages] =     {0.0,       1/2.0,  3/4.0,  1.0};
+        };
+
+        /** \copydoc IntegratorMethods::RungeKuttaFehlberg54 */
+        struct RungeKuttaFehlberg54
+        {
+            static constexpr unsigned char stages = 6;
+            static constexpr unsigned char embeddedOrder = 4;
+            static constexpr Scalar a[stages][stages] =
+                {
+                    {0.0,           0.0,            0.0,
+                        0.0,            0.0,            0.0},
+                    {1/4.0,         0.0,            0.0,
+                        0.0,            0.0,            0.0},
+                    {3/32.0,        9/32.0,         0.0,
+                        0.0,            0.0,            0.0},
+                    {1932/2197.0,   -7200/2197.0,   7296/2197.0,
+                        0.0,            0.0,            0.0},
+                    {439/216.0,     -8.0,           3680/513.0,
+                        -845/4104.0,    0.0,            0.0},
+                    {-8/27.0,       2.0,            -3544/2565.0,
+                        1859/4104.0,    -11/40.0,       0.0}
+                };
+            static constexpr Scalar b[stages] =
+                {
+                    16/135.0,       0.0,            6656/12825.0,
+                    28561/56430.0,  -9/50.0,        2/55.0
+                };
+            static constexpr Scalar b_[stages] =
+                {
+                    25/216.0,       0.0,            1408/2565.0,
+                    2197/4104.0,    -1/5.0,         0.0
+                };
+            static constexpr Scalar c[stages] =
+                {
+                    0.0,            1/4.0,          3/8.0,
+                    12/13.0,        1.0,            1/2.0
+                };
+        };
+
+        /** \copydoc IntegratorMethods::CashKarp54 */
+        struct CashKarp54
+        {
+            static constexpr unsigned char stages = 6;
+            static constexpr unsigned char embeddedOrder = 4;
+            static constexpr Scalar a[stages][stages] =
+                {
+                    {0.0,           0.0,        0.0,
+                        0.0,            0.0,        0.0},
+                    {1/5.0,         0.0,        0.0,
+                        0.0,            0.0,        0.0},
+                    {3/40.0,        9/40.0,     0.0,
+                        0.0,            0.0,        0.0},
+                    {3/10.0,        -9/10.0,    6/5.0,
+                        0.0,            0.0,        0.0},
+                    {-11/54.0,      5/2.0,      -70/27.0,
+                        35/27.0,        0.0,        0.0},
+                    {1631/55296.0,  175/512.0,  575/13824.0,
+                        44275/110592.0, 253/4096.0, 0.0}
+                };
+            static constexpr Scalar b[stages] =
+                {
+                    37/378.0,       0.0,        250/621.0,
+                    125/594.0,      0.0,        512/1771.0
+                };
+            static constexpr Scalar b_[stages] =
+                {
+                    2825/27648.0,   0.0,            18575/48384.0,
+                    13525/55296.0,  277/14336.0,    1/4.0
+                };
+            static constexpr Scalar c[stages] =
+                {
+                    0.0,            1/5.0,          3/10.0,
+                    3/5.0,          1.0,            7/8.0
+                };
+        };
+
+        /** \copydoc IntegratorMethods::DormandPrince54 */
+        struct DormandPrince54
+        {
+            static constexpr unsigned char stages = 7;
+            static constexpr unsigned char embeddedOrder = 4;
+            static constexpr Scalar a[stages][stages] =
+                {
+                    {0.0,           0.0,                0.0,
+                        0.0,            0.0,                0.0,            0.0},
+                    {1/5.0,         0.0,                0.0,
+                        0.0,            0.0,                0.0,            0.0},
+                    {3/40.0,        9/40.0,             0.0,
+                        0.0,            0.0,                0.0,            0.0},
+                    {44/45.0,       -56/15.0,           32/9.0,
+                        0.0,            0.0,                0.0,            0.0},
+                    {19372/6561.0,  -25360/2187.0,      64448/6561.0,
+                        -212/729.0,     0.0,                0.0,            0.0},
+                    {9017/3168.0,   -355/33.0,          46732/5247.0,
+                        49/176.0,       -5103/18656.0,      0.0,            0.0},
+                    {35/384.0,      0.0,                500/1113.0,
+                        125/192.0,      -2187/6784.0,       11/84.0,        0.0}
+                };
+            static constexpr Scalar b[stages] =
+                {
+                    35/384.0,       0.0,                500/1113.0,
+                    125/192.0,      -2187/6784.0,       11/84.0,        0.0
+                };
+            static constexpr Scalar b_[stages] =
+                {
+                    5179/57600.0,   0.0,                7571/16695.0,
+                    393/640.0,      -92097/339200.0,    187/2100.0,     1/40.0
+                };
+            static constexpr Scalar c[stages] =
+                {
+                    0.0,            1/5.0,              3/10.0,
+                    4/5.0,          8/9.0,              1.0,            1.0
+                };
+        };
+
+        /** \brief Coefficients of one row of the central matrix. */
+        template <typename Tableau, unsigned char row>
+        struct RowA
+        {
+            static constexpr Scalar value(unsigned char column)
+            {
+                return Tableau::a[row][column];
+            }
+        };
+
+        /** \brief Coefficients of the first bottom vector. */
+        template <typename Tableau>
+        struct RowB
+        {
+            static constexpr Scalar value(unsigned char column)
+            {
+                return Tableau::b[column];
+            }
+        };
+
+        /** \brief Coefficients of the second bottom vector. */
+        template <typename Tableau>
+        struct RowB_
+        {
+            static constexpr Scalar value(unsigned char column)
+            {
+                return Tableau::b_[column];
+            }
+        };
+
+        /** \brief Add the stage values weighted with the coefficients of one
+         * row; unrolled at compile time, zero coefficients are skipped.
+         * \param sum Vector to add the weighted values to.
+         * \param stepLength Current step length (time in s).
+         * \param values Value of the first stage.
+         * \param stride Distance between the values of two stages. */
+        template <typename Row, unsigned char columns>
+        struct WeightedSum
+        {
+            static inline void add(Vector3& sum, Scalar stepLength,
+                const Vector3* values, unsigned int stride)
+            {
+                WeightedSum<Row, columns-1>::add(sum, stepLength, values, stride);
+                if (Row::value(columns-1) != 0)
+                {
+                    sum.add_ax(stepLength*Row::value(columns-1),
+                        values[(columns-1)*stride]);
+                }
+            }
+        };
+
+        template <typename Row>
+        struct WeightedSum<Row, 0>
+        {
+            static inline void add(Vector3&, Scalar, const Vector3*, unsigned int)
+            {
+            }
+        };
+
+        /** \brief Check whether the last row of the central matrix equals the
+         * first bottom vector (first same as last), i.e. the last stage is
+         * evaluated at the end of the step with c = 1. */
+        template <typename Tableau, unsigned char columns = Tableau::stages>
+        struct IsFirstSameAsLast
+        {
+            static constexpr bool value =
+                Tableau::a[Tableau::stages-1][columns-1] == Tableau::b[columns-1]
+                && IsFirstSameAsLast<Tableau, columns-1>::value;
+        };
+
+        template <typename Tableau>
+        struct IsFirstSameAsLast<Tableau, 0>
+        {
+            static constexpr bool value = (Tableau::c[Tableau::stages-1] == 1.0);
+        };
+
+        /** \brief Sum of the first columns of one row of the central matrix. */
+        template <typename Tableau, unsigned char row, unsigned char columns>
+        struct RowSum
+        {
+            static constexpr Scalar value = Tableau::a[row][columns-1]
+                + RowSum<Tableau, row, columns-1>::value;
+        };
+
+        template <typename Tableau, unsigned char row>
+        struct RowSum<Tableau, row, 0>
+        {
+            static constexpr Scalar value = 0.0;
+        };
+
+        /** \brief Check whether the rows of the central matrix sum up to the
+         * left vector, starting at the specified row. */
+        template <typename Tableau, unsigned char row = 0,
+            bool lastRowPassed = (row >= Tableau::stages)>
+        struct IsConsistent
+        {
+            static constexpr Scalar difference =
+                RowSum<Tableau, row, Tableau::stages>::value - Tableau::c[row];
+            static constexpr bool value = difference < 0.0001
+                && difference > -0.0001
+                && IsConsistent<Tableau, row+1>::value;
+        };
+
+        template <typename Tableau, unsigned char row>
+        struct IsConsistent<Tableau, row, true>
+        {
+            static constexpr bool value = true;
+        };
+    }
 
 }
 
@@ -0,0 +1,200 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#ifndef _DOMAINGROUP_HPP_
+#define _DOMAINGROUP_HPP_
+
+#include <QObject>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace SphereSim
+{
+    class ActionReceiver;
+    class TaskScheduler;
+
+    /** \brief Types of the messages between the domains of a simulation. */
+    namespace DomainMessages
+    {
+        /** \see DomainMessages */
+        enum Type
+        {
+            /** \brief Client request forwarded by the coordinator. */
+            request,
+            /** \brief Start of a run: halo width and the spheres of the
+             * receiving domain. */
+            runStart,
+            /** \brief Sent by every domain to every other one before each
+             * step: time step, migrating spheres and ghost spheres. */
+            exchange,
+            /** \brief Sent by every domain to every other one after each
+             * attempt of a step with adaptive time step: largest step error
+             * of its spheres. */
+            stepError,
+            /** \brief End of a run, sent by the coordinator instead of the
+             * next exchange. */
+            runEnd,
+            /** \brief Spheres of a domain, sent to the coordinator at the end
+             * of a run. */
+            gather,
+            /** \brief Radii and positions of the spheres of a domain, sent to
+             * the coordinator for frames. */
+            frameSpheres,
+            /** \brief The simulation was closed on the coordinator. */
+            closeSimulation
+        };
+    }
+
+    /** \brief Message between two domains of a simulation. */
+    struct DomainMessage
+    {
+        unsigned int simulationID;
+        /** \see DomainMessages */
+        unsigned char type;
+        /** \brief Index of the sending domain. */
+        unsigned char sender;
+        /** \brief Run of the simulation the message belongs to. */
+        unsigned int run;
+        /** \brief Step within the run the message belongs to. */
+        unsigned int step;
+        std::string data;
+    };
+
+    /** \brief Connection of a server process to the other processes sharing
+     * its simulations by spatial domain decomposition.
+     *
+     * Every process owns one domain and has one pulling socket bound to its
+     * address and one pushing socket per other domain, so the messages of
+     * each pair of domains arrive in order. Domain 0 is the coordinator: it
+     * is the only process serving clients and forwards their requests to the
+     * other domains. A thread receives all messages; messages of running
+     * simulations are kept in a mailbox until their simulation thread takes
+     * them, control messages for the simulations of the other domains are
+     * handled in the thread of the group. */
+    class DomainGroup : public QObject
+    {
+        Q_OBJECT
+
+    private:
+        /** \brief Index of the domain of this process. */
+        const unsigned int domainIndex;
+
+        /** \brief Number of domains (processes). */
+        const unsigned int domainCount;
+
+        /** \brief Socket receiving the messages of all other domains. */
+        int inbox;
+
+        /** \brief Sockets sending to the other domains, indexed by domain;
+         * -1 for this domain. */
+        std::vector<int> outboxes;
+
+        /** \brief Thread receiving the messages. */
+        std::thread receiveThread;
+
+        /** \brief Flag telling the receiving thread and waiting simulations
+         * to return. */
+        std::atomic<bool> stopping;
+
+        /** \brief Mutex locking the mailbox. */
+        std::mutex mailboxMutex;
+
+        /** \brief Condition signalling new messages in the mailbox. */
+        std::condition_variable mailboxCondition;
+
+        /** \brief Received messages not yet taken, in order of arrival. */
+        std::list<DomainMessage> mailbox;
+
+        /** \brief Thread pool of the simulations of a non-coordinator
+         * domain. */
+        TaskScheduler* taskScheduler;
+
+        /** \brief Simulations of a non-coordinator domain. */
+        typedef std::map<unsigned int, ActionReceiver*> ActionReceiverMap;
+        ActionReceiverMap actionReceivers;
+
+        /** \brief Receive messages until the group is stopped. */
+        void receiveMessages();
+
+    public:
+        /** \brief Bind to the address of this domain and connect to the
+         * other domains.
+         * \param addresses nanomsg addresses of all domains, indexed by
+         * domain.
+         * \param taskScheduler Thread pool for the simulations of this
+         * domain; not used by the coordinator. */
+        DomainGroup(unsigned int domainIndex,
+            const std::vector<std::string>& addresses, TaskScheduler* taskScheduler);
+
+        /** \brief Delete the simulations and close the sockets. */
+        ~DomainGroup();
+
+        DomainGroup() = delete;
+        DomainGroup(const DomainGroup&) = delete;
+        DomainGroup& operator=(const DomainGroup&) = delete;
+
+        unsigned int getDomainIndex() const
+        {
+            return domainIndex;
+        }
+
+        unsigned int getDomainCount() const
+        {
+            return domainCount;
+        }
+
+        /** \brief Send a message to another domain; may block until the
+         * domain is connected. */
+        void send(unsigned int domain, unsigned int simulationID,
+            unsigned char type, unsigned int run, unsigned int step,
+            const std::string& data);
+
+        /** \brief Send a message to all other domains. */
+        void sendToAll(unsigned int simulationID, unsigned char type,
+            unsigned int run, unsigned int step, const std::string& data);
+
+        /** \brief Take the oldest matching message from the mailbox, waiting
+         * for it if there is none.
+         * \param typeMask Bit mask of the accepted message types.
+         * \param run Run of the message; 0 accepts any run.
+         * \param timeout Time (in ms) to wait at most.
+         * \return Flag whether a message was taken. */
+        bool receive(unsigned int simulationID, unsigned int sender,
+            unsigned int typeMask, unsigned int run, DomainMessage& message,
+            int timeout);
+
+        /** \brief Take the newest matching message from the mailbox without
+         * waiting and drop the older ones.
+         * \return Flag whether there was a message. */
+        bool receiveLatest(unsigned int simulationID, unsigned int sender,
+            unsigned char type, std::string& data);
+
+        /** \brief Drop all messages of a simulation from the mailbox. */
+        void discard(unsigned int simulationID);
+
+    private slots:
+        /** \brief Handle a control message for a simulation of this domain. */
+        void processControlMessage(unsigned int simulationID, unsigned char type,
+            const std::string& data);
+
+    signals:
+        /** \brief A control message for a simulation of this domain arrived. */
+        void controlMessageReceived(unsigned int simulationID, unsigned char type,
+            const std::string& data);
+
+    };
+
+}
+
+#endif /*_DOMAINGROUP_HPP_*/
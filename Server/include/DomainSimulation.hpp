@@ -0,0 +1,227 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#ifndef _DOMAINSIMULATION_HPP_
+#define _DOMAINSIMULATION_HPP_
+
+#include "DomainGroup.hpp"
+#include "Sphere.hpp"
+
+#include <string>
+#include <vector>
+
+namespace SphereSim
+{
+    class ByteReader;
+    class ByteWriter;
+    class SphereCalculator;
+
+    /** \brief Part of a simulation split over the processes of a DomainGroup.
+     *
+     * The box is cut into slabs of equal width along the x axis, one per
+     * domain. Between runs, all spheres are kept by the coordinator; a run
+     * starts with the coordinator sending each domain the spheres in its
+     * slab. Before each step, every domain sends every other one its time
+     * step, the spheres that left its slab (migration) and copies of the
+     * spheres closer than the halo width to a neighbouring slab (ghosts).
+     * The ghosts are appended to the spheres of the receiving domain for the
+     * step, so the forces across the slab boundaries are calculated, and
+     * removed afterwards. Every force pass of a step carries the forces one
+     * interaction range further, so the halo is one interaction range plus
+     * the distance the spheres move within the step wide per force pass,
+     * derived anew every step; the outermost ghosts lack neighbours, but their
+     * forces do not reach the spheres of the domain within the step. Gravity
+     * reaches all spheres, so it cannot be simulated on several domains.
+     * All domains use the time step of the coordinator. With adaptive time
+     * step, the domains send each other the largest error of their own
+     * spheres after every attempt of a step, so all of them accept or reject
+     * it with the same error and adapt the time step alike. At the end of the
+     * run, the spheres are gathered by the coordinator.
+     * Every sphere is sent with its client index, so the coordinator puts the
+     * gathered spheres back into client order. */
+    class DomainSimulation
+    {
+    private:
+        /** \brief Group connecting the domains. */
+        DomainGroup* domainGroup;
+
+        /** \brief ID of the simulation, the same in all domains. */
+        const unsigned int simulationID;
+
+        /** \brief Calculator of the spheres of this domain. */
+        SphereCalculator* sphCalc;
+
+        const unsigned int domainIndex;
+
+        const unsigned int domainCount;
+
+        /** \brief Time (in ms) to wait for the other domains before giving up
+         * the run. */
+        const int timeout;
+
+        /** \brief Flag showing that the spheres are distributed. */
+        bool runActive;
+
+        /** \brief Number of the current run; starts at 1. */
+        unsigned int run;
+
+        /** \brief Number of the current step within the run. */
+        unsigned int step;
+
+        /** \brief Distance (in m) up to which spheres of different domains
+         * interact: contacts and 2.5 sigma of the Lennard-Jones potential,
+         * which is cut off beyond; fixed for a run. */
+        Scalar interactionRange;
+
+        /** \brief Largest distance (in m) along the x axis that a sphere of
+         * the other domains moves within a step, as sent with their last
+         * exchange. */
+        Scalar otherDomainsDisplacement;
+
+        /** \brief Flag showing that the domains were found narrower than the
+         * halo in the current run. */
+        bool haloWarningShown;
+
+        /** \brief Number of spheres owned by this domain; the following
+         * spheres are ghosts during a step. */
+        unsigned int ownedSphereCount;
+
+        /** \brief Flag showing that spheres left or entered the domain since
+         * the last frame. */
+        bool spheresReordered;
+
+        /** \brief Client index of each sphere owned by this domain; empty
+         * while the spheres of the coordinator are in client order. */
+        std::vector<unsigned int> clientIndices;
+
+        /** \brief Spheres migrating to each domain in the current step. */
+        std::vector<std::vector<Sphere>> migrants;
+        std::vector<std::vector<unsigned int>> migrantIndices;
+
+        /** \brief Ghost spheres sent to each domain in the current step. */
+        std::vector<std::vector<Sphere>> ghosts;
+        std::vector<std::vector<unsigned int>> ghostIndices;
+
+        /** \brief Spheres that migrated away, kept as ghosts for the step. */
+        std::vector<Sphere> emigrantGhosts;
+        std::vector<unsigned int> emigrantGhostIndices;
+
+        /** \brief Ghost spheres received from the other domains. */
+        std::vector<Sphere> receivedGhosts;
+        std::vector<unsigned int> receivedGhostIndices;
+
+        /** \brief Buffers for putting the gathered spheres into client order
+         * (only coordinator). */
+        std::vector<unsigned int> clientOrder;
+        std::vector<Sphere> orderedSpheres;
+
+        /** \brief Buffer for encoding messages. */
+        std::string sendBuffer;
+
+        /** \brief Buffer for received messages. */
+        DomainMessage message;
+
+        /** \brief Latest frame spheres of each domain (only coordinator). */
+        std::vector<std::string> frameSpheres;
+
+        /** \brief Domain owning a position. */
+        unsigned int getDomainOfPosition(const Vector3& pos) const;
+
+        /** \brief Largest distance (in m) along the x axis that one of the
+         * first spheres moves within a step. */
+        Scalar getMaximumDisplacement(unsigned int sphereCount) const;
+
+        /** \brief Distribute the spheres to the domains (only coordinator). */
+        void beginRun();
+
+        /** \brief Take the spheres of a run started by the coordinator.
+         * \return Flag whether a run was started. */
+        bool takeRun();
+
+        /** \brief Stop the simulation and give the spheres back to the
+         * coordinator (all but the coordinator). */
+        void endRun();
+
+        /** \brief Stop the run after another domain did not respond. */
+        void abortRun(unsigned int domain);
+
+        /** \brief Undo the exchange of a step that cannot be calculated: drop
+         * the received spheres and take back the migrated ones.
+         * \param keptSphereCount Number of spheres that stayed in the domain. */
+        void restoreSpheres(unsigned int keptSphereCount);
+
+        /** \brief Put the gathered spheres back into client order (only
+         * coordinator). */
+        void restoreClientOrder();
+
+        static void writeSpheres(ByteWriter& writer, const Sphere* spheres,
+            const unsigned int* sphereClientIndices, unsigned int count);
+
+        /** \brief Append the spheres of a message and their client indices.
+         * \return Flag whether the message was complete. */
+        static bool readSpheres(ByteReader& reader, std::vector<Sphere>& spheres,
+            std::vector<unsigned int>& sphereClientIndices);
+
+    public:
+        /** \brief Share a simulation with the other domains of the group. */
+        DomainSimulation(DomainGroup* domainGroup, unsigned int simulationID,
+            SphereCalculator* sphCalc);
+
+        /** \brief Finish the run and close the simulation in the other
+         * domains. */
+        ~DomainSimulation();
+
+        DomainSimulation() = delete;
+        DomainSimulation(const DomainSimulation&) = delete;
+        DomainSimulation& operator=(const DomainSimulation&) = delete;
+
+        /** \brief Flag whether this domain serves the client. */
+        bool isCoordinator() const
+        {
+            return (domainIndex == 0);
+        }
+
+        /** \brief Client index of each sphere owned by this domain, so the
+         * indices can be moved along when the spheres are reordered. */
+        std::vector<unsigned int>& getClientIndices();
+
+        /** \brief Exchange the migrating and ghost spheres with the other
+         * domains before a step; starts a run if needed.
+         * \return Flag whether the step can be calculated. */
+        bool beginStep();
+
+        /** \brief Exchange the step error with the other domains after an
+         * attempt of a step with adaptive time step.
+         * \param sphereStepErrors Step error of each sphere, relative to
+         * the maximum step error; the errors of the ghost spheres are left
+         * to the domains owning them.
+         * \return Largest step error of the spheres of all domains. */
+        Scalar agreeStepError(const std::vector<Scalar>& sphereStepErrors);
+
+        /** \brief Remove the ghost spheres after a step. */
+        void finishStep();
+
+        /** \brief Gather the spheres of all domains (only coordinator). */
+        void finishRun();
+
+        /** \brief Send the radii and positions of the spheres of this domain
+         * to the coordinator, which sends them to the client in its frames
+         * (all but the coordinator). */
+        void sendFrameSpheres();
+
+        /** \brief Append the spheres of the other domains to a frame (only
+         * coordinator).
+         * \return Flag whether the order of the spheres changed. */
+        bool appendFrameSpheres(std::vector<Scalar>& radii,
+            std::vector<Vector3>& positions);
+
+    };
+
+}
+
+#endif /*_DOMAINSIMULATION_HPP_*/
@@ -0,0 +1,140 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#ifndef _FRAMESERIALIZER_HPP_
+#define _FRAMESERIALIZER_HPP_
+
+#include "Vector.hpp"
+#include "FrameCodec.hpp"
+#include "MessageTransmitter.hpp"
+
+#include <QObject>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SphereSim
+{
+
+    /** \brief Sphere data of one frame, copied from the simulation. */
+    class FrameSnapshot
+    {
+    public:
+        /** \brief Number of the frame. */
+        unsigned int frameCounter;
+
+        /** \brief Size of the box the positions are quantized in. */
+        Vector3 boxSize;
+
+        /** \brief Flag showing that other spheres are sent than in the
+         * previous frame. */
+        bool selectionChanged;
+
+        /** \brief Sphere radii. */
+        std::vector<Scalar> radii;
+
+        /** \brief Sphere positions. */
+        std::vector<Vector3> positions;
+
+        /** \brief Initialize FrameSnapshot. */
+        FrameSnapshot()
+            :frameCounter(0), boxSize(), selectionChanged(false), radii(),
+            positions()
+        {
+        }
+
+    };
+
+    /** \brief Serializer of frames on its own thread.
+     *
+     * The simulation worker fills one snapshot and publishes it by swapping
+     * pointers with the pending snapshot; the serializer thread swaps the
+     * pending snapshot with its own and encodes and sends it while the next
+     * steps are calculated. Frames are encoded directly into the nanomsg
+     * buffer of the message behind the space of the reply header, which the
+     * server network layer fills in before sending. If the serializer is slower than the simulation,
+     * older pending frames are replaced by newer ones; a change of the sent
+     * spheres in a replaced frame still makes the next frame a keyframe. */
+    class FrameSerializer : public QObject
+    {
+        Q_OBJECT
+
+    private:
+        /** \brief Snapshot filled by the simulation worker. */
+        FrameSnapshot* writingSnapshot;
+
+        /** \brief Published snapshot waiting for the serializer; protected by
+         * the mutex. */
+        FrameSnapshot* pendingSnapshot;
+
+        /** \brief Snapshot being serialized. */
+        FrameSnapshot* serializingSnapshot;
+
+        /** \brief Flag showing that pendingSnapshot holds a new frame; protected
+         * by the mutex. */
+        bool snapshotPending;
+
+        /** \brief Flag showing that a published snapshot changed the sent
+         * spheres since the last serialized one; kept when the snapshot is
+         * replaced by a newer one. Protected by the mutex. */
+        bool keyframePending;
+
+        /** \brief Flag telling the serializer thread to exit; protected by the
+         * mutex. */
+        bool stopping;
+
+        /** \brief Mutex protecting the pending snapshot. */
+        std::mutex mutex;
+
+        /** \brief Condition waking the serializer thread. */
+        std::condition_variable snapshotCondition;
+
+        /** \brief Encoder keeping the frame state sent to the client. */
+        FrameEncoder frameEncoder;
+
+        /** \brief Serializer thread. */
+        std::thread thread;
+
+        /** \brief Serialize published snapshots until stopped. */
+        void serializeLoop();
+
+        /** \brief Encode and send one snapshot.
+         * \param keyframe Flag whether the frame has to be a keyframe. */
+        void serialize(const FrameSnapshot& snapshot, bool keyframe);
+
+    public:
+        /** \brief Start the serializer thread. */
+        FrameSerializer();
+
+        /** \brief Stop the serializer thread. */
+        ~FrameSerializer();
+
+        FrameSerializer(const FrameSerializer&) = delete;
+        FrameSerializer& operator=(const FrameSerializer&) = delete;
+
+        /** \brief Snapshot to be filled by the simulation worker before calling
+         * publishSnapshot. */
+        FrameSnapshot& getSnapshot()
+        {
+            return *writingSnapshot;
+        }
+
+        /** \brief Hand the filled snapshot over to the serializer thread. */
+        void publishSnapshot();
+
+    signals:
+        /** \brief Send a frame message to the client; the frame data starts
+         * after ServerStatusReplies::headerSize bytes. */
+        void frameToSend(MessageBuffer message);
+
+    };
+
+}
+
+#endif /*_FRAMESERIALIZER_HPP_*/
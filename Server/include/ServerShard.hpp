@@ -0,0 +1,124 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#ifndef _SERVERSHARD_HPP_
+#define _SERVERSHARD_HPP_
+
+#include "MessageTransmitter.hpp"
+
+#include <QObject>
+#include <QTimer>
+#include <map>
+#include <nanomsg/nn.hpp>
+#include <string>
+
+namespace SphereSim
+{
+    class ActionReceiver;
+    class DomainGroup;
+    class TaskScheduler;
+
+    /** \brief Part of the server network layer, handling the requests and
+     * replies of the simulations pinned to it in its own thread.
+     *
+     * Each shard has its own socket pair, connected to the devices of the
+     * ActionServer: its receiving socket subscribes only to the requests of
+     * its simulations, its sending socket publishes their control replies and
+     * its frame socket their frames.
+     * The ActionReceivers of the simulations live in the shard thread. */
+    class ServerShard : public QObject
+    {
+        Q_OBJECT
+
+    private:
+        /** \brief Index of this shard. */
+        const unsigned int shardIndex;
+
+        /** \brief Number of shards of the server. */
+        const unsigned int shardCount;
+
+        /** \brief ID of the server, sent with every reply. */
+        const unsigned int serverID;
+
+        /** \brief Address the ActionServer forwards requests from. */
+        const std::string requestAddress;
+
+        /** \brief Address the ActionServer forwards replies to. */
+        const std::string replyAddress;
+
+        /** \brief Address the ActionServer forwards frames to. */
+        const std::string frameAddress;
+
+        nn::socket sendSocket;
+        nn::socket recvSocket;
+
+        /** \brief Socket publishing the frames, apart from the replies. */
+        nn::socket frameSocket;
+
+        /** \brief Created in the shard thread by start(). */
+        MessageTransmitter* messageTransmitter;
+
+        typedef std::map<unsigned int, ActionReceiver*> ActionReceiverMap;
+        ActionReceiverMap actionReceivers;
+
+        /** \brief Thread pool shared by the simulations of all clients. */
+        TaskScheduler* taskScheduler;
+
+        /** \brief Group the simulations are distributed over; nullptr if they
+         * are not distributed. */
+        DomainGroup* domainGroup;
+
+        /** \brief Created in the shard thread by start(). */
+        QTimer* disconnectionTimer;
+
+    public:
+        /** \brief Create a shard; start() has to be called in its thread.
+         * \param requestAddress Address of the device forwarding requests.
+         * \param replyAddress Address of the device forwarding replies.
+         * \param frameAddress Address of the device forwarding frames. */
+        ServerShard(unsigned int shardIndex, unsigned int shardCount,
+            unsigned int serverID, const std::string& requestAddress,
+            const std::string& replyAddress, const std::string& frameAddress,
+            TaskScheduler* taskScheduler, DomainGroup* domainGroup);
+
+        /** \brief Clean up member variables; stop() has to be called before. */
+        ~ServerShard();
+
+        ServerShard() = delete;
+        ServerShard(const ServerShard&) = delete;
+        ServerShard& operator=(const ServerShard&) = delete;
+
+        /** \brief Index of the shard a simulation is pinned to, derived from
+         * the first byte of its ID as sent in messages. */
+        static unsigned int getShardIndex(unsigned int simulationID,
+            unsigned int shardCount);
+
+    public slots:
+        /** \brief Connect the sockets and start receiving requests. */
+        void start();
+
+        /** \brief Disconnect all simulations and stop receiving requests. */
+        void stop();
+
+        /** \brief Send a message, writing the reply header into its first
+         * ServerStatusReplies::headerSize bytes. */
+        void sendMessage(unsigned int simulationID, unsigned short serverStatus,
+            MessageBuffer message);
+
+        void receiveRequest(const char* request, size_t size);
+
+        void disconnectionCheck();
+
+    signals:
+        void terminateServer();
+
+    };
+
+}
+
+#endif /*_SERVERSHARD_HPP_*/
@@ -9,9 +9,13 @@
 #ifndef _SIMULATIONWORKER_HPP_
 #define _SIMULATIONWORKER_HPP_
 
+#include "MessageTransmitter.hpp"
+
 #include <QObject>
 #include <string>
 
+class QElapsedTimer;
+
 namespace SphereSim
 {
 
@@ -40,6 +44,27 @@ namespace SphereSim
 
         bool hasFinished;
 
+        /** \brief Number of steps calculated without looking at the queue. */
+        unsigned int stepBatchSize;
+
+        /** \brief Aimed time (in ns) for one batch of steps; bounds the delay
+         * of control requests. */
+        const long long targetBatchTime;
+
+        /** \brief Timer measuring the batches. */
+        QElapsedTimer* batchTimer;
+
+        /** \brief Buffer reused for encoding the replies. */
+        std::string replyData;
+
+        /** \brief Send a reply, copied once into the message handed to the
+         * server thread. */
+        void reply(unsigned short serverStatus, const std::string& data);
+
+        /** \brief Calculate a batch of steps and adapt the batch size to the
+         * measured step time. */
+        void calculateStepBatch();
+
         /** \brief Handle any action request and forward to specific handlers.
          * \param actionGroup Action group that will be handled.
          * \param action Action that will be handled.
@@ -79,6 +104,9 @@ namespace SphereSim
         SimulationWorker(SphereCalculator* sphCalc, WorkQueue* queue,
             ActionReceiver* actRcv);
 
+        /** \brief Clean up member variables. */
+        ~SimulationWorker();
+
         SimulationWorker() = delete;
         SimulationWorker(const SimulationWorker&) = delete;
         SimulationWorker& operator=(const SimulationWorker&) = delete;
@@ -96,7 +124,9 @@ namespace SphereSim
         /** \brief Worker stopped working. */
         void finished();
 
-        void sendReply(unsigned short serverStatus, std::string data);
+        /** \brief Reply to be sent to the client.
+         * \see ActionReceiver::createReply */
+        void sendReply(unsigned short serverStatus, MessageBuffer message);
 
     };
 
@@ -14,10 +14,13 @@
 #include "ButcherTableau.hpp"
 #include "SimulatedSystem.hpp"
 #include "TwoDimArray.hpp"
+#include "TaskScheduler.hpp"
+#include "MessageTransmitter.hpp"
 
 #include <QMutex>
 #include <QObject>
 #include <string>
+#include <type_traits>
 
 class QTimer;
 class QElapsedTimer;
@@ -27,7 +30,11 @@ namespace SphereSim
 
     class SimulationWorker;
     class WorkQueue;
+    class FrameSerializer;
     class ActionReceiver;
+    class DomainGroup;
+    class DomainSimulation;
+    class SphereSorting;
 
     /** \brief Calculator of sphere movements.
      */
@@ -39,11 +46,102 @@ namespace SphereSim
         /** \brief Spheres managed by the server. */
         std::vector<Sphere> spheres;
 
-        /** \brief New calculated positions of the spheres. */
-        std::vector<Vector3> newSpherePos;
+        /** \brief Positions of all spheres in the current integrator stage. */
+        std::vector<Vector3> stagePositions;
 
-        /** \brief Butcher tableau used in the integrator. */
-        ButcherTableau butcherTableau;
+        /** \brief Positions of all spheres in the next integrator stage. */
+        std::vector<Vector3> nextStagePositions;
+
+        /** \brief Speeds of all spheres in all integrator stages (stage-major). */
+        std::vector<Vector3> stageSpeeds;
+
+        /** \brief Accelerations of all spheres in all integrator stages
+         * (stage-major). */
+        std::vector<Vector3> stageAccelerations;
+
+        /** \brief Relative lengths of the velocity Verlet substeps of a symplectic
+         * integrator; empty if a Runge-Kutta method is used. */
+        std::vector<Scalar> symplecticStepWeights;
+
+        /** \brief Earliest and latest time, relative to the time step, at
+         * which the integrator evaluates positions within a step; the cell
+         * lists cover the spheres over this window. */
+        Scalar cellListWindowBegin;
+        Scalar cellListWindowEnd;
+
+        /** \brief Flag whether the sphere accelerations belong to the current
+         * positions and can be reused as the first force evaluation of the
+         * next step of the same method. Only first-same-as-last tableaux on a
+         * single time step level and the symplectic methods set it; the other
+         * tableaux store a finite difference of the speeds in Sphere::acc. */
+        bool accelerationsValid;
+
+        /** \brief Time step level of each sphere; a sphere of level L is
+         * integrated with steps of timeStep/2^L. */
+        std::vector<unsigned char> sphereStepLevels;
+
+        /** \brief Time (in s) within the current step at which each sphere was
+         * last updated. */
+        std::vector<Scalar> sphereUpdateTimes;
+
+        /** \brief Largest error of each sphere in the current step, relative to
+         * maximumStepError. */
+        std::vector<Scalar> sphereStepErrors;
+
+        /** \brief Flag per sphere whether its error of the current step is
+         * accepted; only the other spheres are integrated again when the
+         * step is repeated with finer levels. */
+        std::vector<unsigned char> sphereStepsFinished;
+
+        /** \brief Number of unfinished spheres per time step level. */
+        std::vector<unsigned int> sphereCountPerStepLevel;
+
+        /** \brief Back buffer of the Runge-Kutta step: spheres at the end of
+         * their last level step. The spheres keep the state at the beginning
+         * of the step, so a repeated step needs no saved copy; the buffers are
+         * swapped at the end of the step. */
+        std::vector<Sphere> newSpheres;
+
+        /** \brief Highest possible time step level. */
+        const unsigned char maxStepLevel;
+
+        /** \brief A sphere moves to the next coarser time step level if its
+         * error, scaled to the doubled step length by the error order of the
+         * method, stays below this fraction of maximumStepError; keeps the
+         * levels from oscillating at the bound. */
+        const Scalar levelDecreaseSafetyFactor;
+
+        /** \brief Short range accelerations of the RESPA integrator. */
+        std::vector<Vector3> shortRangeAccelerations;
+
+        /** \brief Long range accelerations of the RESPA integrator. */
+        std::vector<Vector3> longRangeAccelerations;
+
+        /** \brief Distance (in Lennard-Jones sigma) up to which the Lennard-Jones
+         * potential is a short range force. */
+        const Scalar respaInnerRadius;
+
+        /** \brief Largest number of conjugate gradient iterations solving the
+         * implicit contact equations of the IMEX integrator. A chain of n stiff
+         * contacts needs about n iterations; a fixed number of Jacobi sweeps
+         * would leave most of the stiffness of such a cluster explicit. */
+        const unsigned short maximumImplicitContactIterations;
+
+        /** \brief Residual of the implicit contact equations, relative to their
+         * right side, at which the iterations stop. */
+        const Scalar implicitContactTolerance;
+
+        /** \brief Largest relative error of the last accepted step, used by the
+         * adaptive time step control. */
+        Scalar lastStepError;
+
+        /** \brief Flag whether the last step was rejected by the adaptive time
+         * step control. */
+        bool lastStepRejected;
+
+        /** \brief Flag whether the adaptive time step changed since it was last
+         * sent to the client. */
+        bool adaptedTimeStepUnsent;
 
         /** \brief Number of calculation steps needed for simulation. */
         unsigned int calculationCounter;
@@ -69,6 +167,40 @@ namespace SphereSim
         /** \brief Worker used for simulation. */
         SimulationWorker* simulationWorker;
 
+        /** \brief Serializer sending the frames from its own thread. */
+        FrameSerializer* frameSerializer;
+
+        /** \brief Part of the simulation shared with the other processes of a
+         * domain group; nullptr if the simulation is not distributed. */
+        DomainSimulation* domainSimulation;
+
+        /** \brief Sorting of the spheres along the box for locality, used
+         * while spatialSorting is set. */
+        SphereSorting* sphereSorting;
+
+        /** \brief Client indices of the spheres sent in frames. */
+        std::vector<unsigned int> frameSphereIndices;
+
+        /** \brief Flag showing that all spheres are sent in frames. */
+        bool frameSendsAllSpheres;
+
+        /** \brief Number of frames after which the sent spheres are chosen
+         * again. */
+        const unsigned int frameSelectionInterval;
+
+        /** \brief Frames sent since the sent spheres were chosen. */
+        unsigned int framesSinceFrameSelection;
+
+        /** \brief Settings of the last choice of sent spheres. */
+        unsigned int frameSelectionSphereCount;
+        unsigned int frameSelectionMaximumSphereCount;
+        Scalar frameSelectionMinimumRadius;
+
+        /** \brief Buffers for choosing the sent spheres. */
+        std::vector<unsigned int> frameCandidateIndices;
+        std::vector<unsigned int> frameCandidateRanks;
+        std::vector<unsigned int> frameCellSphereCounts;
+
         Vector3 sphereBoxSize;
 
         Vector3 sphereBoxPosition;
@@ -129,6 +261,56 @@ namespace SphereSim
 
         QElapsedTimer* elapsedTimer;
 
+        /** \brief Timer used to measure the single phases of a step. */
+        QElapsedTimer* phaseTimer;
+
+        /** \brief Share in the process-wide scheduler running the force and
+         * update passes of the integrators. */
+        TaskAccount* taskAccount;
+
+        /** \brief Measured cost of passes calculating sphere forces. */
+        LoopCost forcePassCost;
+
+        /** \brief Measured cost of passes only updating sphere states. */
+        LoopCost updatePassCost;
+
+        /** \brief Measured cost of the passes sorting the spheres into the
+         * cell lists, the gravity cell lists and of sorting the cells. */
+        LoopCost cellListPassCost;
+        LoopCost gravityCellListPassCost;
+        LoopCost cellSortPassCost;
+
+        /** \brief Measured cost of the passes summing up the gravity cells. */
+        LoopCost gravityCellDataPassCost;
+
+        /** \brief Measured cost of the pass over the blocks of the sphere box. */
+        LoopCost sphereBoxPassCost;
+
+        /** \brief Number of blocks of spheres getting their own bounding box,
+         * a few per pool thread; the boxes are merged afterwards. */
+        const unsigned int sphereBoxBlockCount;
+
+        /** \brief Lower and upper corner of the bounding box of each block. */
+        std::vector<Vector3> sphereBoxBlockMinima;
+        std::vector<Vector3> sphereBoxBlockMaxima;
+
+        /** \brief Measured cost of the passes of the implicit contact
+         * iterations over the blocks of spheres. */
+        LoopCost implicitContactPassCost;
+
+        /** \brief Inverse of the mass plus contact stiffness matrix of each
+         * sphere, as upper triangle (xx, xy, xz, yy, yz, zz); preconditioner
+         * of the implicit contact iterations. */
+        std::vector<Scalar> implicitContactInverseMatrices;
+
+        /** \brief Partial dot products of the implicit contact iterations, one
+         * per block of spheres as for the sphere box. */
+        std::vector<Scalar> implicitContactBlockSums;
+
+        /** \brief Accumulated time (in ns) spent in each step phase.
+         * \see CalculationPhases */
+        unsigned long long phaseCalculationTimes[CalculationPhases::numberOfPhases];
+
         const unsigned int &sphereCount;
         const Scalar &timeStep;
         const unsigned int &integratorMethod;
@@ -150,21 +332,42 @@ namespace SphereSim
         const Scalar &kBoltzmann;
         const Scalar &lenJonPotEpsilon;
         const Scalar &lenJonPotSigma;
+        const unsigned int &respaStepRatio;
+        const bool &adaptiveTimeStep;
+        const unsigned int &rejectedStepCount;
+        const unsigned int &simulationWeight;
+        const unsigned int &simulationPriority;
+        const unsigned int &maximumFrameSphereCount;
+        const Scalar &minimumFrameSphereRadius;
+        const bool &spatialSorting;
 
         Scalar sphereSphereE;
         Scalar sphereWallE;
 
         bool isSimulationThreadDestroyed;
 
+        /** \brief Parts of the forces used by the RESPA integrator. */
+        enum ForceRange
+        {
+            /** \brief All forces. */
+            allForces,
+            /** \brief Earth gravity, walls, collisions and the Lennard-Jones
+             * potential closer than respaInnerRadius. */
+            shortRangeForces,
+            /** \brief Sphere gravity and the remaining Lennard-Jones potential. */
+            longRangeForces
+        };
+
         /** \brief Calculate the current sphere acceleration.
+         * \tparam forceRange Part of the forces to calculate.
          * \param sphereIndex Index of the sphere to be calculated.
-         * \param sphere Sphere to be calculated.
-         * \param timeDiff Time difference (in s) for movements of other spheres.
+         * \param spherePos Position of the sphere to be calculated; the other
+         * spheres are taken from stagePositions.
          * \return Calculated current acceleration of the sphere. */
         template <bool detectCollisions, bool gravity, bool lennardJonesPotential,
-            bool periodicBoundaries>
-        Vector3 sphereAcceleration(unsigned short sphereIndex, Sphere sphere,
-            Scalar timeDiff);
+            bool periodicBoundaries, ForceRange forceRange = allForces>
+        Vector3 sphereAcceleration(unsigned short sphereIndex,
+            const Vector3& spherePos);
 
         /** \brief Integrate one step using specified Runge Kutta method. */
         void integrateRungeKuttaStep();
@@ -174,15 +377,113 @@ namespace SphereSim
             bool periodicBoundaries>
         void integrateRungeKuttaStep_internal();
 
-        /** \brief Integrates one step of one sphere.
-         * \param sphereIndex Index of the sphere to be integrated.
-         * \param stepLength Current step length (time in s).
-         * \param timeDiff Time difference (in s) for movements of other spheres.
-         * \return Number of steps used to integrate. */
+        /** \brief Integrates one step of all spheres with block time steps:
+         * each sphere is integrated with the step length of its level and the
+         * step is repeated if a sphere needs a finer level.
+         * \tparam Tableau Butcher tableau type of the Runge-Kutta method. */
+        template <typename Tableau, bool detectCollisions, bool gravity,
+            bool lennardJonesPotential, bool periodicBoundaries>
+        void integrateRungeKuttaStep_internal();
+
+        /** \brief Integrates one step of all spheres of one time step level.
+         * \param level Time step level of the spheres to integrate.
+         * \param tickTime Time (in s) within the current step of the
+         * beginning of the level step.
+         * \param reuseAccelerations Flag whether the sphere accelerations belong
+         * to the current positions and are used as the first stage. */
+        template <typename Tableau, bool detectCollisions, bool gravity,
+            bool lennardJonesPotential, bool periodicBoundaries>
+        void integrateRungeKuttaLevel_internal(unsigned char level,
+            Scalar tickTime, bool reuseAccelerations);
+
+        /** \brief Calculates the accelerations of one stage and predicts the
+         * positions and speeds of the next one; recurses up to the last stage.
+         * \copydetails integrateRungeKuttaLevel_internal
+         * \param stepLength Step length (time in s) of the level. */
+        template <typename Tableau, unsigned char stage, bool detectCollisions,
+            bool gravity, bool lennardJonesPotential, bool periodicBoundaries>
+        void integrateRungeKuttaStage_internal(unsigned char level, Scalar tickTime,
+            Scalar stepLength, bool reuseAccelerations, std::true_type);
+
+        /** \brief End of the stage recursion. */
+        template <typename Tableau, unsigned char stage, bool detectCollisions,
+            bool gravity, bool lennardJonesPotential, bool periodicBoundaries>
+        void integrateRungeKuttaStage_internal(unsigned char level, Scalar tickTime,
+            Scalar stepLength, bool reuseAccelerations, std::false_type);
+
+        /** \brief Predict the position of a sphere from its last update.
+         * \param sphereIndex Index of the sphere to predict.
+         * \param time Time (in s) within the current step.
+         * \return Predicted position (second order Taylor expansion), or
+         * the position interpolated within the step if the sphere is already
+         * past the time. */
+        Vector3 predictSpherePosition(unsigned int sphereIndex, Scalar time) const;
+
+        /** \brief State of a sphere after its last level step within the
+         * current Runge-Kutta step. */
+        const Sphere& getCurrentSphere(unsigned int sphereIndex) const
+        {
+            return (sphereUpdateTimes[sphereIndex] > 0 ? newSpheres[sphereIndex]
+                : spheres[sphereIndex]);
+        }
+
+        /** \brief Integrates one step of all spheres with the symplectic
+         * integrator described by symplecticStepWeights. */
+        template <bool detectCollisions, bool gravity, bool lennardJonesPotential,
+            bool periodicBoundaries>
+        void integrateSymplecticStep_internal();
+
+        /** \brief Integrates one step of all spheres with the RESPA integrator. */
+        template <bool detectCollisions, bool gravity, bool lennardJonesPotential,
+            bool periodicBoundaries>
+        void integrateRespaStep_internal();
+
+        /** \brief Integrates one step of all spheres with the IMEX integrator;
+         * contact forces are linearized and treated implicitly. */
         template <bool detectCollisions, bool gravity, bool lennardJonesPotential,
             bool periodicBoundaries>
-        unsigned int integrateRungeKuttaStep_internal(unsigned short sphereIndex,
-            Scalar stepLength, Scalar timeDiff, unsigned short stepDivisionCounter);
+        void integrateImexStep_internal();
+
+        /** \brief Build the linearized implicit contact equation of one sphere.
+         * \param sphereIndex Index of the sphere; its colliding spheres have to
+         * be listed by sphereAcceleration before.
+         * \param stepLength Step length (time in s).
+         * \param speeds Vectors of all spheres the coupling is calculated for,
+         * e.g. speeds or search directions of the iterations.
+         * \param matrix Upper triangle (xx, xy, xz, yy, yz, zz) of the sphere
+         * mass plus stepLength^2 times the contact stiffness.
+         * \param coupling stepLength^2 times the stiffness times the vectors of
+         * the colliding spheres. */
+        template <bool detectCollisions>
+        void contactStiffness(unsigned short sphereIndex, Scalar stepLength,
+            const Vector3* speeds, Scalar* matrix, Vector3& coupling);
+
+        /** \brief Adapt the time step to the error of the last step using a PI
+         * controller.
+         * \param stepError Largest error of the step, relative to
+         * maximumStepError.
+         * \param errorOrder Order of the error estimate plus one.
+         * \return Flag whether the step is accepted. */
+        bool updateAdaptiveTimeStep(Scalar stepError, unsigned char errorOrder);
+
+        /** \brief Wrap a position back into the box (periodic boundaries). */
+        void wrapPosition(Vector3& pos);
+
+        /** \brief Adapt the per-sphere arrays to a changed set of spheres.
+         * \param spheresReordered Flag whether sphere indices changed, so the
+         * per-sphere states are reset. */
+        void updateSphereArrays(bool spheresReordered);
+
+        /** \brief Number of force passes of a step that depend on each
+         * other, including the one at its beginning. */
+        unsigned int getForcePassCount() const;
+
+        /** \brief Gather the spheres of a distributed simulation. */
+        void finishDistributedRun();
+
+        /** \brief Send the adaptive time step to the client if it changed; called
+         * once per frame and at the end of the requested steps. */
+        void sendAdaptedTimeStep();
 
         /** \brief Remove a specific sphere.
          * \param i Index of the sphere to remove.
@@ -192,6 +493,9 @@ namespace SphereSim
         /** \brief Prepare sphere data for a frame. */
         void prepareFrameData();
 
+        /** \brief Add the time since the last phase to the specified phase. */
+        void finishPhase(CalculationPhases::Phase phase);
+
         void updateSphereBox();
 
         void updateSphereCellLists();
@@ -221,6 +525,12 @@ namespace SphereSim
 
         void updateSphereWallE();
 
+        /** \brief Choose the spheres sent in frames: all spheres with at least
+         * minimumFrameSphereRadius, thinned out evenly over the box to at most
+         * maximumFrameSphereCount.
+         * \return Flag whether the choice changed. */
+        bool updateFrameSelection();
+
         unsigned short getAndUpdateSphereCount();
 
         void startUp();
@@ -228,7 +538,12 @@ namespace SphereSim
         void tearDown();
 
     public:
-        SphereCalculator(ActionReceiver* actRcv, SimulatedSystem* simulatedSystem);
+        /** \param domainGroup Group the simulation is distributed over;
+         * nullptr if it is not distributed.
+         * \param simulationID ID of the simulation in the domain group. */
+        SphereCalculator(ActionReceiver* actRcv, SimulatedSystem* simulatedSystem,
+            TaskScheduler* taskScheduler, DomainGroup* domainGroup,
+            unsigned int simulationID);
         ~SphereCalculator();
 
         SphereCalculator() = delete;
@@ -238,6 +553,8 @@ namespace SphereSim
         WorkQueue* getWorkQueue();
 
         friend class SimulationWorker;
+        friend class DomainSimulation;
+        friend class SphereSorting;
 
     signals:
         /** \brief Stop the running simulation. */
@@ -246,8 +563,9 @@ namespace SphereSim
         /** \brief Stop and delete the worker. */
         void requestingWorkerStop();
 
-        /** \brief Send frame to client. */
-        void frameToSend(std::string frameData);
+        /** \brief Send frame to client.
+         * \see FrameSerializer::frameToSend */
+        void frameToSend(MessageBuffer message);
 
     public slots:
         /** \copydoc SpheresUpdatingActions::addSphere
@@ -313,6 +631,10 @@ namespace SphereSim
         /** \copydoc CalculationActions::getLastStepCalculationTime */
         unsigned int getLastStepCalculationTime();
 
+        /** \copydoc CalculationActions::popPhaseCalculationTimes
+         * \return Requested phase times (in us), indexed by CalculationPhases. */
+        std::vector<unsigned int> popPhaseCalculationTimes();
+
         /** \copydoc InformationActions::getTotalEnergy
          * \return Requested total energy. */
         Scalar getTotalEnergy();
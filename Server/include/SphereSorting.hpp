@@ -0,0 +1,117 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#ifndef _SPHERESORTING_HPP_
+#define _SPHERESORTING_HPP_
+
+#include "Sphere.hpp"
+#include "TaskScheduler.hpp"
+
+#include <vector>
+
+namespace SphereSim
+{
+    class SphereCalculator;
+
+    /** \brief Sorting of the spheres of a simulation along the box for
+     * locality; not a decomposition of the box between the threads.
+     *
+     * Before each step, the spheres are sorted along the longest axis of the
+     * box, so neighbouring sphere indices belong to neighbouring spheres. The
+     * parallel loops hand out contiguous chunks of indices, so a thread
+     * mostly works on one region of the box and the per-sphere arrays it
+     * uses tend to stay in its caches. This only improves locality: the
+     * slabs are not owned by threads, as idle threads steal chunks of other
+     * threads, and spheres of other slabs are read where they are. Only
+     * spheres that moved into another bin change their place.
+     *
+     * Clients keep their sphere indices: the order given by the clients is
+     * remembered and restored before spheres are added or removed. */
+    class SphereSorting
+    {
+    private:
+        /** \brief Calculator of the sorted spheres. */
+        SphereCalculator* sphCalc;
+
+        /** \brief Account running the loops moving the spheres. */
+        TaskAccount* taskAccount;
+
+        /** \brief Number of slabs, as many as pool threads. */
+        const unsigned int slabCount;
+
+        /** \brief Number of bins per slab the spheres are sorted into; the
+         * slabs are cut between the bins by sphere count. */
+        const unsigned int binsPerSlab;
+
+        /** \brief Flag whether the client order of the spheres is kept; the
+         * DomainSimulation keeps the client indices of distributed spheres. */
+        const bool keepClientOrder;
+
+        /** \brief Client index of each sphere; empty while the spheres are in
+         * client order. */
+        std::vector<unsigned int> clientIndices;
+
+        /** \brief Index of the sphere of each client index; empty while the
+         * spheres are in client order. */
+        std::vector<unsigned int> sphereIndices;
+
+        /** \brief Bin of each sphere in the current sort. */
+        std::vector<unsigned int> binOfSpheres;
+
+        /** \brief First sorted index of each bin. */
+        std::vector<unsigned int> binOffsets;
+
+        /** \brief Previous index of the sphere moved to each index. */
+        std::vector<unsigned int> sourceIndices;
+
+        /** \brief Buffers the per-sphere arrays are moved into. */
+        std::vector<Sphere> movedSpheres;
+        std::vector<unsigned char> movedStepLevels;
+        std::vector<Vector3> movedShortRangeAccelerations;
+        std::vector<Vector3> movedLongRangeAccelerations;
+        std::vector<unsigned int> movedClientIndices;
+        std::vector<unsigned int> movedDomainClientIndices;
+
+        LoopCost binPassCost;
+        LoopCost movePassCost;
+
+        /** \brief Move the sphere at sourceIndices[i] to index i in all
+         * per-sphere arrays that outlive a step. */
+        void moveSpheres();
+
+    public:
+        /** \param slabCount Number of pool threads. */
+        SphereSorting(SphereCalculator* sphCalc, TaskAccount* taskAccount,
+            unsigned int slabCount, bool keepClientOrder);
+
+        SphereSorting() = delete;
+        SphereSorting(const SphereSorting&) = delete;
+        SphereSorting& operator=(const SphereSorting&) = delete;
+
+        /** \brief Sort the spheres into the slabs; only spheres that moved
+         * into another bin change their place.
+         * \return Flag whether the order of the spheres changed. */
+        bool sortSpheres();
+
+        /** \brief Move the spheres back into client order. */
+        void restoreClientOrder();
+
+        /** \brief Take the current order of the spheres as client order. */
+        void clearClientOrder();
+
+        /** \brief Index of the sphere the client knows by an index. */
+        unsigned int getSphereIndex(unsigned int clientIndex) const
+        {
+            return (sphereIndices.empty() ? clientIndex : sphereIndices[clientIndex]);
+        }
+
+    };
+
+}
+
+#endif /*_SPHERESORTING_HPP_*/
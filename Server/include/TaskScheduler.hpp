@@ -0,0 +1,240 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#ifndef _TASKSCHEDULER_HPP_
+#define _TASKSCHEDULER_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SphereSim
+{
+
+    class TaskScheduler;
+
+    /** \brief Measured cost of a parallel loop, used to adapt its chunk size. */
+    class LoopCost
+    {
+    public:
+        /** \brief Averaged time (in ns) one thread needs per loop index;
+         * 0 if not yet measured. */
+        double nanosecondsPerIndex;
+
+        /** \brief Initialize LoopCost. */
+        LoopCost()
+            :nanosecondsPerIndex(0)
+        {
+        }
+
+    };
+
+    /** \brief Range of loop indices processed as one task. */
+    struct TaskRange
+    {
+        unsigned int begin;
+        unsigned int end;
+    };
+
+    /** \brief Tasks of one pool thread. */
+    struct TaskDeque
+    {
+        std::mutex mutex;
+        std::deque<TaskRange> tasks;
+    };
+
+    /** \brief Share of one simulation in the TaskScheduler; runs the parallel
+     * loops of the simulation on the shared thread pool. Deleting the account
+     * removes it from the scheduler. */
+    class TaskAccount
+    {
+        friend class TaskScheduler;
+
+    private:
+        /** \brief Type-erased function running the loop body for a range. */
+        typedef void (*LoopBodyCaller)(const void* body, unsigned int begin,
+            unsigned int end);
+
+        /** \brief Scheduler owning the thread pool. */
+        TaskScheduler* scheduler;
+
+        /** \brief Relative share of the threads among accounts of equal
+         * priority; protected by the scheduler mutex. */
+        unsigned int weight;
+
+        /** \brief Accounts with higher priority are served first; protected by
+         * the scheduler mutex. */
+        unsigned int priority;
+
+        /** \brief Served thread time (in ns) divided by the weight; protected by
+         * the scheduler mutex. */
+        double virtualTime;
+
+        /** \brief Time of the last submitted loop; protected by the scheduler
+         * mutex. */
+        std::chrono::steady_clock::time_point lastSubmission;
+
+        /** \brief Number of pool threads currently working for this account;
+         * protected by the scheduler mutex. */
+        unsigned int activeWorkers;
+
+        /** \brief Task deques of the current loop, one per pool thread. */
+        TaskDeque* deques;
+
+        /** \brief Body of the current loop. */
+        const void* loopBody;
+
+        /** \brief Caller of the current loop body. */
+        LoopBodyCaller loopBodyCaller;
+
+        /** \brief Number of tasks of the current loop not yet taken. */
+        std::atomic<unsigned int> queuedTasks;
+
+        /** \brief Number of unfinished tasks of the current loop. */
+        std::atomic<unsigned int> remainingTasks;
+
+        /** \brief Mutex for waiting on the end of the current loop. */
+        std::mutex doneMutex;
+
+        /** \brief Condition signalled at the end of the current loop. */
+        std::condition_variable doneCondition;
+
+        /** \brief Create an account of the specified scheduler. */
+        TaskAccount(TaskScheduler* scheduler);
+
+        template <typename Body>
+        static void callLoopBody(const void* body, unsigned int begin,
+            unsigned int end)
+        {
+            const Body& loopBody = *static_cast<const Body*>(body);
+            for (unsigned int index = begin; index<end; index++)
+            {
+                loopBody(index);
+            }
+        }
+
+        /** \brief Split a loop into tasks, run them and update the cost. */
+        void run(unsigned int count, LoopCost& cost, const void* body,
+            LoopBodyCaller caller);
+
+    public:
+        /** \brief Remove the account from the scheduler. */
+        ~TaskAccount();
+
+        TaskAccount() = delete;
+        TaskAccount(const TaskAccount&) = delete;
+        TaskAccount& operator=(const TaskAccount&) = delete;
+
+        /** \brief Call body(index) for all indices in [0, count) on the pool
+         * and return when all calls are finished.
+         * \param cost Measured cost of this loop, updated after the loop. */
+        template <typename Body>
+        void parallelFor(unsigned int count, LoopCost& cost, const Body& body)
+        {
+            run(count, cost, &body, &callLoopBody<Body>);
+        }
+
+        /** \brief Update weight and priority of the account. */
+        void setShare(unsigned int weight, unsigned int priority);
+
+    };
+
+    /** \brief Process-wide pool of threads running the parallel loops of all
+     * simulations.
+     *
+     * A loop is split into chunks of consecutive indices. Each pool thread
+     * gets a contiguous block of chunks in its own deque of the account,
+     * processes it from the front and steals chunks from the back of the other
+     * deques. The chunk size is chosen from the measured cost of the loop, so
+     * that one chunk takes about targetChunkTime.
+     *
+     * Free threads pick the account with the highest priority and, among
+     * these, the lowest served thread time per weight (fair share); they
+     * switch accounts after timeSlice. Accounts without a running loop use no
+     * threads, the submitting thread only waits for its loop. */
+    class TaskScheduler
+    {
+        friend class TaskAccount;
+
+    private:
+        /** \brief Number of pool threads. */
+        const unsigned int threadCount;
+
+        /** \brief Aimed time (in ns) for processing one chunk. */
+        const double targetChunkTime;
+
+        /** \brief Time (in ns) after which a thread picks an account again. */
+        const double timeSlice;
+
+        /** \brief Time after which an account counts as idle. */
+        const std::chrono::milliseconds idleTime;
+
+        /** \brief Pool threads. */
+        std::vector<std::thread> threads;
+
+        /** \brief Registered accounts. */
+        std::vector<TaskAccount*> accounts;
+
+        /** \brief Mutex protecting the accounts and their shares. */
+        std::mutex mutex;
+
+        /** \brief Condition waking pool threads for new tasks. */
+        std::condition_variable workCondition;
+
+        /** \brief Condition waking unregistering accounts when their workers
+         * finished. */
+        std::condition_variable workersFinishedCondition;
+
+        /** \brief Flag telling the pool threads to exit. */
+        bool stopping;
+
+        /** \brief Work on the picked accounts until stopped. */
+        void workerLoop(unsigned int threadIndex);
+
+        /** \brief Account with queued tasks to be served next; the mutex has to
+         * be locked. */
+        TaskAccount* pickAccount();
+
+        /** \brief Take a task of an account from the own deque or steal one. */
+        bool takeTask(TaskAccount* account, unsigned int threadIndex,
+            TaskRange& task);
+
+        /** \brief Remove an account after its workers finished. */
+        void unregisterAccount(TaskAccount* account);
+
+    public:
+        /** \brief Start the pool threads.
+         * \param count Number of pool threads; 0 uses the number of hardware
+         * threads. */
+        TaskScheduler(unsigned int count);
+
+        /** \brief Stop the pool threads. */
+        ~TaskScheduler();
+
+        TaskScheduler() = delete;
+        TaskScheduler(const TaskScheduler&) = delete;
+        TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+        /** \brief Create an account for a simulation; the caller owns it. */
+        TaskAccount* createAccount();
+
+        /** \brief Number of pool threads. */
+        unsigned int getThreadCount() const
+        {
+            return threadCount;
+        }
+
+    };
+
+}
+
+#endif /*_TASKSCHEDULER_HPP_*/
@@ -12,6 +12,7 @@
 #include "Console.hpp"
 
 #include <vector>
+#include <algorithm>
 #include <cassert>
 #include <exception>
 
@@ -136,6 +137,61 @@ namespace SphereSim
             }
         }
 
+        /** \brief Add an element; may be called by several threads at once.
+         * Does not throw, as it is called inside parallel loops; the counter
+         * of a full sub array keeps growing until sortElements limits it.
+         * \return Flag whether the element fitted into the sub array. */
+        inline bool addElementAtomic(const unsigned int index, T& element)
+        {
+            #ifndef NDEBUG
+                assert(counter != nullptr);
+                assert(index < outerSize);
+                assert(subArrays != nullptr);
+                assert(subArrays[index] != nullptr);
+            #endif /*NDEBUG*/
+            unsigned int position = __atomic_fetch_add(&counter[index], 1u,
+                __ATOMIC_RELAXED);
+            if (position < constInnerSize)
+            {
+                subArrays[index][position] = element;
+                return true;
+            }
+            return false;
+        }
+
+        /** \brief Add an element without throwing if the sub array is full.
+         * \return Flag whether the element fitted into the sub array. */
+        inline bool tryAddElement(const unsigned int index, T& element)
+        {
+            #ifndef NDEBUG
+                assert(counter != nullptr);
+                assert(index < outerSize);
+                assert(subArrays != nullptr);
+                assert(subArrays[index] != nullptr);
+            #endif /*NDEBUG*/
+            if (counter[index] < constInnerSize)
+            {
+                subArrays[index][counter[index]++] = element;
+                return true;
+            }
+            return false;
+        }
+
+        /** \brief Sort the elements of one sub array in ascending order; drops
+         * the elements that did not fit into a full sub array. */
+        inline void sortElements(const unsigned int index)
+        {
+            #ifndef NDEBUG
+                assert(counter != nullptr);
+                assert(index < outerSize);
+            #endif /*NDEBUG*/
+            if (counter[index] > constInnerSize)
+            {
+                counter[index] = constInnerSize;
+            }
+            std::sort(subArrays[index], subArrays[index]+counter[index]);
+        }
+
         inline bool addElementIfNotContained(const unsigned int index, T& element)
         {
             #ifndef NDEBUG
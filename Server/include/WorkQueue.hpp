@@ -14,7 +14,7 @@
 #include <QMutex>
 #include <QWaitCondition>
 #include <QObject>
-#include <list>
+#include <atomic>
 #include <string>
 
 class QElapsedTimer;
@@ -36,61 +36,125 @@ namespace SphereSim
         /** \brief Any data or parameter for the work item. */
         std::string data;
 
+        /** \brief Next item in the queue or in the pool of free items. */
+        std::atomic<WorkQueueItem*> next;
+
+        /** \brief Number of queue resets before the item was pushed. */
+        unsigned int resetCount;
+
         /** \brief Initialize WorkQueueItem. */
-        WorkQueueItem(const unsigned char actGrp, const unsigned char act,
-            const std::string d = std::string())
-            :actionGroup(actGrp), action(act), data(d)
+        WorkQueueItem(const unsigned char actGrp, const unsigned char act)
+            :actionGroup(actGrp), action(act), data(), next(nullptr), resetCount(0)
         {
         }
 
         WorkQueueItem() = delete;
-        WorkQueueItem(const WorkQueueItem&) = default;
-        WorkQueueItem& operator=(const WorkQueueItem&) = default;
+        WorkQueueItem(const WorkQueueItem&) = delete;
+        WorkQueueItem& operator=(const WorkQueueItem&) = delete;
 
     };
 
-    /** \brief Storage for work to be done by the worker. */
+    /** \brief Storage for work to be done by the worker.
+     *
+     * Control items are passed in a lock-free queue with many producers and
+     * the worker as single consumer. Items are taken from a pool and given
+     * back by the worker, so their data strings keep their memory. Simulation
+     * steps are only counted; popping a step neither locks nor allocates. The
+     * mutex is only used when the worker has to sleep or the simulation
+     * starts. */
     class WorkQueue : public QObject
     {
         Q_OBJECT
 
     private:
-        /** \brief Items of the queue. */
-        std::list<WorkQueueItem> items;
+        /** \brief Placeholder item in the queue, never handed out. */
+        WorkQueueItem stubItem;
+
+        /** \brief Item for simulation steps, handed out by the worker. */
+        WorkQueueItem calculateStepItem;
+
+        /** \brief Item for frame sending, handed out by the worker. */
+        WorkQueueItem prepareFrameDataItem;
+
+        /** \brief Item for the end of a simulation, handed out by the worker. */
+        WorkQueueItem finishSimulationItem;
+
+        /** \brief Oldest item of the queue; only used by the worker. */
+        WorkQueueItem* queueHead;
+
+        /** \brief Most recently pushed item of the queue. */
+        std::atomic<WorkQueueItem*> queueTail;
+
+        /** \brief Number of pushed items not yet popped. */
+        std::atomic<unsigned int> queuedItems;
+
+        /** \brief Stack of free items. */
+        std::atomic<WorkQueueItem*> freeItems;
+
+        /** \brief Number of queue resets; items pushed before the last reset
+         * are dropped. */
+        std::atomic<unsigned int> resetCount;
 
         /** \brief Mutex used to lock the work status. */
         QMutex* mutex;
 
-        /** \brief Flag for work queue emptyness. */
-        bool queueEmpty;
-
-        /** \brief Flag showing if there is work to do. */
-        bool canWork;
+        /** \brief Flag showing that the worker waits for work. */
+        std::atomic<bool> workerWaiting;
 
         /** \brief Wait condition controlling the worker. */
         QWaitCondition workCondition;
 
         /** \brief Number of steps to simulate. */
-        unsigned int simulationSteps;
+        std::atomic<unsigned int> simulationSteps;
 
         /** \brief Flag showing if a continuous simulation is running. */
-        bool continuousSimulationRunning;
+        std::atomic<bool> continuousSimulationRunning;
 
-        /** \brief Flag showing if the worker is simulating. */
+        /** \brief Flag showing if the worker is simulating; protected by the
+         * mutex. */
         bool isSimulating;
 
+        /** \brief Flag showing that frame data is due before the next step;
+         * only used by the worker. */
+        bool frameDataDue;
+
         /** \brief Animation timer. */
         QElapsedTimer* animationTimer;
 
         /** \brief Animation timer. */
         const bool &sendFramesRegularly;
 
-        /** \brief Update the canWork flag. */
-        void updateStatus();
+        /** \brief Number of regular frames per second. */
+        const unsigned int &frameRate;
+
+        /** \brief Limit of the regular frame rate adapted to the client
+         * feedback; only used by the worker. */
+        double pacedFrameRate;
+
+        /** \brief Regular frames issued since the last client feedback; only
+         * used by the worker. */
+        unsigned int issuedFrames;
+
+        /** \brief Add an item to the end of the queue and wake the worker. */
+        void pushItem(WorkQueueItem* item);
+
+        /** \brief Take an item from the pool or allocate a new one. */
+        WorkQueueItem* acquireItem();
+
+        /** \brief Remove the oldest item from the queue; nullptr if there is
+         * none. Only called by the worker. */
+        WorkQueueItem* popQueuedItem();
+
+        /** \brief Take one simulation step from the counters. */
+        bool popSimulationStep();
+
+        /** \brief Check for any work. */
+        bool canWork();
 
     public:
         /** \brief Initialize member variables. */
-        WorkQueue(QMutex* mutex, const bool &frameSending);
+        WorkQueue(QMutex* mutex, const bool &frameSending,
+            const unsigned int &frameRate);
 
         /** \brief Clean up member variables. */
         ~WorkQueue();
@@ -99,21 +163,36 @@ namespace SphereSim
         WorkQueue(const WorkQueue&) = delete;
         WorkQueue& operator=(const WorkQueue&) = delete;
 
-        /** \brief Add a new item to the end of the work queue. */
-        void pushItem(WorkQueueItem& item);
-
-        /** \copybrief pushItem */
-        void pushItem(unsigned char actionGroup, unsigned char action, std::string data);
+        /** \brief Add a new item to the end of the work queue.
+         * \param data Request data, copied into a pooled item. */
+        void pushItem(unsigned char actionGroup, unsigned char action,
+            const char* data, size_t size);
 
         /** \brief Increase simulation steps (0 = start continuous simulation). */
         void pushSimulationSteps(unsigned int steps);
 
-        /** \brief Return the next work to do and remove it from the queue. */
+        /** \brief Return the next work to do and remove it from the queue; wait
+         * if there is none. Only called by the worker. */
         WorkQueueItem* popItem();
 
+        /** \brief Take up to the specified number of further simulation steps
+         * at once and return the number taken. Only called by the worker. */
+        unsigned int takeSimulationSteps(unsigned int maximumSteps);
+
+        /** \brief Give an item returned by popItem back to the queue. */
+        void releaseItem(WorkQueueItem* item);
+
         /** \brief Send updated frame data to client. */
         void sendFrameData();
 
+        /** \brief Adapt the frame rate to the client feedback: decrease it
+         * multiplicatively when the client buffer is filling up or frames got
+         * lost, increase it additively otherwise. Only called by the worker.
+         * \param bufferLevel Frame buffer level of the client (in percent).
+         * \param receivedFrames Frames received since the last feedback. */
+        void updateFramePacing(unsigned char bufferLevel,
+            unsigned int receivedFrames);
+
     public slots:
         /** \brief Stop a running simulation. */
         void stopSimulation();
@@ -10,18 +10,26 @@
 #include "Connection.hpp"
 #include "Console.hpp"
 #include "WorkQueue.hpp"
+#include "ByteBuffer.hpp"
 #include "DataTransmit.hpp"
+#include "DomainGroup.hpp"
 #include "MessageTransmitter.hpp"
+#include "SharedFrameRing.hpp"
 
 #include <QCoreApplication>
+#include <random>
 
 using namespace SphereSim;
 
-ActionReceiver::ActionReceiver(const unsigned int clientID)
-    :clientID(clientID), simulatedSystem(), sphCalc(this, &simulatedSystem),
-    workQueue(sphCalc.getWorkQueue()), clientAccepted(false), receivedRequests(false)
+ActionReceiver::ActionReceiver(const unsigned int clientID,
+    TaskScheduler* taskScheduler, DomainGroup* domainGroup)
+    :clientID(clientID), simulatedSystem(),
+    sphCalc(this, &simulatedSystem, taskScheduler, domainGroup, clientID),
+    workQueue(sphCalc.getWorkQueue()), clientAccepted(false), receivedRequests(false),
+    sharedFrameRing(nullptr), sharedFramesUsed(false), domainGroup(domainGroup)
 {
-    connect(&sphCalc, SIGNAL(frameToSend(std::string)), SLOT(sendFrame(std::string)));
+    connect(&sphCalc, SIGNAL(frameToSend(MessageBuffer)),
+        SLOT(sendFrame(MessageBuffer)));
     connect(&simulatedSystem, SIGNAL(variableToSend(std::string)),
         SLOT(sendVariable(std::string)));
     connect(workQueue, SIGNAL(simulating(bool)), SLOT(simulating(bool)));
@@ -29,6 +37,7 @@ ActionReceiver::ActionReceiver(const unsigned int clientID)
 
 ActionReceiver::~ActionReceiver()
 {
+    delete sharedFrameRing;
     Console()<<"ActionReceiver: disconnected.\n";
 }
 
@@ -39,8 +48,12 @@ bool ActionReceiver::hasReceivedRequests()
     return tmp;
 }
 
-void ActionReceiver::processRequest(std::string data)
+void ActionReceiver::processRequest(const char* data, size_t size)
 {
+    if (size < 2)
+    {
+        return;
+    }
     receivedRequests = true;
     unsigned char actionGroup = data[0];
     unsigned char action = data[1];
@@ -51,31 +64,124 @@ void ActionReceiver::processRequest(std::string data)
         sendReply(ServerStatusReplies::clientAccepted, std::string());
         return;
     }
-    if (data.size()>2)
+    if (actionGroup == ActionGroups::basic
+        && negotiateSharedFrames(action, data+2, size-2))
     {
-        data = data.substr(2);
+        return;
     }
-    else
+    if (actionGroup == ActionGroups::basic && action == BasicActions::updateVariable)
+    {
+        forwardToDomains(data, size);
+    }
+    workQueue->pushItem(actionGroup, action, data+2, size-2);
+}
+
+MessageBuffer ActionReceiver::createReply(const std::string& data)
+{
+    const size_t headerSize = ServerStatusReplies::headerSize;
+    MessageBuffer message = MessageBuffer::allocate(headerSize+data.size());
+    if (message.isValid())
     {
-        data.clear();
+        memcpy(message.getData()+headerSize, data.data(), data.size());
     }
-    workQueue->pushItem(actionGroup, action, data);
+    return message;
 }
 
-void ActionReceiver::sendReply(unsigned short serverStatus, std::string dataToSend)
+void ActionReceiver::sendReply(unsigned short serverStatus,
+    const std::string& dataToSend)
 {
-    std::ostringstream data;
-    writeShort(data, serverStatus);
-    data<<dataToSend;
-    emit send(clientID, data.str());
+    sendReply(serverStatus, createReply(dataToSend));
 }
 
-void ActionReceiver::sendFrame(std::string frameToSend)
+void ActionReceiver::sendReply(unsigned short serverStatus, MessageBuffer message)
 {
-    sendReply(ServerStatusReplies::sendFrame, frameToSend);
+    if (message.isValid())
+    {
+        emit sendMessage(clientID, serverStatus, message);
+    }
+}
+
+bool ActionReceiver::negotiateSharedFrames(unsigned char action, const char* data,
+    size_t size)
+{
+    if (action == BasicActions::requestSharedFrames)
+    {
+        delete sharedFrameRing;
+        sharedFrameRing = new SharedFrameRing();
+        sharedFramesUsed = false;
+        std::random_device randomDevice;
+        std::uniform_int_distribution<unsigned long long> distribution;
+        unsigned long long token = distribution(randomDevice);
+        std::string name = SharedFrameRing::getName(clientID);
+        // slot memory is only committed when a frame of that size is written
+        if (!sharedFrameRing->create(name, token, 16, 8*1024*1024))
+        {
+            Console()<<"ActionReceiver: cannot create shared memory ring.\n";
+            delete sharedFrameRing;
+            sharedFrameRing = nullptr;
+            return true;
+        }
+        std::string offer;
+        ByteWriter writer(offer);
+        writer.write<unsigned long long>(token);
+        writer.writeBytes(name.data(), name.size());
+        sendReply(ServerStatusReplies::sharedFramesOffered, offer);
+        return true;
+    }
+    if (action == BasicActions::useSharedFrames)
+    {
+        if (sharedFrameRing != nullptr && size >= 1 && data[0] != 0)
+        {
+            Console()<<"ActionReceiver: sending frames over shared memory.\n";
+            sharedFramesUsed = true;
+            // the client mapped the ring, so the name is not needed anymore
+            sharedFrameRing->unlink();
+        }
+        else
+        {
+            delete sharedFrameRing;
+            sharedFrameRing = nullptr;
+            sharedFramesUsed = false;
+        }
+        return true;
+    }
+    return false;
+}
+
+void ActionReceiver::forwardToDomains(const char* data, size_t size)
+{
+    if (domainGroup == nullptr || domainGroup->getDomainIndex() != 0)
+    {
+        return;
+    }
+    ByteReader reader(data+2, size-2);
+    unsigned short variable = reader.readShort();
+    // the time step of the coordinator is sent with every step
+    if (!reader.isGood() || variable == SimulationVariables::adaptiveTimeStep)
+    {
+        return;
+    }
+    domainGroup->sendToAll(clientID, DomainMessages::request, 0, 0,
+        std::string(data, size));
+}
+
+void ActionReceiver::sendFrame(MessageBuffer message)
+{
+    // frames too large for a ring slot fall back to the network; the buffer
+    // is freed with the last copy of message
+    const size_t headerSize = ServerStatusReplies::headerSize;
+    if (sharedFramesUsed && sharedFrameRing->push(message.getData()+headerSize,
+        message.getSize()-headerSize))
+    {
+        // the client reads the ring when notified instead of polling it
+        emit sendMessage(clientID, ServerStatusReplies::sharedFrameWritten,
+            MessageBuffer::allocate(headerSize));
+        return;
+    }
+    emit sendMessage(clientID, ServerStatusReplies::sendFrame, message);
 }
 
-void ActionReceiver::sendVariable(std::string variableToSend)
+void ActionReceiver::sendVariable(const std::string& variableToSend)
 {
     sendReply(ServerStatusReplies::sendVariable, variableToSend);
 }
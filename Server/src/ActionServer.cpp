@@ -7,137 +7,153 @@
  * Full license text is under the file "LICENSE" provided with this code. */
 
 #include "ActionServer.hpp"
-#include "ActionReceiver.hpp"
+#include "Actions.hpp"
+#include "ByteBuffer.hpp"
 #include "Console.hpp"
-#include "DataTransmit.hpp"
-#include "MessageTransmitter.hpp"
+#include "ServerShard.hpp"
+#include "TaskScheduler.hpp"
 
 #include <QCoreApplication>
+#include <QThread>
 #include <nanomsg/pubsub.h>
+#include <random>
 #include <sstream>
 
 using namespace SphereSim;
 
-ActionServer::ActionServer(const char* addr,
-    unsigned short sendPort, unsigned short recvPort)
-    :sendSocket(AF_SP, NN_PUB), recvSocket(AF_SP, NN_SUB), serverID(0),
-    messageTransmitter(nullptr), actionReceivers(),
-    heartbeatTimer(this), disconnectionTimer(this)
+namespace
+{
+    /** \brief In-process addresses the shards connect to. */
+    const char* requestAddress = "inproc://SphereSim_requests";
+    const char* replyAddress = "inproc://SphereSim_replies";
+    const char* frameAddress = "inproc://SphereSim_frames";
+
+    /** \brief Create a raw socket for a device and bind it. */
+    int createDeviceSocket(int protocol, const char* address)
+    {
+        int socket = nn_socket(AF_SP_RAW, protocol);
+        if (socket < 0)
+        {
+            throw nn::exception();
+        }
+        if (protocol == NN_SUB)
+        {
+            nn_setsockopt(socket, NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
+        }
+        if (nn_bind(socket, address) < 0)
+        {
+            nn_close(socket);
+            throw nn::exception();
+        }
+        return socket;
+    }
+}
+
+ActionServer::ActionServer(const char* addr, unsigned short sendPort,
+    unsigned short recvPort, unsigned short framePort, unsigned int shardCount,
+    DomainGroup* domainGroup)
+    :requestFrontend(-1), requestBackend(-1), replyFrontend(-1), replyBackend(-1),
+    frameFrontend(-1), frameBackend(-1), requestDevice(), replyDevice(),
+    frameDevice(), heartbeatSocket(AF_SP, NN_PUB), serverID(0),
+    taskScheduler(nullptr), shards(), shardThreads(), heartbeatTimer(this),
+    sendBuffer()
 {
     Console()<<"ActionServer: constructor called.\n";
 
+    taskScheduler = new TaskScheduler(0);
+    Console()<<"ActionServer: number of scheduler threads: "
+        <<taskScheduler->getThreadCount()<<".\n";
+
     std::random_device randomDevice;
     std::uniform_int_distribution<unsigned int> distribution;
     serverID = distribution(randomDevice) & ~1; // even number as server ID
 
     std::ostringstream sendAddress;
     sendAddress<<"tcp://"<<addr<<':'<<sendPort;
-    sendSocket.bind(sendAddress.str().c_str());
     std::ostringstream recvAddress;
     recvAddress<<"tcp://"<<addr<<':'<<recvPort;
-    recvSocket.bind(recvAddress.str().c_str());
-    recvSocket.setsockopt(NN_SUB, NN_SUB_SUBSCRIBE, "", 0);
-    messageTransmitter = new MessageTransmitter(&sendSocket, &recvSocket);
+    std::ostringstream frameSendAddress;
+    frameSendAddress<<"tcp://"<<addr<<':'<<framePort;
+    requestFrontend = createDeviceSocket(NN_SUB, recvAddress.str().c_str());
+    requestBackend = createDeviceSocket(NN_PUB, requestAddress);
+    replyFrontend = createDeviceSocket(NN_SUB, replyAddress);
+    replyBackend = createDeviceSocket(NN_PUB, sendAddress.str().c_str());
+    frameFrontend = createDeviceSocket(NN_SUB, frameAddress);
+    frameBackend = createDeviceSocket(NN_PUB, frameSendAddress.str().c_str());
+    requestDevice = std::thread(nn_device, requestFrontend, requestBackend);
+    replyDevice = std::thread(nn_device, replyFrontend, replyBackend);
+    frameDevice = std::thread(nn_device, frameFrontend, frameBackend);
+    heartbeatSocket.connect(replyAddress);
+
+    if (shardCount == 0)
+    {
+        // network threads mostly wait, a few of them suffice
+        shardCount = std::thread::hardware_concurrency()/8;
+        shardCount = (shardCount < 2 ? 2 : (shardCount > 4 ? 4 : shardCount));
+    }
+    Console()<<"ActionServer: number of network shards: "<<shardCount<<".\n";
+    for (unsigned int shardIndex = 0; shardIndex<shardCount; shardIndex++)
+    {
+        ServerShard* shard = new ServerShard(shardIndex, shardCount, serverID,
+            requestAddress, replyAddress, frameAddress, taskScheduler,
+            domainGroup);
+        QThread* shardThread = new QThread();
+        shard->moveToThread(shardThread);
+        connect(shardThread, SIGNAL(started()), shard, SLOT(start()));
+#ifndef NDEBUG
+        connect(shard, SIGNAL(terminateServer()), SLOT(tearDown()));
+#endif /*NDEBUG*/
+        shards.push_back(shard);
+        shardThreads.push_back(shardThread);
+        shardThread->start();
+    }
 
-    connect(messageTransmitter, SIGNAL(processData(std::string)),
-        SLOT(receiveRequest(std::string)));
     connect(&heartbeatTimer, SIGNAL(timeout()), SLOT(sendHeartbeat()));
-    connect(&disconnectionTimer, SIGNAL(timeout()), SLOT(disconnectionCheck()));
-    messageTransmitter->start();
     heartbeatTimer.start(1000);
-    disconnectionTimer.start(5000);
 }
 
 ActionServer::~ActionServer()
 {
     tearDown();
+    delete taskScheduler;
 }
 
 void ActionServer::tearDown()
 {
-    for (ActionReceiverMap::iterator it = actionReceivers.begin();
-        it != actionReceivers.end(); ++it)
+    heartbeatTimer.stop();
+    for (unsigned int i = 0; i<shards.size(); i++)
     {
-        delete &(*it->second);
+        // the simulations have to be deleted in the thread of their shard
+        QMetaObject::invokeMethod(shards[i], "stop", Qt::BlockingQueuedConnection);
+        shardThreads[i]->quit();
+        shardThreads[i]->wait();
+        delete shards[i];
+        delete shardThreads[i];
     }
-    actionReceivers.clear();
-    if (messageTransmitter != nullptr)
+    shards.clear();
+    shardThreads.clear();
+    if (requestDevice.joinable())
     {
-        messageTransmitter->deleteLater();
-        messageTransmitter = nullptr;
+        // makes the devices return
+        nn_term();
+        requestDevice.join();
+        replyDevice.join();
+        frameDevice.join();
+        nn_close(requestFrontend);
+        nn_close(requestBackend);
+        nn_close(replyFrontend);
+        nn_close(replyBackend);
+        nn_close(frameFrontend);
+        nn_close(frameBackend);
     }
     qApp->quit();
 }
 
-void ActionServer::receiveRequest(std::string request)
-{
-    std::istringstream stream(request);
-    unsigned int simulationID = readInt(stream);
-    unsigned int senderID = readInt(stream);
-    if ((senderID & 1) != 1)
-    {
-        // requests from other servers not supported yet
-        return;
-    }
-    ActionReceiver* actionReceiver;
-    ActionReceiverMap::iterator it = actionReceivers.find(simulationID);
-    if (it != actionReceivers.end())
-    {
-        actionReceiver = it->second;
-    }
-    else
-    {
-        Console()<<"Registering simulation ID "<<std::hex<<simulationID<<".\n";
-        actionReceiver = new ActionReceiver(simulationID);
-        connect(actionReceiver, SIGNAL(send(unsigned int, std::string)),
-            SLOT(send(unsigned int, std::string)));
-#ifndef NDEBUG
-        connect(actionReceiver, SIGNAL(terminateServer()),
-            SLOT(tearDown()));
-#endif /*NDEBUG*/
-        actionReceivers.emplace(simulationID, actionReceiver);
-    }
-    request = request.substr(8);
-    actionReceiver->processRequest(request);
-}
-
-void ActionServer::send(unsigned int simulationID, std::string reply)
-{
-    if (actionReceivers.count(simulationID) == 0 || (simulationID & 1) != 1)
-    {
-        Console()<<Console::red<<Console::bold<<"Bad simulation ID reply.\n";
-        return;
-    }
-    std::ostringstream stream;
-    writeInt(stream, simulationID);
-    writeInt(stream, serverID);
-    stream<<reply;
-    messageTransmitter->send(stream.str());
-}
-
 void ActionServer::sendHeartbeat()
 {
-    std::ostringstream stream;
-    writeInt(stream, 0);
-    writeInt(stream, serverID);
-    writeShort(stream, ServerStatusReplies::serverHeartbeat);
-    messageTransmitter->send(stream.str());
-}
-
-void ActionServer::disconnectionCheck()
-{
-    for (ActionReceiverMap::iterator it = actionReceivers.begin();
-        it != actionReceivers.end(); )
-    {
-        if (it->second->hasReceivedRequests() == false)
-        {
-            Console()<<"Deregistering simulation ID "<<std::hex<<it->first<<".\n";
-            delete &(*it->second);
-            it = actionReceivers.erase(it);
-        }
-        else
-        {
-            ++it;
-        }
-    }
+    ByteWriter writer(sendBuffer);
+    writer.writeInt(0);
+    writer.writeInt(serverID);
+    writer.writeShort(ServerStatusReplies::serverHeartbeat);
+    heartbeatSocket.send(sendBuffer.data(), sendBuffer.size(), NN_DONTWAIT);
 }
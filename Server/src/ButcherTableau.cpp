@@ -7,41 +7,21 @@
  * Full license text is under the file "LICENSE" provided with this code. */
 
 #include "ButcherTableau.hpp"
-#include "Console.hpp"
 
 using namespace SphereSim;
 
-ButcherTableau::ButcherTableau()
-    :ButcherTableau(0)
-{
-}
+#define defineButcherTableau(Tableau)                                       \
+    static_assert(ButcherTableau::IsConsistent<ButcherTableau::Tableau>::value, \
+        "Butcher tableau " #Tableau " checksum is wrong!");                 \
+    constexpr unsigned char ButcherTableau::Tableau::stages;                \
+    constexpr unsigned char ButcherTableau::Tableau::embeddedOrder;         \
+    constexpr Scalar ButcherTableau::Tableau::a[stages][stages];            \
+    constexpr Scalar ButcherTableau::Tableau::b[stages];                    \
+    constexpr Scalar ButcherTableau::Tableau::b_[stages];                   \
+    constexpr Scalar ButcherTableau::Tableau::c[stages];
 
-ButcherTableau::ButcherTableau(unsigned char _order)
-    :order(_order), a(), b(), b_(), c()
-{
-}
-
-ButcherTableau::ButcherTableau(unsigned char _order, const Scalar* _a, const Scalar* _b,
-    const Scalar* _b_, const Scalar* _c)
-    :ButcherTableau(_order)
-{
-    unsigned short counter = 0;
-    Scalar checksum;
-    for (unsigned char x = 0; x<order; x++)
-    {
-        checksum = 0.0;
-        for (unsigned char y = 0; y<order; y++)
-        {
-            a[x][y] = _a[counter++];
-            checksum += a[x][y];
-        }
-        b[x] = _b[x];
-        b_[x] = _b_[x];
-        c[x] = _c[x];
-        if (fabs(checksum-c[x])>0.0001*(checksum+c[x]))
-        {
-            Console()<<Console::red<<Console::bold
-                <<"Error: Butcher tableau checksum is wrong!\n";
-        }
-    }
-}
+defineButcherTableau(HeunEuler21)
+defineButcherTableau(BogackiShampine32)
+defineButcherTableau(RungeKuttaFehlberg54)
+defineButcherTableau(CashKarp54)
+defineButcherTableau(DormandPrince54)
@@ -0,0 +1,291 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#include "DomainGroup.hpp"
+#include "ActionReceiver.hpp"
+#include "Actions.hpp"
+#include "ByteBuffer.hpp"
+#include "Console.hpp"
+
+#include <chrono>
+#include <nanomsg/nn.hpp>
+#include <nanomsg/pipeline.h>
+
+using namespace SphereSim;
+
+DomainGroup::DomainGroup(unsigned int domainIndex,
+    const std::vector<std::string>& addresses, TaskScheduler* taskScheduler)
+    :domainIndex(domainIndex), domainCount(addresses.size()), inbox(-1),
+    outboxes(addresses.size(), -1), receiveThread(), stopping(false),
+    mailboxMutex(), mailboxCondition(), mailbox(), taskScheduler(taskScheduler),
+    actionReceivers()
+{
+    // the receiving thread checks the stopping flag between the timeouts
+    const int receiveTimeout = 100;
+    const int sendTimeout = 5000;
+    inbox = nn_socket(AF_SP, NN_PULL);
+    if (inbox < 0 || nn_bind(inbox, addresses[domainIndex].c_str()) < 0)
+    {
+        throw nn::exception();
+    }
+    nn_setsockopt(inbox, NN_SOL_SOCKET, NN_RCVTIMEO, &receiveTimeout,
+        sizeof(receiveTimeout));
+    for (unsigned int domain = 0; domain<domainCount; domain++)
+    {
+        if (domain == domainIndex)
+        {
+            continue;
+        }
+        outboxes[domain] = nn_socket(AF_SP, NN_PUSH);
+        if (outboxes[domain] < 0)
+        {
+            throw nn::exception();
+        }
+        nn_setsockopt(outboxes[domain], NN_SOL_SOCKET, NN_SNDTIMEO, &sendTimeout,
+            sizeof(sendTimeout));
+        // connecting does not need the other process to be running yet
+        if (nn_connect(outboxes[domain], addresses[domain].c_str()) < 0)
+        {
+            throw nn::exception();
+        }
+    }
+    Console()<<"DomainGroup: domain "<<domainIndex<<" of "<<domainCount
+        <<" at "<<addresses[domainIndex]<<".\n";
+
+    connect(this, SIGNAL(controlMessageReceived(unsigned int, unsigned char,
+        std::string)), SLOT(processControlMessage(unsigned int, unsigned char,
+        std::string)), Qt::QueuedConnection);
+    receiveThread = std::thread(&DomainGroup::receiveMessages, this);
+}
+
+DomainGroup::~DomainGroup()
+{
+    {
+        std::lock_guard<std::mutex> lock(mailboxMutex);
+        stopping.store(true);
+    }
+    // waiting simulations return before they are deleted
+    mailboxCondition.notify_all();
+    for (ActionReceiverMap::iterator it = actionReceivers.begin();
+        it != actionReceivers.end(); ++it)
+    {
+        delete it->second;
+    }
+    actionReceivers.clear();
+    if (receiveThread.joinable())
+    {
+        receiveThread.join();
+    }
+    for (unsigned int domain = 0; domain<domainCount; domain++)
+    {
+        if (outboxes[domain] >= 0)
+        {
+            nn_close(outboxes[domain]);
+        }
+    }
+    nn_close(inbox);
+}
+
+void DomainGroup::receiveMessages()
+{
+    while (stopping.load() == false)
+    {
+        char* buffer = nullptr;
+        int size = nn_recv(inbox, &buffer, NN_MSG, 0);
+        if (size < 0)
+        {
+            int error = nn_errno();
+            if (error == ETIMEDOUT || error == EAGAIN || error == EINTR)
+            {
+                continue;
+            }
+            // the library is terminating
+            break;
+        }
+        ByteReader reader(buffer, size);
+        DomainMessage message;
+        message.simulationID = reader.readInt();
+        message.type = reader.readChar();
+        message.sender = reader.readChar();
+        message.run = reader.readInt();
+        message.step = reader.readInt();
+        bool good = reader.isGood();
+        if (good)
+        {
+            message.data.assign(reader.getCurrent(), reader.getRemainingSize());
+        }
+        nn_freemsg(buffer);
+        if (good == false)
+        {
+            continue;
+        }
+        if (message.type == DomainMessages::request
+            || message.type == DomainMessages::closeSimulation)
+        {
+            emit controlMessageReceived(message.simulationID, message.type,
+                message.data);
+            continue;
+        }
+        unsigned int simulationID = message.simulationID;
+        bool runStart = (message.type == DomainMessages::runStart);
+        {
+            std::lock_guard<std::mutex> lock(mailboxMutex);
+            mailbox.push_back(std::move(message));
+        }
+        mailboxCondition.notify_all();
+        if (runStart)
+        {
+            // the simulation takes its spheres from the mailbox when started
+            emit controlMessageReceived(simulationID, DomainMessages::runStart,
+                std::string());
+        }
+    }
+}
+
+void DomainGroup::send(unsigned int domain, unsigned int simulationID,
+    unsigned char type, unsigned int run, unsigned int step,
+    const std::string& data)
+{
+    if (domain >= domainCount || outboxes[domain] < 0)
+    {
+        return;
+    }
+    std::string buffer;
+    ByteWriter writer(buffer);
+    writer.writeInt(simulationID);
+    writer.writeChar(type);
+    writer.writeChar(domainIndex);
+    writer.writeInt(run);
+    writer.writeInt(step);
+    writer.writeBytes(data.data(), data.size());
+    if (nn_send(outboxes[domain], buffer.data(), buffer.size(), 0) < 0)
+    {
+        Console()<<Console::red<<Console::bold<<"DomainGroup: cannot send to domain "
+            <<domain<<": "<<nn_strerror(nn_errno())<<".\n";
+    }
+}
+
+void DomainGroup::sendToAll(unsigned int simulationID, unsigned char type,
+    unsigned int run, unsigned int step, const std::string& data)
+{
+    for (unsigned int domain = 0; domain<domainCount; domain++)
+    {
+        if (domain != domainIndex)
+        {
+            send(domain, simulationID, type, run, step, data);
+        }
+    }
+}
+
+bool DomainGroup::receive(unsigned int simulationID, unsigned int sender,
+    unsigned int typeMask, unsigned int run, DomainMessage& message, int timeout)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+        + std::chrono::milliseconds(timeout);
+    std::unique_lock<std::mutex> lock(mailboxMutex);
+    while (true)
+    {
+        for (std::list<DomainMessage>::iterator it = mailbox.begin();
+            it != mailbox.end(); ++it)
+        {
+            if (it->simulationID == simulationID && it->sender == sender
+                && ((typeMask>>it->type) & 1) == 1 && (run == 0 || it->run == run))
+            {
+                message = std::move(*it);
+                mailbox.erase(it);
+                return true;
+            }
+        }
+        if (stopping.load() || std::chrono::steady_clock::now() >= deadline)
+        {
+            return false;
+        }
+        mailboxCondition.wait_until(lock, deadline);
+    }
+}
+
+bool DomainGroup::receiveLatest(unsigned int simulationID, unsigned int sender,
+    unsigned char type, std::string& data)
+{
+    bool received = false;
+    std::lock_guard<std::mutex> lock(mailboxMutex);
+    for (std::list<DomainMessage>::iterator it = mailbox.begin();
+        it != mailbox.end(); )
+    {
+        if (it->simulationID == simulationID && it->sender == sender
+            && it->type == type)
+        {
+            data.swap(it->data);
+            received = true;
+            it = mailbox.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    return received;
+}
+
+void DomainGroup::discard(unsigned int simulationID)
+{
+    std::lock_guard<std::mutex> lock(mailboxMutex);
+    for (std::list<DomainMessage>::iterator it = mailbox.begin();
+        it != mailbox.end(); )
+    {
+        if (it->simulationID == simulationID)
+        {
+            it = mailbox.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void DomainGroup::processControlMessage(unsigned int simulationID,
+    unsigned char type, const std::string& data)
+{
+    ActionReceiverMap::iterator it = actionReceivers.find(simulationID);
+    if (type == DomainMessages::closeSimulation)
+    {
+        if (it != actionReceivers.end())
+        {
+            Console()<<"Deregistering simulation ID "<<std::hex<<simulationID
+                <<std::dec<<" in domain "<<domainIndex<<".\n";
+            delete it->second;
+            actionReceivers.erase(it);
+        }
+        discard(simulationID);
+        return;
+    }
+    ActionReceiver* actionReceiver;
+    if (it != actionReceivers.end())
+    {
+        actionReceiver = it->second;
+    }
+    else
+    {
+        Console()<<"Registering simulation ID "<<std::hex<<simulationID
+            <<std::dec<<" in domain "<<domainIndex<<".\n";
+        actionReceiver = new ActionReceiver(simulationID, taskScheduler, this);
+        actionReceivers.emplace(simulationID, actionReceiver);
+    }
+    if (type == DomainMessages::request)
+    {
+        actionReceiver->processRequest(data.data(), data.size());
+    }
+    else if (type == DomainMessages::runStart)
+    {
+        // the coordinator decides when the run ends
+        const char startRequest[2] = {(char)ActionGroups::calculation,
+            (char)CalculationActions::startSimulation};
+        actionReceiver->processRequest(startRequest, sizeof(startRequest));
+    }
+}
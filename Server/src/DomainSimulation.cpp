@@ -0,0 +1,616 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#include "DomainSimulation.hpp"
+#include "ByteBuffer.hpp"
+#include "Console.hpp"
+#include "SphereCalculator.hpp"
+#include "WorkQueue.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace SphereSim;
+
+namespace
+{
+    /** \brief Size (in bytes) of an encoded sphere with its client index. */
+    const unsigned int encodedSphereSize = sizeof(unsigned int)+11*sizeof(double);
+}
+
+DomainSimulation::DomainSimulation(DomainGroup* domainGroup,
+    unsigned int simulationID, SphereCalculator* sphCalc)
+    :domainGroup(domainGroup), simulationID(simulationID), sphCalc(sphCalc),
+    domainIndex(domainGroup->getDomainIndex()),
+    domainCount(domainGroup->getDomainCount()), timeout(60000), runActive(false),
+    run(0), step(0), interactionRange(0), otherDomainsDisplacement(0),
+    haloWarningShown(false), ownedSphereCount(0), spheresReordered(false),
+    clientIndices(), migrants(domainCount), migrantIndices(domainCount),
+    ghosts(domainCount), ghostIndices(domainCount), emigrantGhosts(),
+    emigrantGhostIndices(), receivedGhosts(), receivedGhostIndices(),
+    clientOrder(), orderedSpheres(), sendBuffer(), message(),
+    frameSpheres(domainCount)
+{
+}
+
+DomainSimulation::~DomainSimulation()
+{
+    if (domainIndex == 0)
+    {
+        if (runActive)
+        {
+            // the spheres of the other domains are not needed anymore
+            domainGroup->sendToAll(simulationID, DomainMessages::runEnd, run, step,
+                std::string());
+        }
+        domainGroup->sendToAll(simulationID, DomainMessages::closeSimulation, run,
+            step, std::string());
+    }
+    domainGroup->discard(simulationID);
+}
+
+unsigned int DomainSimulation::getDomainOfPosition(const Vector3& pos) const
+{
+    if (!(sphCalc->boxSize(0) > 0))
+    {
+        return 0;
+    }
+    Scalar relativePosition = pos(0)/sphCalc->boxSize(0)*domainCount;
+    if (!(relativePosition > 0))
+    {
+        return 0;
+    }
+    if (relativePosition >= domainCount)
+    {
+        return domainCount-1;
+    }
+    return (unsigned int)relativePosition;
+}
+
+Scalar DomainSimulation::getMaximumDisplacement(unsigned int sphereCount) const
+{
+    const std::vector<Sphere>& spheres = sphCalc->spheres;
+    const Scalar timeStep = sphCalc->timeStep;
+    Scalar maximumDisplacement = 0;
+    for (unsigned int i = 0; i<sphereCount; i++)
+    {
+        const Sphere& sphere = spheres[i];
+        maximumDisplacement = fmax(maximumDisplacement,
+            fabs(sphere.speed(0))*timeStep
+            + 0.5*fabs(sphere.acc(0))*timeStep*timeStep);
+    }
+    return maximumDisplacement;
+}
+
+std::vector<unsigned int>& DomainSimulation::getClientIndices()
+{
+    const unsigned int sphereCount = (runActive ? ownedSphereCount
+        : sphCalc->spheres.size());
+    if (clientIndices.size() != sphereCount)
+    {
+        // between runs, the spheres of the coordinator are in client order
+        clientIndices.resize(sphereCount);
+        for (unsigned int i = 0; i<sphereCount; i++)
+        {
+            clientIndices[i] = i;
+        }
+    }
+    return clientIndices;
+}
+
+void DomainSimulation::restoreClientOrder()
+{
+    std::vector<Sphere>& spheres = sphCalc->spheres;
+    const unsigned int sphereCount = spheres.size();
+    clientOrder.resize(sphereCount);
+    for (unsigned int i = 0; i<sphereCount; i++)
+    {
+        clientOrder[i] = i;
+    }
+    // sorted instead of placed, so lost spheres only leave the order shorter
+    std::sort(clientOrder.begin(), clientOrder.end(),
+        [this](unsigned int a, unsigned int b)
+        {
+            return clientIndices[a] < clientIndices[b];
+        });
+    orderedSpheres.resize(sphereCount);
+    for (unsigned int i = 0; i<sphereCount; i++)
+    {
+        orderedSpheres[i] = spheres[clientOrder[i]];
+    }
+    spheres.swap(orderedSpheres);
+    clientIndices.clear();
+}
+
+void DomainSimulation::writeSpheres(ByteWriter& writer, const Sphere* spheres,
+    const unsigned int* sphereClientIndices, unsigned int count)
+{
+    writer.writeInt(count);
+    for (unsigned int i = 0; i<count; i++)
+    {
+        const Sphere& sphere = spheres[i];
+        writer.writeInt(sphereClientIndices[i]);
+        writer.writeDouble(sphere.radius);
+        writer.writeDouble(sphere.mass);
+        writer.writeVector3(sphere.pos);
+        writer.writeVector3(sphere.speed);
+        writer.writeVector3(sphere.acc);
+    }
+}
+
+bool DomainSimulation::readSpheres(ByteReader& reader, std::vector<Sphere>& spheres,
+    std::vector<unsigned int>& sphereClientIndices)
+{
+    unsigned int count = reader.readInt();
+    if (!reader.isGood() || count > reader.getRemainingSize()/encodedSphereSize)
+    {
+        return false;
+    }
+    Sphere sphere;
+    for (unsigned int i = 0; i<count; i++)
+    {
+        sphereClientIndices.push_back(reader.readInt());
+        sphere.radius = reader.readDouble();
+        sphere.mass = reader.readDouble();
+        sphere.pos = reader.readVector3();
+        sphere.speed = reader.readVector3();
+        sphere.acc = reader.readVector3();
+        spheres.push_back(sphere);
+    }
+    return reader.isGood();
+}
+
+void DomainSimulation::beginRun()
+{
+    std::vector<Sphere>& spheres = sphCalc->spheres;
+    const unsigned int sphereCount = spheres.size();
+    // the spheres may have been sorted into slabs already
+    std::vector<unsigned int>& indices = getClientIndices();
+    run++;
+    step = 0;
+    domainGroup->discard(simulationID);
+
+    // contacts reach two radii; the movement is added to the halo every step
+    Scalar maximumRadius = 0;
+    for (unsigned int i = 0; i<sphereCount; i++)
+    {
+        maximumRadius = fmax(maximumRadius, spheres[i].radius);
+    }
+    interactionRange = 2*maximumRadius;
+    if (sphCalc->lennardJonesPotential)
+    {
+        interactionRange = fmax(interactionRange, 2.5*sphCalc->lenJonPotSigma);
+    }
+    // all spheres are still here, so the coordinator knows all displacements
+    otherDomainsDisplacement = getMaximumDisplacement(sphereCount);
+    haloWarningShown = false;
+    if (run == 1 && sphCalc->lennardJonesPotential)
+    {
+        Console()<<Console::red<<Console::bold<<"DomainSimulation: "
+            "Lennard-Jones forces between spheres of different domains are "
+            "cut off at 2.5 sigma.\n";
+    }
+    if (run == 1 && sphCalc->integratorMethod == IntegratorMethods::ImexEuler)
+    {
+        Console()<<Console::red<<Console::bold<<"DomainSimulation: the "
+            "implicit contacts are only solved within the domains and their "
+            "halos.\n";
+    }
+
+    for (unsigned int domain = 0; domain<domainCount; domain++)
+    {
+        migrants[domain].clear();
+        migrantIndices[domain].clear();
+    }
+    unsigned int keptSphereCount = 0;
+    for (unsigned int i = 0; i<sphereCount; i++)
+    {
+        unsigned int domain = getDomainOfPosition(spheres[i].pos);
+        if (domain == domainIndex)
+        {
+            indices[keptSphereCount] = indices[i];
+            spheres[keptSphereCount++] = spheres[i];
+        }
+        else
+        {
+            migrants[domain].push_back(spheres[i]);
+            migrantIndices[domain].push_back(indices[i]);
+        }
+    }
+    spheres.resize(keptSphereCount);
+    indices.resize(keptSphereCount);
+    for (unsigned int domain = 0; domain<domainCount; domain++)
+    {
+        if (domain == domainIndex)
+        {
+            continue;
+        }
+        ByteWriter writer(sendBuffer);
+        writer.writeDouble(interactionRange);
+        writer.writeDouble(otherDomainsDisplacement);
+        writeSpheres(writer, migrants[domain].data(), migrantIndices[domain].data(),
+            migrants[domain].size());
+        domainGroup->send(domain, simulationID, DomainMessages::runStart, run, 0,
+            sendBuffer);
+        frameSpheres[domain].clear();
+    }
+    ownedSphereCount = keptSphereCount;
+    spheresReordered = true;
+    runActive = true;
+}
+
+bool DomainSimulation::takeRun()
+{
+    if (!domainGroup->receive(simulationID, 0, 1u<<DomainMessages::runStart, 0,
+        message, 0))
+    {
+        return false;
+    }
+    std::vector<Sphere>& spheres = sphCalc->spheres;
+    ByteReader reader(message.data);
+    interactionRange = reader.readDouble();
+    otherDomainsDisplacement = reader.readDouble();
+    haloWarningShown = false;
+    spheres.clear();
+    clientIndices.clear();
+    if (!readSpheres(reader, spheres, clientIndices))
+    {
+        Console()<<Console::red<<Console::bold
+            <<"DomainSimulation: incomplete run start.\n";
+    }
+    run = message.run;
+    step = 0;
+    ownedSphereCount = spheres.size();
+    spheresReordered = true;
+    runActive = true;
+    return true;
+}
+
+void DomainSimulation::endRun()
+{
+    // no further steps until the coordinator starts the next run; the
+    // coordinator only starts it after gathering these spheres
+    sphCalc->workQueue->stopSimulation();
+    domainGroup->discard(simulationID);
+    std::vector<Sphere>& spheres = sphCalc->spheres;
+    ByteWriter writer(sendBuffer);
+    writeSpheres(writer, spheres.data(), clientIndices.data(), spheres.size());
+    domainGroup->send(0, simulationID, DomainMessages::gather, run, step,
+        sendBuffer);
+    spheres.clear();
+    clientIndices.clear();
+    ownedSphereCount = 0;
+    runActive = false;
+    sphCalc->updateSphereArrays(true);
+}
+
+void DomainSimulation::abortRun(unsigned int domain)
+{
+    Console()<<Console::red<<Console::bold<<"DomainSimulation: domain "<<domain
+        <<" does not respond, ending the run.\n";
+    if (domainIndex == 0)
+    {
+        sphCalc->workQueue->stopSimulation();
+        finishRun();
+    }
+    else
+    {
+        endRun();
+    }
+}
+
+void DomainSimulation::restoreSpheres(unsigned int keptSphereCount)
+{
+    std::vector<Sphere>& spheres = sphCalc->spheres;
+    spheres.resize(keptSphereCount);
+    spheres.insert(spheres.end(), emigrantGhosts.begin(), emigrantGhosts.end());
+    clientIndices.resize(keptSphereCount);
+    clientIndices.insert(clientIndices.end(), emigrantGhostIndices.begin(),
+        emigrantGhostIndices.end());
+    ownedSphereCount = spheres.size();
+}
+
+bool DomainSimulation::beginStep()
+{
+    if (runActive == false)
+    {
+        if (domainIndex == 0)
+        {
+            if (sphCalc->gravityCalculation)
+            {
+                // gravity reaches all spheres, the halos cannot hold them
+                Console()<<Console::red<<Console::bold<<"DomainSimulation: "
+                    "gravity cannot be calculated across domains, switch it "
+                    "off to simulate.\n";
+                sphCalc->workQueue->stopSimulation();
+                return false;
+            }
+            beginRun();
+        }
+        else if (takeRun() == false)
+        {
+            return false;
+        }
+    }
+
+    std::vector<Sphere>& spheres = sphCalc->spheres;
+    const bool periodicBoundaries = sphCalc->periodicBoundaryConditions;
+    const Scalar domainWidth = sphCalc->boxSize(0)/domainCount;
+    const Scalar lowerBound = domainIndex*domainWidth;
+    const Scalar upperBound = lowerBound+domainWidth;
+    // the neighbour is the domain itself if there is none
+    const unsigned int lowerDomain = (domainIndex > 0 ? domainIndex-1
+        : (periodicBoundaries ? domainCount-1 : 0));
+    const unsigned int upperDomain = (domainIndex+1 < domainCount ? domainIndex+1
+        : (periodicBoundaries ? 0 : domainIndex));
+    // ghosts are sent at the beginning of the step, and both they and the
+    // spheres they meet move on within it; the displacements of the other
+    // domains are known from their exchange of the last step. Every force
+    // pass of the step carries the forces one interaction range further, so
+    // the ghosts next to the domain keep all their neighbours
+    const Scalar ownDisplacement = getMaximumDisplacement(ownedSphereCount);
+    const Scalar haloWidth = sphCalc->getForcePassCount()*(interactionRange
+        +2*fmax(ownDisplacement, otherDomainsDisplacement));
+    if (haloWidth > domainWidth && haloWarningShown == false)
+    {
+        Console()<<Console::red<<Console::bold<<"DomainSimulation: the "
+            "domains are narrower than the halo, the forces near their "
+            "boundaries are inexact.\n";
+        haloWarningShown = true;
+    }
+    for (unsigned int domain = 0; domain<domainCount; domain++)
+    {
+        migrants[domain].clear();
+        migrantIndices[domain].clear();
+        ghosts[domain].clear();
+        ghostIndices[domain].clear();
+    }
+    emigrantGhosts.clear();
+    emigrantGhostIndices.clear();
+    receivedGhosts.clear();
+    receivedGhostIndices.clear();
+
+    // ghosts keep their positions, the periodic boundaries are handled by the
+    // force calculation
+    unsigned int keptSphereCount = 0;
+    for (unsigned int i = 0; i<ownedSphereCount; i++)
+    {
+        const Sphere& sphere = spheres[i];
+        const unsigned int clientIndex = clientIndices[i];
+        unsigned int domain = getDomainOfPosition(sphere.pos);
+        if (domain != domainIndex)
+        {
+            // the new domain does not send it as ghost in this step yet
+            migrants[domain].push_back(sphere);
+            migrantIndices[domain].push_back(clientIndex);
+            emigrantGhosts.push_back(sphere);
+            emigrantGhostIndices.push_back(clientIndex);
+            continue;
+        }
+        bool nearLowerBound = (sphere.pos(0) < lowerBound+haloWidth);
+        if (lowerDomain != domainIndex && nearLowerBound)
+        {
+            ghosts[lowerDomain].push_back(sphere);
+            ghostIndices[lowerDomain].push_back(clientIndex);
+        }
+        if (upperDomain != domainIndex && sphere.pos(0) >= upperBound-haloWidth
+            && (upperDomain != lowerDomain || !nearLowerBound))
+        {
+            ghosts[upperDomain].push_back(sphere);
+            ghostIndices[upperDomain].push_back(clientIndex);
+        }
+        clientIndices[keptSphereCount] = clientIndex;
+        spheres[keptSphereCount++] = sphere;
+    }
+    bool reordered = (emigrantGhosts.empty() == false);
+
+    const Scalar timeStep = sphCalc->timeStep;
+    for (unsigned int domain = 0; domain<domainCount; domain++)
+    {
+        if (domain == domainIndex)
+        {
+            continue;
+        }
+        ByteWriter writer(sendBuffer);
+        writer.writeDouble(timeStep);
+        writer.writeDouble(ownDisplacement);
+        writeSpheres(writer, migrants[domain].data(), migrantIndices[domain].data(),
+            migrants[domain].size());
+        writeSpheres(writer, ghosts[domain].data(), ghostIndices[domain].data(),
+            ghosts[domain].size());
+        domainGroup->send(domain, simulationID, DomainMessages::exchange, run, step,
+            sendBuffer);
+    }
+    spheres.resize(keptSphereCount);
+    clientIndices.resize(keptSphereCount);
+
+    // the coordinator comes first, so a run end is seen before any spheres
+    // are taken from the other domains
+    otherDomainsDisplacement = 0;
+    for (unsigned int domain = 0; domain<domainCount; domain++)
+    {
+        if (domain == domainIndex)
+        {
+            continue;
+        }
+        unsigned int typeMask = 1u<<DomainMessages::exchange;
+        if (domain == 0)
+        {
+            typeMask |= 1u<<DomainMessages::runEnd;
+        }
+        if (!domainGroup->receive(simulationID, domain, typeMask, run, message,
+            timeout))
+        {
+            restoreSpheres(keptSphereCount);
+            abortRun(domain);
+            return false;
+        }
+        if (message.type == DomainMessages::runEnd)
+        {
+            restoreSpheres(keptSphereCount);
+            endRun();
+            return false;
+        }
+        ByteReader reader(message.data);
+        Scalar coordinatorTimeStep = reader.readDouble();
+        otherDomainsDisplacement = fmax(otherDomainsDisplacement,
+            reader.readDouble());
+        unsigned int previousSphereCount = spheres.size();
+        if (!readSpheres(reader, spheres, clientIndices)
+            || !readSpheres(reader, receivedGhosts, receivedGhostIndices))
+        {
+            Console()<<Console::red<<Console::bold
+                <<"DomainSimulation: incomplete exchange from domain "<<domain<<".\n";
+        }
+        reordered = reordered || (spheres.size() != previousSphereCount);
+        if (domain == 0)
+        {
+            sphCalc->simulatedSystem->set(SimulationVariables::timeStep,
+                (double)coordinatorTimeStep);
+        }
+    }
+
+    ownedSphereCount = spheres.size();
+    spheres.insert(spheres.end(), receivedGhosts.begin(), receivedGhosts.end());
+    spheres.insert(spheres.end(), emigrantGhosts.begin(), emigrantGhosts.end());
+    spheresReordered = spheresReordered || reordered;
+    sphCalc->updateSphereArrays(reordered);
+    return true;
+}
+
+Scalar DomainSimulation::agreeStepError(const std::vector<Scalar>& sphereStepErrors)
+{
+    Scalar stepError = 0;
+    for (unsigned int i = 0; i<ownedSphereCount; i++)
+    {
+        stepError = fmax(stepError, sphereStepErrors[i]);
+    }
+    if (runActive == false)
+    {
+        return stepError;
+    }
+    ByteWriter writer(sendBuffer);
+    writer.writeDouble(stepError);
+    domainGroup->sendToAll(simulationID, DomainMessages::stepError, run, step,
+        sendBuffer);
+    for (unsigned int domain = 0; domain<domainCount; domain++)
+    {
+        if (domain == domainIndex)
+        {
+            continue;
+        }
+        // the run is aborted by the exchange of the next step
+        if (!domainGroup->receive(simulationID, domain,
+            1u<<DomainMessages::stepError, run, message, timeout))
+        {
+            Console()<<Console::red<<Console::bold<<"DomainSimulation: no step "
+                "error from domain "<<domain<<".\n";
+            continue;
+        }
+        ByteReader reader(message.data);
+        Scalar domainStepError = reader.readDouble();
+        if (reader.isGood())
+        {
+            stepError = fmax(stepError, domainStepError);
+        }
+    }
+    return stepError;
+}
+
+void DomainSimulation::finishStep()
+{
+    if (runActive)
+    {
+        sphCalc->spheres.resize(ownedSphereCount);
+        step++;
+    }
+}
+
+void DomainSimulation::finishRun()
+{
+    if (runActive == false || domainIndex != 0)
+    {
+        return;
+    }
+    domainGroup->sendToAll(simulationID, DomainMessages::runEnd, run, step,
+        std::string());
+    std::vector<Sphere>& spheres = sphCalc->spheres;
+    for (unsigned int domain = 1; domain<domainCount; domain++)
+    {
+        if (!domainGroup->receive(simulationID, domain, 1u<<DomainMessages::gather,
+            run, message, timeout))
+        {
+            Console()<<Console::red<<Console::bold<<"DomainSimulation: the "
+                "spheres of domain "<<domain<<" are lost.\n";
+            continue;
+        }
+        ByteReader reader(message.data);
+        if (!readSpheres(reader, spheres, clientIndices))
+        {
+            Console()<<Console::red<<Console::bold
+                <<"DomainSimulation: incomplete spheres from domain "<<domain<<".\n";
+        }
+    }
+    restoreClientOrder();
+    runActive = false;
+    ownedSphereCount = spheres.size();
+    domainGroup->discard(simulationID);
+    sphCalc->updateSphereArrays(true);
+    sphCalc->getAndUpdateSphereCount();
+}
+
+void DomainSimulation::sendFrameSpheres()
+{
+    if (runActive == false || domainIndex == 0)
+    {
+        return;
+    }
+    const std::vector<Sphere>& spheres = sphCalc->spheres;
+    ByteWriter writer(sendBuffer);
+    writer.writeChar(spheresReordered ? 1 : 0);
+    writer.writeInt(ownedSphereCount);
+    for (unsigned int i = 0; i<ownedSphereCount; i++)
+    {
+        writer.writeDouble(spheres[i].radius);
+        writer.writeVector3(spheres[i].pos);
+    }
+    domainGroup->send(0, simulationID, DomainMessages::frameSpheres, run, step,
+        sendBuffer);
+    spheresReordered = false;
+}
+
+bool DomainSimulation::appendFrameSpheres(std::vector<Scalar>& radii,
+    std::vector<Vector3>& positions)
+{
+    if (runActive == false || domainIndex != 0)
+    {
+        return false;
+    }
+    bool reordered = spheresReordered;
+    spheresReordered = false;
+    for (unsigned int domain = 1; domain<domainCount; domain++)
+    {
+        // older frames are kept until the domain sends a new one
+        bool received = domainGroup->receiveLatest(simulationID, domain,
+            DomainMessages::frameSpheres, frameSpheres[domain]);
+        ByteReader reader(frameSpheres[domain]);
+        bool domainReordered = (reader.readChar() != 0);
+        unsigned int count = reader.readInt();
+        if (!reader.isGood() || count > reader.getRemainingSize()/(4*sizeof(double)))
+        {
+            continue;
+        }
+        reordered = reordered || (received && domainReordered);
+        for (unsigned int i = 0; i<count; i++)
+        {
+            radii.push_back(reader.readDouble());
+            positions.push_back(reader.readVector3());
+        }
+    }
+    return reordered;
+}
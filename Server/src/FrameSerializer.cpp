@@ -0,0 +1,93 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#include "FrameSerializer.hpp"
+#include "Actions.hpp"
+#include "ByteBuffer.hpp"
+
+using namespace SphereSim;
+
+FrameSerializer::FrameSerializer()
+    :writingSnapshot(new FrameSnapshot()), pendingSnapshot(new FrameSnapshot()),
+    serializingSnapshot(new FrameSnapshot()), snapshotPending(false),
+    keyframePending(false), stopping(false), mutex(), snapshotCondition(),
+    frameEncoder(), thread()
+{
+    thread = std::thread(&FrameSerializer::serializeLoop, this);
+}
+
+FrameSerializer::~FrameSerializer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    snapshotCondition.notify_one();
+    thread.join();
+    delete writingSnapshot;
+    delete pendingSnapshot;
+    delete serializingSnapshot;
+}
+
+void FrameSerializer::publishSnapshot()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // a replaced pending snapshot may have changed the selection
+        keyframePending = (keyframePending || writingSnapshot->selectionChanged);
+        std::swap(writingSnapshot, pendingSnapshot);
+        snapshotPending = true;
+    }
+    snapshotCondition.notify_one();
+}
+
+void FrameSerializer::serializeLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        while (snapshotPending == false && stopping == false)
+        {
+            snapshotCondition.wait(lock);
+        }
+        if (stopping)
+        {
+            return;
+        }
+        std::swap(pendingSnapshot, serializingSnapshot);
+        snapshotPending = false;
+        bool keyframe = keyframePending;
+        keyframePending = false;
+        lock.unlock();
+        serialize(*serializingSnapshot, keyframe);
+        lock.lock();
+    }
+}
+
+void FrameSerializer::serialize(const FrameSnapshot& snapshot, bool keyframe)
+{
+    if (keyframe)
+    {
+        // the sphere indices of the frames refer to other spheres now
+        frameEncoder.requestKeyframe();
+    }
+    size_t frameSize = frameEncoder.prepare(snapshot.frameCounter,
+        snapshot.boxSize, snapshot.radii.size(), snapshot.radii.data(),
+        snapshot.positions.data());
+    const size_t headerSize = ServerStatusReplies::headerSize;
+    MessageBuffer message = MessageBuffer::allocate(headerSize+frameSize);
+    if (!message.isValid())
+    {
+        // the client does not know the prepared state
+        frameEncoder.requestKeyframe();
+        return;
+    }
+    ByteWriter writer(message.getData()+headerSize, frameSize);
+    frameEncoder.write(writer);
+    emit frameToSend(message);
+}
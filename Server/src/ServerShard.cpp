@@ -0,0 +1,165 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#include "ServerShard.hpp"
+#include "ActionReceiver.hpp"
+#include "Actions.hpp"
+#include "ByteBuffer.hpp"
+#include "Console.hpp"
+#include "MessageTransmitter.hpp"
+
+#include <cstring>
+#include <nanomsg/pubsub.h>
+
+using namespace SphereSim;
+
+ServerShard::ServerShard(unsigned int shardIndex, unsigned int shardCount,
+    unsigned int serverID, const std::string& requestAddress,
+    const std::string& replyAddress, const std::string& frameAddress,
+    TaskScheduler* taskScheduler, DomainGroup* domainGroup)
+    :shardIndex(shardIndex), shardCount(shardCount), serverID(serverID),
+    requestAddress(requestAddress), replyAddress(replyAddress),
+    frameAddress(frameAddress), sendSocket(AF_SP, NN_PUB),
+    recvSocket(AF_SP, NN_SUB), frameSocket(AF_SP, NN_PUB),
+    messageTransmitter(nullptr), actionReceivers(), taskScheduler(taskScheduler),
+    domainGroup(domainGroup), disconnectionTimer(nullptr)
+{
+}
+
+ServerShard::~ServerShard()
+{
+    stop();
+}
+
+unsigned int ServerShard::getShardIndex(unsigned int simulationID,
+    unsigned int shardCount)
+{
+    // simulation IDs are odd, so the lowest bit does not distribute
+    return ((simulationID & 0xff)>>1)%shardCount;
+}
+
+void ServerShard::start()
+{
+    sendSocket.connect(replyAddress.c_str());
+    frameSocket.connect(frameAddress.c_str());
+    recvSocket.connect(requestAddress.c_str());
+    // IDs are sent little-endian, so the first byte of a request decides its
+    // shard; other servers' requests (even IDs) are not subscribed
+    for (unsigned int firstByte = 1; firstByte<256; firstByte += 2)
+    {
+        if (getShardIndex(firstByte, shardCount) == shardIndex)
+        {
+            char prefix = (char)firstByte;
+            recvSocket.setsockopt(NN_SUB, NN_SUB_SUBSCRIBE, &prefix, 1);
+        }
+    }
+    messageTransmitter = new MessageTransmitter(&sendSocket, &recvSocket);
+    connect(messageTransmitter, SIGNAL(processData(const char*, size_t)),
+        SLOT(receiveRequest(const char*, size_t)), Qt::DirectConnection);
+    disconnectionTimer = new QTimer(this);
+    connect(disconnectionTimer, SIGNAL(timeout()), SLOT(disconnectionCheck()));
+    messageTransmitter->start();
+    disconnectionTimer->start(5000);
+}
+
+void ServerShard::stop()
+{
+    for (ActionReceiverMap::iterator it = actionReceivers.begin();
+        it != actionReceivers.end(); ++it)
+    {
+        delete &(*it->second);
+    }
+    actionReceivers.clear();
+    if (disconnectionTimer != nullptr)
+    {
+        delete disconnectionTimer;
+        disconnectionTimer = nullptr;
+    }
+    if (messageTransmitter != nullptr)
+    {
+        delete messageTransmitter;
+        messageTransmitter = nullptr;
+    }
+}
+
+void ServerShard::receiveRequest(const char* request, size_t size)
+{
+    ByteReader reader(request, size);
+    unsigned int simulationID = reader.readInt();
+    unsigned int senderID = reader.readInt();
+    if (!reader.isGood() || (senderID & 1) != 1)
+    {
+        // other servers of a domain group use their own sockets
+        return;
+    }
+    ActionReceiver* actionReceiver;
+    ActionReceiverMap::iterator it = actionReceivers.find(simulationID);
+    if (it != actionReceivers.end())
+    {
+        actionReceiver = it->second;
+    }
+    else
+    {
+        Console()<<"Registering simulation ID "<<std::hex<<simulationID
+            <<" in shard "<<std::dec<<shardIndex<<".\n";
+        actionReceiver = new ActionReceiver(simulationID, taskScheduler, domainGroup);
+        connect(actionReceiver,
+            SIGNAL(sendMessage(unsigned int, unsigned short, MessageBuffer)),
+            SLOT(sendMessage(unsigned int, unsigned short, MessageBuffer)));
+#ifndef NDEBUG
+        connect(actionReceiver, SIGNAL(terminateServer()),
+            SIGNAL(terminateServer()));
+#endif /*NDEBUG*/
+        actionReceivers.emplace(simulationID, actionReceiver);
+    }
+    actionReceiver->processRequest(reader.getCurrent(), reader.getRemainingSize());
+}
+
+void ServerShard::sendMessage(unsigned int simulationID,
+    unsigned short serverStatus, MessageBuffer message)
+{
+    if (actionReceivers.count(simulationID) == 0 || (simulationID & 1) != 1)
+    {
+        Console()<<Console::red<<Console::bold<<"Bad simulation ID reply.\n";
+        return;
+    }
+    // the header is written in front of the data, which is not copied again
+    char* data = message.getData();
+    if (data == nullptr)
+    {
+        return;
+    }
+    ByteOrder::store<unsigned int>(&data[0], simulationID);
+    ByteOrder::store<unsigned int>(&data[4], serverID);
+    ByteOrder::store<unsigned short>(&data[8], serverStatus);
+    if (serverStatus == ServerStatusReplies::sendFrame
+        || serverStatus == ServerStatusReplies::sharedFrameWritten)
+    {
+        MessageTransmitter::sendMessage(&frameSocket, message);
+        return;
+    }
+    MessageTransmitter::sendMessage(&sendSocket, message);
+}
+
+void ServerShard::disconnectionCheck()
+{
+    for (ActionReceiverMap::iterator it = actionReceivers.begin();
+        it != actionReceivers.end(); )
+    {
+        if (it->second->hasReceivedRequests() == false)
+        {
+            Console()<<"Deregistering simulation ID "<<std::hex<<it->first<<".\n";
+            delete &(*it->second);
+            it = actionReceivers.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
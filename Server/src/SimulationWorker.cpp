@@ -12,28 +12,37 @@
 #include "ActionReceiver.hpp"
 #include "Version.hpp"
 #include "Connection.hpp"
+#include "ByteBuffer.hpp"
 #include "DataTransmit.hpp"
 
 #include <QCoreApplication>
-#include <sstream>
+#include <QElapsedTimer>
 
 using namespace SphereSim;
 
 SimulationWorker::SimulationWorker(SphereCalculator* sphCalc, WorkQueue* queue,
     ActionReceiver* actRcv)
     :sphCalc(sphCalc), actRcv(actRcv), running(true), queue(queue),
-    hasFinished(false)
+    hasFinished(false), stepBatchSize(1), targetBatchTime(1000000),
+    batchTimer(new QElapsedTimer()), replyData()
 {
 }
 
+SimulationWorker::~SimulationWorker()
+{
+    delete batchTimer;
+}
+
 void SimulationWorker::work()
 {
     WorkQueueItem* workQueueItem;
     while (running)
     {
+        // steps come in batches, so this loop runs at most about once per
+        // targetBatchTime during a simulation
         workQueueItem = queue->popItem();
         handleAction(workQueueItem);
-        delete workQueueItem;
+        queue->releaseItem(workQueueItem);
         workQueueItem = nullptr;
         QCoreApplication::processEvents();
     }
@@ -59,12 +68,15 @@ void SimulationWorker::handleAction(WorkQueueItem* workQueueItem)
         handleBasicAction(workQueueItem);
         break;
     case ActionGroups::spheresUpdating:
+        // distributed spheres are gathered first
+        sphCalc->finishDistributedRun();
         handleSpheresUpdatingAction(workQueueItem);
         break;
     case ActionGroups::calculation:
         handleCalculationAction(workQueueItem);
         break;
     case ActionGroups::information:
+        sphCalc->finishDistributedRun();
         handleInformationAction(workQueueItem);
         break;
     case ActionGroups::workQueue:
@@ -78,23 +90,29 @@ void SimulationWorker::handleAction(WorkQueueItem* workQueueItem)
 
 void SimulationWorker::handleBasicAction(WorkQueueItem* workQueueItem)
 {
-    std::istringstream stream(workQueueItem->data);
+    ByteReader reader(workQueueItem->data);
     std::string varData;
     SimulationVariables::Variable var;
     unsigned short _var;
     switch (workQueueItem->action)
     {
     case BasicActions::terminateServer:
-        emit sendReply(ServerStatusReplies::terminating, "Server terminating...");
+        reply(ServerStatusReplies::terminating, "Server terminating...");
         emit actRcv->terminateServer();
         break;
     case BasicActions::updateVariable:
-        _var = readShort(stream);
+        _var = reader.readShort();
         var = (SimulationVariables::Variable)_var;
-        varData = workQueueItem->data.substr(2);
+        varData.assign(reader.getCurrent(), reader.getRemainingSize());
         sphCalc->simulatedSystem->receiveVariable(var, varData);
         break;
     case BasicActions::heartbeat:
+        if (workQueueItem->data.size() >= 5)
+        {
+            unsigned char bufferLevel = reader.readChar();
+            unsigned int receivedFrames = reader.readInt();
+            queue->updateFramePacing(bufferLevel, receivedFrames);
+        }
         break;
     default:
         handleUnknownAction(workQueueItem);
@@ -106,57 +124,57 @@ void SimulationWorker::handleSpheresUpdatingAction(WorkQueueItem* workQueueItem)
 {
     unsigned short i;
     Sphere s;
-    std::istringstream stream(workQueueItem->data);
-    std::ostringstream retStream;
+    ByteReader reader(workQueueItem->data);
+    ByteWriter writer(replyData);
     Scalar s1, s2;
     switch (workQueueItem->action)
     {
     case SpheresUpdatingActions::addSphere:
-        writeShort(retStream, sphCalc->addSphere());
-        emit sendReply(ServerStatusReplies::acknowledge, retStream.str());
+        writer.writeShort(sphCalc->addSphere());
+        reply(ServerStatusReplies::acknowledge, replyData);
         break;
     case SpheresUpdatingActions::removeLastSphere:
-        writeShort(retStream, sphCalc->removeLastSphere());
-        emit sendReply(ServerStatusReplies::acknowledge, retStream.str());
+        writer.writeShort(sphCalc->removeLastSphere());
+        reply(ServerStatusReplies::acknowledge, replyData);
         break;
     case SpheresUpdatingActions::updateSphere:
-        i = readShort(stream);
-        readAllSphereData(stream, s);
+        i = reader.readShort();
+        readAllSphereData(reader, s);
         sphCalc->updateSphere(i, s);
         break;
     case SpheresUpdatingActions::getBasicSphereData:
-        i = readShort(stream);
+        i = reader.readShort();
         s = sphCalc->getAllSphereData(i);
-        writeBasicSphereData(retStream, s);
-        emit sendReply(ServerStatusReplies::acknowledge, retStream.str());
+        writeBasicSphereData(writer, s);
+        reply(ServerStatusReplies::acknowledge, replyData);
         break;
     case SpheresUpdatingActions::getAllSphereData:
-        i = readShort(stream);
+        i = reader.readShort();
         s = sphCalc->getAllSphereData(i);
-        writeAllSphereData(retStream, s);
-        emit sendReply(ServerStatusReplies::acknowledge, retStream.str());
+        writeAllSphereData(writer, s);
+        reply(ServerStatusReplies::acknowledge, replyData);
         break;
     case SpheresUpdatingActions::addSomeSpheres:
-        i = readShort(stream);
-        writeShort(retStream, sphCalc->addSomeSpheres(i));
-        emit sendReply(ServerStatusReplies::acknowledge, retStream.str());
+        i = reader.readShort();
+        writer.writeShort(sphCalc->addSomeSpheres(i));
+        reply(ServerStatusReplies::acknowledge, replyData);
         break;
     case SpheresUpdatingActions::removeSomeLastSpheres:
-        i = readShort(stream);
-        writeShort(retStream, sphCalc->removeSomeLastSpheres(i));
-        emit sendReply(ServerStatusReplies::acknowledge, retStream.str());
+        i = reader.readShort();
+        writer.writeShort(sphCalc->removeSomeLastSpheres(i));
+        reply(ServerStatusReplies::acknowledge, replyData);
         break;
     case SpheresUpdatingActions::updateSpherePositionsInBox:
-        s1 = readDouble(stream);
-        s2 = readDouble(stream);
+        s1 = reader.readDouble();
+        s2 = reader.readDouble();
         sphCalc->updateSpherePositionsInBox(s1, s2);
         break;
     case SpheresUpdatingActions::updateAllSpheres:
-        readAllSphereData(stream, s);
+        readAllSphereData(reader, s);
         sphCalc->updateAllSpheres(s);
         break;
     case SpheresUpdatingActions::updateKineticEnergy:
-        s1 = readDouble(stream);
+        s1 = reader.readDouble();
         sphCalc->updateKineticEnergy(s1);
         break;
     default:
@@ -167,22 +185,33 @@ void SimulationWorker::handleSpheresUpdatingAction(WorkQueueItem* workQueueItem)
 
 void SimulationWorker::handleCalculationAction(WorkQueueItem* workQueueItem)
 {
-    std::istringstream stream(workQueueItem->data);
-    std::ostringstream retStream;
+    ByteReader reader(workQueueItem->data);
+    ByteWriter writer(replyData);
     switch (workQueueItem->action)
     {
     case CalculationActions::popCalculationCounter:
-        writeInt(retStream, sphCalc->popCalculationCounter());
-        emit sendReply(ServerStatusReplies::acknowledge, retStream.str());
+        writer.writeInt(sphCalc->popCalculationCounter());
+        reply(ServerStatusReplies::acknowledge, replyData);
         break;
     case CalculationActions::popStepCounter:
-        writeInt(retStream, sphCalc->popStepCounter());
-        emit sendReply(ServerStatusReplies::acknowledge, retStream.str());
+        writer.writeInt(sphCalc->popStepCounter());
+        reply(ServerStatusReplies::acknowledge, replyData);
         break;
     case CalculationActions::getLastStepCalculationTime:
-        writeInt(retStream, sphCalc->getLastStepCalculationTime());
-        emit sendReply(ServerStatusReplies::acknowledge, retStream.str());
+        writer.writeInt(sphCalc->getLastStepCalculationTime());
+        reply(ServerStatusReplies::acknowledge, replyData);
         break;
+    case CalculationActions::popPhaseCalculationTimes:
+    {
+        std::vector<unsigned int> times = sphCalc->popPhaseCalculationTimes();
+        writer.writeInt(times.size());
+        for (unsigned int i = 0; i<times.size(); i++)
+        {
+            writer.writeInt(times[i]);
+        }
+        reply(ServerStatusReplies::acknowledge, replyData);
+        break;
+    }
     default:
         handleUnknownAction(workQueueItem);
         break;
@@ -191,17 +220,17 @@ void SimulationWorker::handleCalculationAction(WorkQueueItem* workQueueItem)
 
 void SimulationWorker::handleInformationAction(WorkQueueItem* workQueueItem)
 {
-    std::istringstream stream(workQueueItem->data);
-    std::ostringstream retStream;
+    ByteReader reader(workQueueItem->data);
+    ByteWriter writer(replyData);
     switch (workQueueItem->action)
     {
     case InformationActions::getTotalEnergy:
-        writeDouble(retStream, sphCalc->getTotalEnergy());
-        emit sendReply(ServerStatusReplies::acknowledge, retStream.str());
+        writer.writeDouble(sphCalc->getTotalEnergy());
+        reply(ServerStatusReplies::acknowledge, replyData);
         break;
     case InformationActions::getKineticEnergy:
-        writeDouble(retStream, sphCalc->getKineticEnergy());
-        emit sendReply(ServerStatusReplies::acknowledge, retStream.str());
+        writer.writeDouble(sphCalc->getKineticEnergy());
+        reply(ServerStatusReplies::acknowledge, replyData);
         break;
     default:
         handleUnknownAction(workQueueItem);
@@ -220,7 +249,11 @@ void SimulationWorker::handleWorkQueueAction(WorkQueueItem* workQueueItem)
         sphCalc->prepareFrameData();
         break;
     case WorkQueueActions::calculateStep:
-        sphCalc->integrateRungeKuttaStep();
+        calculateStepBatch();
+        break;
+    case WorkQueueActions::finishSimulation:
+        sphCalc->sendAdaptedTimeStep();
+        sphCalc->finishDistributedRun();
         break;
     default:
         handleUnknownAction(workQueueItem);
@@ -228,16 +261,56 @@ void SimulationWorker::handleWorkQueueAction(WorkQueueItem* workQueueItem)
     }
 }
 
+void SimulationWorker::calculateStepBatch()
+{
+    // the popped item stands for the first step of the batch
+    unsigned int steps = 1 + queue->takeSimulationSteps(stepBatchSize-1);
+    batchTimer->start();
+    for (unsigned int step = 0; step<steps; step++)
+    {
+        sphCalc->integrateRungeKuttaStep();
+    }
+    if (steps < stepBatchSize)
+    {
+        // the requested steps ran out, the measurement is not representative
+        sphCalc->sendAdaptedTimeStep();
+        return;
+    }
+    long long batchTime = batchTimer->nsecsElapsed();
+    long long stepTime = (batchTime > 0 ? batchTime/steps : 1);
+    stepTime = (stepTime > 0 ? stepTime : 1);
+    unsigned long long idealBatchSize = targetBatchTime/stepTime;
+    // grow slowly, shrink at once
+    if (idealBatchSize > 2ull*stepBatchSize)
+    {
+        idealBatchSize = 2ull*stepBatchSize;
+    }
+    if (idealBatchSize > 65536)
+    {
+        idealBatchSize = 65536;
+    }
+    stepBatchSize = (idealBatchSize > 0 ? idealBatchSize : 1);
+}
+
+void SimulationWorker::reply(unsigned short serverStatus, const std::string& data)
+{
+    MessageBuffer message = ActionReceiver::createReply(data);
+    if (message.isValid())
+    {
+        emit sendReply(serverStatus, message);
+    }
+}
+
 void SimulationWorker::handleUnknownActionGroup(WorkQueueItem* workQueueItem)
 {
     Console()<<"SimulationWorker: Warning: received unknown action group "
         <<(int)workQueueItem->actionGroup<<'|'<<(int)workQueueItem->action<<".\n";
-    emit sendReply(ServerStatusReplies::unknownActionGroup, "unknown action group");
+    reply(ServerStatusReplies::unknownActionGroup, "unknown action group");
 }
 
 void SimulationWorker::handleUnknownAction(WorkQueueItem* workQueueItem)
 {
     Console()<<"SimulationWorker: Warning: received unknown action "
         <<(int)workQueueItem->actionGroup<<'|'<<(int)workQueueItem->action<<".\n";
-    emit sendReply(ServerStatusReplies::unknownAction, "unknown action");
+    reply(ServerStatusReplies::unknownAction, "unknown action");
 }
@@ -9,25 +9,23 @@
 #include "SphereCalculator.hpp"
 #include "SimulationWorker.hpp"
 #include "WorkQueue.hpp"
+#include "FrameSerializer.hpp"
 #include "Console.hpp"
 #include "DataTransmit.hpp"
 #include "ActionReceiver.hpp"
+#include "DomainSimulation.hpp"
+#include "SphereSorting.hpp"
 
 #include <QThread>
 #include <QTimer>
 #include <QElapsedTimer>
 #include <QCoreApplication>
+#include <atomic>
 #include <cmath>
 #include <random>
 #include <chrono>
 #include <sstream>
-
-#ifndef NO_OPENMP
-    #define NO_OPENMP 0
-#endif /*NO_OPENMP*/
-#if NO_OPENMP != 1
-    #include <omp.h>
-#endif /*NO_OPENMP != 1*/
+#include <utility>
 
 #define POW4(x) ((x)*(x)*(x)*(x))
 #define POW5(x) ((x)*(x)*(x)*(x)*(x))
@@ -36,12 +34,57 @@
 
 using namespace SphereSim;
 
+/** \brief Product of a symmetric 3x3 matrix, given as upper triangle (xx, xy,
+ * xz, yy, yz, zz), and a vector. */
+static inline Vector3 multiplySymmetricMatrix(const Scalar* matrix,
+    const Vector3& vector)
+{
+    return Vector3(matrix[0]*vector(0) + matrix[1]*vector(1) + matrix[2]*vector(2),
+        matrix[1]*vector(0) + matrix[3]*vector(1) + matrix[4]*vector(2),
+        matrix[2]*vector(0) + matrix[4]*vector(1) + matrix[5]*vector(2));
+}
+
+/** \brief Invert a symmetric 3x3 matrix, given as upper triangle, in place
+ * with its adjugate matrix. */
+static inline void invertSymmetricMatrix(Scalar* matrix)
+{
+    const Scalar c00 = matrix[3]*matrix[5] - matrix[4]*matrix[4];
+    const Scalar c01 = matrix[2]*matrix[4] - matrix[1]*matrix[5];
+    const Scalar c02 = matrix[1]*matrix[4] - matrix[2]*matrix[3];
+    const Scalar c11 = matrix[0]*matrix[5] - matrix[2]*matrix[2];
+    const Scalar c12 = matrix[1]*matrix[2] - matrix[0]*matrix[4];
+    const Scalar c22 = matrix[0]*matrix[3] - matrix[1]*matrix[1];
+    const Scalar inverseDeterminant = 1/(matrix[0]*c00 + matrix[1]*c01
+        + matrix[2]*c02);
+    matrix[0] = c00*inverseDeterminant;
+    matrix[1] = c01*inverseDeterminant;
+    matrix[2] = c02*inverseDeterminant;
+    matrix[3] = c11*inverseDeterminant;
+    matrix[4] = c12*inverseDeterminant;
+    matrix[5] = c22*inverseDeterminant;
+}
+
 SphereCalculator::SphereCalculator(ActionReceiver* actRcv,
-    SimulatedSystem *simulatedSystem)
-    :spheres(), newSpherePos(), butcherTableau(), calculationCounter(0),
+    SimulatedSystem *simulatedSystem, TaskScheduler* taskScheduler,
+    DomainGroup* domainGroup, unsigned int simulationID)
+    :spheres(), stagePositions(), nextStagePositions(), stageSpeeds(),
+    stageAccelerations(), symplecticStepWeights(), cellListWindowBegin(0),
+    cellListWindowEnd(1), accelerationsValid(false), sphereStepLevels(),
+    sphereUpdateTimes(), sphereStepErrors(), sphereStepsFinished(),
+    sphereCountPerStepLevel(), newSpheres(),
+    maxStepLevel(16), levelDecreaseSafetyFactor(0.5), shortRangeAccelerations(),
+    longRangeAccelerations(), respaInnerRadius(2.0),
+    maximumImplicitContactIterations(1000), implicitContactTolerance(1.0e-6),
+    lastStepError(1.0),
+    lastStepRejected(false), adaptedTimeStepUnsent(false), calculationCounter(0),
     stepCounter(0), frameCounter(0), simulatedSystem(simulatedSystem),
     simulationThread(nullptr), workQueueMutex(nullptr), workQueue(nullptr),
-    simulationWorker(nullptr),
+    simulationWorker(nullptr), frameSerializer(nullptr), domainSimulation(nullptr),
+    sphereSorting(nullptr), frameSphereIndices(),
+    frameSendsAllSpheres(true), frameSelectionInterval(60),
+    framesSinceFrameSelection(0), frameSelectionSphereCount(0),
+    frameSelectionMaximumSphereCount(0), frameSelectionMinimumRadius(0),
+    frameCandidateIndices(), frameCandidateRanks(), frameCellSphereCounts(),
     sphereBoxSize(0, 0, 0), sphereBoxPosition(0, 0, 0), cellCount(8),
     cellCount3((unsigned int)cellCount*cellCount*cellCount),
     maxSpheresPerCell(1024), maxCellsPerSphere(1024),
@@ -62,7 +105,14 @@ SphereCalculator::SphereCalculator(ActionReceiver* actRcv,
     maxPairwiseCellsPerGravityCell(gravityCellCount3), pairwiseCellsPerGravityCell(
         maxPairwiseCellsPerGravityCell, gravityAllCellCount),
     gravityCellIndexOfSpheres(nullptr), sphereCountPerGravityCell(nullptr),
-    lastStepCalculationTime(0), elapsedTimer(nullptr),
+    lastStepCalculationTime(0), elapsedTimer(nullptr), phaseTimer(nullptr),
+    taskAccount(taskScheduler->createAccount()), forcePassCost(), updatePassCost(),
+    cellListPassCost(), gravityCellListPassCost(), cellSortPassCost(),
+    gravityCellDataPassCost(), sphereBoxPassCost(),
+    sphereBoxBlockCount(4*taskScheduler->getThreadCount()), sphereBoxBlockMinima(),
+    sphereBoxBlockMaxima(), implicitContactPassCost(),
+    implicitContactInverseMatrices(), implicitContactBlockSums(),
+    phaseCalculationTimes(),
     sphereCount(simulatedSystem->getRef<unsigned int>(SimulationVariables::sphereCount)),
     timeStep(simulatedSystem->getRef<Scalar>(SimulationVariables::timeStep)),
     integratorMethod(simulatedSystem->getRef<unsigned int>(
@@ -103,29 +153,50 @@ SphereCalculator::SphereCalculator(ActionReceiver* actRcv,
         SimulationVariables::lenJonPotEpsilon)),
     lenJonPotSigma(simulatedSystem->getRef<Scalar>(
         SimulationVariables::lenJonPotSigma)),
+    respaStepRatio(simulatedSystem->getRef<unsigned int>(
+        SimulationVariables::respaStepRatio)),
+    adaptiveTimeStep(simulatedSystem->getRef<bool>(
+        SimulationVariables::adaptiveTimeStep)),
+    rejectedStepCount(simulatedSystem->getRef<unsigned int>(
+        SimulationVariables::rejectedStepCount)),
+    simulationWeight(simulatedSystem->getRef<unsigned int>(
+        SimulationVariables::simulationWeight)),
+    simulationPriority(simulatedSystem->getRef<unsigned int>(
+        SimulationVariables::simulationPriority)),
+    maximumFrameSphereCount(simulatedSystem->getRef<unsigned int>(
+        SimulationVariables::maximumFrameSphereCount)),
+    minimumFrameSphereRadius(simulatedSystem->getRef<Scalar>(
+        SimulationVariables::minimumFrameSphereRadius)),
+    spatialSorting(simulatedSystem->getRef<bool>(
+        SimulationVariables::spatialSorting)),
     sphereSphereE(0), sphereWallE(0), isSimulationThreadDestroyed(false)
 {
     Console()<<"SphereCalculator: constructor called.\n";
-#if NO_OPENMP != 1
-    unsigned short ompThreads = 0;
-    _Pragma("omp parallel")
-    _Pragma("omp atomic")
-    ompThreads++;
-    Console()<<"SphereCalculator: number of OpenMP threads: "
-        <<omp_get_num_threads()<<"|"<<ompThreads<<".\n";
-#endif /*NO_OPENMP != 1*/
+    Console()<<"SphereCalculator: number of pool threads: "
+        <<taskScheduler->getThreadCount()<<".\n";
 
     simulationThread = new QThread();
     workQueueMutex = new QMutex();
     workQueue = new WorkQueue(workQueueMutex,
-        simulatedSystem->getRef<bool>(SimulationVariables::frameSending));
+        simulatedSystem->getRef<bool>(SimulationVariables::frameSending),
+        simulatedSystem->getRef<unsigned int>(SimulationVariables::frameRate));
     simulationWorker = new SimulationWorker(this, workQueue, actRcv);
+    frameSerializer = new FrameSerializer();
     elapsedTimer = new QElapsedTimer();
+    phaseTimer = new QElapsedTimer();
+    if (domainGroup != nullptr && domainGroup->getDomainCount() > 1)
+    {
+        domainSimulation = new DomainSimulation(domainGroup, simulationID, this);
+    }
+    sphereSorting = new SphereSorting(this, taskAccount,
+        taskScheduler->getThreadCount(), domainSimulation == nullptr);
 
     startUp();
 
     QObject::connect(simulatedSystem, SIGNAL(variableUpdated(int)),
         SLOT(variableUpdated(int)));
+    QObject::connect(frameSerializer, SIGNAL(frameToSend(MessageBuffer)),
+        SIGNAL(frameToSend(MessageBuffer)));
 
     simulationWorker->moveToThread(simulationThread);
     QObject::connect(simulationThread, SIGNAL(started()),
@@ -143,8 +214,8 @@ SphereCalculator::SphereCalculator(ActionReceiver* actRcv,
     QObject::connect(this, SIGNAL(requestingWorkerStop()),
         workQueue, SLOT(stop()));
     QObject::connect(simulationWorker,
-        SIGNAL(sendReply(unsigned short, std::string)),
-        actRcv, SLOT(sendReply(unsigned short, std::string)));
+        SIGNAL(sendReply(unsigned short, MessageBuffer)),
+        actRcv, SLOT(sendReply(unsigned short, MessageBuffer)));
     simulationThread->start();
 }
 
@@ -156,8 +227,14 @@ SphereCalculator::~SphereCalculator()
     {
     }
     delete simulationWorker;
+    // the worker does not use it anymore
+    delete domainSimulation;
+    delete sphereSorting;
+    delete frameSerializer;
     delete workQueue;
     delete elapsedTimer;
+    delete phaseTimer;
+    delete taskAccount;
     while (isSimulationThreadDestroyed == false)
     {
         QCoreApplication::processEvents();
@@ -176,31 +253,40 @@ unsigned short SphereCalculator::getAndUpdateSphereCount()
 }
 
 template <bool detectCollisions, bool gravity, bool lennardJonesPotential,
-    bool periodicBoundaries>
-Vector3 SphereCalculator::sphereAcceleration(unsigned short sphereIndex, Sphere sphere,
-    Scalar timeDiff)
+    bool periodicBoundaries, SphereCalculator::ForceRange forceRange>
+Vector3 SphereCalculator::sphereAcceleration(unsigned short sphereIndex,
+    const Vector3& spherePos)
 {
+    Sphere sphere = spheres[sphereIndex];
+    sphere.pos = spherePos;
     Scalar d, forceNorm;
     Vector3 force, acc, dVec, dNormalized;
     unsigned short sphereIndex2;
     Vector3 sphere2Pos;
     Scalar sphere2Radius;
 
-    force.set_ax(sphere.mass, earthGravity);
-    for (unsigned char dim = 0; dim<3; dim++)
+    if (forceRange == longRangeForces)
     {
-        if ((d = (sphere.radius - sphere.pos(dim))) > 0)
-        {
-            forceNorm = 4.0/3.0*sphereWallE*sqrt(sphere.radius*d*d*d);
-            force(dim) += forceNorm;
-        }
-        if ((d = (sphere.radius + sphere.pos(dim) - boxSize(dim))) > 0)
+        force.setZero();
+    }
+    else
+    {
+        force.set_ax(sphere.mass, earthGravity);
+        for (unsigned char dim = 0; dim<3; dim++)
         {
-            forceNorm = 4.0/3.0*sphereWallE*sqrt(sphere.radius*d*d*d);
-            force(dim) -= forceNorm;
+            if ((d = (sphere.radius - sphere.pos(dim))) > 0)
+            {
+                forceNorm = 4.0/3.0*sphereWallE*sqrt(sphere.radius*d*d*d);
+                force(dim) += forceNorm;
+            }
+            if ((d = (sphere.radius + sphere.pos(dim) - boxSize(dim))) > 0)
+            {
+                forceNorm = 4.0/3.0*sphereWallE*sqrt(sphere.radius*d*d*d);
+                force(dim) -= forceNorm;
+            }
         }
     }
-    if (detectCollisions)
+    if (detectCollisions && forceRange != longRangeForces)
     {
         unsigned int cellIndex;
         Scalar bothRadii, dOverlapping, R;
@@ -216,9 +302,7 @@ Vector3 SphereCalculator::sphereAcceleration(unsigned short sphereIndex, Sphere
                     if (collidingSpheresPerSphere.addElementIfNotContained(
                         sphereIndex, sphereIndex2))
                     {
-                        sphere2Pos.set_axpy(timeDiff, spheres[sphereIndex2].speed,
-                            spheres[sphereIndex2].pos);
-                            // + 0.5*sphere2.acc*timeDiff*timeDiff;
+                        sphere2Pos = stagePositions[sphereIndex2];
                         sphere2Radius = spheres[sphereIndex2].radius;
                         dVec = sphere2Pos;
                         dVec -= sphere.pos;
@@ -239,7 +323,8 @@ Vector3 SphereCalculator::sphereAcceleration(unsigned short sphereIndex, Sphere
         }
     }
 
-    if (gravity || lennardJonesPotential)
+    // only the Lennard-Jones potential has a short range part
+    if ((gravity && forceRange != shortRangeForces) || lennardJonesPotential)
     {
         unsigned int gravityCellIndex = gravityCellCount3
             + gravityCellIndexOfSpheres[sphereIndex];
@@ -262,9 +347,7 @@ Vector3 SphereCalculator::sphereAcceleration(unsigned short sphereIndex, Sphere
                 {
                     continue;
                 }
-                sphere2Pos.set_axpy(timeDiff, spheres[sphereIndex2].speed,
-                    spheres[sphereIndex2].pos);
-                    // + 0.5*sphere2.acc*timeDiff*timeDiff;
+                sphere2Pos = stagePositions[sphereIndex2];
                 dVec = sphere2Pos;
                 dVec -= sphere.pos;
                 d = dVec.norm();
@@ -300,12 +383,14 @@ Vector3 SphereCalculator::sphereAcceleration(unsigned short sphereIndex, Sphere
                         }
                     }
                 }
-                if (gravity)
+                if (gravity && forceRange != shortRangeForces)
                 {
                     force.add_ax(gravitationalConstant * sphere.mass
                         * spheres[sphereIndex2].mass / d / d / d, dVec);
                 }
-                if (lennardJonesPotential)
+                if (lennardJonesPotential && (forceRange == allForces
+                    || (forceRange == shortRangeForces)
+                        == (d < respaInnerRadius*lenJonPotSigma)))
                 {
                     const Scalar pow2 = (lenJonPotSigma/d)*(lenJonPotSigma/d);
                     const Scalar pow8 = POW4(pow2);
@@ -315,7 +400,8 @@ Vector3 SphereCalculator::sphereAcceleration(unsigned short sphereIndex, Sphere
                 }
             }
         }
-        for (int i = approximatingCellsPerGravityCell.getCounter(gravityCellIndex)-1;
+        for (int i = (forceRange == shortRangeForces ? -1
+            : approximatingCellsPerGravityCell.getCounter(gravityCellIndex)-1);
             i>=0; i--)
         {
             gravityCellIndex2 =
@@ -350,8 +436,6 @@ Vector3 SphereCalculator::sphereAcceleration(unsigned short sphereIndex, Sphere
     }
 
     acc.set_ax(1/sphere.mass, force);
-    _Pragma("omp atomic")
-    calculationCounter++;
     return acc;
 }
 
@@ -511,6 +595,17 @@ Scalar SphereCalculator::getTotalEnergy_internal()
 
 void SphereCalculator::integrateRungeKuttaStep()
 {
+    if (spatialSorting)
+    {
+        // before the ghost spheres of a distributed simulation are appended
+        phaseTimer->start();
+        sphereSorting->sortSpheres();
+        finishPhase(CalculationPhases::spatialSorting);
+    }
+    if (domainSimulation != nullptr && domainSimulation->beginStep() == false)
+    {
+        return;
+    }
     elapsedTimer->start();
     if (collisionDetection)
     {
@@ -619,131 +714,893 @@ void SphereCalculator::integrateRungeKuttaStep()
         }
     }
     lastStepCalculationTime = elapsedTimer->elapsed()+1;
+    if (domainSimulation != nullptr)
+    {
+        domainSimulation->finishStep();
+    }
 }
 
 template <bool detectCollisions, bool gravity, bool lennardJonesPotential,
     bool periodicBoundaries>
 void SphereCalculator::integrateRungeKuttaStep_internal()
 {
+    taskAccount->setShare(simulationWeight, simulationPriority);
+    phaseTimer->start();
     if (detectCollisions || gravity || lennardJonesPotential)
     {
         updateSphereBox();
+        finishPhase(CalculationPhases::sphereBox);
     }
     if (detectCollisions)
     {
         updateSphereCellLists();
+        finishPhase(CalculationPhases::cellLists);
     }
     if (gravity || lennardJonesPotential)
     {
         updateSphereGravityCellLists();
+        finishPhase(CalculationPhases::gravityCellLists);
         updateGravityCellData();
+        finishPhase(CalculationPhases::gravityCellData);
     }
-    _Pragma("omp parallel for schedule(dynamic,1)")
-    for (unsigned short sphereIndex = 0; sphereIndex<spheres.size(); ++sphereIndex)
+    const unsigned int count = spheres.size();
+    stagePositions.resize(count);
+    nextStagePositions.resize(count);
+    switch (integratorMethod)
     {
-        newSpherePos[sphereIndex] = spheres[sphereIndex].pos;
-        integrateRungeKuttaStep_internal<detectCollisions, gravity,
-            lennardJonesPotential, periodicBoundaries>(sphereIndex, timeStep,
-            0.0, 0);
+    case IntegratorMethods::VelocityVerlet:
+    case IntegratorMethods::Yoshida4:
+        integrateSymplecticStep_internal<detectCollisions, gravity,
+            lennardJonesPotential, periodicBoundaries>();
+        break;
+    case IntegratorMethods::RespaVerlet:
+        integrateRespaStep_internal<detectCollisions, gravity,
+            lennardJonesPotential, periodicBoundaries>();
+        break;
+    case IntegratorMethods::ImexEuler:
+        integrateImexStep_internal<detectCollisions, gravity,
+            lennardJonesPotential, periodicBoundaries>();
+        break;
+    case IntegratorMethods::HeunEuler21:
+        integrateRungeKuttaStep_internal<ButcherTableau::HeunEuler21,
+            detectCollisions, gravity, lennardJonesPotential,
+            periodicBoundaries>();
+        break;
+    case IntegratorMethods::BogackiShampine32:
+        integrateRungeKuttaStep_internal<ButcherTableau::BogackiShampine32,
+            detectCollisions, gravity, lennardJonesPotential,
+            periodicBoundaries>();
+        break;
+    case IntegratorMethods::CashKarp54:
+        integrateRungeKuttaStep_internal<ButcherTableau::CashKarp54,
+            detectCollisions, gravity, lennardJonesPotential,
+            periodicBoundaries>();
+        break;
+    case IntegratorMethods::DormandPrince54:
+        integrateRungeKuttaStep_internal<ButcherTableau::DormandPrince54,
+            detectCollisions, gravity, lennardJonesPotential,
+            periodicBoundaries>();
+        break;
+    default:
+        integrateRungeKuttaStep_internal<ButcherTableau::RungeKuttaFehlberg54,
+            detectCollisions, gravity, lennardJonesPotential,
+            periodicBoundaries>();
+        break;
     }
-    _Pragma("omp parallel for schedule(dynamic,1)")
-    for (unsigned short sphereIndex = 0; sphereIndex<spheres.size(); ++sphereIndex)
-    {
-        if (periodicBoundaries)
+    finishPhase(CalculationPhases::integration);
+    stepCounter++;
+}
+
+template <typename Tableau, bool detectCollisions, bool gravity,
+    bool lennardJonesPotential, bool periodicBoundaries>
+void SphereCalculator::integrateRungeKuttaStep_internal()
+{
+    const unsigned int count = spheres.size();
+    // the adaptive time step replaces the time step levels
+    const unsigned char maximumLevel = (adaptiveTimeStep ? 0
+        : (maximumStepDivision < maxStepLevel ? maximumStepDivision : maxStepLevel));
+    // first same as last: the last stage is evaluated at the end of the step
+    const bool firstSameAsLast = ButcherTableau::IsFirstSameAsLast<Tableau>::value;
+    // doubling the step length multiplies the error by 2^errorOrder, so a
+    // sphere only moves to a coarser level if it stays well within the bound
+    const unsigned char errorOrder = Tableau::embeddedOrder+1;
+    const Scalar levelDecreaseStepError = levelDecreaseSafetyFactor/(1u<<errorOrder);
+    const bool reuseAccelerations = accelerationsValid;
+    accelerationsValid = false;
+    stageSpeeds.resize(Tableau::stages*count);
+    stageAccelerations.resize(Tableau::stages*count);
+    sphereStepLevels.resize(count, 0);
+    sphereUpdateTimes.assign(count, 0);
+    sphereStepErrors.assign(count, 0);
+    sphereStepsFinished.assign(count, 0);
+    sphereCountPerStepLevel.resize(maxStepLevel+1);
+    newSpheres.resize(count);
+
+    bool levelsRaised, stepRejected;
+    unsigned char finestLevel;
+    do
+    {
+        // only the unfinished spheres are integrated, the others are
+        // interpolated between the beginning and the end of the step
+        unsigned char usedLevel = 0;
+        for (unsigned char level = 0; level<=maxStepLevel; level++)
         {
-            Vector3 pos = newSpherePos[sphereIndex];
-            for (unsigned char dim = 0; dim<3; dim++)
+            sphereCountPerStepLevel[level] = 0;
+        }
+        for (unsigned int sphereIndex = 0; sphereIndex<count; sphereIndex++)
+        {
+            if (sphereStepsFinished[sphereIndex] == 0)
             {
-                if (pos(dim) > boxSize(dim))
+                unsigned char& level = sphereStepLevels[sphereIndex];
+                level = (level < maximumLevel ? level : maximumLevel);
+                usedLevel = (level > usedLevel ? level : usedLevel);
+                sphereCountPerStepLevel[level]++;
+            }
+        }
+
+        // spheres of level L start a new step at every 2^(usedLevel-L)-th tick
+        const unsigned int tickCount = 1u<<usedLevel;
+        const Scalar tickLength = timeStep/tickCount;
+        for (unsigned int tick = 0; tick<tickCount; tick++)
+        {
+            for (unsigned char level = 0; level<=usedLevel; level++)
+            {
+                if (tick % (1u<<(usedLevel-level)) == 0
+                    && sphereCountPerStepLevel[level] > 0)
                 {
-                    pos(dim) -= boxSize(dim);
+                    // at the first tick, all spheres are at the beginning of
+                    // the step
+                    integrateRungeKuttaLevel_internal<Tableau, detectCollisions,
+                        gravity, lennardJonesPotential, periodicBoundaries>(level,
+                        tick*tickLength, reuseAccelerations && tick == 0);
                 }
-                else if (pos(dim) < 0)
+            }
+        }
+
+        // too cheap to be worth a parallel loop; the spheres above the error
+        // bound repeat the step with a finer level, the others are finished
+        levelsRaised = false;
+        finestLevel = 0;
+        for (unsigned int sphereIndex = 0; sphereIndex<count; sphereIndex++)
+        {
+            unsigned char& level = sphereStepLevels[sphereIndex];
+            if (sphereStepsFinished[sphereIndex] == 0)
+            {
+                if (sphereStepErrors[sphereIndex] > 1 && level < maximumLevel)
+                {
+                    level++;
+                    sphereUpdateTimes[sphereIndex] = 0;
+                    sphereStepErrors[sphereIndex] = 0;
+                    levelsRaised = true;
+                }
+                else
                 {
-                    pos(dim) += boxSize(dim);
+                    sphereStepsFinished[sphereIndex] = 1;
                 }
             }
-            spheres[sphereIndex].pos = pos;
+            finestLevel = (level > finestLevel ? level : finestLevel);
+        }
+        stepRejected = false;
+        if (adaptiveTimeStep)
+        {
+            Scalar stepError = 0;
+            if (domainSimulation != nullptr)
+            {
+                // all domains have to accept or reject the step together
+                stepError = domainSimulation->agreeStepError(sphereStepErrors);
+            }
+            else
+            {
+                for (unsigned int sphereIndex = 0; sphereIndex<count; sphereIndex++)
+                {
+                    stepError = fmax(stepError, sphereStepErrors[sphereIndex]);
+                }
+            }
+            stepRejected = !updateAdaptiveTimeStep(stepError, errorOrder);
+            if (stepRejected)
+            {
+                // the shorter step starts again from the unchanged spheres
+                sphereUpdateTimes.assign(count, 0);
+                sphereStepErrors.assign(count, 0);
+                sphereStepsFinished.assign(count, 0);
+            }
+        }
+    }
+    while (levelsRaised || stepRejected);
+    // with a single level, the last stages of all spheres are evaluated at
+    // the same end positions
+    accelerationsValid = (firstSameAsLast && finestLevel == 0);
+
+    taskAccount->parallelFor(count, updatePassCost, [&](unsigned int sphereIndex)
+    {
+        if (sphereStepLevels[sphereIndex] > 0
+            && sphereStepErrors[sphereIndex] < levelDecreaseStepError)
+        {
+            sphereStepLevels[sphereIndex]--;
+        }
+        if (periodicBoundaries)
+        {
+            wrapPosition(newSpheres[sphereIndex].pos);
+        }
+    });
+    spheres.swap(newSpheres);
+}
+
+template <typename Tableau, bool detectCollisions, bool gravity,
+    bool lennardJonesPotential, bool periodicBoundaries>
+void SphereCalculator::integrateRungeKuttaLevel_internal(unsigned char level,
+    Scalar tickTime, bool reuseAccelerations)
+{
+    const unsigned int count = spheres.size();
+    const Scalar stepLength = timeStep/(1u<<level);
+
+    // the spheres of this level are at tickTime, all others are predicted
+    taskAccount->parallelFor(count, updatePassCost, [&](unsigned int sphereIndex)
+    {
+        stagePositions[sphereIndex] = predictSpherePosition(sphereIndex, tickTime);
+        stageSpeeds[sphereIndex] = getCurrentSphere(sphereIndex).speed;
+    });
+
+    integrateRungeKuttaStage_internal<Tableau, 0, detectCollisions, gravity,
+        lennardJonesPotential, periodicBoundaries>(level, tickTime, stepLength,
+        reuseAccelerations, std::integral_constant<bool, (1<Tableau::stages)>());
+
+    // last stage: combine all stages and estimate the error
+    const unsigned char lastStage = Tableau::stages-1;
+    Vector3* k_acc = &stageAccelerations[lastStage*count];
+    taskAccount->parallelFor(count, forcePassCost, [&](unsigned int sphereIndex)
+    {
+        if (sphereStepLevels[sphereIndex] != level
+            || sphereStepsFinished[sphereIndex] != 0)
+        {
+            return;
+        }
+        k_acc[sphereIndex] = sphereAcceleration<detectCollisions, gravity,
+            lennardJonesPotential, periodicBoundaries>(sphereIndex,
+            stagePositions[sphereIndex]);
+
+        const Sphere& sphere = getCurrentSphere(sphereIndex);
+        Vector3 pos = sphere.pos;
+        Vector3 pos_ = pos;
+        Vector3 speed = sphere.speed;
+        Vector3 speed_ = speed;
+        typedef ButcherTableau::RowB<Tableau> RowB;
+        typedef ButcherTableau::RowB_<Tableau> RowB_;
+        const Vector3* k_speed = &stageSpeeds[sphereIndex];
+        const Vector3* k_acc_all = &stageAccelerations[sphereIndex];
+        ButcherTableau::WeightedSum<RowB, Tableau::stages>::add(pos, stepLength,
+            k_speed, count);
+        ButcherTableau::WeightedSum<RowB, Tableau::stages>::add(speed, stepLength,
+            k_acc_all, count);
+        ButcherTableau::WeightedSum<RowB_, Tableau::stages>::add(pos_, stepLength,
+            k_speed, count);
+        ButcherTableau::WeightedSum<RowB_, Tableau::stages>::add(speed_, stepLength,
+            k_acc_all, count);
+
+        // relative error, 1 equals maximumStepError
+        Scalar error_pos_ = pos.distance(pos_);
+        Scalar error_speed_ = speed.distance(speed_);
+        Scalar stepError = sphereStepErrors[sphereIndex];
+        if (error_pos_ > 0)
+        {
+            stepError = fmax(stepError,
+                error_pos_/(pos.distance(sphere.pos)*maximumStepError));
+        }
+        if (error_speed_ > 0)
+        {
+            stepError = fmax(stepError,
+                error_speed_/(speed.distance(sphere.speed)*maximumStepError));
+        }
+        sphereStepErrors[sphereIndex] = stepError;
+
+        Vector3 acc;
+        if (ButcherTableau::IsFirstSameAsLast<Tableau>::value)
+        {
+            acc = k_acc[sphereIndex];
         }
         else
         {
-            spheres[sphereIndex].pos = newSpherePos[sphereIndex];
+            acc = speed;
+            acc -= sphere.speed;
+            acc *= 1/stepLength;
         }
+        // the spheres keep the state at the beginning of the step
+        Sphere& newSphere = newSpheres[sphereIndex];
+        if (sphereUpdateTimes[sphereIndex] == 0)
+        {
+            newSphere = sphere;
+        }
+        newSphere.acc = acc;
+        newSphere.pos = pos;
+        newSphere.speed = speed;
+        sphereUpdateTimes[sphereIndex] = tickTime+stepLength;
+    });
+    calculationCounter += (reuseAccelerations ? Tableau::stages-1 : Tableau::stages)
+        *sphereCountPerStepLevel[level];
+}
+
+template <typename Tableau, unsigned char stage, bool detectCollisions, bool gravity,
+    bool lennardJonesPotential, bool periodicBoundaries>
+void SphereCalculator::integrateRungeKuttaStage_internal(unsigned char level,
+    Scalar tickTime, Scalar stepLength, bool reuseAccelerations, std::true_type)
+{
+    // one force pass over the spheres of this level at the stage positions,
+    // each of them then predicts its own state for the next stage; all other
+    // spheres are predicted to the time of the next stage
+    const unsigned int count = spheres.size();
+    const Scalar nextStageTime = tickTime + Tableau::c[stage+1]*stepLength;
+    Vector3* k_acc = &stageAccelerations[stage*count];
+    taskAccount->parallelFor(count, forcePassCost, [&](unsigned int sphereIndex)
+    {
+        if (sphereStepLevels[sphereIndex] != level
+            || sphereStepsFinished[sphereIndex] != 0)
+        {
+            nextStagePositions[sphereIndex] = predictSpherePosition(sphereIndex,
+                nextStageTime);
+            return;
+        }
+        if (stage == 0 && reuseAccelerations)
+        {
+            k_acc[sphereIndex] = spheres[sphereIndex].acc;
+        }
+        else
+        {
+            k_acc[sphereIndex] = sphereAcceleration<detectCollisions, gravity,
+                lennardJonesPotential, periodicBoundaries>(sphereIndex,
+                stagePositions[sphereIndex]);
+        }
+
+        typedef ButcherTableau::RowA<Tableau, stage+1> Row;
+        const Sphere& sphere = getCurrentSphere(sphereIndex);
+        Vector3 pos = sphere.pos;
+        Vector3 speed = sphere.speed;
+        ButcherTableau::WeightedSum<Row, stage+1>::add(pos, stepLength,
+            &stageSpeeds[sphereIndex], count);
+        ButcherTableau::WeightedSum<Row, stage+1>::add(speed, stepLength,
+            &stageAccelerations[sphereIndex], count);
+        nextStagePositions[sphereIndex] = pos;
+        stageSpeeds[(stage+1)*count+sphereIndex] = speed;
+    });
+    stagePositions.swap(nextStagePositions);
+
+    integrateRungeKuttaStage_internal<Tableau, stage+1, detectCollisions, gravity,
+        lennardJonesPotential, periodicBoundaries>(level, tickTime, stepLength,
+        false, std::integral_constant<bool, (stage+2<Tableau::stages)>());
+}
+
+template <typename Tableau, unsigned char stage, bool detectCollisions, bool gravity,
+    bool lennardJonesPotential, bool periodicBoundaries>
+void SphereCalculator::integrateRungeKuttaStage_internal(unsigned char, Scalar,
+    Scalar, bool, std::false_type)
+{
+}
+
+template <bool detectCollisions, bool gravity, bool lennardJonesPotential,
+    bool periodicBoundaries>
+void SphereCalculator::integrateSymplecticStep_internal()
+{
+    const unsigned int count = spheres.size();
+    const unsigned char substepCount = symplecticStepWeights.size();
+
+    if (!accelerationsValid)
+    {
+        taskAccount->parallelFor(count, updatePassCost, [&](unsigned int sphereIndex)
+        {
+            stagePositions[sphereIndex] = spheres[sphereIndex].pos;
+        });
+        taskAccount->parallelFor(count, forcePassCost, [&](unsigned int sphereIndex)
+        {
+            spheres[sphereIndex].acc = sphereAcceleration<detectCollisions, gravity,
+                lennardJonesPotential, periodicBoundaries>(sphereIndex,
+                stagePositions[sphereIndex]);
+        });
+        calculationCounter += count;
+    }
+
+    // kick and drift of the first substep
+    Scalar stepLength = symplecticStepWeights[0]*timeStep;
+    taskAccount->parallelFor(count, updatePassCost, [&](unsigned int sphereIndex)
+    {
+        Sphere& sphere = spheres[sphereIndex];
+        sphere.speed.add_ax(stepLength/2, sphere.acc);
+        sphere.pos.add_ax(stepLength, sphere.speed);
+        stagePositions[sphereIndex] = sphere.pos;
+    });
+
+    // one force pass per substep: closing kick of this substep, followed by
+    // the kick and drift of the next one
+    for (unsigned char n = 0; n<substepCount; n++)
+    {
+        const Scalar nextStepLength = (n+1<substepCount
+            ? symplecticStepWeights[n+1]*timeStep : 0.0);
+        taskAccount->parallelFor(count, forcePassCost, [&](unsigned int sphereIndex)
+        {
+            Sphere& sphere = spheres[sphereIndex];
+            sphere.acc = sphereAcceleration<detectCollisions, gravity,
+                lennardJonesPotential, periodicBoundaries>(sphereIndex,
+                stagePositions[sphereIndex]);
+            sphere.speed.add_ax((stepLength+nextStepLength)/2, sphere.acc);
+            if (n+1<substepCount)
+            {
+                sphere.pos.add_ax(nextStepLength, sphere.speed);
+                nextStagePositions[sphereIndex] = sphere.pos;
+            }
+            else if (periodicBoundaries)
+            {
+                wrapPosition(sphere.pos);
+            }
+        });
+        stagePositions.swap(nextStagePositions);
+        calculationCounter += count;
+        stepLength = nextStepLength;
     }
-    stepCounter++;
+    accelerationsValid = true;
 }
 
 template <bool detectCollisions, bool gravity, bool lennardJonesPotential,
     bool periodicBoundaries>
-unsigned int SphereCalculator::integrateRungeKuttaStep_internal(unsigned short sphereIndex,
-    Scalar stepLength, Scalar timeDiff, unsigned short stepDivisionCounter)
+void SphereCalculator::integrateRespaStep_internal()
 {
-    Sphere sphere = spheres[sphereIndex];
-    sphere.pos = newSpherePos[sphereIndex];
-    Sphere origSphere = sphere;
-    const unsigned char integratorOrder = butcherTableau.order;
-    Vector3 k_acc[integratorOrder];
-    Vector3 k_speed[integratorOrder];
+    const unsigned int count = spheres.size();
+    const unsigned int innerStepCount = (respaStepRatio > 0 ? respaStepRatio : 1);
+    const Scalar stepLength = timeStep;
+    const Scalar innerStepLength = timeStep/innerStepCount;
+    shortRangeAccelerations.resize(count);
+    longRangeAccelerations.resize(count);
+
+    // the ghost spheres of a distributed simulation change every step, and
+    // their accelerations are kept by index
+    if (!accelerationsValid || domainSimulation != nullptr)
+    {
+        taskAccount->parallelFor(count, updatePassCost, [&](unsigned int sphereIndex)
+        {
+            stagePositions[sphereIndex] = spheres[sphereIndex].pos;
+        });
+        taskAccount->parallelFor(count, forcePassCost, [&](unsigned int sphereIndex)
+        {
+            shortRangeAccelerations[sphereIndex] = sphereAcceleration<
+                detectCollisions, gravity, lennardJonesPotential,
+                periodicBoundaries, shortRangeForces>(sphereIndex,
+                stagePositions[sphereIndex]);
+            longRangeAccelerations[sphereIndex] = sphereAcceleration<
+                detectCollisions, gravity, lennardJonesPotential,
+                periodicBoundaries, longRangeForces>(sphereIndex,
+                stagePositions[sphereIndex]);
+        });
+        calculationCounter += count;
+    }
+
+    // outer kick with the long range forces, then kick and drift of the first
+    // inner step
+    taskAccount->parallelFor(count, updatePassCost, [&](unsigned int sphereIndex)
+    {
+        Sphere& sphere = spheres[sphereIndex];
+        sphere.speed.add_ax(stepLength/2, longRangeAccelerations[sphereIndex]);
+        sphere.speed.add_ax(innerStepLength/2, shortRangeAccelerations[sphereIndex]);
+        sphere.pos.add_ax(innerStepLength, sphere.speed);
+        stagePositions[sphereIndex] = sphere.pos;
+    });
+
+    // inner steps: one short range force pass each
+    for (unsigned int n = 0; n<innerStepCount; n++)
+    {
+        const bool lastInnerStep = (n+1 == innerStepCount);
+        taskAccount->parallelFor(count, forcePassCost, [&](unsigned int sphereIndex)
+        {
+            Sphere& sphere = spheres[sphereIndex];
+            Vector3& acc = shortRangeAccelerations[sphereIndex];
+            acc = sphereAcceleration<detectCollisions, gravity,
+                lennardJonesPotential, periodicBoundaries, shortRangeForces>(
+                sphereIndex, stagePositions[sphereIndex]);
+            if (lastInnerStep)
+            {
+                sphere.speed.add_ax(innerStepLength/2, acc);
+            }
+            else
+            {
+                sphere.speed.add_ax(innerStepLength, acc);
+                sphere.pos.add_ax(innerStepLength, sphere.speed);
+                nextStagePositions[sphereIndex] = sphere.pos;
+            }
+        });
+        if (!lastInnerStep)
+        {
+            stagePositions.swap(nextStagePositions);
+        }
+        calculationCounter += count;
+    }
 
-    k_acc[0] = sphereAcceleration<detectCollisions, gravity, lennardJonesPotential,
-        periodicBoundaries>(sphereIndex, sphere, timeDiff);
-    k_speed[0] = sphere.speed;
-    for (unsigned char n = 1; n<integratorOrder; n++)
+    // closing outer kick with the long range forces at the new positions
+    taskAccount->parallelFor(count, forcePassCost, [&](unsigned int sphereIndex)
     {
-        sphere.pos = origSphere.pos;
-        for (unsigned char j = 0; j<n; j++)
+        Sphere& sphere = spheres[sphereIndex];
+        Vector3& acc = longRangeAccelerations[sphereIndex];
+        acc = sphereAcceleration<detectCollisions, gravity, lennardJonesPotential,
+            periodicBoundaries, longRangeForces>(sphereIndex,
+            stagePositions[sphereIndex]);
+        sphere.speed.add_ax(stepLength/2, acc);
+        sphere.acc = acc;
+        sphere.acc += shortRangeAccelerations[sphereIndex];
+        if (periodicBoundaries)
         {
-            sphere.pos.add_ax(stepLength*butcherTableau.a[n][j], k_speed[j]);
+            wrapPosition(sphere.pos);
         }
-        k_acc[n] = sphereAcceleration<detectCollisions, gravity,
-            lennardJonesPotential, periodicBoundaries>(sphereIndex, sphere,
-            timeDiff);
+    });
+    calculationCounter += count;
+    accelerationsValid = true;
+}
 
-        k_speed[n] = origSphere.speed;
-        for (unsigned char j = 0; j<n; j++)
+template <bool detectCollisions, bool gravity, bool lennardJonesPotential,
+    bool periodicBoundaries>
+void SphereCalculator::integrateImexStep_internal()
+{
+    const unsigned int count = spheres.size();
+    const Scalar stepLength = timeStep;
+    stageSpeeds.resize(5*count);
+    stageAccelerations.resize(count);
+    implicitContactInverseMatrices.resize(6*count);
+    Vector3* speeds = &stageSpeeds[0];
+    Vector3* residuals = &stageSpeeds[count];
+    Vector3* preconditionedResiduals = &stageSpeeds[2*count];
+    Vector3* directions = &stageSpeeds[3*count];
+    Vector3* matrixDirections = &stageSpeeds[4*count];
+    Scalar* inverseMatrices = &implicitContactInverseMatrices[0];
+    const unsigned int blockCount = (count < sphereBoxBlockCount ? count
+        : sphereBoxBlockCount);
+    implicitContactBlockSums.resize(2*blockCount);
+    Scalar* blockSums = &implicitContactBlockSums[0];
+
+    taskAccount->parallelFor(count, updatePassCost, [&](unsigned int sphereIndex)
+    {
+        stagePositions[sphereIndex] = spheres[sphereIndex].pos;
+        speeds[sphereIndex] = spheres[sphereIndex].speed;
+    });
+    // explicit part: all forces at the current positions
+    taskAccount->parallelFor(count, forcePassCost, [&](unsigned int sphereIndex)
+    {
+        stageAccelerations[sphereIndex] = sphereAcceleration<detectCollisions,
+            gravity, lennardJonesPotential, periodicBoundaries>(sphereIndex,
+            stagePositions[sphereIndex]);
+    });
+    calculationCounter += count;
+
+    // implicit part: the contact forces at the end of the step are linearized,
+    // (M + h^2 K) v' = M v + h F. The stiffness K couples the colliding
+    // spheres; the system is symmetric and positive definite, so it is solved
+    // by conjugate gradients from the current speeds, preconditioned with the
+    // 3x3 block of each sphere. The dot products are summed per block.
+    taskAccount->parallelFor(blockCount, implicitContactPassCost,
+        [&](unsigned int block)
+    {
+        const unsigned int begin = (unsigned long long)count*block/blockCount;
+        const unsigned int end = (unsigned long long)count*(block+1)/blockCount;
+        Scalar residualProduct = 0, rightSideProduct = 0;
+        Vector3 coupling, rightSide;
+        for (unsigned int sphereIndex = begin; sphereIndex<end; sphereIndex++)
+        {
+            const Sphere& sphere = spheres[sphereIndex];
+            Scalar* matrix = &inverseMatrices[6*sphereIndex];
+            contactStiffness<detectCollisions>(sphereIndex, stepLength, speeds,
+                matrix, coupling);
+            rightSide.set_axpy(stepLength, stageAccelerations[sphereIndex],
+                sphere.speed);
+            rightSide *= sphere.mass;
+            Vector3& residual = residuals[sphereIndex];
+            residual = rightSide;
+            residual += coupling;
+            residual -= multiplySymmetricMatrix(matrix, speeds[sphereIndex]);
+            invertSymmetricMatrix(matrix);
+            rightSideProduct += rightSide.dot(multiplySymmetricMatrix(matrix,
+                rightSide));
+            preconditionedResiduals[sphereIndex] = multiplySymmetricMatrix(matrix,
+                residual);
+            directions[sphereIndex] = preconditionedResiduals[sphereIndex];
+            residualProduct += residual.dot(preconditionedResiduals[sphereIndex]);
+        }
+        blockSums[2*block] = residualProduct;
+        blockSums[2*block+1] = rightSideProduct;
+    });
+    Scalar residualProduct = 0, rightSideProduct = 0;
+    for (unsigned int block = 0; block<blockCount; block++)
+    {
+        residualProduct += blockSums[2*block];
+        rightSideProduct += blockSums[2*block+1];
+    }
+    // the products are squared norms weighted with the inverse matrices
+    const Scalar toleratedProduct = implicitContactTolerance
+        *implicitContactTolerance*rightSideProduct;
+    for (unsigned short iteration = 0; iteration<maximumImplicitContactIterations
+        && residualProduct > toleratedProduct; iteration++)
+    {
+        taskAccount->parallelFor(blockCount, implicitContactPassCost,
+            [&](unsigned int block)
+        {
+            const unsigned int begin = (unsigned long long)count*block/blockCount;
+            const unsigned int end = (unsigned long long)count*(block+1)/blockCount;
+            Scalar directionProduct = 0;
+            Scalar matrix[6];
+            Vector3 coupling;
+            for (unsigned int sphereIndex = begin; sphereIndex<end; sphereIndex++)
+            {
+                contactStiffness<detectCollisions>(sphereIndex, stepLength,
+                    directions, matrix, coupling);
+                Vector3& matrixDirection = matrixDirections[sphereIndex];
+                matrixDirection = multiplySymmetricMatrix(matrix,
+                    directions[sphereIndex]);
+                matrixDirection -= coupling;
+                directionProduct += directions[sphereIndex].dot(matrixDirection);
+            }
+            blockSums[block] = directionProduct;
+        });
+        Scalar directionProduct = 0;
+        for (unsigned int block = 0; block<blockCount; block++)
+        {
+            directionProduct += blockSums[block];
+        }
+        if (!(directionProduct > 0))
+        {
+            break;
+        }
+        const Scalar stepSize = residualProduct/directionProduct;
+        taskAccount->parallelFor(blockCount, implicitContactPassCost,
+            [&](unsigned int block)
+        {
+            const unsigned int begin = (unsigned long long)count*block/blockCount;
+            const unsigned int end = (unsigned long long)count*(block+1)/blockCount;
+            Scalar newResidualProduct = 0;
+            for (unsigned int sphereIndex = begin; sphereIndex<end; sphereIndex++)
+            {
+                speeds[sphereIndex].add_ax(stepSize, directions[sphereIndex]);
+                residuals[sphereIndex].add_ax(-stepSize,
+                    matrixDirections[sphereIndex]);
+                preconditionedResiduals[sphereIndex] = multiplySymmetricMatrix(
+                    &inverseMatrices[6*sphereIndex], residuals[sphereIndex]);
+                newResidualProduct += residuals[sphereIndex].dot(
+                    preconditionedResiduals[sphereIndex]);
+            }
+            blockSums[block] = newResidualProduct;
+        });
+        Scalar newResidualProduct = 0;
+        for (unsigned int block = 0; block<blockCount; block++)
         {
-            k_speed[n].add_ax(stepLength*butcherTableau.a[n][j], k_acc[j]);
+            newResidualProduct += blockSums[block];
         }
+        const Scalar directionFactor = newResidualProduct/residualProduct;
+        residualProduct = newResidualProduct;
+        if (residualProduct <= toleratedProduct)
+        {
+            break;
+        }
+        taskAccount->parallelFor(count, updatePassCost, [&](unsigned int sphereIndex)
+        {
+            directions[sphereIndex].set_axpy(directionFactor,
+                directions[sphereIndex], preconditionedResiduals[sphereIndex]);
+        });
     }
 
-    Vector3 pos = origSphere.pos;
-    Vector3 pos_ = pos;
-    Vector3 speed = origSphere.speed;
-    Vector3 speed_ = speed;
-    for (unsigned char j = 0; j<integratorOrder; j++)
+    taskAccount->parallelFor(count, updatePassCost, [&](unsigned int sphereIndex)
+    {
+        Sphere& sphere = spheres[sphereIndex];
+        sphere.acc = speeds[sphereIndex];
+        sphere.acc -= sphere.speed;
+        sphere.acc *= 1/stepLength;
+        sphere.speed = speeds[sphereIndex];
+        sphere.pos.add_ax(stepLength, sphere.speed);
+        if (periodicBoundaries)
+        {
+            wrapPosition(sphere.pos);
+        }
+    });
+    // the stored accelerations are step averages
+    accelerationsValid = false;
+}
+
+template <bool detectCollisions>
+void SphereCalculator::contactStiffness(unsigned short sphereIndex,
+    Scalar stepLength, const Vector3* speeds, Scalar* matrix, Vector3& coupling)
+{
+    const Sphere& sphere = spheres[sphereIndex];
+    const Vector3& spherePos = stagePositions[sphereIndex];
+    const Scalar stepLength2 = stepLength*stepLength;
+    Scalar d, stiffness;
+    matrix[0] = sphere.mass;
+    matrix[1] = 0;
+    matrix[2] = 0;
+    matrix[3] = sphere.mass;
+    matrix[4] = 0;
+    matrix[5] = sphere.mass;
+    coupling.setZero();
+
+    // walls: derivative of 4/3*E*sqrt(r*d^3)
+    const unsigned char diagonal[3] = {0, 3, 5};
+    for (unsigned char dim = 0; dim<3; dim++)
     {
-        pos.add_ax(stepLength*butcherTableau.b[j], k_speed[j]);
-        pos_.add_ax(stepLength*butcherTableau.b_[j], k_speed[j]);
-        speed.add_ax(stepLength*butcherTableau.b[j], k_acc[j]);
-        speed_.add_ax(stepLength*butcherTableau.b_[j], k_acc[j]);
+        if ((d = (sphere.radius - spherePos(dim))) > 0)
+        {
+            matrix[diagonal[dim]] += stepLength2*2*sphereWallE*sqrt(sphere.radius*d);
+        }
+        if ((d = (sphere.radius + spherePos(dim) - boxSize(dim))) > 0)
+        {
+            matrix[diagonal[dim]] += stepLength2*2*sphereWallE*sqrt(sphere.radius*d);
+        }
+    }
+    if (detectCollisions)
+    {
+        unsigned short sphereIndex2;
+        Scalar sphere2Radius, bothRadii, R;
+        Vector3 dVec;
+        for (int i = collidingSpheresPerSphere.getCounter(sphereIndex)-1; i>=0; i--)
+        {
+            sphereIndex2 = collidingSpheresPerSphere[sphereIndex][i];
+            sphere2Radius = spheres[sphereIndex2].radius;
+            dVec = stagePositions[sphereIndex2];
+            dVec -= spherePos;
+            d = dVec.norm();
+            bothRadii = sphere2Radius + sphere.radius;
+            if (d < bothRadii)
+            {
+                // normal stiffness K = k*n*n^T, tangential terms are neglected
+                dVec *= 1/d;
+                R = 1/((1/sphere.radius)+(1/sphere2Radius));
+                stiffness = stepLength2*2*sphereSphereE*sqrt(R*(bothRadii - d));
+                matrix[0] += stiffness*dVec(0)*dVec(0);
+                matrix[1] += stiffness*dVec(0)*dVec(1);
+                matrix[2] += stiffness*dVec(0)*dVec(2);
+                matrix[3] += stiffness*dVec(1)*dVec(1);
+                matrix[4] += stiffness*dVec(1)*dVec(2);
+                matrix[5] += stiffness*dVec(2)*dVec(2);
+                coupling.add_ax(stiffness*dVec.dot(speeds[sphereIndex2]), dVec);
+            }
+        }
     }
+}
 
-    Vector3 dSpeed = speed;
-    dSpeed -= origSphere.speed;
-    Scalar dSpeedNorm = dSpeed.norm();
-    if (stepDivisionCounter < maximumStepDivision)
+bool SphereCalculator::updateAdaptiveTimeStep(Scalar stepError,
+    unsigned char errorOrder)
+{
+    const Scalar safetyFactor = 0.9;
+    const Scalar minimumFactor = 0.2;
+    const Scalar maximumFactor = 5.0;
+    // avoid infinite growth for steps without any error
+    stepError = fmax(stepError, 1.0e-4);
+    Scalar factor;
+    bool accepted = (stepError <= 1);
+    if (accepted)
+    {
+        // PI controller (Gustafsson): the integral part uses the current error,
+        // the proportional part the change since the last accepted step
+        factor = safetyFactor*pow(stepError, -0.7/errorOrder)
+            *pow(lastStepError, 0.4/errorOrder);
+        if (lastStepRejected)
+        {
+            // do not grow directly after a rejected step
+            factor = fmin(factor, 1.0);
+        }
+        lastStepError = stepError;
+    }
+    else
     {
-        Scalar error_pos_ = pos.distance(pos_);
-        Scalar error_speed_ = speed.distance(speed_);
-        Scalar dPosNorm = pos.distance(origSphere.pos);
-        if (error_pos_ > dPosNorm*maximumStepError
-            || error_speed_ > dSpeedNorm*maximumStepError)
-        {
-            unsigned int stepCount = 0;
-            stepCount += integrateRungeKuttaStep_internal<detectCollisions, gravity,
-                lennardJonesPotential, periodicBoundaries>(sphereIndex, stepLength/2,
-                timeDiff, stepDivisionCounter+1);
-            stepCount += integrateRungeKuttaStep_internal<detectCollisions, gravity,
-                lennardJonesPotential, periodicBoundaries>(sphereIndex, stepLength/2,
-                timeDiff+(stepLength/2), stepDivisionCounter+1);
-            spheres[sphereIndex].acc.set_ax(1/stepLength, dSpeed);
-            return stepCount;
-        }
-    }
-    newSpherePos[sphereIndex] = pos;
-    spheres[sphereIndex].speed = speed;
-    spheres[sphereIndex].acc.set_ax(1/stepLength, dSpeed);
-    return 1;
+        factor = safetyFactor*pow(stepError, -1.0/errorOrder);
+        simulatedSystem->set(SimulationVariables::rejectedStepCount,
+            rejectedStepCount+1);
+    }
+    lastStepRejected = !accepted;
+    factor = fmax(minimumFactor, fmin(maximumFactor, factor));
+    // the step changes after nearly every step, it is sent once per frame
+    simulatedSystem->setWithoutSending(SimulationVariables::timeStep,
+        (double)(timeStep*factor));
+    adaptedTimeStepUnsent = true;
+    return accepted;
+}
+
+void SphereCalculator::sendAdaptedTimeStep()
+{
+    if (adaptedTimeStepUnsent)
+    {
+        adaptedTimeStepUnsent = false;
+        simulatedSystem->sendVariable(SimulationVariables::timeStep);
+    }
+}
+
+Vector3 SphereCalculator::predictSpherePosition(unsigned int sphereIndex,
+    Scalar time) const
+{
+    const Scalar updateTime = sphereUpdateTimes[sphereIndex];
+    if (updateTime > time)
+    {
+        // a coarser or finished sphere is already ahead: interpolate (cubic
+        // Hermite) between the beginning of the step and its current state
+        // instead of predicting backwards
+        const Sphere& begin = spheres[sphereIndex];
+        const Sphere& end = newSpheres[sphereIndex];
+        const Scalar t = time/updateTime;
+        const Scalar t2 = t*t;
+        const Scalar t3 = t2*t;
+        Vector3 pos;
+        pos.set_ax(2*t3-3*t2+1, begin.pos);
+        pos.add_ax((t3-2*t2+t)*updateTime, begin.speed);
+        pos.add_ax(3*t2-2*t3, end.pos);
+        pos.add_ax((t3-t2)*updateTime, end.speed);
+        return pos;
+    }
+    const Sphere& sphere = getCurrentSphere(sphereIndex);
+    const Scalar timeDiff = time - updateTime;
+    Vector3 pos = sphere.pos;
+    pos.add_ax(timeDiff, sphere.speed);
+    pos.add_ax(0.5*timeDiff*timeDiff, sphere.acc);
+    return pos;
+}
+
+void SphereCalculator::wrapPosition(Vector3& pos)
+{
+    for (unsigned char dim = 0; dim<3; dim++)
+    {
+        if (pos(dim) > boxSize(dim))
+        {
+            pos(dim) -= boxSize(dim);
+        }
+        else if (pos(dim) < 0)
+        {
+            pos(dim) += boxSize(dim);
+        }
+    }
+}
+
+void SphereCalculator::updateSphereArrays(bool spheresReordered)
+{
+    if (spheresReordered)
+    {
+        sphereStepLevels.clear();
+        accelerationsValid = false;
+    }
+    cellIndicesOfSpheres.resize(spheres.size());
+    collidingSpheresPerSphere.resize(spheres.size());
+    updateGravityCellIndexOfSpheresArray();
+}
+
+unsigned int SphereCalculator::getForcePassCount() const
+{
+    // the accelerations at the beginning of the step are not always reused
+    unsigned int passCount = 1;
+    unsigned int stages = 0;
+    switch (integratorMethod)
+    {
+    case IntegratorMethods::VelocityVerlet:
+    case IntegratorMethods::Yoshida4:
+        return passCount+symplecticStepWeights.size();
+    case IntegratorMethods::RespaVerlet:
+        // the inner steps, then the long range forces at the end
+        return passCount+(respaStepRatio > 0 ? respaStepRatio : 1)+1;
+    case IntegratorMethods::ImexEuler:
+        return passCount+1;
+    case IntegratorMethods::HeunEuler21:
+        stages = ButcherTableau::HeunEuler21::stages;
+        break;
+    case IntegratorMethods::BogackiShampine32:
+        stages = ButcherTableau::BogackiShampine32::stages;
+        break;
+    case IntegratorMethods::CashKarp54:
+        stages = ButcherTableau::CashKarp54::stages;
+        break;
+    case IntegratorMethods::DormandPrince54:
+        stages = ButcherTableau::DormandPrince54::stages;
+        break;
+    case IntegratorMethods::RungeKuttaFehlberg54:
+        stages = ButcherTableau::RungeKuttaFehlberg54::stages;
+        break;
+    }
+    // the finest step level repeats the stages 2^level times
+    const unsigned char maximumLevel = (adaptiveTimeStep ? 0
+        : (maximumStepDivision < maxStepLevel ? maximumStepDivision : maxStepLevel));
+    return passCount+(stages<<maximumLevel);
+}
+
+void SphereCalculator::finishDistributedRun()
+{
+    if (domainSimulation != nullptr)
+    {
+        domainSimulation->finishRun();
+    }
 }
 
 unsigned short SphereCalculator::removeSphere(unsigned short i)
@@ -751,7 +1608,11 @@ unsigned short SphereCalculator::removeSphere(unsigned short i)
     if (spheres.size()>i)
     {
         spheres.erase(spheres.begin()+i);
-        newSpherePos.erase(newSpherePos.begin()+i);
+        if (sphereStepLevels.size()>i)
+        {
+            sphereStepLevels.erase(sphereStepLevels.begin()+i);
+        }
+        accelerationsValid = false;
         cellIndicesOfSpheres.resize(spheres.size());
         collidingSpheresPerSphere.resize(spheres.size());
         updateGravityCellIndexOfSpheresArray();
@@ -759,59 +1620,205 @@ unsigned short SphereCalculator::removeSphere(unsigned short i)
     return getAndUpdateSphereCount();
 }
 
-void SphereCalculator::prepareFrameData()
+bool SphereCalculator::updateFrameSelection()
 {
-    std::ostringstream dataStream;
-    for (unsigned short i = 0; i<spheres.size(); i++)
+    const unsigned int sphereCount = spheres.size();
+    std::vector<unsigned int>& candidates = frameCandidateIndices;
+    candidates.clear();
+    for (unsigned int i = 0; i<sphereCount; i++)
     {
-        dataStream.str(std::string());
-        writeInt(dataStream, frameCounter);
-        writeShort(dataStream, i);
-        writeBasicSphereData(dataStream, spheres[i]);
-        emit frameToSend(dataStream.str());
+        if (spheres[sphereSorting->getSphereIndex(i)].radius
+            >= minimumFrameSphereRadius)
+        {
+            candidates.push_back(i);
+        }
     }
-    frameCounter++;
-}
-
-void SphereCalculator::updateSphereBox()
-{
-    if (spheres.size()>0)
-    {
-        Vector3 pos = spheres[0].pos;
-        Scalar radius;
-        Vector3 maxPos = pos, minPos = pos;
-        for (unsigned short i = 1; i<spheres.size(); i++)
+    frameSelectionSphereCount = sphereCount;
+    frameSelectionMaximumSphereCount = maximumFrameSphereCount;
+    frameSelectionMinimumRadius = minimumFrameSphereRadius;
+    framesSinceFrameSelection = 0;
+    const unsigned int candidateCount = candidates.size();
+    bool allSpheres = (candidateCount == sphereCount)
+        && (maximumFrameSphereCount == 0 || sphereCount <= maximumFrameSphereCount);
+    if (allSpheres)
+    {
+        bool changed = (frameSendsAllSpheres == false);
+        frameSendsAllSpheres = true;
+        frameSphereIndices.clear();
+        return changed;
+    }
+
+    if (maximumFrameSphereCount > 0 && candidateCount > maximumFrameSphereCount)
+    {
+        // rank the candidates within cells of about the same number as the
+        // wanted spheres and take them rank by rank, so every cell keeps
+        // spheres in proportion
+        unsigned int cellsPerAxis = (unsigned int)std::cbrt(
+            (double)maximumFrameSphereCount);
+        cellsPerAxis = (cellsPerAxis > 0 ? cellsPerAxis : 1);
+        frameCellSphereCounts.assign(cellsPerAxis*cellsPerAxis*cellsPerAxis, 0);
+        frameCandidateRanks.resize(candidateCount);
+        std::vector<unsigned int> rankCounts;
+        for (unsigned int i = 0; i<candidateCount; i++)
         {
-            pos = spheres[i].pos;
-            radius = spheres[i].radius;
-            if (pos(0)+radius>maxPos(0))
-            {
-                maxPos(0) = pos(0)+radius;
-            }
-            if (pos(1)+radius>maxPos(1))
+            const Vector3& pos = spheres[sphereSorting->getSphereIndex(
+                candidates[i])].pos;
+            unsigned int cellIndex = 0;
+            for (unsigned char dim = 0; dim<3; dim++)
             {
-                maxPos(1) = pos(1)+radius;
+                Scalar relativePos = (boxSize(dim) > 0 ? pos(dim)/boxSize(dim) : 0);
+                int cell = (int)(relativePos*cellsPerAxis);
+                cell = (cell < 0 ? 0 : (cell >= (int)cellsPerAxis ?
+                    cellsPerAxis-1 : cell));
+                cellIndex = cellIndex*cellsPerAxis + cell;
             }
-            if (pos(2)+radius>maxPos(2))
+            unsigned int rank = frameCellSphereCounts[cellIndex]++;
+            frameCandidateRanks[i] = rank;
+            if (rank >= rankCounts.size())
             {
-                maxPos(2) = pos(2)+radius;
+                rankCounts.push_back(0);
             }
-            if (pos(0)-radius<minPos(0))
+            rankCounts[rank]++;
+        }
+        unsigned int lastRank = 0;
+        unsigned int takenCount = 0;
+        while (takenCount+rankCounts[lastRank] <= maximumFrameSphereCount)
+        {
+            takenCount += rankCounts[lastRank];
+            lastRank++;
+        }
+        unsigned int lastRankCount = maximumFrameSphereCount-takenCount;
+        unsigned int selectedCount = 0;
+        for (unsigned int i = 0; i<candidateCount; i++)
+        {
+            unsigned int rank = frameCandidateRanks[i];
+            if (rank < lastRank || (rank == lastRank && lastRankCount > 0))
             {
-                minPos(0) = pos(0)-radius;
+                if (rank == lastRank)
+                {
+                    lastRankCount--;
+                }
+                candidates[selectedCount++] = candidates[i];
             }
-            if (pos(1)-radius<minPos(1))
+        }
+        candidates.resize(selectedCount);
+    }
+
+    bool changed = frameSendsAllSpheres || (candidates != frameSphereIndices);
+    frameSendsAllSpheres = false;
+    frameSphereIndices.swap(candidates);
+    return changed;
+}
+
+void SphereCalculator::prepareFrameData()
+{
+    if (domainSimulation != nullptr && domainSimulation->isCoordinator() == false)
+    {
+        // the coordinator sends the spheres of all domains to the client
+        domainSimulation->sendFrameSpheres();
+        return;
+    }
+    sendAdaptedTimeStep();
+    // only copy the data, the serializer thread encodes and sends it
+    FrameSnapshot& snapshot = frameSerializer->getSnapshot();
+    snapshot.frameCounter = frameCounter;
+    snapshot.boxSize = boxSize;
+    snapshot.selectionChanged = false;
+    framesSinceFrameSelection++;
+    if (frameSelectionSphereCount != spheres.size()
+        || frameSelectionMaximumSphereCount != maximumFrameSphereCount
+        || frameSelectionMinimumRadius != minimumFrameSphereRadius
+        || (frameSendsAllSpheres == false
+            && framesSinceFrameSelection >= frameSelectionInterval))
+    {
+        snapshot.selectionChanged = updateFrameSelection();
+    }
+    if (frameSendsAllSpheres)
+    {
+        snapshot.radii.resize(spheres.size());
+        snapshot.positions.resize(spheres.size());
+        for (unsigned int i = 0; i<spheres.size(); i++)
+        {
+            const Sphere& sphere = spheres[sphereSorting->getSphereIndex(i)];
+            snapshot.radii[i] = sphere.radius;
+            snapshot.positions[i] = sphere.pos;
+        }
+    }
+    else
+    {
+        snapshot.radii.resize(frameSphereIndices.size());
+        snapshot.positions.resize(frameSphereIndices.size());
+        for (unsigned int i = 0; i<frameSphereIndices.size(); i++)
+        {
+            const Sphere& sphere = spheres[sphereSorting->getSphereIndex(
+                frameSphereIndices[i])];
+            snapshot.radii[i] = sphere.radius;
+            snapshot.positions[i] = sphere.pos;
+        }
+    }
+    if (domainSimulation != nullptr && domainSimulation->appendFrameSpheres(
+        snapshot.radii, snapshot.positions))
+    {
+        snapshot.selectionChanged = true;
+    }
+    frameSerializer->publishSnapshot();
+    frameCounter++;
+}
+
+void SphereCalculator::finishPhase(CalculationPhases::Phase phase)
+{
+    phaseCalculationTimes[phase] += phaseTimer->nsecsElapsed();
+    phaseTimer->start();
+}
+
+void SphereCalculator::updateSphereBox()
+{
+    const unsigned int count = spheres.size();
+    if (count>0)
+    {
+        const unsigned int blockCount = (count < sphereBoxBlockCount ? count
+            : sphereBoxBlockCount);
+        sphereBoxBlockMinima.resize(blockCount);
+        sphereBoxBlockMaxima.resize(blockCount);
+        taskAccount->parallelFor(blockCount, sphereBoxPassCost,
+            [&](unsigned int block)
+        {
+            const unsigned int begin = (unsigned long long)count*block/blockCount;
+            const unsigned int end = (unsigned long long)count*(block+1)/blockCount;
+            Scalar radius = spheres[begin].radius;
+            Scalar minX = spheres[begin].pos(0)-radius;
+            Scalar minY = spheres[begin].pos(1)-radius;
+            Scalar minZ = spheres[begin].pos(2)-radius;
+            Scalar maxX = spheres[begin].pos(0)+radius;
+            Scalar maxY = spheres[begin].pos(1)+radius;
+            Scalar maxZ = spheres[begin].pos(2)+radius;
+            for (unsigned int i = begin+1; i<end; i++)
             {
-                minPos(1) = pos(1)-radius;
+                const Vector3& pos = spheres[i].pos;
+                const Scalar r = spheres[i].radius;
+                minX = fmin(minX, pos(0)-r);
+                minY = fmin(minY, pos(1)-r);
+                minZ = fmin(minZ, pos(2)-r);
+                maxX = fmax(maxX, pos(0)+r);
+                maxY = fmax(maxY, pos(1)+r);
+                maxZ = fmax(maxZ, pos(2)+r);
             }
-            if (pos(2)-radius<minPos(2))
+            sphereBoxBlockMinima[block] = Vector3(minX, minY, minZ);
+            sphereBoxBlockMaxima[block] = Vector3(maxX, maxY, maxZ);
+        });
+        Vector3 minimum = sphereBoxBlockMinima[0];
+        Vector3 maximum = sphereBoxBlockMaxima[0];
+        for (unsigned int block = 1; block<blockCount; block++)
+        {
+            for (unsigned char dim = 0; dim<3; dim++)
             {
-                minPos(2) = pos(2)-radius;
+                minimum(dim) = fmin(minimum(dim), sphereBoxBlockMinima[block](dim));
+                maximum(dim) = fmax(maximum(dim), sphereBoxBlockMaxima[block](dim));
             }
         }
-        sphereBoxSize = maxPos;
-        sphereBoxSize -= minPos;
-        sphereBoxPosition = minPos;
+        sphereBoxPosition = minimum;
+        sphereBoxSize = maximum;
+        sphereBoxSize -= sphereBoxPosition;
     }
     else
     {
@@ -822,60 +1829,77 @@ void SphereCalculator::updateSphereBox()
 
 void SphereCalculator::updateSphereCellLists()
 {
-    for (unsigned int i = 0; i<cellCount3; i++)
+    const unsigned int count = spheres.size();
+    // exceptions must not leave the parallel loop, overflows are reported
+    // afterwards
+    std::atomic<bool> cellsFull(false);
+    // the spheres are binned into all cells they can reach at the times the
+    // integrator evaluates positions within the next step
+    const Scalar windowBegin = cellListWindowBegin*timeStep;
+    const Scalar windowEnd = cellListWindowEnd*timeStep;
+    const Scalar accelerationWindow = 0.5*windowEnd*windowEnd;
+    taskAccount->parallelFor(cellCount3, updatePassCost, [&](unsigned int i)
     {
         sphereIndicesInCells.resetCounter(i);
-    }
-    unsigned short indexMinX, indexMinY, indexMinZ;
-    unsigned short indexMaxX, indexMaxY, indexMaxZ;
-    unsigned int indexAll;
-    Scalar value, pos;
-    Sphere s;
-    for (unsigned short i = 0; i<spheres.size(); i++)
+    });
+
+    // bin the spheres in parallel, slots in the cells are reserved atomically
+    taskAccount->parallelFor(count, cellListPassCost, [&](unsigned int i)
     {
-        s = spheres[i];
+        unsigned short indexMinX, indexMinY, indexMinZ;
+        unsigned short indexMaxX, indexMaxY, indexMaxZ;
+        unsigned int indexAll;
+        unsigned short sphereIndex = i;
+        Scalar value, pos;
+        const Sphere& s = spheres[i];
         cellIndicesOfSpheres.resetCounter(i);
 
         pos = s.pos(0);
-        pos = fmin(pos, pos + timeStep*s.speed(0));
-        pos = fmin(pos, pos + 0.5*s.acc(0)*timeStep*timeStep);
+        pos = fmin(pos, pos + windowEnd*s.speed(0));
+        pos = fmin(pos, pos + windowBegin*s.speed(0));
+        pos = fmin(pos, pos + accelerationWindow*s.acc(0));
         value = (pos-sphereBoxPosition(0)-s.radius)/sphereBoxSize(0);
         indexMinX = (unsigned short)(value*cellCount);
         indexMinX = (indexMinX<cellCount?indexMinX:cellCount-1);
 
         pos = s.pos(1);
-        pos = fmin(pos, pos + timeStep*s.speed(1));
-        pos = fmin(pos, pos + 0.5*s.acc(1)*timeStep*timeStep);
+        pos = fmin(pos, pos + windowEnd*s.speed(1));
+        pos = fmin(pos, pos + windowBegin*s.speed(1));
+        pos = fmin(pos, pos + accelerationWindow*s.acc(1));
         value = (pos-sphereBoxPosition(1)-s.radius)/sphereBoxSize(1);
         indexMinY = (unsigned short)(value*cellCount);
         indexMinY = (indexMinY<cellCount?indexMinY:cellCount-1);
 
         pos = s.pos(2);
-        pos = fmin(pos, pos + timeStep*s.speed(2));
-        pos = fmin(pos, pos + 0.5*s.acc(2)*timeStep*timeStep);
+        pos = fmin(pos, pos + windowEnd*s.speed(2));
+        pos = fmin(pos, pos + windowBegin*s.speed(2));
+        pos = fmin(pos, pos + accelerationWindow*s.acc(2));
         value = (pos-sphereBoxPosition(2)-s.radius)/sphereBoxSize(2);
         indexMinZ = (unsigned short)(value*cellCount);
         indexMinZ = (indexMinZ<cellCount?indexMinZ:cellCount-1);
 
         pos = s.pos(0);
-        pos = fmax(pos, pos + timeStep*s.speed(0));
-        pos = fmax(pos, pos + 0.5*s.acc(0)*timeStep*timeStep);
+        pos = fmax(pos, pos + windowEnd*s.speed(0));
+        pos = fmax(pos, pos + windowBegin*s.speed(0));
+        pos = fmax(pos, pos + accelerationWindow*s.acc(0));
         value = (pos-sphereBoxPosition(0)+s.radius)/sphereBoxSize(0);
         indexMaxX = (unsigned short)(value*cellCount);
         indexMaxX = (indexMaxX<cellCount?indexMaxX:cellCount-1);
         indexMaxX = (indexMaxX<indexMinX?indexMinX:indexMaxX);
 
         pos = s.pos(1);
-        pos = fmax(pos, pos + timeStep*s.speed(1));
-        pos = fmax(pos, pos + 0.5*s.acc(1)*timeStep*timeStep);
+        pos = fmax(pos, pos + windowEnd*s.speed(1));
+        pos = fmax(pos, pos + windowBegin*s.speed(1));
+        pos = fmax(pos, pos + accelerationWindow*s.acc(1));
         value = (pos-sphereBoxPosition(1)+s.radius)/sphereBoxSize(1);
         indexMaxY = (unsigned short)(value*cellCount);
         indexMaxY = (indexMaxY<cellCount?indexMaxY:cellCount-1);
         indexMaxY = (indexMaxY<indexMinY?indexMinY:indexMaxY);
 
         pos = s.pos(2);
-        pos = fmax(pos, pos + timeStep*s.speed(2));
-        pos = fmax(pos, pos + 0.5*s.acc(2)*timeStep*timeStep);
+        pos = fmax(pos, pos + windowEnd*s.speed(2));
+        pos = fmax(pos, pos + windowBegin*s.speed(2));
+        pos = fmax(pos, pos + accelerationWindow*s.acc(2));
         value = (pos-sphereBoxPosition(2)+s.radius)/sphereBoxSize(2);
         indexMaxZ = (unsigned short)(value*cellCount);
         indexMaxZ = (indexMaxZ<cellCount?indexMaxZ:cellCount-1);
@@ -888,27 +1912,44 @@ void SphereCalculator::updateSphereCellLists()
                 for (unsigned short x = indexMinX; x<=indexMaxX; x++)
                 {
                     indexAll = z*cellCount*cellCount + y*cellCount + x;
-                    sphereIndicesInCells.addElement(indexAll, i);
-                    cellIndicesOfSpheres.addElement(i, indexAll);
+                    if (!sphereIndicesInCells.addElementAtomic(indexAll, sphereIndex)
+                        || !cellIndicesOfSpheres.tryAddElement(i, indexAll))
+                    {
+                        cellsFull.store(true, std::memory_order_relaxed);
+                    }
                 }
             }
         }
+    });
+
+    // restore a deterministic order of the spheres inside the cells
+    taskAccount->parallelFor(cellCount3, cellSortPassCost, [&](unsigned int i)
+    {
+        sphereIndicesInCells.sortElements(i);
+    });
+    if (cellsFull.load())
+    {
+        Console()<<Console::red<<Console::bold<<"SphereCalculator: cell lists are "
+            "full, some collisions are not detected.\n";
     }
 }
 
 void SphereCalculator::updateSphereGravityCellLists()
 {
-    for (unsigned int i = 0; i<gravityCellCount3; i++)
+    const unsigned int count = spheres.size();
+    std::atomic<bool> cellsFull(false);
+    taskAccount->parallelFor(gravityCellCount3, updatePassCost, [&](unsigned int i)
     {
         sphereIndicesInGravityCells.resetCounter(i);
-    }
-    unsigned short indexX, indexY, indexZ;
-    unsigned int indexAll;
-    Vector3 pos;
-    Scalar value;
-    for (unsigned short i = 0; i<spheres.size(); i++)
+    });
+
+    taskAccount->parallelFor(count, gravityCellListPassCost, [&](unsigned int i)
     {
-        pos = spheres[i].pos;
+        unsigned short indexX, indexY, indexZ;
+        unsigned int indexAll;
+        unsigned short sphereIndex = i;
+        const Vector3& pos = spheres[i].pos;
+        Scalar value;
         value = (pos(0)-sphereBoxPosition(0))/sphereBoxSize(0);
         indexX = (unsigned short)(value*gravityCellCount);
         indexX = (indexX<gravityCellCount?indexX:gravityCellCount-1);
@@ -920,8 +1961,21 @@ void SphereCalculator::updateSphereGravityCellLists()
         indexZ = (indexZ<gravityCellCount?indexZ:gravityCellCount-1);
         indexAll = indexZ*gravityCellCount*gravityCellCount
             + indexY*gravityCellCount + indexX;
-        sphereIndicesInGravityCells.addElement(indexAll, i);
+        if (!sphereIndicesInGravityCells.addElementAtomic(indexAll, sphereIndex))
+        {
+            cellsFull.store(true, std::memory_order_relaxed);
+        }
         gravityCellIndexOfSpheres[i] = indexAll;
+    });
+
+    taskAccount->parallelFor(gravityCellCount3, cellSortPassCost, [&](unsigned int i)
+    {
+        sphereIndicesInGravityCells.sortElements(i);
+    });
+    if (cellsFull.load())
+    {
+        Console()<<Console::red<<Console::bold<<"SphereCalculator: gravity cell "
+            "lists are full, some masses are missing.\n";
     }
 }
 
@@ -1085,37 +2139,53 @@ void SphereCalculator::updateGravityCellIndexOfSpheresArray()
 
 void SphereCalculator::updateGravityCellData()
 {
-    unsigned int cellIndex;
-    for (cellIndex = 0; cellIndex<gravityAllCellCount; cellIndex++)
-    {
-        massVectorSumPerCell[cellIndex].setZero();
-        massSumPerCell[cellIndex] = 0;
-        sphereCountPerGravityCell[cellIndex] = 0;
-    }
-    unsigned int sphereIndex;
-    Sphere s;
-    for (sphereIndex = 0; sphereIndex<spheres.size(); sphereIndex++)
-    {
-        s = spheres[sphereIndex];
-        cellIndex = gravityCellCount3 + gravityCellIndexOfSpheres[sphereIndex];
-        massVectorSumPerCell[cellIndex].add_ax(s.mass, s.pos);
-        massSumPerCell[cellIndex] += s.mass;
-        sphereCountPerGravityCell[cellIndex]++;
-    }
-    unsigned int parentCellIndex;
-    for (cellIndex = gravityAllCellCount-1; cellIndex > 1; cellIndex--)
-    {
-        if (massSumPerCell[cellIndex] != 0)
+    // leaf cells: sum up the spheres of each cell
+    taskAccount->parallelFor(gravityCellCount3, gravityCellDataPassCost,
+        [&](unsigned int leafIndex)
+    {
+        const unsigned int cellIndex = gravityCellCount3 + leafIndex;
+        Vector3 massVectorSum(0, 0, 0);
+        Scalar massSum = 0;
+        const unsigned short count =
+            sphereIndicesInGravityCells.getCounter(leafIndex);
+        for (unsigned short j = 0; j<count; j++)
         {
-            parentCellIndex = cellIndex/2;
-            massVectorSumPerCell[parentCellIndex] += massVectorSumPerCell[cellIndex];
-            massSumPerCell[parentCellIndex] += massSumPerCell[cellIndex];
-
-            massCenterPerCell[cellIndex].set_ax(1/massSumPerCell[cellIndex],
-                massVectorSumPerCell[cellIndex]);
-            sphereCountPerGravityCell[parentCellIndex] +=
-                sphereCountPerGravityCell[cellIndex];
+            const Sphere& s = spheres[sphereIndicesInGravityCells[leafIndex][j]];
+            massVectorSum.add_ax(s.mass, s.pos);
+            massSum += s.mass;
+        }
+        massVectorSumPerCell[cellIndex] = massVectorSum;
+        massSumPerCell[cellIndex] = massSum;
+        sphereCountPerGravityCell[cellIndex] = count;
+        if (massSum != 0)
+        {
+            massCenterPerCell[cellIndex].set_ax(1/massSum, massVectorSum);
         }
+    });
+
+    // inner cells: accumulate the children bottom-up, one tree level at a time;
+    // the small upper levels run on the calling thread
+    for (unsigned int levelBegin = gravityCellCount3/2; levelBegin>=1;
+        levelBegin /= 2)
+    {
+        taskAccount->parallelFor(levelBegin, updatePassCost,
+            [&](unsigned int levelIndex)
+        {
+            const unsigned int cellIndex = levelBegin + levelIndex;
+            const unsigned int child = 2*cellIndex;
+            massVectorSumPerCell[cellIndex] = massVectorSumPerCell[child];
+            massVectorSumPerCell[cellIndex] += massVectorSumPerCell[child+1];
+            massSumPerCell[cellIndex] =
+                massSumPerCell[child] + massSumPerCell[child+1];
+            sphereCountPerGravityCell[cellIndex] =
+                sphereCountPerGravityCell[child]
+                + sphereCountPerGravityCell[child+1];
+            if (massSumPerCell[cellIndex] != 0)
+            {
+                massCenterPerCell[cellIndex].set_ax(1/massSumPerCell[cellIndex],
+                    massVectorSumPerCell[cellIndex]);
+            }
+        });
     }
 }
 
@@ -1124,10 +2194,16 @@ void SphereCalculator::startUp()
     Console()<<"SphereCalculator: starting up.\n";
 
     spheres.clear();
-    newSpherePos.clear();
+    sphereStepLevels.clear();
+    sphereSorting->clearClientOrder();
+    accelerationsValid = false;
     calculationCounter = 0;
     stepCounter = 0;
     frameCounter = 0;
+    for (unsigned char phase = 0; phase<CalculationPhases::numberOfPhases; phase++)
+    {
+        phaseCalculationTimes[phase] = 0;
+    }
     cellIndicesOfSpheres.resize(0);
     collidingSpheresPerSphere.resize(0);
 
@@ -1197,8 +2273,9 @@ void SphereCalculator::tearDown()
 
 unsigned short SphereCalculator::addSphere()
 {
+    sphereSorting->restoreClientOrder();
     spheres.push_back(Sphere());
-    newSpherePos.push_back(Vector3());
+    accelerationsValid = false;
     cellIndicesOfSpheres.resize(spheres.size());
     collidingSpheresPerSphere.resize(spheres.size());
     updateGravityCellIndexOfSpheresArray();
@@ -1208,6 +2285,7 @@ unsigned short SphereCalculator::addSphere()
 
 unsigned short SphereCalculator::removeLastSphere()
 {
+    sphereSorting->restoreClientOrder();
     if (spheres.size()>0)
     {
         return removeSphere(spheres.size()-1);
@@ -1222,7 +2300,8 @@ unsigned short SphereCalculator::updateSphere(unsigned short i, Sphere s)
 {
     if (spheres.size()>i)
     {
-        spheres[i] = s;
+        spheres[sphereSorting->getSphereIndex(i)] = s;
+        accelerationsValid = false;
         workQueue->sendFrameData();
     }
     return spheres.size();
@@ -1232,7 +2311,7 @@ Sphere SphereCalculator::getAllSphereData(unsigned short i)
 {
     if (spheres.size()>i)
     {
-        return spheres[i];
+        return spheres[sphereSorting->getSphereIndex(i)];
     }
     else
     {
@@ -1243,7 +2322,6 @@ Sphere SphereCalculator::getAllSphereData(unsigned short i)
 unsigned short SphereCalculator::addSomeSpheres(unsigned short count)
 {
     /*spheres.insert(spheres.size()-1, spheres.size(), Sphere());
-    newSpherePos.insert(newSpherePos.size()-1, spheres.size(), Vector3());
     cellIndicesOfSpheres.resize(spheres.size());
     collidingSpheresPerSphere.resize(spheres.size());
     updateGravityCellIndexOfSpheresArray();
@@ -1275,6 +2353,9 @@ void SphereCalculator::updateSpherePositionsInBox(Scalar randomDisplacement,
     std::default_random_engine generator(timepoint.count());
     std::uniform_real_distribution<Scalar> distribution(-1, 1);
 
+    // the spheres are placed by their client indices
+    sphereSorting->restoreClientOrder();
+    accelerationsValid = false;
     for (unsigned int i = 0; i<spheres.size(); i++)
     {
         Console()<<"SphereCalculator: sphere "<<(i+1)<<"|"<<spheres.size()<<"\r";
@@ -1302,6 +2383,7 @@ unsigned short SphereCalculator::updateAllSpheres(Sphere s)
     {
         spheres[i] = s;
     }
+    accelerationsValid = false;
     workQueue->sendFrameData();
     return spheres.size();
 }
@@ -1314,143 +2396,61 @@ void SphereCalculator::calculateStep()
 void SphereCalculator::updateIntegratorMethod()
 {
     unsigned char integrMethod = integratorMethod;
+    symplecticStepWeights.clear();
+    cellListWindowBegin = 0;
+    cellListWindowEnd = 1;
+    // RESPA keeps the accelerations split by range, so they are not reused
+    // across a change of the method
+    accelerationsValid = false;
 
-    if (integrMethod == IntegratorMethods::HeunEuler21)
+    if (integrMethod == IntegratorMethods::VelocityVerlet)
+    {
+        Console()<<"SphereCalculator: activated VelocityVerlet integrator.\n";
+        symplecticStepWeights.push_back(1.0);
+    }
+    else if (integrMethod == IntegratorMethods::Yoshida4)
+    {
+        Console()<<"SphereCalculator: activated Yoshida4 integrator.\n";
+        const Scalar cbrt2 = cbrt(2.0);
+        const Scalar w1 = 1/(2-cbrt2);
+        const Scalar w0 = -cbrt2/(2-cbrt2);
+        symplecticStepWeights.push_back(w1);
+        symplecticStepWeights.push_back(w0);
+        symplecticStepWeights.push_back(w1);
+        // the negative middle drift moves the spheres behind their starting
+        // positions, the first one beyond the end of the step
+        cellListWindowBegin = w1+w0;
+        cellListWindowEnd = w1;
+    }
+    else if (integrMethod == IntegratorMethods::RespaVerlet)
+    {
+        Console()<<"SphereCalculator: activated RespaVerlet integrator.\n";
+    }
+    else if (integrMethod == IntegratorMethods::ImexEuler)
+    {
+        Console()<<"SphereCalculator: activated ImexEuler integrator.\n";
+    }
+    else if (integrMethod == IntegratorMethods::HeunEuler21)
     {
         Console()<<"SphereCalculator: activated HeunEuler21 integrator.\n";
-        const Scalar a[4] =
-            {
-                0.0,    0.0,
-                1.0,    0.0
-            };
-        const Scalar b[2] =     {1/2.0, 1/2.0};
-        const Scalar b_[2] =    {1.0,   0.0};
-        const Scalar c[2] =     {0.0,   1.0};
-        butcherTableau = ButcherTableau(2, a, b, b_, c);
     }
     else if (integrMethod == IntegratorMethods::BogackiShampine32)
     {
         Console()<<"SphereCalculator: activated BogackiShampine32 integrator.\n";
-        const Scalar a[16] =
-            {
-                0.0,    0.0,    0.0,    0.0,
-                1/2.0,  0.0,    0.0,    0.0,
-                0.0,    3/4.0,  0.0,    0.0,
-                2/9.0,  1/3.0,  4/9.0,  0.0
-            };
-        const Scalar b[4] =     {2/9.0,     1/3.0,  4/9.0,  0.0};
-        const Scalar b_[4] =    {7/24.0,    1/4.0,  1/3.0,  1/8.0};
-        const Scalar c[4] =     {0.0,       1/2.0,  3/4.0,  1.0};
-        butcherTableau = ButcherTableau(4, a, b, b_, c);
     }
     else if (integrMethod == IntegratorMethods::CashKarp54)
     {
         Console()<<"SphereCalculator: activated CashKarp54 integrator.\n";
-        const Scalar a[36] =
-            {
-                0.0,            0.0,        0.0,
-                0.0,            0.0,        0.0,
-                1/5.0,          0.0,        0.0,
-                0.0,            0.0,        0.0,
-                3/40.0,         9/40.0,     0.0,
-                0.0,            0.0,        0.0,
-                3/10.0,         -9/10.0,    6/5.0,
-                0.0,            0.0,        0.0,
-                -11/54.0,       5/2.0,      -70/27.0,
-                35/27.0,        0.0,        0.0,
-                1631/55296.0,   175/512.0,  575/13824.0,
-                44275/110592.0, 253/4096.0, 0.0
-            };
-        const Scalar b[6] =
-            {
-                37/378.0,       0.0,        250/621.0,
-                125/594.0,      0.0,        512/1771.0
-            };
-        const Scalar b_[6] =
-            {
-                2825/27648.0,   0.0,            18575/48384.0,
-                13525/55296.0,  277/14336.0,    1/4.0
-            };
-        const Scalar c[6] =
-            {
-                0.0,            1/5.0,          3/10.0,
-                3/5.0,          1.0,            7/8.0
-            };
-        butcherTableau = ButcherTableau(6, a, b, b_, c);
     }
     else if (integrMethod == IntegratorMethods::DormandPrince54)
     {
         Console()<<"SphereCalculator: activated DormandPrince54 integrator.\n";
-        const Scalar a[49] =
-            {
-                0.0,            0.0,                0.0,
-                0.0,            0.0,                0.0,            0.0,
-                1/5.0,          0.0,                0.0,
-                0.0,            0.0,                0.0,            0.0,
-                3/40.0,         9/40.0,             0.0,
-                0.0,            0.0,                0.0,            0.0,
-                44/45.0,        -56/15.0,           32/9.0,
-                0.0,            0.0,                0.0,            0.0,
-                19372/6561.0,   -25360/2187.0,      64448/6561.0,
-                -212/729.0,     0.0,                0.0,            0.0,
-                9017/3168.0,    -355/33.0,          46732/5247.0,
-                49/176.0,       -5103/18656.0,      0.0,            0.0,
-                35/384.0,       0.0,                500/1113.0,
-                125/192.0,      -2187/6784.0,       11/84.0,        0.0
-            };
-        const Scalar b[7] =
-            {
-                35/384.0,       0.0,                500/1113.0,
-                125/192.0,      -2187/6784.0,       11/84.0,        0.0
-            };
-        const Scalar b_[7] =
-            {
-                5179/57600.0,   0.0,                7571/16695.0,
-                393/640.0,      -92097/339200.0,    187/2100.0,     1/40.0
-            };
-        const Scalar c[7] =
-            {
-                0.0,            1/5.0,              3/10.0,
-                4/5.0,          8/9.0,              1.0,            1.0
-            };
-        butcherTableau = ButcherTableau(7, a, b, b_, c);
     }
     else
     {
         Console()<<"SphereCalculator: activated RungeKuttaFehlberg54 integrator.\n";
         simulatedSystem->set(SimulationVariables::integratorMethod,
             (unsigned int)IntegratorMethods::RungeKuttaFehlberg54);
-        const Scalar a[36] =
-            {
-                0.0,            0.0,            0.0,
-                0.0,            0.0,            0.0,
-                1/4.0,          0.0,            0.0,
-                0.0,            0.0,            0.0,
-                3/32.0,         9/32.0,         0.0,
-                0.0,            0.0,            0.0,
-                1932/2197.0,    -7200/2197.0,   7296/2197.0,
-                0.0,            0.0,            0.0,
-                439/216.0,      -8.0,           3680/513.0,
-                -845/4104.0,    0.0,            0.0,
-                -8/27.0,        2.0,            -3544/2565.0,
-                1859/4104.0,    -11/40.0,       0.0
-            };
-        const Scalar b[6] =
-            {
-                16/135.0,       0.0,            6656/12825.0,
-                28561/56430.0,  -9/50.0,        2/55.0
-            };
-        const Scalar b_[6] =
-            {
-                25/216.0,       0.0,            1408/2565.0,
-                2197/4104.0,    -1/5.0,         0.0
-            };
-        const Scalar c[6] =
-            {
-                0.0,            1/4.0,          3/8.0,
-                12/13.0,        1.0,            1/2.0
-            };
-        butcherTableau = ButcherTableau(6, a, b, b_, c);
     }
 }
 
@@ -1490,6 +2490,17 @@ unsigned int SphereCalculator::getLastStepCalculationTime()
     return lastStepCalculationTime;
 }
 
+std::vector<unsigned int> SphereCalculator::popPhaseCalculationTimes()
+{
+    std::vector<unsigned int> times(CalculationPhases::numberOfPhases);
+    for (unsigned char phase = 0; phase<CalculationPhases::numberOfPhases; phase++)
+    {
+        times[phase] = (unsigned int)(phaseCalculationTimes[phase]/1000);
+        phaseCalculationTimes[phase] = 0;
+    }
+    return times;
+}
+
 Scalar SphereCalculator::getTotalEnergy()
 {
     if (collisionDetection)
@@ -1643,6 +2654,28 @@ void SphereCalculator::updateSphereWallE()
 
 void SphereCalculator::variableUpdated(int var)
 {
+    switch (var)
+    {
+    case SimulationVariables::sphereCount:
+    case SimulationVariables::timeStep:
+    case SimulationVariables::simulating:
+    case SimulationVariables::frameSending:
+    case SimulationVariables::maximumStepDivision:
+    case SimulationVariables::maximumStepError:
+    case SimulationVariables::respaStepRatio:
+    case SimulationVariables::rejectedStepCount:
+    case SimulationVariables::simulationWeight:
+    case SimulationVariables::simulationPriority:
+    case SimulationVariables::frameRate:
+    case SimulationVariables::maximumFrameSphereCount:
+    case SimulationVariables::minimumFrameSphereRadius:
+    case SimulationVariables::spatialSorting:
+        // these do not change the forces
+        break;
+    default:
+        accelerationsValid = false;
+        break;
+    }
     switch (var)
     {
     case SimulationVariables::sphereE:
@@ -1654,6 +2687,9 @@ void SphereCalculator::variableUpdated(int var)
         break;
     case SimulationVariables::integratorMethod:
         updateIntegratorMethod();
+    case SimulationVariables::adaptiveTimeStep:
+        lastStepError = 1.0;
+        lastStepRejected = false;
         break;
     }
 }
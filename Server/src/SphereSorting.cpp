@@ -0,0 +1,193 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#include "SphereSorting.hpp"
+#include "DomainSimulation.hpp"
+#include "SphereCalculator.hpp"
+
+using namespace SphereSim;
+
+SphereSorting::SphereSorting(SphereCalculator* sphCalc,
+    TaskAccount* taskAccount, unsigned int slabCount, bool keepClientOrder)
+    :sphCalc(sphCalc), taskAccount(taskAccount),
+    slabCount(slabCount > 0 ? slabCount : 1), binsPerSlab(16),
+    keepClientOrder(keepClientOrder), clientIndices(), sphereIndices(),
+    binOfSpheres(), binOffsets(), sourceIndices(), movedSpheres(),
+    movedStepLevels(), movedShortRangeAccelerations(),
+    movedLongRangeAccelerations(), movedClientIndices(),
+    movedDomainClientIndices(), binPassCost(), movePassCost()
+{
+}
+
+bool SphereSorting::sortSpheres()
+{
+    const std::vector<Sphere>& spheres = sphCalc->spheres;
+    const Vector3& boxSize = sphCalc->boxSize;
+    const unsigned int count = spheres.size();
+    unsigned char axis = 0;
+    for (unsigned char dim = 1; dim<3; dim++)
+    {
+        if (boxSize(dim) > boxSize(axis))
+        {
+            axis = dim;
+        }
+    }
+    if (count < 2 || !(boxSize(axis) > 0))
+    {
+        return false;
+    }
+
+    const unsigned int binCount = slabCount*binsPerSlab;
+    const Scalar binsPerLength = binCount/boxSize(axis);
+    binOfSpheres.resize(count);
+    taskAccount->parallelFor(count, binPassCost, [&](unsigned int sphereIndex)
+    {
+        Scalar bin = spheres[sphereIndex].pos(axis)*binsPerLength;
+        // spheres outside of the box belong to the outer bins
+        binOfSpheres[sphereIndex] = (bin >= 1 ? (bin < binCount
+            ? (unsigned int)bin : binCount-1) : 0);
+    });
+    unsigned int sortedCount = 1;
+    while (sortedCount<count && binOfSpheres[sortedCount-1] <= binOfSpheres[sortedCount])
+    {
+        sortedCount++;
+    }
+    if (sortedCount == count)
+    {
+        // no sphere moved into another bin since the last sort
+        return false;
+    }
+
+    // stable counting sort, so the spheres keep their order within a bin
+    binOffsets.assign(binCount+1, 0);
+    for (unsigned int i = 0; i<count; i++)
+    {
+        binOffsets[binOfSpheres[i]+1]++;
+    }
+    for (unsigned int bin = 0; bin<binCount; bin++)
+    {
+        binOffsets[bin+1] += binOffsets[bin];
+    }
+    sourceIndices.resize(count);
+    for (unsigned int i = 0; i<count; i++)
+    {
+        sourceIndices[binOffsets[binOfSpheres[i]]++] = i;
+    }
+    if (keepClientOrder && clientIndices.empty())
+    {
+        clientIndices.resize(count);
+        sphereIndices.resize(count);
+        for (unsigned int i = 0; i<count; i++)
+        {
+            clientIndices[i] = i;
+        }
+    }
+    moveSpheres();
+    return true;
+}
+
+void SphereSorting::restoreClientOrder()
+{
+    if (clientIndices.empty())
+    {
+        return;
+    }
+    // the sphere of client index i moves to index i
+    sourceIndices.swap(sphereIndices);
+    clearClientOrder();
+    moveSpheres();
+}
+
+void SphereSorting::clearClientOrder()
+{
+    clientIndices.clear();
+    sphereIndices.clear();
+}
+
+void SphereSorting::moveSpheres()
+{
+    std::vector<Sphere>& spheres = sphCalc->spheres;
+    std::vector<unsigned char>& stepLevels = sphCalc->sphereStepLevels;
+    std::vector<Vector3>& shortRangeAccelerations = sphCalc->shortRangeAccelerations;
+    std::vector<Vector3>& longRangeAccelerations = sphCalc->longRangeAccelerations;
+    const unsigned int count = spheres.size();
+    // the states of the integrators are moved only if they are in use
+    const bool moveStepLevels = (stepLevels.size() == count);
+    const bool moveRespaAccelerations = (shortRangeAccelerations.size() == count
+        && longRangeAccelerations.size() == count);
+    const bool moveClientIndices = (clientIndices.empty() == false);
+    // the spheres of a distributed simulation carry their client indices
+    std::vector<unsigned int>* domainClientIndices =
+        (sphCalc->domainSimulation != nullptr
+        ? &sphCalc->domainSimulation->getClientIndices() : nullptr);
+    const bool moveDomainClientIndices = (domainClientIndices != nullptr
+        && domainClientIndices->size() == count);
+    movedSpheres.resize(count);
+    if (moveStepLevels)
+    {
+        movedStepLevels.resize(count);
+    }
+    if (moveRespaAccelerations)
+    {
+        movedShortRangeAccelerations.resize(count);
+        movedLongRangeAccelerations.resize(count);
+    }
+    if (moveClientIndices)
+    {
+        movedClientIndices.resize(count);
+    }
+    if (moveDomainClientIndices)
+    {
+        movedDomainClientIndices.resize(count);
+    }
+
+    // the spheres are gathered into the sorted order in parallel
+    taskAccount->parallelFor(count, movePassCost, [&](unsigned int index)
+    {
+        const unsigned int sourceIndex = sourceIndices[index];
+        movedSpheres[index] = spheres[sourceIndex];
+        if (moveStepLevels)
+        {
+            movedStepLevels[index] = stepLevels[sourceIndex];
+        }
+        if (moveRespaAccelerations)
+        {
+            movedShortRangeAccelerations[index] = shortRangeAccelerations[sourceIndex];
+            movedLongRangeAccelerations[index] = longRangeAccelerations[sourceIndex];
+        }
+        if (moveClientIndices)
+        {
+            const unsigned int clientIndex = clientIndices[sourceIndex];
+            movedClientIndices[index] = clientIndex;
+            sphereIndices[clientIndex] = index;
+        }
+        if (moveDomainClientIndices)
+        {
+            movedDomainClientIndices[index] = (*domainClientIndices)[sourceIndex];
+        }
+    });
+
+    spheres.swap(movedSpheres);
+    if (moveStepLevels)
+    {
+        stepLevels.swap(movedStepLevels);
+    }
+    if (moveRespaAccelerations)
+    {
+        shortRangeAccelerations.swap(movedShortRangeAccelerations);
+        longRangeAccelerations.swap(movedLongRangeAccelerations);
+    }
+    if (moveClientIndices)
+    {
+        clientIndices.swap(movedClientIndices);
+    }
+    if (moveDomainClientIndices)
+    {
+        domainClientIndices->swap(movedDomainClientIndices);
+    }
+}
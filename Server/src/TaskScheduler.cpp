@@ -0,0 +1,288 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#include "TaskScheduler.hpp"
+
+#include <algorithm>
+
+using namespace SphereSim;
+
+TaskAccount::TaskAccount(TaskScheduler* scheduler)
+    :scheduler(scheduler), weight(1), priority(0), virtualTime(0),
+    lastSubmission(), activeWorkers(0),
+    deques(new TaskDeque[scheduler->threadCount]), loopBody(nullptr),
+    loopBodyCaller(nullptr), queuedTasks(0), remainingTasks(0), doneMutex(),
+    doneCondition()
+{
+}
+
+TaskAccount::~TaskAccount()
+{
+    scheduler->unregisterAccount(this);
+    delete[] deques;
+}
+
+void TaskAccount::setShare(unsigned int weight, unsigned int priority)
+{
+    std::lock_guard<std::mutex> lock(scheduler->mutex);
+    this->weight = (weight > 0 ? weight : 1);
+    this->priority = priority;
+}
+
+void TaskAccount::run(unsigned int count, LoopCost& cost, const void* body,
+    LoopBodyCaller caller)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    const unsigned int threadCount = scheduler->threadCount;
+    std::chrono::steady_clock::time_point startTime =
+        std::chrono::steady_clock::now();
+
+    // unmeasured loops get 8 chunks per thread; measured ones get chunks of
+    // about targetChunkTime, but at least 2 per thread for stealing
+    unsigned int maximumChunkSize = count/(2*threadCount);
+    maximumChunkSize = (maximumChunkSize > 0 ? maximumChunkSize : 1);
+    unsigned int chunkSize;
+    if (cost.nanosecondsPerIndex > 0)
+    {
+        double idealChunkSize = scheduler->targetChunkTime/cost.nanosecondsPerIndex;
+        chunkSize = (idealChunkSize < maximumChunkSize
+            ? (unsigned int)idealChunkSize : maximumChunkSize);
+    }
+    else
+    {
+        chunkSize = count/(8*threadCount);
+    }
+    chunkSize = (chunkSize > 0 ? chunkSize : 1);
+    unsigned int chunkCount = (count+chunkSize-1)/chunkSize;
+
+    double elapsedTime;
+    if (chunkCount == 1)
+    {
+        // not worth waking a pool thread
+        caller(body, 0, count);
+        elapsedTime = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now()-startTime).count();
+        std::lock_guard<std::mutex> lock(scheduler->mutex);
+        virtualTime += elapsedTime/weight;
+        lastSubmission = startTime;
+    }
+    else
+    {
+        // the body has to be visible before any task; the deque mutexes
+        // order it
+        loopBody = body;
+        loopBodyCaller = caller;
+        remainingTasks.store(chunkCount, std::memory_order_relaxed);
+        for (unsigned int threadIndex = 0; threadIndex<threadCount; threadIndex++)
+        {
+            unsigned int firstChunk = (unsigned long long)chunkCount*threadIndex
+                /threadCount;
+            unsigned int lastChunk = (unsigned long long)chunkCount*(threadIndex+1)
+                /threadCount;
+            TaskDeque& deque = deques[threadIndex];
+            std::lock_guard<std::mutex> lock(deque.mutex);
+            // a worker still serving this account may take the tasks as soon as
+            // the lock is released, so they are counted before
+            queuedTasks.fetch_add(lastChunk-firstChunk, std::memory_order_relaxed);
+            for (unsigned int chunk = firstChunk; chunk<lastChunk; chunk++)
+            {
+                TaskRange task;
+                task.begin = chunk*chunkSize;
+                task.end = (chunk+1 < chunkCount ? (chunk+1)*chunkSize : count);
+                deque.tasks.push_back(task);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(scheduler->mutex);
+            if (startTime-lastSubmission >= scheduler->idleTime)
+            {
+                // a simulation becoming busy again must not make up for its
+                // idle time, so start at the least served busy account
+                bool otherBusy = false;
+                double minimumVirtualTime = 0;
+                for (unsigned int i = 0; i<scheduler->accounts.size(); i++)
+                {
+                    TaskAccount* account = scheduler->accounts[i];
+                    if (account != this
+                        && startTime-account->lastSubmission < scheduler->idleTime
+                        && (!otherBusy || account->virtualTime < minimumVirtualTime))
+                    {
+                        minimumVirtualTime = account->virtualTime;
+                        otherBusy = true;
+                    }
+                }
+                if (otherBusy && minimumVirtualTime > virtualTime)
+                {
+                    virtualTime = minimumVirtualTime;
+                }
+            }
+            lastSubmission = startTime;
+        }
+        scheduler->workCondition.notify_all();
+
+        // loops follow each other closely during a step, so spin for a while
+        // before sleeping
+        for (unsigned int i = 0; i<1000
+            && remainingTasks.load(std::memory_order_acquire) > 0; i++)
+        {
+            std::this_thread::yield();
+        }
+        {
+            std::unique_lock<std::mutex> lock(doneMutex);
+            while (remainingTasks.load(std::memory_order_acquire) > 0)
+            {
+                doneCondition.wait(lock);
+            }
+        }
+        elapsedTime = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now()-startTime).count();
+    }
+
+    double measuredCost = elapsedTime*(chunkCount == 1 ? 1 : threadCount)/count;
+    cost.nanosecondsPerIndex = (cost.nanosecondsPerIndex > 0
+        ? 0.8*cost.nanosecondsPerIndex + 0.2*measuredCost : measuredCost);
+}
+
+TaskScheduler::TaskScheduler(unsigned int count)
+    :threadCount(count > 0 ? count : (std::thread::hardware_concurrency() > 0
+        ? std::thread::hardware_concurrency() : 1)),
+    targetChunkTime(20000), timeSlice(200000), idleTime(100), threads(),
+    accounts(), mutex(), workCondition(), workersFinishedCondition(),
+    stopping(false)
+{
+    for (unsigned int threadIndex = 0; threadIndex<threadCount; threadIndex++)
+    {
+        threads.push_back(std::thread(&TaskScheduler::workerLoop, this,
+            threadIndex));
+    }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workCondition.notify_all();
+    for (unsigned int i = 0; i<threads.size(); i++)
+    {
+        threads[i].join();
+    }
+}
+
+TaskAccount* TaskScheduler::createAccount()
+{
+    TaskAccount* account = new TaskAccount(this);
+    std::lock_guard<std::mutex> lock(mutex);
+    accounts.push_back(account);
+    return account;
+}
+
+void TaskScheduler::unregisterAccount(TaskAccount* account)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    accounts.erase(std::remove(accounts.begin(), accounts.end(), account),
+        accounts.end());
+    while (account->activeWorkers > 0)
+    {
+        workersFinishedCondition.wait(lock);
+    }
+}
+
+TaskAccount* TaskScheduler::pickAccount()
+{
+    TaskAccount* pickedAccount = nullptr;
+    for (unsigned int i = 0; i<accounts.size(); i++)
+    {
+        TaskAccount* account = accounts[i];
+        if (account->queuedTasks.load(std::memory_order_relaxed) == 0)
+        {
+            continue;
+        }
+        if (pickedAccount == nullptr || account->priority > pickedAccount->priority
+            || (account->priority == pickedAccount->priority
+                && account->virtualTime < pickedAccount->virtualTime))
+        {
+            pickedAccount = account;
+        }
+    }
+    return pickedAccount;
+}
+
+bool TaskScheduler::takeTask(TaskAccount* account, unsigned int threadIndex,
+    TaskRange& task)
+{
+    for (unsigned int i = 0; i<threadCount; i++)
+    {
+        // own deque from the front, other deques from the back
+        TaskDeque& deque = account->deques[(threadIndex+i)%threadCount];
+        std::lock_guard<std::mutex> lock(deque.mutex);
+        if (!deque.tasks.empty())
+        {
+            if (i == 0)
+            {
+                task = deque.tasks.front();
+                deque.tasks.pop_front();
+            }
+            else
+            {
+                task = deque.tasks.back();
+                deque.tasks.pop_back();
+            }
+            account->queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::workerLoop(unsigned int threadIndex)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping)
+    {
+        TaskAccount* account = pickAccount();
+        if (account == nullptr)
+        {
+            workCondition.wait(lock);
+            continue;
+        }
+        account->activeWorkers++;
+        lock.unlock();
+
+        std::chrono::steady_clock::time_point sliceStart =
+            std::chrono::steady_clock::now();
+        double servedTime = 0;
+        TaskRange task;
+        while (servedTime < timeSlice && takeTask(account, threadIndex, task))
+        {
+            account->loopBodyCaller(account->loopBody, task.begin, task.end);
+            if (account->remainingTasks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                {
+                    std::lock_guard<std::mutex> doneLock(account->doneMutex);
+                }
+                account->doneCondition.notify_one();
+            }
+            servedTime = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now()-sliceStart).count();
+        }
+
+        lock.lock();
+        account->virtualTime += servedTime/account->weight;
+        account->activeWorkers--;
+        if (account->activeWorkers == 0)
+        {
+            // an unregistering account may wait for its workers
+            workersFinishedCondition.notify_all();
+        }
+    }
+}
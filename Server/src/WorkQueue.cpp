@@ -7,48 +7,127 @@
  * Full license text is under the file "LICENSE" provided with this code. */
 
 #include "WorkQueue.hpp"
-#include "DataTransmit.hpp"
+#include "ByteBuffer.hpp"
 
 #include <QElapsedTimer>
-#include <sstream>
-#include <stdexcept>
+#include <QThread>
 
 using namespace SphereSim;
 
-WorkQueue::WorkQueue(QMutex* mutex, const bool &frameSending)
-    :items(), mutex(mutex), queueEmpty(true), canWork(false), workCondition(),
-    simulationSteps(0), continuousSimulationRunning(false), isSimulating(false),
-    animationTimer(new QElapsedTimer()), sendFramesRegularly(frameSending)
+WorkQueue::WorkQueue(QMutex* mutex, const bool &frameSending,
+    const unsigned int &frameRate)
+    :stubItem(ActionGroups::workQueue, WorkQueueActions::stopWorker),
+    calculateStepItem(ActionGroups::workQueue, WorkQueueActions::calculateStep),
+    prepareFrameDataItem(ActionGroups::workQueue,
+        WorkQueueActions::prepareFrameData),
+    finishSimulationItem(ActionGroups::workQueue,
+        WorkQueueActions::finishSimulation),
+    queueHead(&stubItem), queueTail(&stubItem), queuedItems(0),
+    freeItems(nullptr), resetCount(0), mutex(mutex), workerWaiting(false),
+    workCondition(), simulationSteps(0), continuousSimulationRunning(false),
+    isSimulating(false), frameDataDue(false), animationTimer(new QElapsedTimer()),
+    sendFramesRegularly(frameSending), frameRate(frameRate),
+    pacedFrameRate(frameRate), issuedFrames(0)
 {
-    updateStatus();
     animationTimer->start();
 }
 
 WorkQueue::~WorkQueue()
 {
+    WorkQueueItem* item = queueHead;
+    while (item != nullptr)
+    {
+        WorkQueueItem* next = item->next.load(std::memory_order_acquire);
+        if (item != &stubItem)
+        {
+            delete item;
+        }
+        item = next;
+    }
+    item = freeItems.load(std::memory_order_acquire);
+    while (item != nullptr)
+    {
+        WorkQueueItem* next = item->next.load(std::memory_order_relaxed);
+        delete item;
+        item = next;
+    }
     delete mutex;
     delete animationTimer;
 }
 
-void WorkQueue::pushItem(WorkQueueItem& item)
+WorkQueueItem* WorkQueue::acquireItem()
 {
-    mutex->lock();
-        items.push_back(item);
-        queueEmpty = false;
-        updateStatus();
-        if (canWork)
+    // popping single items from a lock-free stack is prone to the ABA
+    // problem, so take the whole stack and push the rest back
+    WorkQueueItem* item = freeItems.exchange(nullptr, std::memory_order_acquire);
+    if (item == nullptr)
+    {
+        return new WorkQueueItem(ActionGroups::workQueue,
+            WorkQueueActions::stopWorker);
+    }
+    WorkQueueItem* remainingItems = item->next.load(std::memory_order_relaxed);
+    if (remainingItems != nullptr)
+    {
+        WorkQueueItem* lastItem = remainingItems;
+        while (lastItem->next.load(std::memory_order_relaxed) != nullptr)
         {
-            workCondition.wakeOne();
+            lastItem = lastItem->next.load(std::memory_order_relaxed);
         }
-    mutex->unlock();
+        WorkQueueItem* top = freeItems.load(std::memory_order_relaxed);
+        do
+        {
+            lastItem->next.store(top, std::memory_order_relaxed);
+        }
+        while (freeItems.compare_exchange_weak(top, remainingItems,
+            std::memory_order_release, std::memory_order_relaxed) == false);
+    }
+    return item;
+}
+
+void WorkQueue::releaseItem(WorkQueueItem* item)
+{
+    if (item == &calculateStepItem || item == &prepareFrameDataItem
+        || item == &finishSimulationItem)
+    {
+        return;
+    }
+    // keeps the memory of the string for the next item
+    item->data.clear();
+    WorkQueueItem* top = freeItems.load(std::memory_order_relaxed);
+    do
+    {
+        item->next.store(top, std::memory_order_relaxed);
+    }
+    while (freeItems.compare_exchange_weak(top, item, std::memory_order_release,
+        std::memory_order_relaxed) == false);
+}
+
+void WorkQueue::pushItem(WorkQueueItem* item)
+{
+    item->resetCount = resetCount.load(std::memory_order_acquire);
+    item->next.store(nullptr, std::memory_order_relaxed);
+    WorkQueueItem* previousItem = queueTail.exchange(item,
+        std::memory_order_acq_rel);
+    previousItem->next.store(item, std::memory_order_release);
+    if (item == &stubItem)
+    {
+        return;
+    }
+    queuedItems.fetch_add(1);
+    if (workerWaiting.load())
+    {
+        mutex->lock();
+            workCondition.wakeOne();
+        mutex->unlock();
+    }
 }
 
 void WorkQueue::pushItem(unsigned char actionGroup, unsigned char action,
-    std::string data)
+    const char* data, size_t size)
 {
     if (actionGroup == ActionGroups::calculation)
     {
-        std::istringstream stream(data);
+        ByteReader reader(data, size);
         unsigned int steps;
         bool actionDone = false;
         switch (action)
@@ -58,7 +137,7 @@ void WorkQueue::pushItem(unsigned char actionGroup, unsigned char action,
             actionDone = true;
             break;
         case CalculationActions::calculateSomeSteps:
-            steps = readInt(stream);
+            steps = reader.readInt();
             pushSimulationSteps(steps);
             actionDone = true;
             break;
@@ -76,7 +155,10 @@ void WorkQueue::pushItem(unsigned char actionGroup, unsigned char action,
             return;
         }
     }
-    WorkQueueItem item(actionGroup, action, data);
+    WorkQueueItem* item = acquireItem();
+    item->actionGroup = actionGroup;
+    item->action = action;
+    item->data.assign(data, size);
     pushItem(item);
 }
 
@@ -85,112 +167,216 @@ void WorkQueue::pushSimulationSteps(unsigned int steps)
     mutex->lock();
         if (steps == 0)
         {
-            simulationSteps = 0;
-            continuousSimulationRunning = true;
+            simulationSteps.store(0);
+            continuousSimulationRunning.store(true);
         }
         else
         {
-            simulationSteps += steps;
+            simulationSteps.fetch_add(steps);
         }
-        updateStatus();
         isSimulating = true;
         emit simulating(isSimulating);
         workCondition.wakeOne();
     mutex->unlock();
 }
 
-WorkQueueItem* WorkQueue::popItem()
+WorkQueueItem* WorkQueue::popQueuedItem()
 {
-    mutex->lock();
-        if (((simulationSteps>0) || continuousSimulationRunning) == false)
+    WorkQueueItem* head = queueHead;
+    WorkQueueItem* next = head->next.load(std::memory_order_acquire);
+    if (head == &stubItem)
+    {
+        if (next == nullptr)
+        {
+            return nullptr;
+        }
+        queueHead = next;
+        head = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next == nullptr)
+    {
+        if (head != queueTail.load(std::memory_order_acquire))
+        {
+            // a producer has not yet linked its item
+            return nullptr;
+        }
+        // the last item can only be removed with another one behind it
+        pushItem(&stubItem);
+        next = head->next.load(std::memory_order_acquire);
+        if (next == nullptr)
         {
-            isSimulating = false;
-            emit simulating(isSimulating);
+            return nullptr;
         }
-        if (canWork == false)
+    }
+    queueHead = next;
+    queuedItems.fetch_sub(1);
+    return head;
+}
+
+bool WorkQueue::popSimulationStep()
+{
+    if (continuousSimulationRunning.load(std::memory_order_relaxed))
+    {
+        return true;
+    }
+    // only the worker decreases the number of steps
+    unsigned int steps = simulationSteps.load(std::memory_order_relaxed);
+    while (steps>0)
+    {
+        if (simulationSteps.compare_exchange_weak(steps, steps-1,
+            std::memory_order_relaxed))
         {
-            workCondition.wait(mutex);
+            return true;
         }
+    }
+    return false;
+}
 
-        WorkQueueItem* item;
-        if (items.size()>0)
+unsigned int WorkQueue::takeSimulationSteps(unsigned int maximumSteps)
+{
+    if (continuousSimulationRunning.load(std::memory_order_relaxed))
+    {
+        return maximumSteps;
+    }
+    unsigned int steps = simulationSteps.load(std::memory_order_relaxed);
+    while (steps>0)
+    {
+        unsigned int takenSteps = (steps < maximumSteps ? steps : maximumSteps);
+        if (simulationSteps.compare_exchange_weak(steps, steps-takenSteps,
+            std::memory_order_relaxed))
         {
-            item = new WorkQueueItem(items.front());
-            items.pop_front();
+            return takenSteps;
         }
-        else
+    }
+    return 0;
+}
+
+WorkQueueItem* WorkQueue::popItem()
+{
+    while (true)
+    {
+        if (frameDataDue)
         {
-            item = new WorkQueueItem(ActionGroups::workQueue,
-                WorkQueueActions::calculateStep);
-            if (simulationSteps>0)
+            frameDataDue = false;
+            return &prepareFrameDataItem;
+        }
+        if (queuedItems.load() != 0)
+        {
+            WorkQueueItem* item = popQueuedItem();
+            if (item == nullptr)
             {
-                simulationSteps--;
+                QThread::yieldCurrentThread();
+                continue;
             }
-            else if (continuousSimulationRunning == false)
+            if (item->resetCount != resetCount.load(std::memory_order_acquire))
             {
-                throw std::runtime_error("WorkQueue failed.");
+                // pushed before a reset
+                releaseItem(item);
+                continue;
             }
+            return item;
         }
-        if (item->actionGroup == ActionGroups::workQueue &&
-            item->action == WorkQueueActions::calculateStep)
+        if (popSimulationStep())
         {
-            if (sendFramesRegularly && animationTimer->elapsed()>(1000/60))
+            double currentFrameRate = (frameRate < pacedFrameRate
+                ? frameRate : pacedFrameRate);
+            if (sendFramesRegularly && frameRate > 0
+                && animationTimer->elapsed()*currentFrameRate >= 1000)
             {
                 animationTimer->restart();
-                WorkQueueItem item2(ActionGroups::workQueue,
-                    WorkQueueActions::prepareFrameData);
-                items.push_front(item2);
+                frameDataDue = true;
+                issuedFrames++;
             }
+            return &calculateStepItem;
         }
-        if (items.size()<=0)
-        {
-            queueEmpty = true;
-            updateStatus();
-        }
-    mutex->unlock();
-    return item;
+        mutex->lock();
+            // producers check workerWaiting after pushing, so either they
+            // wake the worker or canWork sees their items
+            workerWaiting.store(true);
+            if (canWork() == false)
+            {
+                if (isSimulating)
+                {
+                    isSimulating = false;
+                    emit simulating(isSimulating);
+                    // the worker finishes the simulation before waiting
+                    workerWaiting.store(false);
+                    mutex->unlock();
+                    return &finishSimulationItem;
+                }
+                workCondition.wait(mutex);
+            }
+            workerWaiting.store(false);
+        mutex->unlock();
+    }
 }
 
-void WorkQueue::updateStatus()
+bool WorkQueue::canWork()
 {
-    canWork = (queueEmpty == false) || (simulationSteps>0)
-        || continuousSimulationRunning;
+    return (queuedItems.load() != 0) || (simulationSteps.load()>0)
+        || continuousSimulationRunning.load();
 }
 
 void WorkQueue::stopSimulation()
 {
-    mutex->lock();
-        continuousSimulationRunning = false;
-        simulationSteps = 0;
-        updateStatus();
-    mutex->unlock();
+    continuousSimulationRunning.store(false);
+    simulationSteps.store(0);
 }
 
 void WorkQueue::stop()
 {
-    WorkQueueItem item(ActionGroups::workQueue, WorkQueueActions::stopWorker);
+    WorkQueueItem* item = acquireItem();
+    item->actionGroup = ActionGroups::workQueue;
+    item->action = WorkQueueActions::stopWorker;
     pushItem(item);
 }
 
 void WorkQueue::reset()
 {
     mutex->lock();
-        continuousSimulationRunning = false;
-        simulationSteps = 0;
-        items.clear();
-        queueEmpty = true;
+        continuousSimulationRunning.store(false);
+        simulationSteps.store(0);
+        // the worker drops the queued items
+        resetCount.fetch_add(1, std::memory_order_release);
         isSimulating = false;
         emit simulating(isSimulating);
-        updateStatus();
     mutex->unlock();
 }
 
+void WorkQueue::updateFramePacing(unsigned char bufferLevel,
+    unsigned int receivedFrames)
+{
+    const double increase = 5;
+    const double decrease = 0.5;
+    const double minimumFrameRate = 1;
+    bool congested = (bufferLevel > 80)
+        || (receivedFrames+1 < issuedFrames*0.9);
+    if (pacedFrameRate > frameRate)
+    {
+        pacedFrameRate = frameRate;
+    }
+    if (congested)
+    {
+        pacedFrameRate *= decrease;
+        pacedFrameRate = (pacedFrameRate > minimumFrameRate
+            ? pacedFrameRate : minimumFrameRate);
+    }
+    else
+    {
+        pacedFrameRate += increase;
+    }
+    issuedFrames = 0;
+}
+
 void WorkQueue::sendFrameData()
 {
     if (sendFramesRegularly == false)
     {
         return;
     }
-    WorkQueueItem item(ActionGroups::workQueue, WorkQueueActions::prepareFrameData);
+    WorkQueueItem* item = acquireItem();
+    item->actionGroup = ActionGroups::workQueue;
+    item->action = WorkQueueActions::prepareFrameData;
     pushItem(item);
 }
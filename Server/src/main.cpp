@@ -9,11 +9,17 @@
 #include "ActionServer.hpp"
 #include "Connection.hpp"
 #include "Console.hpp"
+#include "DomainGroup.hpp"
+#include "MessageTransmitter.hpp"
+#include "TaskScheduler.hpp"
 
 #include <QCoreApplication>
+#include <cstdlib>
 #include <string>
+#include <vector>
 
 Q_DECLARE_METATYPE(std::string);
+Q_DECLARE_METATYPE(SphereSim::MessageBuffer);
 
 using namespace SphereSim;
 
@@ -21,17 +27,57 @@ using namespace SphereSim;
  * method main:
  * Creates instance of ActionServer to listen to incoming client connections.
  * Starts QCoreApplication.
+ *
+ * With "--domain <index> <address 0> ... <address n-1>", the simulations are
+ * split spatially over n server processes connected at the specified nanomsg
+ * addresses. Only domain 0 serves clients. On one host for example:
+ *   SphereSim_Server --domain 1 tcp://127.0.0.1:7100 tcp://127.0.0.1:7101 &
+ *   SphereSim_Server --domain 0 tcp://127.0.0.1:7100 tcp://127.0.0.1:7101
  */
 
 int main(int argc, char** argv)
 {
     qRegisterMetaType<std::string>();
+    qRegisterMetaType<MessageBuffer>("MessageBuffer");
 
     QCoreApplication app(argc, argv);
+    unsigned int domainIndex = 0;
+    std::vector<std::string> domainAddresses;
+    if (argc > 1 && std::string(argv[1]) == "--domain")
+    {
+        domainIndex = (argc > 2 ? strtoul(argv[2], nullptr, 10) : 0);
+        for (int i = 3; i<argc; i++)
+        {
+            domainAddresses.push_back(argv[i]);
+        }
+        if (domainAddresses.size() < 2 || domainAddresses.size() > 256
+            || domainIndex >= domainAddresses.size())
+        {
+            Console()<<Console::red<<Console::bold<<"Usage: "<<argv[0]
+                <<" [--domain <index> <address 0> <address 1> ...]\n";
+            return 1;
+        }
+    }
     try
     {
-        ActionServer actSvr(Connection::listeningAddress,
-            Connection::serverSendPort, Connection::serverRecvPort);
+        if (domainAddresses.empty())
+        {
+            ActionServer actSvr(Connection::listeningAddress,
+                Connection::serverSendPort, Connection::serverRecvPort,
+                Connection::serverFramePort);
+            return app.exec();
+        }
+        if (domainIndex == 0)
+        {
+            DomainGroup domainGroup(domainIndex, domainAddresses, nullptr);
+            ActionServer actSvr(Connection::listeningAddress,
+                Connection::serverSendPort, Connection::serverRecvPort,
+                Connection::serverFramePort, 0, &domainGroup);
+            return app.exec();
+        }
+        // the other domains only calculate and do not listen to clients
+        TaskScheduler taskScheduler(0);
+        DomainGroup domainGroup(domainIndex, domainAddresses, &taskScheduler);
         return app.exec();
     }
     catch (std::exception ex)
@@ -22,14 +22,19 @@ HEADERS     =   Actions.hpp         \
                 Integrators.hpp     \
                 Object.hpp          \
                 SimulatedSystem.hpp \
-                MessageTransmitter.hpp
+                MessageTransmitter.hpp \
+                FrameCodec.hpp      \
+                ByteBuffer.hpp      \
+                SharedFrameRing.hpp
 
 SOURCES     =   Connection.cpp      \
                 Console.cpp         \
                 Object.cpp          \
                 SimulatedSystem.cpp \
                 DataTransmit.cpp    \
-                MessageTransmitter.cpp
+                MessageTransmitter.cpp \
+                FrameCodec.cpp      \
+                SharedFrameRing.cpp
 
 QMAKE_CXXFLAGS_RELEASE  +=  -O3 -Wno-unused-local-typedefs -Wno-enum-compare \
                             -Wno-unused-parameter -Wno-unused-variable \
@@ -38,7 +38,8 @@ namespace SphereSim
             gravityCalculation,
             /** \brief Flag if Lennard-Jones potential and forces get calculated. */
             lennardJonesPotential,
-            /** \brief Maximum number of dividing simulation steps. */
+            /** \brief Maximum number of dividing simulation steps, i.e. the
+             * highest time step level of a sphere. */
             maximumStepDivision,
             /** \brief Maximum allowed relative error for simulation steps. */
             maximumStepError,
@@ -68,6 +69,32 @@ namespace SphereSim
             lenJonPotEpsilon,
             /** \brief Sigma used for Lennard-Jones potential. */
             lenJonPotSigma,
+            /** \brief Number of inner steps for short range forces per step of
+             * the RESPA integrator. */
+            respaStepRatio,
+            /** \brief Flag if the time step gets adapted to maximumStepError
+             * after every step; disables the time step levels. */
+            adaptiveTimeStep,
+            /** \brief Number of steps rejected by the adaptive time step
+             * control. */
+            rejectedStepCount,
+            /** \brief Relative share of the server threads this simulation gets
+             * among busy simulations of equal priority. */
+            simulationWeight,
+            /** \brief Simulations with a higher priority get the server threads
+             * first. */
+            simulationPriority,
+            /** \brief Number of frames per second sent regularly to the
+             * client; 0 disables regular frames. */
+            frameRate,
+            /** \brief Maximum number of spheres per frame, chosen evenly over
+             * the box; 0 sends all spheres. */
+            maximumFrameSphereCount,
+            /** \brief Spheres with a smaller radius are not sent in frames. */
+            minimumFrameSphereRadius,
+            /** \brief Flag if the spheres are sorted along the longest axis of
+             * the box before every step, for memory locality. */
+            spatialSorting,
             /** \brief Last enum value equals number of variables. */
             numberOfVariables
         };
@@ -109,8 +136,17 @@ namespace SphereSim
             terminateServer,
             /** \brief Inform about an updated variable. */
             updateVariable,
-            /** \brief Confirm connection with heartbeat. */
-            heartbeat
+            /** \brief Confirm connection with heartbeat; may carry the frame
+             * buffer level (in percent, 1 byte) and the number of frames
+             * received since the last heartbeat (4 bytes). */
+            heartbeat,
+            /** \brief Ask for frames over shared memory, for clients on the
+             * same host as the server.
+             * \see SharedFrameRing */
+            requestSharedFrames,
+            /** \brief Confirm (1) or decline (0) the offered shared memory ring
+             * (1 byte); frames are sent over it only after confirmation. */
+            useSharedFrames
         };
     }
 
@@ -163,7 +199,34 @@ namespace SphereSim
             /** \brief Get and reset the number of simulated time steps. */
             popStepCounter,
             /** \brief Get time (in ms) needed to calculate the last step. */
-            getLastStepCalculationTime
+            getLastStepCalculationTime,
+            /** \brief Get and reset the time (in us) spent in each CalculationPhases
+             * phase. */
+            popPhaseCalculationTimes
+        };
+    }
+
+    /** \brief Phases of a simulation step, timed separately by the server. */
+    namespace CalculationPhases
+    {
+        /** \see CalculationPhases */
+        enum Phase
+        {
+            /** \brief Update of the bounding box of all spheres. */
+            sphereBox,
+            /** \brief Update of the collision detection cell lists. */
+            cellLists,
+            /** \brief Update of the gravity cell lists. */
+            gravityCellLists,
+            /** \brief Update of masses and mass centers of the gravity cells. */
+            gravityCellData,
+            /** \brief Integration of the sphere movements. */
+            integration,
+            /** \brief Sorting of the spheres along the longest axis of the
+             * box. */
+            spatialSorting,
+            /** \brief Last enum value equals number of phases. */
+            numberOfPhases
         };
     }
 
@@ -183,6 +246,10 @@ namespace SphereSim
     /** \brief Server status replies. */
     namespace ServerStatusReplies
     {
+        /** \brief Size of the header preceding each reply: simulation ID (4
+         * bytes), server ID (4) and reply (2). */
+        const unsigned int headerSize = 10;
+
         /** \see ServerStatusReplies */
         enum Reply
         {
@@ -192,7 +259,8 @@ namespace SphereSim
             unknownActionGroup,
             /** \brief The action requested by client is unknown to server. */
             unknownAction,
-            /** \brief The server is sending sphere data. */
+            /** \brief The server is sending the sphere data of a frame.
+             * \see FrameCodec */
             sendFrame,
             /** \brief The server is terminating. */
             terminating,
@@ -201,7 +269,13 @@ namespace SphereSim
             /** \brief The server accepted the client connection. */
             clientAccepted,
             /** \brief Confirm connection with heartbeat. */
-            serverHeartbeat
+            serverHeartbeat,
+            /** \brief The server offers a shared memory ring for frames: token
+             * (8 bytes) and name of the ring.
+             * \see SharedFrameRing */
+            sharedFramesOffered,
+            /** \brief The server wrote a frame to the shared memory ring. */
+            sharedFrameWritten
         };
     }
 
@@ -216,7 +290,9 @@ namespace SphereSim
             /** \brief Prepare frame data which will be sent to client. */
             prepareFrameData,
             /** \copybrief CalculationActions::calculateStep */
-            calculateStep
+            calculateStep,
+            /** \brief The simulation ran out of steps. */
+            finishSimulation
         };
     }
 
@@ -0,0 +1,380 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#ifndef _BYTEBUFFER_HPP_
+#define _BYTEBUFFER_HPP_
+
+#include "Vector.hpp"
+
+#include <cstring>
+#include <string>
+
+namespace SphereSim
+{
+
+    /** \brief Helpers for the little-endian byte layout of messages. */
+    namespace ByteOrder
+    {
+        /** \brief Flag whether values already are little-endian in memory, so
+         * arrays can be copied as a whole. */
+        constexpr bool hostIsLittleEndian =
+            (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+
+        /** \brief Unsigned integer type with the size of T. */
+        template <unsigned int size> struct UnsignedOfSize;
+        template <> struct UnsignedOfSize<1> { typedef unsigned char Type; };
+        template <> struct UnsignedOfSize<2> { typedef unsigned short Type; };
+        template <> struct UnsignedOfSize<4> { typedef unsigned int Type; };
+        template <> struct UnsignedOfSize<8> { typedef unsigned long long Type; };
+
+        /** \brief Store a value little-endian at data. */
+        template <typename T>
+        inline void store(char* data, T value)
+        {
+            if (hostIsLittleEndian)
+            {
+                memcpy(data, &value, sizeof(T));
+                return;
+            }
+            typename UnsignedOfSize<sizeof(T)>::Type bits;
+            memcpy(&bits, &value, sizeof(T));
+            for (unsigned int i = 0; i<sizeof(T); i++)
+            {
+                data[i] = (char)((bits>>(8*i)) & 0xff);
+            }
+        }
+
+        /** \brief Load a little-endian value from data. */
+        template <typename T>
+        inline T load(const char* data)
+        {
+            T value;
+            if (hostIsLittleEndian)
+            {
+                memcpy(&value, data, sizeof(T));
+                return value;
+            }
+            typedef typename UnsignedOfSize<sizeof(T)>::Type Bits;
+            Bits bits = 0;
+            for (unsigned int i = 0; i<sizeof(T); i++)
+            {
+                bits |= (Bits)(unsigned char)data[i]<<(8*i);
+            }
+            memcpy(&value, &bits, sizeof(T));
+            return value;
+        }
+    }
+
+    /** \brief Writer of little-endian values into a reusable buffer.
+     *
+     * The buffer is cleared on construction but keeps its memory, so a buffer
+     * reused for every message does not allocate once it is large enough.
+     * A writer can also fill a fixed memory range of known size, like a
+     * message allocated by nanomsg; writes past its end are dropped and mark
+     * the writer as failed. */
+    class ByteWriter
+    {
+    private:
+        /** \brief Buffer the values are appended to; nullptr when writing into
+         * a fixed memory range. */
+        std::string* buffer;
+
+        /** \brief Fixed memory range. */
+        char* data;
+
+        /** \brief Number of bytes of the fixed memory range. */
+        size_t capacity;
+
+        /** \brief Number of bytes written into the fixed memory range. */
+        size_t size;
+
+        /** \brief Flag showing that a write went past the end. */
+        bool failed;
+
+        /** \brief Make room for byteCount bytes and return their position;
+         * nullptr if the fixed memory range is too small. */
+        char* extend(size_t byteCount)
+        {
+            if (buffer != nullptr)
+            {
+                size_t position = buffer->size();
+                buffer->resize(position+byteCount);
+                return &(*buffer)[position];
+            }
+            if (failed || capacity-size < byteCount)
+            {
+                failed = true;
+                return nullptr;
+            }
+            char* current = &data[size];
+            size += byteCount;
+            return current;
+        }
+
+    public:
+        /** \brief Start writing into the buffer, discarding its content. */
+        ByteWriter(std::string& buffer)
+            :buffer(&buffer), data(nullptr), capacity(0), size(0), failed(false)
+        {
+            buffer.clear();
+        }
+
+        /** \brief Start writing into the fixed memory range. */
+        ByteWriter(char* data, size_t capacity)
+            :buffer(nullptr), data(data), capacity(capacity), size(0),
+            failed(false)
+        {
+        }
+
+        ByteWriter() = delete;
+        ByteWriter(const ByteWriter&) = delete;
+        ByteWriter& operator=(const ByteWriter&) = delete;
+
+        /** \brief Append a value. */
+        template <typename T>
+        void write(T value)
+        {
+            char* current = extend(sizeof(T));
+            if (current != nullptr)
+            {
+                ByteOrder::store<T>(current, value);
+            }
+        }
+
+        void writeChar(unsigned char c)
+        {
+            write<unsigned char>(c);
+        }
+
+        void writeShort(unsigned short s)
+        {
+            write<unsigned short>(s);
+        }
+
+        void writeInt(unsigned int i)
+        {
+            write<unsigned int>(i);
+        }
+
+        void writeFloat(float f)
+        {
+            write<float>(f);
+        }
+
+        void writeDouble(double d)
+        {
+            write<double>(d);
+        }
+
+        void writeVector3(const Vector3& v)
+        {
+            writeDouble(v(0));
+            writeDouble(v(1));
+            writeDouble(v(2));
+        }
+
+        /** \brief Append an array of values at once. */
+        template <typename T>
+        void writeArray(const T* values, size_t count)
+        {
+            if (count == 0)
+            {
+                return;
+            }
+            char* current = extend(count*sizeof(T));
+            if (current == nullptr)
+            {
+                return;
+            }
+            if (ByteOrder::hostIsLittleEndian)
+            {
+                memcpy(current, values, count*sizeof(T));
+                return;
+            }
+            for (size_t i = 0; i<count; i++)
+            {
+                ByteOrder::store<T>(&current[i*sizeof(T)], values[i]);
+            }
+        }
+
+        /** \brief Append raw bytes. */
+        void writeBytes(const char* bytes, size_t byteCount)
+        {
+            char* current = extend(byteCount);
+            if (current != nullptr)
+            {
+                memcpy(current, bytes, byteCount);
+            }
+        }
+
+        /** \brief Number of written bytes. */
+        size_t getSize() const
+        {
+            return (buffer != nullptr ? buffer->size() : size);
+        }
+
+        /** \brief Check whether all values fitted into the memory range. */
+        bool isGood() const
+        {
+            return !failed;
+        }
+
+    };
+
+    /** \brief Reader of little-endian values from a byte range.
+     *
+     * Reading past the end yields zeros and marks the reader as failed
+     * instead of throwing. */
+    class ByteReader
+    {
+    private:
+        /** \brief First byte of the range. */
+        const char* data;
+
+        /** \brief Number of bytes of the range. */
+        size_t size;
+
+        /** \brief Position of the next byte to read. */
+        size_t position;
+
+        /** \brief Flag showing that a read went past the end. */
+        bool failed;
+
+        /** \brief Consume size bytes; nullptr if there are not enough. */
+        const char* consume(size_t byteCount)
+        {
+            if (failed || size-position < byteCount)
+            {
+                failed = true;
+                return nullptr;
+            }
+            const char* current = &data[position];
+            position += byteCount;
+            return current;
+        }
+
+    public:
+        /** \brief Start reading the byte range. */
+        ByteReader(const char* data, size_t size)
+            :data(data), size(size), position(0), failed(false)
+        {
+        }
+
+        /** \brief Start reading the string content. */
+        ByteReader(const std::string& buffer)
+            :ByteReader(buffer.data(), buffer.size())
+        {
+        }
+
+        ByteReader() = delete;
+        ByteReader(const ByteReader&) = default;
+        ByteReader& operator=(const ByteReader&) = default;
+
+        /** \brief Read a value. */
+        template <typename T>
+        T read()
+        {
+            const char* current = consume(sizeof(T));
+            return (current != nullptr ? ByteOrder::load<T>(current) : T());
+        }
+
+        unsigned char readChar()
+        {
+            return read<unsigned char>();
+        }
+
+        unsigned short readShort()
+        {
+            return read<unsigned short>();
+        }
+
+        unsigned int readInt()
+        {
+            return read<unsigned int>();
+        }
+
+        float readFloat()
+        {
+            return read<float>();
+        }
+
+        double readDouble()
+        {
+            return read<double>();
+        }
+
+        Vector3 readVector3()
+        {
+            Vector3 v;
+            v(0) = readDouble();
+            v(1) = readDouble();
+            v(2) = readDouble();
+            return v;
+        }
+
+        /** \brief Read an array of values at once.
+         * \return Flag whether there were enough bytes. */
+        template <typename T>
+        bool readArray(T* values, size_t count)
+        {
+            if (count == 0)
+            {
+                return isGood();
+            }
+            if (count > (size-position)/sizeof(T))
+            {
+                failed = true;
+                return false;
+            }
+            const char* current = consume(count*sizeof(T));
+            if (current == nullptr)
+            {
+                return false;
+            }
+            if (ByteOrder::hostIsLittleEndian)
+            {
+                memcpy(values, current, count*sizeof(T));
+                return true;
+            }
+            for (size_t i = 0; i<count; i++)
+            {
+                values[i] = ByteOrder::load<T>(&current[i*sizeof(T)]);
+            }
+            return true;
+        }
+
+        /** \brief Skip bytes.
+         * \return Flag whether there were enough bytes. */
+        bool skip(size_t byteCount)
+        {
+            return (consume(byteCount) != nullptr);
+        }
+
+        /** \brief Next byte to read. */
+        const char* getCurrent() const
+        {
+            return &data[position];
+        }
+
+        /** \brief Number of bytes not yet read. */
+        size_t getRemainingSize() const
+        {
+            return size-position;
+        }
+
+        /** \brief Flag whether all reads were within the range. */
+        bool isGood() const
+        {
+            return (failed == false);
+        }
+
+    };
+
+}
+
+#endif /*_BYTEBUFFER_HPP_*/
@@ -23,6 +23,8 @@ namespace SphereSim
         extern unsigned short serverSendPort;
         /** \brief The port that the server listens to. */
         extern unsigned short serverRecvPort;
+        /** \brief The port that the client listens to for frames. */
+        extern unsigned short serverFramePort;
     }
 
 }
@@ -9,56 +9,37 @@
 #ifndef _SPHERETRANSMIT_HPP_
 #define _SPHERETRANSMIT_HPP_
 
-#include "Vector.hpp"
+#include "ByteBuffer.hpp"
 
-#include <iostream>
 #include <string>
 
 namespace SphereSim
 {
     class Sphere;
 
-    void writeBool(std::ostream& stream, bool b);
-    bool readBool(std::istream& stream);
+    void writeBool(ByteWriter& writer, bool b);
+    bool readBool(ByteReader& reader);
 
-    void writeChar(std::ostream& stream, unsigned char c);
-    char readChar(std::istream& stream);
+    void writeString(ByteWriter& writer, const std::string& s);
+    std::string readString(ByteReader& reader);
 
-    void writeShort(std::ostream& stream, unsigned short s);
-    unsigned short readShort(std::istream& stream);
-
-    void writeInt(std::ostream& stream, unsigned int i);
-    unsigned int readInt(std::istream& stream);
-
-    void writeFloat(std::ostream& stream, float f);
-    float readFloat(std::istream& stream);
-
-    void writeDouble(std::ostream& stream, double d);
-    double readDouble(std::istream& stream);
-
-    void writeVector3(std::ostream& stream, Vector3 v);
-    Vector3 readVector3(std::istream& stream);
-
-    void writeString(std::ostream& stream, std::string s);
-    std::string readString(std::istream& stream);
-
-    /** \brief Write basic data of a sphere to a stream.
-     * \param stream Stream to write to.
+    /** \brief Write basic data of a sphere to a message.
+     * \param writer Writer of the message.
      * \param s Sphere to send. */
-    void writeBasicSphereData(std::ostream& stream, Sphere& s);
-    /** \brief Read and update basic data of a sphere from a stream.
-     * \param stream Stream to read from.
+    void writeBasicSphereData(ByteWriter& writer, const Sphere& s);
+    /** \brief Read and update basic data of a sphere from a message.
+     * \param reader Reader of the message.
      * \param s Sphere to update. */
-    void readBasicSphereData(std::istream& stream, Sphere& s);
+    void readBasicSphereData(ByteReader& reader, Sphere& s);
 
-    /** \brief Write all data of a sphere to a stream.
-     * \param stream Stream to write to.
+    /** \brief Write all data of a sphere to a message.
+     * \param writer Writer of the message.
      * \param s Sphere to send. */
-    void writeAllSphereData(std::ostream& stream, Sphere& s);
-    /** \brief Read and update all data of a sphere from a stream.
-     * \param stream Stream to read from.
+    void writeAllSphereData(ByteWriter& writer, const Sphere& s);
+    /** \brief Read and update all data of a sphere from a message.
+     * \param reader Reader of the message.
      * \param s Sphere to update. */
-    void readAllSphereData(std::istream& stream, Sphere& s);
+    void readAllSphereData(ByteReader& reader, Sphere& s);
 
 }
 
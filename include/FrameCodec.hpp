@@ -0,0 +1,241 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#ifndef _FRAMECODEC_HPP_
+#define _FRAMECODEC_HPP_
+
+#include "Vector.hpp"
+
+#include <string>
+#include <vector>
+
+namespace SphereSim
+{
+
+    class ByteWriter;
+    class ByteReader;
+
+    /** \brief Compact encoding of the sphere data of frames.
+     *
+     * Positions are quantized to 16 or 21 bits per axis relative to the box
+     * [0, boxSize]. A keyframe contains all radii (as floats) and positions;
+     * 16 bit positions are stored per axis (all x, all y, all z), 21 bit
+     * positions are packed into one 64 bit value per sphere. A delta frame
+     * refers to the previous frame and contains the indices and positions of
+     * the spheres that moved more than a threshold, and the indices and radii
+     * of the spheres whose radius changed. Keyframes are sent periodically
+     * and whenever the sphere count or the box changes. With the default
+     * movement threshold of 0, the decoded positions stay within half a
+     * quantization step of the encoded ones.
+     *
+     * Message layout (little-endian): frame counter (4 bytes), reference
+     * frame counter (4), sphere count (4), frame type (1), position bits (1),
+     * box size (3*8, keyframes only), frame data. */
+    namespace FrameCodec
+    {
+        /** \brief Type of an encoded frame. */
+        enum FrameType
+        {
+            /** \brief Frame containing all spheres. */
+            keyframe,
+            /** \brief Frame containing the changes to the previous frame. */
+            deltaFrame
+        };
+    }
+
+    /** \brief Encoder of frames, keeping the state sent before. */
+    class FrameEncoder
+    {
+    private:
+        /** \brief Number of bits per axis of the quantized positions. */
+        const unsigned char positionBits;
+
+        /** \brief Number of frames after which a keyframe is sent. */
+        const unsigned int keyframeInterval;
+
+        /** \brief Movement (in quantization steps) a sphere needs for being
+         * sent in a delta frame. */
+        const unsigned int movementThreshold;
+
+        /** \brief Frames sent since the last keyframe. */
+        unsigned int framesSinceKeyframe;
+
+        /** \brief Flag forcing the next frame to be a keyframe. */
+        bool keyframeRequested;
+
+        /** \brief Counter of the last encoded frame. */
+        unsigned int lastFrameCounter;
+
+        /** \brief Box size of the last keyframe. */
+        Vector3 lastBoxSize;
+
+        /** \brief Radii as known by the receivers. */
+        std::vector<float> sentRadii;
+
+        /** \brief Quantized positions as known by the receivers, per axis. */
+        std::vector<unsigned int> sentPositions[3];
+
+        /** \brief Indices of the spheres whose positions are sent. */
+        std::vector<unsigned int> movedSpheres;
+
+        /** \brief Indices of the spheres whose radii are sent in a delta
+         * frame. */
+        std::vector<unsigned int> resizedSpheres;
+
+        /** \brief Header values of the prepared frame. */
+        unsigned int preparedFrameCounter;
+        unsigned int preparedReferenceCounter;
+        unsigned int preparedSphereCount;
+        bool preparedKeyframe;
+
+        /** \brief Buffers for gathering the values written as one array. */
+        std::vector<unsigned short> shortBuffer;
+        std::vector<unsigned long long> longBuffer;
+        std::vector<float> floatBuffer;
+
+        /** \brief Write the quantized positions of the specified spheres. */
+        void writePositions(ByteWriter& writer, const unsigned int* sphereIndices,
+            unsigned int count);
+
+    public:
+        /** \brief Initialize FrameEncoder.
+         * \param positionBits Bits per axis, 16 or 21.
+         * \param keyframeInterval Number of frames after which a keyframe is
+         * sent.
+         * \param movementThreshold Movement (in quantization steps) a sphere
+         * needs for being sent in a delta frame. */
+        FrameEncoder(unsigned char positionBits = 16,
+            unsigned int keyframeInterval = 30, unsigned int movementThreshold = 0);
+
+        /** \brief Decide the content of a frame and update the state known by
+         * the receivers; write() has to be called before the next frame.
+         * \return Exact size of the encoded frame in bytes. */
+        size_t prepare(unsigned int frameCounter, const Vector3& boxSize,
+            unsigned int sphereCount, const Scalar* radii, const Vector3* positions);
+
+        /** \brief Write the prepared frame, e.g. into a memory range of the
+         * size returned by prepare(). */
+        void write(ByteWriter& writer);
+
+        /** \brief Encode a frame, replacing the content of data but reusing
+         * its memory. */
+        void encode(unsigned int frameCounter, const Vector3& boxSize,
+            unsigned int sphereCount, const Scalar* radii, const Vector3* positions,
+            std::string& data);
+
+        /** \brief Make the next frame a keyframe. */
+        void requestKeyframe();
+
+    };
+
+    /** \brief Decoder of frames, keeping the state of all spheres.
+     *
+     * A frame is first parsed into buffers and then applied to the state, so
+     * a frame read from memory that may change meanwhile can be discarded
+     * after parsing without touching the state. */
+    class FrameDecoder
+    {
+    private:
+        /** \brief Flag showing that the state is complete. */
+        bool valid;
+
+        /** \brief Counter of the last decoded frame. */
+        unsigned int frameCounter;
+
+        /** \brief Box size of the last keyframe. */
+        Scalar boxSize[3];
+
+        /** \brief Sphere radii. */
+        std::vector<Scalar> radii;
+
+        /** \brief Sphere positions, per axis. */
+        std::vector<Scalar> positions[3];
+
+        /** \brief Header values of the parsed frame. */
+        unsigned int parsedFrameCounter;
+        unsigned int parsedSphereCount;
+        unsigned char parsedPositionBits;
+        bool parsedKeyframe;
+
+        /** \brief Box size of a parsed keyframe. */
+        Scalar parsedBoxSize[3];
+
+        /** \brief Quantized positions of a frame, per axis. */
+        std::vector<unsigned int> quantizedPositions[3];
+
+        /** \brief Indices of the spheres with positions in a delta frame. */
+        std::vector<unsigned int> movedSpheres;
+
+        /** \brief Indices of the spheres with radii in a delta frame. */
+        std::vector<unsigned int> resizedSpheres;
+
+        /** \brief Buffers for the raw data of a frame. */
+        std::vector<unsigned short> shortBuffer;
+        std::vector<unsigned long long> longBuffer;
+        std::vector<float> floatBuffer;
+
+        /** \brief Read the quantized positions of count spheres; returns false
+         * if the data is too short. */
+        bool readPositions(ByteReader& reader, unsigned char positionBits,
+            unsigned int count);
+
+        /** \brief Read a count and that many sphere indices below the sphere
+         * count; returns false if the data is too short or invalid. */
+        bool readIndices(ByteReader& reader, std::vector<unsigned int>& indices);
+
+    public:
+        /** \brief Initialize FrameDecoder. */
+        FrameDecoder();
+
+        /** \brief Parse a frame message without changing the state; returns
+         * false if the frame is malformed or refers to a frame not received. */
+        bool parse(const char* data, size_t size);
+
+        /** \brief Apply the frame of the last successful parse() to the state. */
+        void apply();
+
+        /** \brief Parse and apply a frame message.
+         * \see parse */
+        bool decode(const char* data, size_t size);
+
+        /** \brief Counter of the last parsed frame. */
+        unsigned int getParsedFrameCounter() const
+        {
+            return parsedFrameCounter;
+        }
+
+        /** \brief Counter of the last decoded frame. */
+        unsigned int getFrameCounter() const
+        {
+            return frameCounter;
+        }
+
+        /** \brief Number of spheres of the last decoded frame. */
+        unsigned int getSphereCount() const
+        {
+            return radii.size();
+        }
+
+        /** \brief Radius of a sphere. */
+        Scalar getRadius(unsigned int sphereIndex) const
+        {
+            return radii[sphereIndex];
+        }
+
+        /** \brief Position of a sphere. */
+        Vector3 getPosition(unsigned int sphereIndex) const
+        {
+            return Vector3(positions[0][sphereIndex], positions[1][sphereIndex],
+                positions[2][sphereIndex]);
+        }
+
+    };
+
+}
+
+#endif /*_FRAMECODEC_HPP_*/
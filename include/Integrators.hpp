@@ -27,7 +27,21 @@ namespace SphereSim
             /** \brief Cash-Karp of order 5+4 using 6 evaluations. */
             CashKarp54,
             /** \brief Dormand-Prince of order 5+4 using 7 evaluations. */
-            DormandPrince54
+            DormandPrince54,
+            /** \brief Symplectic velocity Verlet (leapfrog) of order 2 using 1
+             * evaluation; fixed step length. */
+            VelocityVerlet,
+            /** \brief Symplectic Yoshida (Forest-Ruth) composition of order 4
+             * using 3 evaluations; fixed step length. */
+            Yoshida4,
+            /** \brief Multiple time stepping velocity Verlet (RESPA): long range
+             * forces once per step, short range forces in respaStepRatio inner
+             * steps; fixed step length. */
+            RespaVerlet,
+            /** \brief Semi-implicit Euler of order 1 using 1 evaluation, with
+             * linearly implicit contact forces; fixed step length, stable for
+             * stiff contacts. */
+            ImexEuler
         };
     }
 }
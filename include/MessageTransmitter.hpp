@@ -12,13 +12,89 @@
 #include <QObject>
 #include <QElapsedTimer>
 #include <QTimer>
+#include <QSocketNotifier>
+#include <memory>
 #include <nanomsg/nn.hpp>
-#include <sstream>
 #include <string>
 
 namespace SphereSim
 {
-    /** \brief Sending and receiving encoded messages over network. */
+    /** \brief Message buffer allocated by nanomsg, handed between threads
+     * through queued signals without copying its content.
+     *
+     * Copies share the buffer; it is freed with the last copy unless it was
+     * released for sending before. */
+    class MessageBuffer
+    {
+    private:
+        /** \brief Owner of the nanomsg buffer. */
+        class Message
+        {
+        public:
+            char* data;
+            size_t size;
+
+            Message(char* data, size_t size)
+                :data(data), size(size)
+            {
+            }
+
+            ~Message()
+            {
+                if (data != nullptr)
+                {
+                    nn_freemsg(data);
+                }
+            }
+
+            Message(const Message&) = delete;
+            Message& operator=(const Message&) = delete;
+
+        };
+
+        std::shared_ptr<Message> message;
+
+    public:
+        /** \brief Create an empty buffer. */
+        MessageBuffer()
+            :message()
+        {
+        }
+
+        /** \brief Allocate a buffer of size bytes from nanomsg; the buffer is
+         * empty if allocation failed. */
+        static MessageBuffer allocate(size_t size);
+
+        /** \brief Check whether the buffer holds a message. */
+        bool isValid() const
+        {
+            return (message != nullptr && message->data != nullptr);
+        }
+
+        char* getData() const
+        {
+            return (message != nullptr ? message->data : nullptr);
+        }
+
+        size_t getSize() const
+        {
+            return (message != nullptr ? message->size : 0);
+        }
+
+        /** \brief Take the buffer out of all copies, e.g. for handing it over
+         * to nanomsg, which frees it. */
+        char* release();
+
+    };
+
+    /** \brief Sending and receiving encoded messages over network.
+     *
+     * Messages are read as soon as the receiving socket signals readiness
+     * through its file descriptor; the timer only checks for receive
+     * timeouts. Messages of any size are received into buffers allocated by
+     * nanomsg and decoded there before the buffers are freed. Messages to send
+     * are encoded directly into buffers from allocateMessage, which nanomsg
+     * takes over on sending. */
     class MessageTransmitter : public QObject
     {
         Q_OBJECT
@@ -27,6 +103,10 @@ namespace SphereSim
         nn::socket* sendSocket;
         nn::socket* recvSocket;
 
+        /** \brief Notifier watching the file descriptor of the receiving
+         * socket. */
+        QSocketNotifier* recvNotifier;
+
         QTimer timer;
 
         QElapsedTimer elapsedTimer;
@@ -36,20 +116,39 @@ namespace SphereSim
     public:
         MessageTransmitter(nn::socket* sendSocket, nn::socket* recvSocket);
 
+        ~MessageTransmitter();
+
         MessageTransmitter() = delete;
         MessageTransmitter(const MessageTransmitter&) = delete;
         MessageTransmitter& operator=(const MessageTransmitter&) = delete;
 
         void start();
 
+        /** \brief Allocate a buffer from nanomsg to encode a message of size
+         * bytes into.
+         * \return Buffer of the message; nullptr if allocation failed. */
+        char* allocateMessage(size_t size);
+
+        /** \brief Send a message from allocateMessage; the buffer must not be
+         * used afterwards. */
+        void sendMessage(char* message);
+
+        /** \brief Send a message from allocateMessage over another socket. */
+        static void sendMessage(nn::socket* socket, char* message);
+
+        /** \brief Send a message buffer over a socket without copying it. */
+        static void sendMessage(nn::socket* socket, MessageBuffer message);
+
     public slots:
-        void send(std::string data);
 
         /** \brief Read new available data. */
         void readData();
 
     signals:
-        void processData(std::string data);
+        /** \brief Signal a received message. The data lives in the buffer of
+         * nanomsg, which is freed after the emission, so connections must be
+         * direct. */
+        void processData(const char* data, size_t size);
 
         void receiveTimeout();
 
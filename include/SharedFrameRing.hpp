@@ -0,0 +1,130 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#ifndef _SHAREDFRAMERING_HPP_
+#define _SHAREDFRAMERING_HPP_
+
+#include <cstddef>
+#include <string>
+
+namespace SphereSim
+{
+
+    /** \brief Ring buffer of encoded frames in POSIX shared memory, written by
+     * the server and read by clients on the same host.
+     *
+     * The ring consists of a header and slotCount slots of slotSize bytes.
+     * Every frame gets a sequence number; frame n is stored in slot
+     * n%slotCount. Each slot works as a sequence lock: the writer invalidates
+     * the sequence of the slot, writes the frame and then publishes the new
+     * sequence, so readers detect frames overwritten while being read.
+     * Readers never block the writer; a reader falling behind by more than
+     * the ring size skips to the newest frame. Readers decode the frames in
+     * place from the slots and discard the result if the slot was overwritten
+     * meanwhile. The writer notifies readers of new frames over the network,
+     * so readers do not have to poll the ring.
+     *
+     * A random token, stored in the header and sent to the client over the
+     * network, makes sure a client opened the ring of its own server and not
+     * one of the same name on another host. */
+    class SharedFrameRing
+    {
+    private:
+        struct RingHeader;
+        struct SlotHeader;
+
+        /** \brief Name of the shared memory object. */
+        std::string name;
+
+        /** \brief Flag showing that this instance created the ring and may
+         * write to it. */
+        bool writer;
+
+        /** \brief Mapped shared memory; nullptr if not open. */
+        void* memory;
+
+        /** \brief Size (in bytes) of the mapped memory. */
+        size_t memorySize;
+
+        /** \brief Header at the start of the memory. */
+        RingHeader* header;
+
+        /** \brief Distance (in bytes) between two slots. */
+        size_t slotStride;
+
+        /** \brief Sequence number of the last read frame. */
+        unsigned long long readSequence;
+
+        /** \brief Slot of the last frame returned by peek(); nullptr if none. */
+        const SlotHeader* readSlot;
+
+        /** \brief Header of the slot of a sequence number. */
+        SlotHeader* getSlot(unsigned long long sequence) const;
+
+        /** \brief Map the shared memory object of a file descriptor. */
+        bool map(int fileDescriptor, size_t size);
+
+    public:
+        /** \brief Initialize a closed ring. */
+        SharedFrameRing();
+
+        /** \brief Close the ring; a created ring is also unlinked. */
+        ~SharedFrameRing();
+
+        SharedFrameRing(const SharedFrameRing&) = delete;
+        SharedFrameRing& operator=(const SharedFrameRing&) = delete;
+
+        /** \brief Create a new ring for writing, replacing a stale one of the
+         * same name.
+         * \param slotCount Number of frames kept in the ring.
+         * \param slotSize Maximum size (in bytes) of one frame.
+         * \return Flag whether the ring could be created. */
+        bool create(const std::string& name, unsigned long long token,
+            unsigned int slotCount, unsigned int slotSize);
+
+        /** \brief Open an existing ring for reading, starting after its last
+         * written frame.
+         * \return Flag whether the ring exists and has the specified token. */
+        bool open(const std::string& name, unsigned long long token);
+
+        /** \brief Unmap the ring; a created ring is also unlinked. */
+        void close();
+
+        /** \brief Remove the name of the ring, so no more readers can open it;
+         * readers that opened it keep the mapping. */
+        void unlink();
+
+        /** \brief Flag whether the ring is open. */
+        bool isOpen() const
+        {
+            return (memory != nullptr);
+        }
+
+        /** \brief Write a frame, overwriting the oldest one.
+         * \return Flag whether the frame fits into a slot. */
+        bool push(const char* data, size_t size);
+
+        /** \brief Get the next frame in place. The writer may overwrite it
+         * while it is read, so anything read from it is only valid if check()
+         * returns true afterwards.
+         * \param size Size of the frame.
+         * \return Data of the frame; nullptr if there is no new frame. */
+        const char* peek(size_t& size);
+
+        /** \brief Check whether the frame of the last peek() was not
+         * overwritten until now. */
+        bool check() const;
+
+        /** \brief Name of the ring used for the specified simulation. */
+        static std::string getName(unsigned int simulationID);
+
+    };
+
+}
+
+#endif /*_SHAREDFRAMERING_HPP_*/
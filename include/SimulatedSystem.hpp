@@ -31,8 +31,6 @@ namespace SphereSim
         void addVariable(SimulationVariables::Variable var, Object::Type type,
             const T& t);
 
-        void sendVariable(SimulationVariables::Variable var);
-
     public:
         SimulatedSystem();
 
@@ -61,6 +59,21 @@ namespace SphereSim
             }
         }
 
+        /** \brief Set a variable without sending it to the client; it is sent
+         * by a later call of sendVariable. Meant for variables the server
+         * changes too often to send every change. */
+        template <typename T>
+        void setWithoutSending(SimulationVariables::Variable var, const T& t)
+        {
+            if (vars[var].set<T>(t))
+            {
+                emit variableUpdated((int)var);
+            }
+        }
+
+        /** \brief Send the current value of a variable to the client. */
+        void sendVariable(SimulationVariables::Variable var);
+
         void receiveVariable(SimulationVariables::Variable var, std::string data);
 
     signals:
@@ -0,0 +1,64 @@
+#!/bin/bash
+
+# Runs the same collision system on one server process and on two server
+# processes splitting it into domains on this host, and compares the sphere
+# count, the total energy and the position and speed of every sphere at the
+# end. The build directory defaults to "build".
+
+msg() {
+  echo ""
+  echo -e "   \033[1;34m->\033[1;0m \033[1;1m${1}\033[1;0m" >&2
+}
+
+error() {
+  echo -e "\033[1;31m==> ERROR:\033[1;0m \033[1;1m$1\033[1;0m" >&2
+}
+
+if [ "$0" != "./scripts/domain_test.sh" ]; then
+    if [ "$0" != "scripts/domain_test.sh" ]; then
+        error "Run this script from project root directory using command './scripts/domain_test.sh [build directory]'"
+        exit 1
+    fi
+fi
+
+BUILD_DIR=${1:-build}
+SERVER=$BUILD_DIR/bin/SphereSim_Server
+TESTER=$BUILD_DIR/bin/SphereSim_Tester
+DOMAIN_0=tcp://127.0.0.1:7100
+DOMAIN_1=tcp://127.0.0.1:7101
+
+if [ ! -x "$SERVER" ] || [ ! -x "$TESTER" ]; then
+    error "Server or tester not found in $BUILD_DIR/bin. Aborting."
+    exit 1
+fi
+
+stop_servers() {
+    kill $(jobs -p) 2>/dev/null
+    wait 2>/dev/null
+}
+trap stop_servers EXIT
+
+msg "Running the reference on one server process..."
+$SERVER &
+sleep 1
+REFERENCE=$($TESTER --distributed-run | tee /dev/stderr \
+    | sed -e 's/\x1b\[[0-9;]*m//g' | grep "ServerTester: reference:" \
+    | sed -e 's/.*reference: //')
+stop_servers
+if [ -z "$REFERENCE" ]; then
+    error "reference run failed! Aborting."
+    exit 1
+fi
+
+msg "Running the same system on two domain server processes..."
+$SERVER --domain 1 $DOMAIN_0 $DOMAIN_1 &
+$SERVER --domain 0 $DOMAIN_0 $DOMAIN_1 &
+sleep 1
+# count, energy, then position and speed of each sphere, one argument each
+$TESTER --distributed-run $REFERENCE
+if [ "$?" != "0" ]; then
+    error "distributed run differs from the reference!"
+    exit 1
+fi
+
+msg "Distributed run matches the reference."
@@ -17,6 +17,7 @@ namespace SphereSim
         const char* address = "127.0.0.1";
         unsigned short serverSendPort = 8764;
         unsigned short serverRecvPort = 8765;
+        unsigned short serverFramePort = 8766;
     }
 
 }
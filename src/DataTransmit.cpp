@@ -11,136 +11,59 @@
 
 using namespace SphereSim;
 
-void SphereSim::writeBool(std::ostream& stream, bool b)
+void SphereSim::writeBool(ByteWriter& writer, bool b)
 {
-    stream.write((char*)&b, 1);
+    writer.writeChar(b ? 1 : 0);
 }
 
-bool SphereSim::readBool(std::istream& stream)
+bool SphereSim::readBool(ByteReader& reader)
 {
-    bool b;
-    stream.read((char*)&b, 1);
-    return b;
+    return (reader.readChar() != 0);
 }
 
-void SphereSim::writeChar(std::ostream& stream, unsigned char c)
+void SphereSim::writeString(ByteWriter& writer, const std::string& s)
 {
-    stream.write((char*)&c, 1);
+    writer.writeShort(s.size());
+    writer.writeBytes(s.data(), s.size());
 }
 
-char SphereSim::readChar(std::istream& stream)
+std::string SphereSim::readString(ByteReader& reader)
 {
-    unsigned char c;
-    stream.read((char*)&c, 1);
-    return c;
+    unsigned short size = reader.readShort();
+    const char* data = reader.getCurrent();
+    if (!reader.skip(size))
+    {
+        return std::string();
+    }
+    return std::string(data, size);
 }
 
-void SphereSim::writeShort(std::ostream& stream, unsigned short s)
+void SphereSim::writeBasicSphereData(ByteWriter& writer, const Sphere& s)
 {
-    stream.write((char*)&s, 2);
+    writer.writeDouble(s.radius);
+    writer.writeVector3(s.pos);
 }
 
-unsigned short SphereSim::readShort(std::istream& stream)
+void SphereSim::readBasicSphereData(ByteReader& reader, Sphere& s)
 {
-    unsigned short s;
-    stream.read((char*)&s, 2);
-    return s;
+    s.radius = reader.readDouble();
+    s.pos = reader.readVector3();
 }
 
-void SphereSim::writeInt(std::ostream& stream, unsigned int i)
+void SphereSim::writeAllSphereData(ByteWriter& writer, const Sphere& s)
 {
-    stream.write((char*)&i, 4);
+    writer.writeDouble(s.radius);
+    writer.writeDouble(s.mass);
+    writer.writeVector3(s.pos);
+    writer.writeVector3(s.speed);
+    writer.writeVector3(s.acc);
 }
 
-unsigned int SphereSim::readInt(std::istream& stream)
+void SphereSim::readAllSphereData(ByteReader& reader, Sphere& s)
 {
-    unsigned int i;
-    stream.read((char*)&i, 4);
-    return i;
-}
-
-void SphereSim::writeFloat(std::ostream& stream, float f)
-{
-    stream.write((char*)&f, 4);
-}
-
-float SphereSim::readFloat(std::istream& stream)
-{
-    float f;
-    stream.read((char*)&f, 8);
-    return f;
-}
-
-void SphereSim::writeDouble(std::ostream& stream, double d)
-{
-    stream.write((char*)&d, 8);
-}
-
-double SphereSim::readDouble(std::istream& stream)
-{
-    double d;
-    stream.read((char*)&d, 8);
-    return d;
-}
-
-void SphereSim::writeVector3(std::ostream& stream, Vector3 v)
-{
-    writeDouble(stream, v(0));
-    writeDouble(stream, v(1));
-    writeDouble(stream, v(2));
-}
-
-Vector3 SphereSim::readVector3(std::istream& stream)
-{
-    Vector3 v;
-    v(0) = readDouble(stream);
-    v(1) = readDouble(stream);
-    v(2) = readDouble(stream);
-    return v;
-}
-
-void SphereSim::writeString(std::ostream& stream, std::string s)
-{
-    writeShort(stream, s.size());
-    stream.write(s.c_str(), s.size());
-}
-
-std::string SphereSim::readString(std::istream& stream)
-{
-    unsigned short size = readShort(stream);
-    char* c_str = new char[size];
-    stream.read(c_str, size);
-    std::string s(c_str, size);
-    delete[] c_str;
-    return s;
-}
-
-void SphereSim::writeBasicSphereData(std::ostream& stream, Sphere& s)
-{
-    writeDouble(stream, s.radius);
-    writeVector3(stream, s.pos);
-}
-
-void SphereSim::readBasicSphereData(std::istream& stream, Sphere& s)
-{
-    s.radius = readDouble(stream);
-    s.pos = readVector3(stream);
-}
-
-void SphereSim::writeAllSphereData(std::ostream& stream, Sphere& s)
-{
-    writeDouble(stream, s.radius);
-    writeDouble(stream, s.mass);
-    writeVector3(stream, s.pos);
-    writeVector3(stream, s.speed);
-    writeVector3(stream, s.acc);
-}
-
-void SphereSim::readAllSphereData(std::istream& stream, Sphere& s)
-{
-    s.radius = readDouble(stream);
-    s.mass = readDouble(stream);
-    s.pos = readVector3(stream);
-    s.speed = readVector3(stream);
-    s.acc = readVector3(stream);
+    s.radius = reader.readDouble();
+    s.mass = reader.readDouble();
+    s.pos = reader.readVector3();
+    s.speed = reader.readVector3();
+    s.acc = reader.readVector3();
 }
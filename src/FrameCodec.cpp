@@ -0,0 +1,375 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#include "FrameCodec.hpp"
+#include "ByteBuffer.hpp"
+
+using namespace SphereSim;
+
+namespace
+{
+    /** \brief Quantize a coordinate to [0, maximum]. */
+    inline unsigned int quantize(Scalar value, Scalar boxLength,
+        unsigned int maximum)
+    {
+        Scalar scaled = value/boxLength*maximum + (Scalar)0.5;
+        if (!(scaled > 0))
+        {
+            return 0;
+        }
+        if (scaled >= maximum)
+        {
+            return maximum;
+        }
+        return (unsigned int)scaled;
+    }
+
+    inline unsigned int difference(unsigned int a, unsigned int b)
+    {
+        return (a > b ? a-b : b-a);
+    }
+}
+
+FrameEncoder::FrameEncoder(unsigned char positionBits,
+    unsigned int keyframeInterval, unsigned int movementThreshold)
+    :positionBits(positionBits == 21 ? 21 : 16), keyframeInterval(keyframeInterval),
+    movementThreshold(movementThreshold), framesSinceKeyframe(0),
+    keyframeRequested(true), lastFrameCounter(0), lastBoxSize(), sentRadii(),
+    sentPositions(), movedSpheres(), resizedSpheres(), preparedFrameCounter(0),
+    preparedReferenceCounter(0), preparedSphereCount(0), preparedKeyframe(true),
+    shortBuffer(), longBuffer(), floatBuffer()
+{
+}
+
+void FrameEncoder::requestKeyframe()
+{
+    keyframeRequested = true;
+}
+
+void FrameEncoder::writePositions(ByteWriter& writer,
+    const unsigned int* sphereIndices, unsigned int count)
+{
+    if (positionBits == 16)
+    {
+        shortBuffer.resize(3*count);
+        for (unsigned char axis = 0; axis<3; axis++)
+        {
+            unsigned short* values = &shortBuffer[axis*count];
+            for (unsigned int i = 0; i<count; i++)
+            {
+                values[i] = sentPositions[axis][sphereIndices[i]];
+            }
+        }
+        writer.writeArray<unsigned short>(shortBuffer.data(), 3*count);
+    }
+    else
+    {
+        longBuffer.resize(count);
+        for (unsigned int i = 0; i<count; i++)
+        {
+            unsigned int sphereIndex = sphereIndices[i];
+            longBuffer[i] = (unsigned long long)sentPositions[0][sphereIndex]
+                | ((unsigned long long)sentPositions[1][sphereIndex]<<21)
+                | ((unsigned long long)sentPositions[2][sphereIndex]<<42);
+        }
+        writer.writeArray<unsigned long long>(longBuffer.data(), count);
+    }
+}
+
+size_t FrameEncoder::prepare(unsigned int frameCounter, const Vector3& boxSize,
+    unsigned int sphereCount, const Scalar* radii, const Vector3* positions)
+{
+    const unsigned int maximum = (1u<<positionBits)-1;
+    Scalar boxLength[3];
+    for (unsigned char axis = 0; axis<3; axis++)
+    {
+        boxLength[axis] = (boxSize(axis) > 0 ? boxSize(axis) : 1);
+    }
+    bool sendKeyframe = keyframeRequested
+        || framesSinceKeyframe+1 >= keyframeInterval
+        || sphereCount != sentRadii.size() || !(boxSize == lastBoxSize);
+
+    preparedFrameCounter = frameCounter;
+    preparedReferenceCounter = (sendKeyframe ? frameCounter : lastFrameCounter);
+    preparedSphereCount = sphereCount;
+    preparedKeyframe = sendKeyframe;
+    lastFrameCounter = frameCounter;
+    const size_t positionSize = (positionBits == 16 ? 3*sizeof(unsigned short)
+        : sizeof(unsigned long long));
+    // frame counter, reference frame counter, sphere count, type, position bits
+    size_t size = 3*sizeof(unsigned int)+2;
+
+    if (sendKeyframe)
+    {
+        for (unsigned char axis = 0; axis<3; axis++)
+        {
+            sentPositions[axis].resize(sphereCount);
+        }
+        sentRadii.resize(sphereCount);
+        movedSpheres.resize(sphereCount);
+        resizedSpheres.clear();
+        for (unsigned int i = 0; i<sphereCount; i++)
+        {
+            sentRadii[i] = radii[i];
+            for (unsigned char axis = 0; axis<3; axis++)
+            {
+                sentPositions[axis][i] = quantize(positions[i](axis),
+                    boxLength[axis], maximum);
+            }
+            movedSpheres[i] = i;
+        }
+        keyframeRequested = false;
+        framesSinceKeyframe = 0;
+        lastBoxSize = boxSize;
+        return size + 3*sizeof(double) + sphereCount*(sizeof(float)+positionSize);
+    }
+
+    // spheres that moved more than the threshold
+    movedSpheres.clear();
+    for (unsigned int i = 0; i<sphereCount; i++)
+    {
+        unsigned int position[3];
+        bool moved = false;
+        for (unsigned char axis = 0; axis<3; axis++)
+        {
+            position[axis] = quantize(positions[i](axis), boxLength[axis],
+                maximum);
+            moved |= (difference(position[axis], sentPositions[axis][i])
+                > movementThreshold);
+        }
+        if (moved)
+        {
+            for (unsigned char axis = 0; axis<3; axis++)
+            {
+                sentPositions[axis][i] = position[axis];
+            }
+            movedSpheres.push_back(i);
+        }
+    }
+
+    // spheres with changed radius
+    resizedSpheres.clear();
+    floatBuffer.clear();
+    for (unsigned int i = 0; i<sphereCount; i++)
+    {
+        if ((float)radii[i] != sentRadii[i])
+        {
+            sentRadii[i] = radii[i];
+            resizedSpheres.push_back(i);
+            floatBuffer.push_back(sentRadii[i]);
+        }
+    }
+    framesSinceKeyframe++;
+    return size + 2*sizeof(unsigned int)
+        + movedSpheres.size()*(sizeof(unsigned int)+positionSize)
+        + resizedSpheres.size()*(sizeof(unsigned int)+sizeof(float));
+}
+
+void FrameEncoder::write(ByteWriter& writer)
+{
+    writer.writeInt(preparedFrameCounter);
+    writer.writeInt(preparedReferenceCounter);
+    writer.writeInt(preparedSphereCount);
+    writer.writeChar(preparedKeyframe ? FrameCodec::keyframe
+        : FrameCodec::deltaFrame);
+    writer.writeChar(positionBits);
+
+    if (preparedKeyframe)
+    {
+        writer.writeVector3(lastBoxSize);
+        writer.writeArray<float>(sentRadii.data(), preparedSphereCount);
+        writePositions(writer, movedSpheres.data(), preparedSphereCount);
+        return;
+    }
+    writer.writeInt(movedSpheres.size());
+    writer.writeArray<unsigned int>(movedSpheres.data(), movedSpheres.size());
+    writePositions(writer, movedSpheres.data(), movedSpheres.size());
+    writer.writeInt(resizedSpheres.size());
+    writer.writeArray<unsigned int>(resizedSpheres.data(), resizedSpheres.size());
+    writer.writeArray<float>(floatBuffer.data(), floatBuffer.size());
+}
+
+void FrameEncoder::encode(unsigned int frameCounter, const Vector3& boxSize,
+    unsigned int sphereCount, const Scalar* radii, const Vector3* positions,
+    std::string& data)
+{
+    prepare(frameCounter, boxSize, sphereCount, radii, positions);
+    ByteWriter writer(data);
+    write(writer);
+}
+
+FrameDecoder::FrameDecoder()
+    :valid(false), frameCounter(0), boxSize{1, 1, 1}, radii(), positions(),
+    parsedFrameCounter(0), parsedSphereCount(0), parsedPositionBits(16),
+    parsedKeyframe(false), parsedBoxSize{1, 1, 1}, quantizedPositions(),
+    movedSpheres(), resizedSpheres(), shortBuffer(), longBuffer(), floatBuffer()
+{
+}
+
+bool FrameDecoder::readPositions(ByteReader& reader, unsigned char positionBits,
+    unsigned int count)
+{
+    for (unsigned char axis = 0; axis<3; axis++)
+    {
+        quantizedPositions[axis].resize(count);
+    }
+    // plain loops over contiguous arrays, vectorized by the compiler
+    if (positionBits == 16)
+    {
+        shortBuffer.resize(3*count);
+        if (!reader.readArray<unsigned short>(shortBuffer.data(), 3*count))
+        {
+            return false;
+        }
+        for (unsigned char axis = 0; axis<3; axis++)
+        {
+            const unsigned short* values = &shortBuffer[axis*count];
+            unsigned int* quantized = quantizedPositions[axis].data();
+            for (unsigned int i = 0; i<count; i++)
+            {
+                quantized[i] = values[i];
+            }
+        }
+        return true;
+    }
+    longBuffer.resize(count);
+    if (!reader.readArray<unsigned long long>(longBuffer.data(), count))
+    {
+        return false;
+    }
+    const unsigned long long mask = (1ull<<21)-1;
+    for (unsigned char axis = 0; axis<3; axis++)
+    {
+        const unsigned long long* values = longBuffer.data();
+        unsigned int* quantized = quantizedPositions[axis].data();
+        const unsigned char shift = 21*axis;
+        for (unsigned int i = 0; i<count; i++)
+        {
+            quantized[i] = (values[i]>>shift) & mask;
+        }
+    }
+    return true;
+}
+
+bool FrameDecoder::readIndices(ByteReader& reader,
+    std::vector<unsigned int>& indices)
+{
+    unsigned int count = reader.readInt();
+    if (!reader.isGood() || count > reader.getRemainingSize()/sizeof(unsigned int))
+    {
+        return false;
+    }
+    indices.resize(count);
+    reader.readArray<unsigned int>(indices.data(), count);
+    for (unsigned int i = 0; i<count; i++)
+    {
+        if (indices[i] >= parsedSphereCount)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FrameDecoder::parse(const char* data, size_t size)
+{
+    ByteReader reader(data, size);
+    parsedFrameCounter = reader.readInt();
+    unsigned int referenceFrameCounter = reader.readInt();
+    parsedSphereCount = reader.readInt();
+    unsigned char frameType = reader.readChar();
+    parsedPositionBits = reader.readChar();
+    if (!reader.isGood() || (parsedPositionBits != 16 && parsedPositionBits != 21))
+    {
+        return false;
+    }
+
+    if (frameType == FrameCodec::keyframe)
+    {
+        parsedKeyframe = true;
+        for (unsigned char axis = 0; axis<3; axis++)
+        {
+            parsedBoxSize[axis] = reader.readDouble();
+        }
+        if (parsedSphereCount > reader.getRemainingSize()/sizeof(float))
+        {
+            return false;
+        }
+        floatBuffer.resize(parsedSphereCount);
+        return reader.readArray<float>(floatBuffer.data(), parsedSphereCount)
+            && readPositions(reader, parsedPositionBits, parsedSphereCount);
+    }
+
+    parsedKeyframe = false;
+    if (frameType != FrameCodec::deltaFrame || valid == false
+        || referenceFrameCounter != frameCounter
+        || parsedSphereCount != radii.size())
+    {
+        // a frame is missing, wait for the next keyframe
+        return false;
+    }
+    if (!readIndices(reader, movedSpheres)
+        || !readPositions(reader, parsedPositionBits, movedSpheres.size())
+        || !readIndices(reader, resizedSpheres))
+    {
+        return false;
+    }
+    floatBuffer.resize(resizedSpheres.size());
+    return reader.readArray<float>(floatBuffer.data(), resizedSpheres.size());
+}
+
+void FrameDecoder::apply()
+{
+    const Scalar maximum = (1u<<parsedPositionBits)-1;
+    if (parsedKeyframe)
+    {
+        radii.resize(parsedSphereCount);
+        for (unsigned int i = 0; i<parsedSphereCount; i++)
+        {
+            radii[i] = floatBuffer[i];
+        }
+        for (unsigned char axis = 0; axis<3; axis++)
+        {
+            boxSize[axis] = parsedBoxSize[axis];
+            const Scalar step = boxSize[axis]/maximum;
+            const unsigned int* quantized = quantizedPositions[axis].data();
+            positions[axis].resize(parsedSphereCount);
+            Scalar* values = positions[axis].data();
+            for (unsigned int i = 0; i<parsedSphereCount; i++)
+            {
+                values[i] = quantized[i]*step;
+            }
+        }
+        valid = true;
+        frameCounter = parsedFrameCounter;
+        return;
+    }
+    for (unsigned char axis = 0; axis<3; axis++)
+    {
+        const Scalar step = boxSize[axis]/maximum;
+        for (unsigned int i = 0; i<movedSpheres.size(); i++)
+        {
+            positions[axis][movedSpheres[i]] = quantizedPositions[axis][i]*step;
+        }
+    }
+    for (unsigned int i = 0; i<resizedSpheres.size(); i++)
+    {
+        radii[resizedSpheres[i]] = floatBuffer[i];
+    }
+    frameCounter = parsedFrameCounter;
+}
+
+bool FrameDecoder::decode(const char* data, size_t size)
+{
+    if (!parse(data, size))
+    {
+        return false;
+    }
+    apply();
+    return true;
+}
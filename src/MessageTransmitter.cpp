@@ -14,33 +14,92 @@ using namespace SphereSim;
 
 MessageTransmitter::MessageTransmitter(nn::socket* sendSocket,
     nn::socket* recvSocket)
-    :sendSocket(sendSocket), recvSocket(recvSocket),
+    :sendSocket(sendSocket), recvSocket(recvSocket), recvNotifier(nullptr),
     timer(this), elapsedTimer(), connected(false)
 {
-    timer.setInterval(10);
+    // no limit for the size of received messages
+    int maximumSize = -1;
+    recvSocket->setsockopt(NN_SOL_SOCKET, NN_RCVMAXSIZE, &maximumSize,
+        sizeof(maximumSize));
+    int recvFileDescriptor;
+    size_t optionSize = sizeof(recvFileDescriptor);
+    recvSocket->getsockopt(NN_SOL_SOCKET, NN_RCVFD, &recvFileDescriptor,
+        &optionSize);
+    recvNotifier = new QSocketNotifier(recvFileDescriptor, QSocketNotifier::Read,
+        this);
+    recvNotifier->setEnabled(false);
+    connect(recvNotifier, SIGNAL(activated(int)), this, SLOT(readData()));
+
+    timer.setInterval(500);
     connect(&timer, SIGNAL(timeout()), this, SLOT(readData()));
 }
 
+MessageTransmitter::~MessageTransmitter()
+{
+    delete recvNotifier;
+}
+
 void MessageTransmitter::start()
 {
+    recvNotifier->setEnabled(true);
     timer.start();
     elapsedTimer.start();
 }
 
-void MessageTransmitter::send(std::string data)
+MessageBuffer MessageBuffer::allocate(size_t size)
+{
+    MessageBuffer buffer;
+    buffer.message = std::make_shared<Message>((char*)nn_allocmsg(size, 0), size);
+    return buffer;
+}
+
+char* MessageBuffer::release()
 {
-    //~ Console()<<"send: "<<data<<".\n";
-    sendSocket->send(data.c_str(), data.size(), NN_DONTWAIT);
+    if (message == nullptr)
+    {
+        return nullptr;
+    }
+    char* data = message->data;
+    message->data = nullptr;
+    return data;
+}
+
+char* MessageTransmitter::allocateMessage(size_t size)
+{
+    return (char*)nn_allocmsg(size, 0);
+}
+
+void MessageTransmitter::sendMessage(char* message)
+{
+    sendMessage(sendSocket, message);
+}
+
+void MessageTransmitter::sendMessage(nn::socket* socket, char* message)
+{
+    void* buffer = message;
+    // nanomsg takes over the message if sending succeeds
+    if (socket->send(&buffer, NN_MSG, NN_DONTWAIT) < 0)
+    {
+        nn_freemsg(buffer);
+    }
+}
+
+void MessageTransmitter::sendMessage(nn::socket* socket, MessageBuffer message)
+{
+    char* data = message.release();
+    if (data != nullptr)
+    {
+        sendMessage(socket, data);
+    }
 }
 
 void MessageTransmitter::readData()
 {
-    constexpr int bufferLength = 1024;
     while (true)
     {
-        char buffer[bufferLength];
-        int length = recvSocket->recv(buffer, bufferLength, NN_DONTWAIT);
-        if (length <= 0)
+        void* message = nullptr;
+        int length = recvSocket->recv(&message, NN_MSG, NN_DONTWAIT);
+        if (length < 0)
         {
             if (connected && nn_errno() == EAGAIN && elapsedTimer.elapsed()>2000)
             {
@@ -49,10 +108,14 @@ void MessageTransmitter::readData()
             }
             break;
         }
+        if (length == 0)
+        {
+            nn_freemsg(message);
+            continue;
+        }
         connected = true;
         elapsedTimer.restart();
-        std::string data(buffer, length);
-        //~ Console()<<"recv: "<<data<<".\n";
-        emit processData(data);
+        emit processData((const char*)message, length);
+        nn_freemsg(message);
     }
 }
@@ -12,7 +12,6 @@
 
 #include <iostream>
 #include <type_traits>
-#include <sstream>
 #include <stdexcept>
 
 const char* errorMessage = "Wrong Object type specified.";
@@ -296,53 +295,53 @@ namespace SphereSim
 
     std::string Object::getData() const
     {
-        std::ostringstream stream;
-        stream<<(char)type;
+        std::string bytes;
+        ByteWriter writer(bytes);
+        writer.writeChar((unsigned char)type);
         switch (type)
         {
         case BOOL:
-            writeBool(stream, *(bool*)data);
+            writeBool(writer, *(bool*)data);
             break;
         case INT:
-            writeInt(stream, *(unsigned int*)data);
+            writer.writeInt(*(unsigned int*)data);
             break;
         case DOUBLE:
-            writeDouble(stream, *(double*)data);
+            writer.writeDouble(*(double*)data);
             break;
         case FLOAT:
-            writeFloat(stream, *(float*)data);
+            writer.writeFloat(*(float*)data);
             break;
         case VECTOR3:
-            writeVector3(stream, *(Vector3*)data);
+            writer.writeVector3(*(Vector3*)data);
             break;
         case STRING:
-            writeString(stream, *(std::string*)data);
+            writeString(writer, *(std::string*)data);
             break;
         default:
             throw std::runtime_error(errorMessage);
         }
-        return stream.str();
+        return bytes;
     }
 
     bool Object::setData(const std::string &bytes)
     {
-        std::istringstream stream(bytes);
-        char type;
-        stream>>type;
+        ByteReader reader(bytes);
+        char type = (char)reader.readChar();
         switch (type)
         {
         case BOOL:
-            return set(readBool(stream));
+            return set(readBool(reader));
         case INT:
-            return set(readInt(stream));
+            return set(reader.readInt());
         case DOUBLE:
-            return set(readDouble(stream));
+            return set(reader.readDouble());
         case FLOAT:
-            return set(readFloat(stream));
+            return set(reader.readFloat());
         case VECTOR3:
-            return set(readVector3(stream));
+            return set(reader.readVector3());
         case STRING:
-            return set(readString(stream));
+            return set(readString(reader));
         default:
             throw std::runtime_error(errorMessage);
         }
@@ -0,0 +1,253 @@
+/** \file
+ * \author Max Mertens <max.mail@dameweb.de>
+ * \section LICENSE
+ * Copyright (c) 2014, Max Mertens.
+ * All rights reserved.
+ * This file is licensed under the "BSD 3-Clause License".
+ * Full license text is under the file "LICENSE" provided with this code. */
+
+#include "SharedFrameRing.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace SphereSim;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+    "SharedFrameRing needs lock-free 64 bit atomics in shared memory.");
+
+namespace
+{
+    const unsigned int ringMagic = 0x53535246; // "SSRF"
+    const unsigned int ringVersion = 1;
+    const size_t cacheLineSize = 64;
+}
+
+struct SharedFrameRing::RingHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long token;
+    unsigned int slotCount;
+    unsigned int slotSize;
+    /** \brief Sequence number of the last written frame; 0 if none. */
+    std::atomic<unsigned long long> writeSequence;
+};
+
+struct SharedFrameRing::SlotHeader
+{
+    /** \brief Sequence number of the frame in the slot; 0 while writing. */
+    std::atomic<unsigned long long> sequence;
+    unsigned long long size;
+};
+
+SharedFrameRing::SharedFrameRing()
+    :name(), writer(false), memory(nullptr), memorySize(0), header(nullptr),
+    slotStride(0), readSequence(0), readSlot(nullptr)
+{
+}
+
+SharedFrameRing::~SharedFrameRing()
+{
+    close();
+}
+
+SharedFrameRing::SlotHeader* SharedFrameRing::getSlot(
+    unsigned long long sequence) const
+{
+    char* slots = (char*)memory + cacheLineSize;
+    return (SlotHeader*)(slots + (sequence%header->slotCount)*slotStride);
+}
+
+bool SharedFrameRing::map(int fileDescriptor, size_t size)
+{
+    void* mappedMemory = mmap(nullptr, size, PROT_READ | (writer ? PROT_WRITE : 0),
+        MAP_SHARED, fileDescriptor, 0);
+    ::close(fileDescriptor);
+    if (mappedMemory == MAP_FAILED)
+    {
+        return false;
+    }
+    memory = mappedMemory;
+    memorySize = size;
+    header = (RingHeader*)memory;
+    return true;
+}
+
+bool SharedFrameRing::create(const std::string& name, unsigned long long token,
+    unsigned int slotCount, unsigned int slotSize)
+{
+    close();
+    // stale rings of crashed servers are replaced
+    shm_unlink(name.c_str());
+    int fileDescriptor = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fileDescriptor < 0)
+    {
+        return false;
+    }
+    size_t stride = (sizeof(SlotHeader)+slotSize+cacheLineSize-1)
+        /cacheLineSize*cacheLineSize;
+    size_t size = cacheLineSize + slotCount*stride;
+    if (slotCount == 0 || ftruncate(fileDescriptor, size) != 0)
+    {
+        ::close(fileDescriptor);
+        shm_unlink(name.c_str());
+        return false;
+    }
+    writer = true;
+    if (!map(fileDescriptor, size))
+    {
+        writer = false;
+        shm_unlink(name.c_str());
+        return false;
+    }
+    this->name = name;
+    slotStride = stride;
+    // the memory is zeroed by ftruncate, so all slots and sequences are 0
+    new (&header->writeSequence) std::atomic<unsigned long long>(0);
+    header->token = token;
+    header->slotCount = slotCount;
+    header->slotSize = slotSize;
+    header->version = ringVersion;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = ringMagic;
+    return true;
+}
+
+bool SharedFrameRing::open(const std::string& name, unsigned long long token)
+{
+    close();
+    int fileDescriptor = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fileDescriptor < 0)
+    {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fileDescriptor, &status) != 0
+        || (size_t)status.st_size < cacheLineSize)
+    {
+        ::close(fileDescriptor);
+        return false;
+    }
+    writer = false;
+    if (!map(fileDescriptor, status.st_size))
+    {
+        return false;
+    }
+    size_t stride = (sizeof(SlotHeader)+header->slotSize+cacheLineSize-1)
+        /cacheLineSize*cacheLineSize;
+    if (header->magic != ringMagic || header->version != ringVersion
+        || header->token != token || header->slotCount == 0
+        || cacheLineSize + header->slotCount*stride > memorySize)
+    {
+        close();
+        return false;
+    }
+    this->name = name;
+    slotStride = stride;
+    readSequence = header->writeSequence.load(std::memory_order_acquire);
+    return true;
+}
+
+void SharedFrameRing::close()
+{
+    if (memory == nullptr)
+    {
+        return;
+    }
+    unlink();
+    munmap(memory, memorySize);
+    memory = nullptr;
+    memorySize = 0;
+    header = nullptr;
+    writer = false;
+}
+
+void SharedFrameRing::unlink()
+{
+    if (writer && !name.empty())
+    {
+        shm_unlink(name.c_str());
+    }
+    name.clear();
+}
+
+bool SharedFrameRing::push(const char* data, size_t size)
+{
+    if (!writer || size > header->slotSize)
+    {
+        return false;
+    }
+    unsigned long long sequence =
+        header->writeSequence.load(std::memory_order_relaxed)+1;
+    SlotHeader* slot = getSlot(sequence);
+    slot->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->size = size;
+    memcpy((char*)slot + sizeof(SlotHeader), data, size);
+    slot->sequence.store(sequence, std::memory_order_release);
+    header->writeSequence.store(sequence, std::memory_order_release);
+    return true;
+}
+
+const char* SharedFrameRing::peek(size_t& size)
+{
+    readSlot = nullptr;
+    if (memory == nullptr)
+    {
+        return nullptr;
+    }
+    const unsigned long long slotCount = header->slotCount;
+    while (true)
+    {
+        unsigned long long writeSequence =
+            header->writeSequence.load(std::memory_order_acquire);
+        if (readSequence >= writeSequence)
+        {
+            return nullptr;
+        }
+        if (writeSequence-readSequence >= slotCount)
+        {
+            // the writer lapped this reader, skip to the newest frame
+            readSequence = writeSequence-1;
+        }
+        unsigned long long sequence = readSequence+1;
+        readSequence = sequence;
+        SlotHeader* slot = getSlot(sequence);
+        if (slot->sequence.load(std::memory_order_acquire) != sequence)
+        {
+            continue;
+        }
+        size = slot->size;
+        if (size > header->slotSize)
+        {
+            continue;
+        }
+        readSlot = slot;
+        return (const char*)slot + sizeof(SlotHeader);
+    }
+}
+
+bool SharedFrameRing::check() const
+{
+    if (readSlot == nullptr)
+    {
+        return false;
+    }
+    // orders the reads of the frame before reading the sequence again
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return (readSlot->sequence.load(std::memory_order_relaxed) == readSequence);
+}
+
+std::string SharedFrameRing::getName(unsigned int simulationID)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/SphereSim_%08x", simulationID);
+    return name;
+}
@@ -12,7 +12,7 @@
 #include "Integrators.hpp"
 #include "Connection.hpp"
 #include "Console.hpp"
-#include "DataTransmit.hpp"
+#include "ByteBuffer.hpp"
 
 #include <iomanip>
 
@@ -51,6 +51,15 @@ SimulatedSystem::SimulatedSystem()
     addVariable(kBoltzmann, Object::SCALAR, 1.3806504e-23);
     addVariable(lenJonPotEpsilon, Object::SCALAR, 1.6540e-21);
     addVariable(lenJonPotSigma, Object::SCALAR, 0.3405e-9);
+    addVariable(respaStepRatio, Object::INT, 4u);
+    addVariable(adaptiveTimeStep, Object::BOOL, false);
+    addVariable(rejectedStepCount, Object::INT, 0u);
+    addVariable(simulationWeight, Object::INT, 1u);
+    addVariable(simulationPriority, Object::INT, 0u);
+    addVariable(frameRate, Object::INT, 60u);
+    addVariable(maximumFrameSphereCount, Object::INT, 0u);
+    addVariable(minimumFrameSphereRadius, Object::SCALAR, 0.0);
+    addVariable(spatialSorting, Object::BOOL, false);
 }
 
 template <typename T>
@@ -67,10 +76,11 @@ void SimulatedSystem::addVariable(SimulationVariables::Variable var,
 void SimulatedSystem::sendVariable(SimulationVariables::Variable var)
 {
     std::string bytes = vars[var].getData();
-    std::ostringstream data;
-    writeShort(data, (unsigned short)var);
-    data<<bytes;
-    emit variableToSend(data.str());
+    std::string data;
+    ByteWriter writer(data);
+    writer.writeShort((unsigned short)var);
+    writer.writeBytes(bytes.data(), bytes.size());
+    emit variableToSend(data);
 }
 
 void SimulatedSystem::sendAllVariables()